@@ -1,48 +1,1470 @@
+// for sync_file_range
+#define _GNU_SOURCE
 #include "sorbet.h"
+#include "sorbet_codec.h"
+#include "sorbet_compute.h"
+#include "sorbet_io.h"
+#include "utf8_val.h"
 #include <stdlib.h>
 #include <memory.h>
 #include <math.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 const int64_t SORBET_SIGNATURE = -3532510898378833984;
-const uint8_t SORBET_VERSION = 3;
+const uint8_t SORBET_VERSION = 5;
 
 int sorbet_version() {
 	return SORBET_VERSION;
 }
 
-void sorbet_flush_write_buffer_uncompressed(sorbet_def *sdef) {
-	if (sdef->buf_offset <= 0) return;
-	size_t written = fwrite(sdef->buf, sizeof(uint8_t), sdef->buf_offset, sdef->f);
-	if (written != sdef->buf_offset) {
-		printf("ERROR: asked to write %d bytes but wrote %d\n", sdef->buf_offset, (int)written);
+// footer section ids. each section is written as an id, a length and a payload, so
+// readers can skip sections they don't know about. the footer ends with SECTION_END.
+#define SECTION_END 0
+#define SECTION_ROW_GROUPS 1
+#define SECTION_COLUMN_CHUNKS 2
+#define SECTION_DICTIONARY 3
+#define SECTION_ZONE_MAPS 4
+#define SECTION_BLOOM_FILTERS 5
+#define SECTION_KEY_INDEX 6
+#define SECTION_COLUMN_STATS 7
+
+// the size of a zone in the footer: nulls, flags, the bounds' lengths and the bounds
+#define ZONE_RECORD_SIZE (7 + 2 * SORBET_ZONE_BYTES)
+
+// O_DIRECT reads whole blocks of this size into memory aligned to it
+#define SORBET_DIRECT_ALIGN 4096
+
+// the rows sorbet_aggregate reads at a time
+#define SORBET_AGGREGATE_ROWS 65536
+
+// the size of an arena's first chunk, which holds the header of a file with a few
+// columns. each chunk after it doubles the arena
+#define SORBET_ARENA_CHUNK 16384
+
+// on-disk width of each column type's value. STRING and BINARY values are
+// length-prefixed, so their width is the width of the prefix.
+const int32_t column_type_width[] = {0, 4, 8, 4, 8, 1, 4, 4, 4, 8, 4};
+
+// a buffer with data but no capacity is a view of memory it doesn't own (a mapped
+// file). it's copied the first time it needs to grow.
+void sorbet_buffer_reserve(sorbet_buffer *b, size_t len) {
+	if (b->size + len <= b->capacity) return;
+	size_t cap = (b->capacity > 0) ? b->capacity : BUF_SIZE;
+	while (cap < b->size + len) cap *= 2;
+	if (b->capacity == 0 && b->data != NULL) {
+		uint8_t *data = (uint8_t *)malloc(cap);
+		memcpy(data, b->data, b->size);
+		b->data = data;
+	} else {
+		b->data = (uint8_t *)realloc(b->data, cap);
+	}
+	b->capacity = cap;
+}
+
+void sorbet_buffer_free(sorbet_buffer *b) {
+	if (b->capacity > 0) free(b->data);
+	b->data = NULL;
+	b->size = 0;
+	b->capacity = 0;
+	b->offset = 0;
+}
+
+// len bytes aligned for O_DIRECT (and to a page), or NULL. free them with free()
+uint8_t *sorbet_alloc_aligned(size_t len) {
+	void *mem = NULL;
+	if (posix_memalign(&mem, SORBET_DIRECT_ALIGN, (len > 0) ? len : 1) != 0) {
+		printf("ERROR: couldn't allocate %ld bytes\n", (long)len);
+		return NULL;
+	}
+	return (uint8_t *)mem;
+}
+
+void *sorbet_malloc(const sorbet_allocator *a, size_t len) {
+	return (a != NULL) ? a->alloc(a->ctx, len) : malloc(len);
+}
+
+void sorbet_free(const sorbet_allocator *a, void *p) {
+	if (a != NULL) {
+		a->release(a->ctx, p);
+	} else {
+		free(p);
+	}
+}
+
+// the head of an arena chunk. the chunk's memory follows it
+typedef struct s_arena_chunk {
+	struct s_arena_chunk *prev;
+	size_t cap;
+} arena_chunk;
+
+// arena blocks are aligned to 16 bytes, like malloc's
+#define ARENA_ALIGN(len) (((len) + 15) & ~(size_t)15)
+#define ARENA_HEAD ARENA_ALIGN(sizeof(arena_chunk))
+
+bool sorbet_arena_grow(sorbet_arena *a, size_t cap) {
+	arena_chunk *c = (arena_chunk *)sorbet_malloc(a->allocator, ARENA_HEAD + cap);
+	if (c == NULL) {
+		printf("ERROR: couldn't allocate %ld bytes\n", (long)(ARENA_HEAD + cap));
+		return false;
+	}
+	c->prev = a->chunk;
+	c->cap = cap;
+	a->chunk = c;
+	a->used = 0;
+	a->size += cap;
+	return true;
+}
+
+void *sorbet_arena_alloc(sorbet_arena *a, size_t len) {
+	len = ARENA_ALIGN(len);
+	if (a->chunk == NULL || a->used + len > a->chunk->cap) {
+		size_t cap = (a->size > 0) ? a->size : SORBET_ARENA_CHUNK;
+		if (!sorbet_arena_grow(a, (cap > len) ? cap : len)) return NULL;
+	}
+	void *p = (uint8_t *)a->chunk + ARENA_HEAD + a->used;
+	a->used += len;
+	return p;
+}
+
+void *sorbet_arena_calloc(sorbet_arena *a, size_t n, size_t size) {
+	void *p = sorbet_arena_alloc(a, n * size);
+	if (p != NULL) memset(p, 0, n * size);
+	return p;
+}
+
+// gives back p, which has to be the last block allocated
+void sorbet_arena_pop(sorbet_arena *a, void *p) {
+	uint8_t *base = (a->chunk != NULL) ? (uint8_t *)a->chunk + ARENA_HEAD : NULL;
+	if (base != NULL && (uint8_t *)p >= base && (uint8_t *)p <= base + a->used) {
+		a->used = (uint8_t *)p - base;
+	}
+}
+
+void sorbet_arena_free(sorbet_arena *a) {
+	while (a->chunk != NULL) {
+		arena_chunk *prev = a->chunk->prev;
+		sorbet_free(a->allocator, a->chunk);
+		a->chunk = prev;
+	}
+	a->used = 0;
+	a->size = 0;
+}
+
+// gives back every block. an arena that grew past one chunk is replaced with a
+// single chunk as big as all of them, so one that's reset over and over stops
+// allocating
+void sorbet_arena_reset(sorbet_arena *a) {
+	if (a->chunk != NULL && a->chunk->prev != NULL) {
+		size_t size = a->size;
+		sorbet_arena_free(a);
+		sorbet_arena_grow(a, size);
+	}
+	a->used = 0;
+}
+
+// makes b hold at least len bytes of aligned memory. unlike sorbet_buffer_reserve
+// it doesn't keep what b held
+bool sorbet_buffer_reserve_aligned(sorbet_buffer *b, size_t len) {
+	b->size = 0;
+	b->offset = 0;
+	if (b->capacity >= len && ((uintptr_t)b->data & (SORBET_DIRECT_ALIGN - 1)) == 0) return true;
+	sorbet_buffer_free(b);
+	b->data = sorbet_alloc_aligned(len);
+	if (b->data == NULL) return false;
+	b->capacity = len;
+	return true;
+}
+
+bool sorbet_buffer_read(sorbet_buffer *b, void *v, size_t len) {
+	if (b->offset + len > b->size) return false;
+	memcpy(v, b->data + b->offset, len);
+	b->offset += len;
+	return true;
+}
+
+int32_t sorbet_buffer_read_int(sorbet_buffer *b) {
+	int32_t v = 0;
+	sorbet_buffer_read(b, &v, 4);
+	return v;
+}
+
+int64_t sorbet_buffer_read_long(sorbet_buffer *b) {
+	int64_t v = 0;
+	sorbet_buffer_read(b, &v, 8);
+	return v;
+}
+
+void sorbet_buffer_append(sorbet_buffer *b, const void *v, size_t len) {
+	sorbet_buffer_reserve(b, len);
+	memcpy(b->data + b->size, v, len);
+	b->size += len;
+}
+
+void sorbet_buffer_append_varint(sorbet_buffer *b, uint64_t u) {
+	sorbet_buffer_reserve(b, 10);
+	while (u >= 0x80) {
+		b->data[b->size++] = (uint8_t)(u | 0x80);
+		u >>= 7;
+	}
+	b->data[b->size++] = (uint8_t)u;
+}
+
+bool sorbet_buffer_read_varint(sorbet_buffer *b, uint64_t *u) {
+	const uint8_t *p = b->data + b->offset;
+	const uint8_t *end = b->data + b->size;
+	int32_t shift = 0;
+	*u = 0;
+	while (p < end && (*p & 0x80) && shift < 63) {
+		*u |= (uint64_t)(*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	if (p == end) return false;
+	*u |= (uint64_t)(*p++) << shift;
+	b->offset = p - b->data;
+	return true;
+}
+
+void sorbet_vector_init(sorbet_vector *vec, column_type type) {
+	memset(vec, 0, sizeof(sorbet_vector));
+	vec->type = type;
+}
+
+void sorbet_vector_free(sorbet_vector *vec) {
+	free(vec->validity);
+	free(vec->values.ptr);
+	free(vec->offsets);
+	free(vec->data);
+	free(vec->codes);
+	free(vec->run_ends);
+	sorbet_vector_init(vec, vec->type);
+}
+
+// empties vec, which also takes it out of dictionary or run form
+void sorbet_vector_clear(sorbet_vector *vec) {
+	vec->length = 0;
+	vec->null_count = 0;
+	vec->data_size = 0;
+	vec->dictionary = NULL;
+	vec->n_runs = 0;
+}
+
+// empties vec and switches it to holding codes into dict
+void sorbet_vector_set_dictionary(sorbet_vector *vec, const sorbet_vector *dict) {
+	sorbet_vector_clear(vec);
+	vec->dictionary = dict;
+	if (vec->codes == NULL && vec->capacity > 0) {
+		vec->codes = (int32_t *)malloc(vec->capacity * sizeof(int32_t));
+	}
+}
+
+// makes room for n more values
+void sorbet_vector_reserve(sorbet_vector *vec, int64_t n) {
+	if (vec->length + n <= vec->capacity) return;
+	int64_t cap = (vec->capacity > 0) ? vec->capacity : 1024;
+	while (cap < vec->length + n) cap *= 2;
+	vec->validity = (uint8_t *)realloc(vec->validity, (cap + 7) / 8);
+	if (vec->type == STRING || vec->type == BINARY) {
+		vec->offsets = (int32_t *)realloc(vec->offsets, (cap + 1) * sizeof(int32_t));
+		// once a vector has held codes it keeps room for them
+		if (vec->codes != NULL || vec->dictionary != NULL) {
+			vec->codes = (int32_t *)realloc(vec->codes, cap * sizeof(int32_t));
+		}
+	} else {
+		vec->values.ptr = realloc(vec->values.ptr, cap * column_type_width[vec->type]);
+		if (vec->run_ends != NULL) {
+			vec->run_ends = (int32_t *)realloc(vec->run_ends, cap * sizeof(int32_t));
+		}
+	}
+	vec->capacity = cap;
+}
+
+// makes room for len more bytes of STRING/BINARY data
+void sorbet_vector_reserve_data(sorbet_vector *vec, int64_t len) {
+	if (vec->data != NULL && vec->data_size + len <= vec->data_capacity) return;
+	int64_t cap = (vec->data_capacity > 0) ? vec->data_capacity : BUF_SIZE;
+	while (cap < vec->data_size + len) cap *= 2;
+	vec->data = (uint8_t *)realloc(vec->data, cap);
+	vec->data_capacity = cap;
+}
+
+void sorbet_vector_set_valid(sorbet_vector *vec, int64_t i, bool valid) {
+	if (valid) {
+		vec->validity[i >> 3] |= (uint8_t)(1 << (i & 7));
+	} else {
+		vec->validity[i >> 3] &= (uint8_t)~(1 << (i & 7));
+	}
+}
+
+void sorbet_vector_append_null(sorbet_vector *vec) {
+	sorbet_vector_reserve(vec, 1);
+	sorbet_vector_set_valid(vec, vec->length, false);
+	if (vec->dictionary != NULL) {
+		vec->codes[vec->length] = 0;
+	} else if (vec->type == STRING || vec->type == BINARY) {
+		if (vec->length == 0) vec->offsets[0] = 0;
+		vec->offsets[vec->length + 1] = vec->data_size;
+	} else {
+		// nulls hold zeros so that kernels can run over them without branching
+		int32_t width = column_type_width[vec->type];
+		memset((uint8_t *)vec->values.ptr + vec->length * width, 0, width);
+	}
+	vec->length++;
+	vec->null_count++;
+}
+
+// appends a value in its on-disk representation. len is only used by STRING and BINARY
+void sorbet_vector_append(sorbet_vector *vec, const void *v, int32_t len) {
+	sorbet_vector_reserve(vec, 1);
+	sorbet_vector_set_valid(vec, vec->length, true);
+	if (vec->type == STRING || vec->type == BINARY) {
+		sorbet_vector_reserve_data(vec, len);
+		memcpy(vec->data + vec->data_size, v, len);
+		vec->data_size += len;
+		if (vec->length == 0) vec->offsets[0] = 0;
+		vec->offsets[vec->length + 1] = vec->data_size;
+	} else {
+		int32_t width = column_type_width[vec->type];
+		memcpy((uint8_t *)vec->values.ptr + vec->length * width, v, width);
+	}
+	vec->length++;
+}
+
+// the run of a vector in run form that holds row i
+int64_t sorbet_vector_find_run(const sorbet_vector *vec, int64_t i) {
+	int64_t lo = 0;
+	int64_t hi = vec->n_runs - 1;
+	while (lo < hi) {
+		int64_t mid = (lo + hi) / 2;
+		if (vec->run_ends[mid] <= i) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// appends rows start..start+n of src, which holds runs, a value per row
+void sorbet_vector_expand_runs(sorbet_vector *dst, const sorbet_vector *src, int64_t start, int64_t n) {
+	int32_t width = column_type_width[dst->type];
+	sorbet_vector_reserve(dst, n);
+	uint8_t *values = (uint8_t *)dst->values.ptr;
+	int64_t r = sorbet_vector_find_run(src, start);
+	for (int64_t i = start; i < start + n; r++) {
+		int64_t end = (src->run_ends[r] < start + n) ? src->run_ends[r] : start + n;
+		bool valid = (src->validity == NULL || sorbet_vector_is_valid(src, i));
+		const uint8_t *v = (uint8_t *)src->values.ptr + r * width;
+		if (!valid) dst->null_count += end - i;
+		for (; i < end; i++) {
+			sorbet_vector_set_valid(dst, dst->length, valid);
+			memcpy(values + dst->length * width, v, width);
+			dst->length++;
+		}
+	}
+}
+
+// replaces what dst held with rows start..start+n of src, keeping them as runs
+void sorbet_vector_slice_runs(sorbet_vector *dst, const sorbet_vector *src, int64_t start, int64_t n) {
+	int32_t width = column_type_width[dst->type];
+	sorbet_vector_clear(dst);
+	sorbet_vector_reserve(dst, n);
+	if (dst->run_ends == NULL) {
+		dst->run_ends = (int32_t *)malloc(dst->capacity * sizeof(int32_t));
+	}
+	for (int64_t i = 0; i < n; i++) {
+		bool valid = (src->validity == NULL || sorbet_vector_is_valid(src, start + i));
+		sorbet_vector_set_valid(dst, i, valid);
+		if (!valid) dst->null_count++;
+	}
+	if (n == 0) return;
+	int64_t r = sorbet_vector_find_run(src, start);
+	for (; r < src->n_runs && src->run_ends[r] - start < n; r++) {
+		memcpy((uint8_t *)dst->values.ptr + dst->n_runs * width, (uint8_t *)src->values.ptr + r * width, width);
+		dst->run_ends[dst->n_runs++] = src->run_ends[r] - start;
+	}
+	if (dst->n_runs == 0 || dst->run_ends[dst->n_runs - 1] < n) {
+		// the last run carries on past the slice
+		memcpy((uint8_t *)dst->values.ptr + dst->n_runs * width, (uint8_t *)src->values.ptr + r * width, width);
+		dst->run_ends[dst->n_runs++] = n;
+	}
+	dst->length = n;
+}
+
+// appends values start..start+n of src. src can have a NULL validity bitmap when
+// none of its values are null. if src holds codes, dst gets the values they stand
+// for, unless dst was switched to the same dictionary, in which case it gets the codes.
+// if src holds runs, dst gets a value per row
+void sorbet_vector_append_slice(sorbet_vector *dst, const sorbet_vector *src, int64_t start, int64_t n) {
+	if (src->n_runs > 0) {
+		sorbet_vector_expand_runs(dst, src, start, n);
+		return;
+	}
+	if (src->dictionary != NULL && dst->dictionary != src->dictionary) {
+		for (int64_t i = start; i < start + n; i++) {
+			if (src->validity != NULL && !sorbet_vector_is_valid(src, i)) {
+				sorbet_vector_append_null(dst);
+			} else {
+				int32_t len;
+				const uint8_t *v = sorbet_vector_bytes(src, i, &len);
+				sorbet_vector_append(dst, v, len);
+			}
+		}
+		return;
+	}
+	sorbet_vector_reserve(dst, n);
+	for (int64_t i = 0; i < n; i++) {
+		bool valid = (src->validity == NULL || sorbet_vector_is_valid(src, start + i));
+		sorbet_vector_set_valid(dst, dst->length + i, valid);
+		if (!valid) dst->null_count++;
+	}
+	if (dst->dictionary != NULL) {
+		memcpy(dst->codes + dst->length, src->codes + start, n * sizeof(int32_t));
+	} else if (dst->type == STRING || dst->type == BINARY) {
+		int32_t base = src->offsets[start];
+		int32_t len = src->offsets[start + n] - base;
+		sorbet_vector_reserve_data(dst, len);
+		// a slice of empty or null strings may come from a vector with no data
+		if (len > 0) {
+			memcpy(dst->data + dst->data_size, src->data + base, len);
+		}
+		if (dst->length == 0) dst->offsets[0] = 0;
+		for (int64_t i = 1; i <= n; i++) {
+			dst->offsets[dst->length + i] = dst->data_size + src->offsets[start + i] - base;
+		}
+		dst->data_size += len;
+	} else {
+		int32_t width = column_type_width[dst->type];
+		memcpy((uint8_t *)dst->values.ptr + dst->length * width, (uint8_t *)src->values.ptr + start * width, n * width);
+	}
+	dst->length += n;
+}
+
+// writes a vector as a PLAIN column chunk: the same tagged values as the ROW layout
+void sorbet_encode_plain(const sorbet_vector *vec, sorbet_buffer *out) {
+	uint8_t tag = column_type_tag[vec->type];
+	uint8_t null_tag = column_type_null_tag[vec->type];
+	int32_t width = column_type_width[vec->type];
+	bool var = (vec->type == STRING || vec->type == BINARY);
+	sorbet_buffer_reserve(out, vec->length * (1 + width) + vec->data_size);
+	for (int64_t i = 0; i < vec->length; i++) {
+		if (!sorbet_vector_is_valid(vec, i)) {
+			sorbet_buffer_append(out, &null_tag, 1);
+		} else if (var) {
+			int32_t len;
+			const uint8_t *v = sorbet_vector_bytes(vec, i, &len);
+			sorbet_buffer_append(out, &tag, 1);
+			sorbet_buffer_append(out, &len, 4);
+			sorbet_buffer_append(out, v, len);
+		} else {
+			sorbet_buffer_append(out, &tag, 1);
+			sorbet_buffer_append(out, (uint8_t *)vec->values.ptr + i * width, width);
+		}
+	}
+}
+
+// reads n values of a PLAIN column chunk into a vector
+bool sorbet_decode_plain(sorbet_buffer *in, sorbet_vector *vec, int64_t n) {
+	uint8_t tag = column_type_tag[vec->type];
+	uint8_t null_tag = column_type_null_tag[vec->type];
+	int32_t width = column_type_width[vec->type];
+	bool var = (vec->type == STRING || vec->type == BINARY);
+	sorbet_vector_clear(vec);
+	sorbet_vector_reserve(vec, n);
+	for (int64_t i = 0; i < n; i++) {
+		uint8_t typ;
+		if (!sorbet_buffer_read(in, &typ, 1)) return false;
+		if (typ == null_tag) {
+			sorbet_vector_append_null(vec);
+			continue;
+		}
+		if (typ != tag) return false;
+		int32_t len = width;
+		if (var) {
+			len = sorbet_buffer_read_int(in);
+		}
+		if (len < 0 || in->offset + len > in->size) return false;
+		sorbet_vector_append(vec, in->data + in->offset, len);
+		in->offset += len;
+	}
+	return true;
+}
+
+uint32_t sorbet_hash_bytes(const uint8_t *v, int32_t len) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (int32_t i = 0; i < len; i++) {
+		h = (h ^ v[i]) * 16777619u;
+	}
+	return h;
+}
+
+// collects the distinct values of a STRING or BINARY vector into dict and gives each
+// value's entry in codes (0 for nulls). gives up, returning false, once there are
+// more than max_entries
+bool sorbet_build_dictionary(const sorbet_vector *vec, int32_t max_entries, sorbet_vector *dict, int32_t *codes) {
+	int64_t slots = 64;
+	while (slots < 2 * ((vec->length < max_entries) ? vec->length : max_entries)) slots *= 2;
+	// entry + 1 for each hash slot, 0 when the slot is empty
+	int32_t *table = (int32_t *)calloc(slots, sizeof(int32_t));
+	sorbet_vector_clear(dict);
+	bool ok = true;
+	for (int64_t i = 0; i < vec->length && ok; i++) {
+		codes[i] = 0;
+		if (!sorbet_vector_is_valid(vec, i)) continue;
+		int32_t len;
+		const uint8_t *v = sorbet_vector_bytes(vec, i, &len);
+		int64_t h = sorbet_hash_bytes(v, len) & (slots - 1);
+		while (table[h] != 0) {
+			int32_t e = table[h] - 1;
+			int32_t elen = dict->offsets[e + 1] - dict->offsets[e];
+			if (elen == len && memcmp(dict->data + dict->offsets[e], v, len) == 0) break;
+			h = (h + 1) & (slots - 1);
+		}
+		if (table[h] == 0) {
+			if (dict->length == max_entries) {
+				ok = false;
+				break;
+			}
+			sorbet_vector_append(dict, v, len);
+			table[h] = dict->length;
+		}
+		codes[i] = table[h] - 1;
+	}
+	free(table);
+	return ok;
+}
+
+// the width of the codes of a dictionary with n entries. the largest code of that
+// width marks a null
+int32_t dictionary_code_width(int64_t n) {
+	return (n < 0xff) ? 1 : (n < 0xffff) ? 2 : 4;
+}
+
+// writes a DICTIONARY column chunk: the number of entries, each entry as a length
+// and its bytes, the code width, then a code per value
+void sorbet_encode_dictionary(const sorbet_vector *vec, const sorbet_vector *dict, const int32_t *codes, sorbet_buffer *out) {
+	int32_t n_entries = dict->length;
+	int32_t width = dictionary_code_width(n_entries);
+	uint32_t null_code = (width == 4) ? 0xffffffff : (1u << (8 * width)) - 1;
+	sorbet_buffer_reserve(out, 5 + n_entries * 4 + dict->data_size + vec->length * width);
+	sorbet_buffer_append(out, &n_entries, 4);
+	for (int32_t e = 0; e < n_entries; e++) {
+		int32_t len = dict->offsets[e + 1] - dict->offsets[e];
+		sorbet_buffer_append(out, &len, 4);
+		sorbet_buffer_append(out, dict->data + dict->offsets[e], len);
+	}
+	uint8_t w = width;
+	sorbet_buffer_append(out, &w, 1);
+	for (int64_t i = 0; i < vec->length; i++) {
+		uint32_t code = sorbet_vector_is_valid(vec, i) ? (uint32_t)codes[i] : null_code;
+		// little-endian, so the low bytes come first
+		memcpy(out->data + out->size, &code, width);
+		out->size += width;
+	}
+}
+
+// reads n values of a DICTIONARY column chunk. the entries go into dict and vec
+// gets the codes
+bool sorbet_decode_dictionary(sorbet_buffer *in, sorbet_vector *vec, sorbet_vector *dict, int64_t n) {
+	int32_t n_entries;
+	if (!sorbet_buffer_read(in, &n_entries, 4) || n_entries < 0) return false;
+	sorbet_vector_clear(dict);
+	sorbet_vector_reserve(dict, n_entries);
+	for (int32_t e = 0; e < n_entries; e++) {
+		int32_t len;
+		if (!sorbet_buffer_read(in, &len, 4) || len < 0 || in->offset + len > in->size) return false;
+		sorbet_vector_append(dict, in->data + in->offset, len);
+		in->offset += len;
+	}
+	uint8_t width;
+	if (!sorbet_buffer_read(in, &width, 1) || width != dictionary_code_width(n_entries)) return false;
+	if (in->offset + n * width > in->size) return false;
+	uint32_t null_code = (width == 4) ? 0xffffffff : (1u << (8 * width)) - 1;
+	sorbet_vector_set_dictionary(vec, dict);
+	sorbet_vector_reserve(vec, n);
+	const uint8_t *p = in->data + in->offset;
+	for (int64_t i = 0; i < n; i++) {
+		uint32_t code = 0;
+		memcpy(&code, p + i * width, width);
+		if (code == null_code) {
+			sorbet_vector_append_null(vec);
+			continue;
+		}
+		if (code >= (uint32_t)n_entries) return false;
+		sorbet_vector_set_valid(vec, vec->length, true);
+		vec->codes[vec->length++] = code;
+	}
+	in->offset += n * width;
+	return true;
+}
+
+bool sorbet_is_integer_type(column_type type) {
+	return type == INTEGER || type == LONG || type == DATE || type == DATETIME || type == TIME;
+}
+
+// whether a column of type can be stored with encoding
+bool sorbet_encoding_fits(column_type type, column_encoding encoding) {
+	switch (encoding) {
+		case SORBET_ENCODING_PLAIN:
+		case SORBET_ENCODING_BITMAP:
+		case SORBET_ENCODING_AUTO:
+			return true;
+		case SORBET_ENCODING_DICTIONARY:
+			return type == STRING || type == BINARY;
+		case SORBET_ENCODING_VARINT:
+		case SORBET_ENCODING_BITPACK:
+		case SORBET_ENCODING_DELTA:
+		case SORBET_ENCODING_DELTA_DELTA:
+			return sorbet_is_integer_type(type);
+		case SORBET_ENCODING_RLE:
+			return type != STRING && type != BINARY && type != NULL_COL_TYPE;
+		case SORBET_ENCODING_XOR:
+			return type == FLOAT || type == DOUBLE;
+	}
+	return false;
+}
+
+uint64_t sorbet_zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+int64_t sorbet_unzigzag(uint64_t u) {
+	return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+int32_t sorbet_varint_size(uint64_t u) {
+	int32_t n = 1;
+	while (u >= 0x80) {
+		u >>= 7;
+		n++;
+	}
+	return n;
+}
+
+// the bits needed to hold every value from 0 to range
+int32_t sorbet_bit_width(uint64_t range) {
+	return (range == 0) ? 0 : 64 - __builtin_clzll(range);
+}
+
+// the size of a bit-packed frame of n values width bits wide. the 8 bytes of padding
+// at the end let decoders load a whole word at any value
+int64_t sorbet_frame_size(int64_t n, int32_t width) {
+	return 9 + (n * width + 7) / 8 + 8;
+}
+
+// the smallest and largest of n values, and how far apart they are. differences are
+// taken with wrapping arithmetic, which frames undo the same way
+uint64_t sorbet_value_spread(const int64_t *v, int64_t n, int64_t *min) {
+	int64_t lo = (n > 0) ? v[0] : 0;
+	int64_t hi = lo;
+	for (int64_t i = 1; i < n; i++) {
+		if (v[i] < lo) lo = v[i];
+		if (v[i] > hi) hi = v[i];
+	}
+	*min = lo;
+	return (uint64_t)hi - (uint64_t)lo;
+}
+
+// writes n values as a bit-packed frame: the smallest value, the bit width, then each
+// value minus the smallest, low bits first
+void sorbet_pack_frame(const int64_t *v, int64_t n, sorbet_buffer *out) {
+	int64_t base;
+	int32_t width = sorbet_bit_width(sorbet_value_spread(v, n, &base));
+	int64_t n_bytes = (n * width + 7) / 8;
+	uint8_t w = width;
+	sorbet_buffer_reserve(out, sorbet_frame_size(n, width));
+	sorbet_buffer_append(out, &base, 8);
+	sorbet_buffer_append(out, &w, 1);
+	uint8_t *p = out->data + out->size;
+	memset(p, 0, n_bytes + 8);
+	for (int64_t i = 0; i < n && width > 0; i++) {
+		uint64_t u = (uint64_t)v[i] - (uint64_t)base;
+		int64_t bit = i * width;
+		int32_t shift = bit & 7;
+		uint64_t word;
+		memcpy(&word, p + (bit >> 3), 8);
+		word |= u << shift;
+		memcpy(p + (bit >> 3), &word, 8);
+		if (shift + width > 64) p[(bit >> 3) + 8] |= (uint8_t)(u >> (64 - shift));
+	}
+	out->size += n_bytes + 8;
+}
+
+// reads a frame of n values written by sorbet_pack_frame into v
+bool sorbet_unpack_frame(sorbet_buffer *in, int64_t *v, int64_t n) {
+	uint64_t base;
+	uint8_t width;
+	if (!sorbet_buffer_read(in, &base, 8) || !sorbet_buffer_read(in, &width, 1) || width > 64) return false;
+	int64_t n_bytes = (n * width + 7) / 8;
+	if (in->offset + n_bytes + 8 > in->size) return false;
+	const uint8_t *p = in->data + in->offset;
+	uint64_t mask = (width == 64) ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+	if (width == 0) {
+		for (int64_t i = 0; i < n; i++) v[i] = (int64_t)base;
+	} else if (width <= 57) {
+		// every value fits in the word loaded at its first byte, so the loop has no
+		// branches and the compiler can vectorize it
+		for (int64_t i = 0; i < n; i++) {
+			int64_t bit = i * width;
+			uint64_t word;
+			memcpy(&word, p + (bit >> 3), 8);
+			v[i] = (int64_t)(base + ((word >> (bit & 7)) & mask));
+		}
+	} else {
+		for (int64_t i = 0; i < n; i++) {
+			int64_t bit = i * width;
+			int32_t shift = bit & 7;
+			uint64_t word;
+			memcpy(&word, p + (bit >> 3), 8);
+			word >>= shift;
+			if (shift + width > 64) word |= (uint64_t)p[(bit >> 3) + 8] << (64 - shift);
+			v[i] = (int64_t)(base + (word & mask));
+		}
+	}
+	in->offset += n_bytes + 8;
+	return true;
+}
+
+// writes the validity bitmap that starts the integer encodings: a flag, then the
+// bitmap if any value is null
+void sorbet_encode_validity(const sorbet_vector *vec, sorbet_buffer *out) {
+	uint8_t has_nulls = (vec->null_count > 0);
+	sorbet_buffer_append(out, &has_nulls, 1);
+	if (!has_nulls) return;
+	int64_t n_bytes = (vec->length + 7) / 8;
+	sorbet_buffer_append(out, vec->validity, n_bytes);
+	if (vec->length & 7) {
+		// the bits past the end are whatever the vector last held
+		out->data[out->size - 1] &= (uint8_t)((1 << (vec->length & 7)) - 1);
+	}
+}
+
+// reads the validity bitmap of n values into vec, which gets a length of n
+bool sorbet_decode_validity(sorbet_buffer *in, sorbet_vector *vec, int64_t n) {
+	uint8_t has_nulls;
+	if (!sorbet_buffer_read(in, &has_nulls, 1)) return false;
+	sorbet_vector_clear(vec);
+	sorbet_vector_reserve(vec, n);
+	int64_t n_bytes = (n + 7) / 8;
+	if (!has_nulls) {
+		memset(vec->validity, 0xff, n_bytes);
+	} else if (!sorbet_buffer_read(in, vec->validity, n_bytes)) {
+		return false;
+	} else {
+		int64_t valid = 0;
+		for (int64_t i = 0; i < n / 8; i++) valid += __builtin_popcount(vec->validity[i]);
+		for (int64_t i = n & ~(int64_t)7; i < n; i++) valid += sorbet_vector_is_valid(vec, i);
+		vec->null_count = n - valid;
+	}
+	vec->length = n;
+	return true;
+}
+
+// writes a BITMAP column chunk: the validity bitmap, then the values that aren't null
+// without tags. BOOLEAN values take a bit each, and STRING and BINARY values are all
+// the lengths followed by all the bytes
+void sorbet_encode_bitmap(const sorbet_vector *vec, sorbet_buffer *out) {
+	sorbet_encode_validity(vec, out);
+	int32_t width = column_type_width[vec->type];
+	int64_t k = vec->length - vec->null_count;
+	bool dense = (vec->null_count == 0);
+	if (vec->type == BOOLEAN) {
+		int64_t n_bytes = (k + 7) / 8;
+		sorbet_buffer_reserve(out, n_bytes);
+		uint8_t *p = out->data + out->size;
+		memset(p, 0, n_bytes);
+		int64_t j = 0;
+		for (int64_t i = 0; i < vec->length; i++) {
+			if (!dense && !sorbet_vector_is_valid(vec, i)) continue;
+			p[j >> 3] |= (uint8_t)((vec->values.boolval[i] != 0) << (j & 7));
+			j++;
+		}
+		out->size += n_bytes;
+	} else if (vec->type == STRING || vec->type == BINARY) {
+		int64_t data_size = 0;
+		sorbet_buffer_reserve(out, k * 4);
+		for (int64_t i = 0; i < vec->length; i++) {
+			if (!dense && !sorbet_vector_is_valid(vec, i)) continue;
+			int32_t len;
+			sorbet_vector_bytes(vec, i, &len);
+			sorbet_buffer_append(out, &len, 4);
+			data_size += len;
+		}
+		sorbet_buffer_reserve(out, data_size);
+		for (int64_t i = 0; i < vec->length; i++) {
+			if (!dense && !sorbet_vector_is_valid(vec, i)) continue;
+			int32_t len;
+			const uint8_t *v = sorbet_vector_bytes(vec, i, &len);
+			sorbet_buffer_append(out, v, len);
+		}
+	} else if (dense) {
+		sorbet_buffer_append(out, vec->values.ptr, k * width);
+	} else {
+		sorbet_buffer_reserve(out, k * width);
+		for (int64_t i = 0; i < vec->length; i++) {
+			if (!sorbet_vector_is_valid(vec, i)) continue;
+			sorbet_buffer_append(out, (uint8_t *)vec->values.ptr + i * width, width);
+		}
+	}
+}
+
+// reads n values of a BITMAP column chunk into a vector
+bool sorbet_decode_bitmap(sorbet_buffer *in, sorbet_vector *vec, int64_t n) {
+	if (!sorbet_decode_validity(in, vec, n)) return false;
+	int32_t width = column_type_width[vec->type];
+	int64_t k = n - vec->null_count;
+	bool dense = (vec->null_count == 0);
+	const uint8_t *p = in->data + in->offset;
+	if (vec->type == BOOLEAN) {
+		int64_t n_bytes = (k + 7) / 8;
+		if (in->offset + n_bytes > in->size) return false;
+		int64_t j = 0;
+		for (int64_t i = 0; i < n; i++) {
+			uint8_t v = 0;
+			if (dense || sorbet_vector_is_valid(vec, i)) {
+				v = (p[j >> 3] >> (j & 7)) & 1;
+				j++;
+			}
+			vec->values.boolval[i] = v;
+		}
+		in->offset += n_bytes;
+	} else if (vec->type == STRING || vec->type == BINARY) {
+		if (in->offset + k * 4 > in->size) return false;
+		int64_t j = 0;
+		vec->offsets[0] = 0;
+		for (int64_t i = 0; i < n; i++) {
+			int32_t len = 0;
+			if (dense || sorbet_vector_is_valid(vec, i)) {
+				memcpy(&len, p + j * 4, 4);
+				j++;
+			}
+			if (len < 0 || (int64_t)vec->offsets[i] + len > INT32_MAX) return false;
+			vec->offsets[i + 1] = vec->offsets[i] + len;
+		}
+		int64_t data_size = vec->offsets[n];
+		in->offset += k * 4;
+		if (in->offset + data_size > in->size) return false;
+		sorbet_vector_reserve_data(vec, data_size);
+		memcpy(vec->data, in->data + in->offset, data_size);
+		vec->data_size = data_size;
+		in->offset += data_size;
+	} else {
+		if (in->offset + k * width > in->size) return false;
+		if (dense) {
+			memcpy(vec->values.ptr, p, k * width);
+		} else {
+			// nulls hold zeros, as they do everywhere else
+			uint8_t *dst = (uint8_t *)vec->values.ptr;
+			for (int64_t i = 0; i < n; i++) {
+				if (sorbet_vector_is_valid(vec, i)) {
+					memcpy(dst + i * width, p, width);
+					p += width;
+				} else {
+					memset(dst + i * width, 0, width);
+				}
+			}
+		}
+		in->offset += k * width;
+	}
+	return true;
+}
+
+// whether rows i and j of a fixed-width vector hold the same value. nulls are all
+// the same as each other and never the same as a value
+bool sorbet_vector_same(const sorbet_vector *vec, int64_t i, int64_t j) {
+	bool valid = (vec->null_count == 0 || sorbet_vector_is_valid(vec, i));
+	if (valid != (vec->null_count == 0 || sorbet_vector_is_valid(vec, j))) return false;
+	if (!valid) return true;
+	int32_t width = column_type_width[vec->type];
+	return memcmp((uint8_t *)vec->values.ptr + i * width, (uint8_t *)vec->values.ptr + j * width, width) == 0;
+}
+
+// the size of a fixed-width vector as an RLE column chunk
+int64_t sorbet_rle_size(const sorbet_vector *vec) {
+	int32_t width = column_type_width[vec->type];
+	int64_t size = 1 + ((vec->null_count > 0) ? (vec->length + 7) / 8 : 0);
+	int64_t n_runs = 0;
+	for (int64_t i = 0; i < vec->length; ) {
+		int64_t end = i + 1;
+		while (end < vec->length && sorbet_vector_same(vec, i, end)) end++;
+		size += sorbet_varint_size(end - i);
+		if (vec->null_count == 0 || sorbet_vector_is_valid(vec, i)) size += width;
+		n_runs++;
+		i = end;
+	}
+	return size + sorbet_varint_size(n_runs);
+}
+
+// writes an RLE column chunk: the validity bitmap, the number of runs, then each run's
+// length and (unless it's a run of nulls) its value
+void sorbet_encode_rle(const sorbet_vector *vec, sorbet_buffer *out) {
+	int32_t width = column_type_width[vec->type];
+	sorbet_encode_validity(vec, out);
+	int64_t n_runs = 0;
+	for (int64_t i = 0; i < vec->length; i++) {
+		if (i == 0 || !sorbet_vector_same(vec, i - 1, i)) n_runs++;
+	}
+	sorbet_buffer_append_varint(out, n_runs);
+	for (int64_t i = 0; i < vec->length; ) {
+		int64_t end = i + 1;
+		while (end < vec->length && sorbet_vector_same(vec, i, end)) end++;
+		sorbet_buffer_append_varint(out, end - i);
+		if (vec->null_count == 0 || sorbet_vector_is_valid(vec, i)) {
+			sorbet_buffer_append(out, (uint8_t *)vec->values.ptr + i * width, width);
+		}
+		i = end;
+	}
+}
+
+// reads n values of an RLE column chunk into vec as runs
+bool sorbet_decode_rle(sorbet_buffer *in, sorbet_vector *vec, int64_t n) {
+	int32_t width = column_type_width[vec->type];
+	uint64_t n_runs;
+	if (!sorbet_decode_validity(in, vec, n)) return false;
+	if (!sorbet_buffer_read_varint(in, &n_runs) || n_runs > (uint64_t)n) return false;
+	if (vec->run_ends == NULL) {
+		vec->run_ends = (int32_t *)malloc(vec->capacity * sizeof(int32_t));
+	}
+	int64_t end = 0;
+	uint8_t *values = (uint8_t *)vec->values.ptr;
+	for (uint64_t r = 0; r < n_runs; r++) {
+		uint64_t len;
+		if (!sorbet_buffer_read_varint(in, &len) || len == 0 || len > (uint64_t)(n - end)) return false;
+		if (vec->null_count > 0 && !sorbet_vector_is_valid(vec, end)) {
+			memset(values + r * width, 0, width);
+		} else if (!sorbet_buffer_read(in, values + r * width, width)) {
+			return false;
+		}
+		end += len;
+		vec->run_ends[r] = end;
+	}
+	vec->n_runs = n_runs;
+	return end == n;
+}
+
+// a stream of bit fields, low bits first (XOR encoding)
+typedef struct s_bit_writer {
+	sorbet_buffer *out;
+	uint64_t acc;
+	int32_t n;
+} bit_writer;
+
+typedef struct s_bit_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc;
+	int32_t n;
+} bit_reader;
+
+// appends the low bits bits of v. fields wider than 32 bits go in two halves
+void bit_writer_put(bit_writer *w, uint64_t v, int32_t bits) {
+	if (bits > 32) {
+		bit_writer_put(w, v, 32);
+		bit_writer_put(w, v >> 32, bits - 32);
+		return;
+	}
+	w->acc |= (v & (((uint64_t)1 << bits) - 1)) << w->n;
+	w->n += bits;
+	while (w->n >= 8) {
+		sorbet_buffer_append(w->out, &w->acc, 1);
+		w->acc >>= 8;
+		w->n -= 8;
+	}
+}
+
+void bit_writer_flush(bit_writer *w) {
+	if (w->n > 0) sorbet_buffer_append(w->out, &w->acc, 1);
+	w->acc = 0;
+	w->n = 0;
+}
+
+bool bit_reader_get(bit_reader *r, int32_t bits, uint64_t *v) {
+	if (bits > 32) {
+		uint64_t lo;
+		uint64_t hi;
+		if (!bit_reader_get(r, 32, &lo) || !bit_reader_get(r, bits - 32, &hi)) return false;
+		*v = lo | (hi << 32);
+		return true;
+	}
+	while (r->n < bits) {
+		if (r->p == r->end) return false;
+		r->acc |= (uint64_t)(*r->p++) << r->n;
+		r->n += 8;
+	}
+	*v = r->acc & (((uint64_t)1 << bits) - 1);
+	r->acc >>= bits;
+	r->n -= bits;
+	return true;
+}
+
+// writes a FLOAT or DOUBLE vector as an XOR column chunk (Gorilla): the validity
+// bitmap, the first value that isn't null, then a bit stream with each following
+// value XORed with the one before it. a 0 bit means the value repeats. otherwise a 1
+// bit, then 0 if the XOR's set bits fit between the leading and trailing zeros of the
+// last window and only those bits follow, or 1 and a new window (leading zeros and
+// length minus one, 5 bits each for FLOAT and 6 for DOUBLE) before the bits
+void sorbet_encode_xor(const sorbet_vector *vec, sorbet_buffer *out) {
+	int32_t width = column_type_width[vec->type];
+	int32_t bits = width * 8;
+	int32_t field = (width == 8) ? 6 : 5;
+	sorbet_encode_validity(vec, out);
+	bit_writer w = {out, 0, 0};
+	bool first = true;
+	uint64_t prev = 0;
+	int32_t lead = -1;
+	int32_t trail = 0;
+	for (int64_t i = 0; i < vec->length; i++) {
+		if (vec->null_count > 0 && !sorbet_vector_is_valid(vec, i)) continue;
+		uint64_t v = 0;
+		memcpy(&v, (uint8_t *)vec->values.ptr + i * width, width);
+		if (first) {
+			sorbet_buffer_append(out, &v, width);
+			prev = v;
+			first = false;
+			continue;
+		}
+		uint64_t x = v ^ prev;
+		prev = v;
+		if (x == 0) {
+			bit_writer_put(&w, 0, 1);
+			continue;
+		}
+		int32_t l = __builtin_clzll(x) - (64 - bits);
+		int32_t t = __builtin_ctzll(x);
+		if (lead >= 0 && l >= lead && t >= trail) {
+			bit_writer_put(&w, 1, 2);
+			bit_writer_put(&w, x >> trail, bits - lead - trail);
+		} else {
+			lead = l;
+			trail = t;
+			bit_writer_put(&w, 3, 2);
+			bit_writer_put(&w, lead, field);
+			bit_writer_put(&w, bits - lead - trail - 1, field);
+			bit_writer_put(&w, x >> trail, bits - lead - trail);
+		}
+	}
+	bit_writer_flush(&w);
+}
+
+// reads n values of an XOR column chunk into a vector
+bool sorbet_decode_xor(sorbet_buffer *in, sorbet_vector *vec, int64_t n) {
+	if (!sorbet_decode_validity(in, vec, n)) return false;
+	int32_t width = column_type_width[vec->type];
+	int32_t bits = width * 8;
+	int32_t field = (width == 8) ? 6 : 5;
+	uint8_t *dst = (uint8_t *)vec->values.ptr;
+	bit_reader r = {NULL, in->data + in->size, 0, 0};
+	bool first = true;
+	uint64_t v = 0;
+	int32_t lead = -1;
+	int32_t trail = 0;
+	for (int64_t i = 0; i < n; i++) {
+		if (vec->null_count > 0 && !sorbet_vector_is_valid(vec, i)) {
+			memset(dst + i * width, 0, width);
+			continue;
+		}
+		if (first) {
+			if (!sorbet_buffer_read(in, &v, width)) return false;
+			r.p = in->data + in->offset;
+			first = false;
+		} else {
+			uint64_t flag;
+			if (!bit_reader_get(&r, 1, &flag)) return false;
+			if (flag) {
+				uint64_t x;
+				if (!bit_reader_get(&r, 1, &flag)) return false;
+				if (flag) {
+					uint64_t l;
+					uint64_t len;
+					if (!bit_reader_get(&r, field, &l) || !bit_reader_get(&r, field, &len)) return false;
+					if (l + len + 1 > (uint64_t)bits) return false;
+					lead = l;
+					trail = bits - lead - (len + 1);
+				} else if (lead < 0) {
+					return false;
+				}
+				if (!bit_reader_get(&r, bits - lead - trail, &x)) return false;
+				v ^= x << trail;
+			}
+		}
+		memcpy(dst + i * width, &v, width);
+	}
+	if (!first) in->offset = r.p - in->data;
+	return true;
+}
+
+// the values of an integer-valued vector that aren't null, widened to 64 bits. returns
+// how many there are
+int64_t sorbet_gather_integers(const sorbet_vector *vec, int64_t *v) {
+	int64_t k = 0;
+	bool wide = (column_type_width[vec->type] == 8);
+	for (int64_t i = 0; i < vec->length; i++) {
+		if (vec->null_count > 0 && !sorbet_vector_is_valid(vec, i)) continue;
+		v[k++] = wide ? vec->values.longval[i] : vec->values.intval[i];
+	}
+	return k;
+}
+
+// turns v into the differences between neighbouring values, in place. the first
+// value stays as it is
+void sorbet_delta(int64_t *v, int64_t n) {
+	for (int64_t i = n - 1; i > 0; i--) {
+		v[i] = (int64_t)((uint64_t)v[i] - (uint64_t)v[i - 1]);
+	}
+}
+
+// undoes sorbet_delta. a prefix sum
+void sorbet_undelta(int64_t *v, int64_t n) {
+	for (int64_t i = 1; i < n; i++) {
+		v[i] = (int64_t)((uint64_t)v[i] + (uint64_t)v[i - 1]);
+	}
+}
+
+// writes an integer-valued vector with one of the integer encodings or BITMAP. with
+// SORBET_ENCODING_AUTO it sizes each of them from the chunk and uses the smallest.
+// returns the encoding used
+uint8_t sorbet_encode_integers(const sorbet_vector *vec, column_encoding encoding, sorbet_buffer *out) {
+	// two extra zeros, which stand in for the first value and difference of the
+	// delta encodings when there are fewer values than that
+	int64_t *v = (int64_t *)calloc(vec->length + 2, sizeof(int64_t));
+	int64_t k = sorbet_gather_integers(vec, v);
+	if (encoding == SORBET_ENCODING_AUTO) {
+		int64_t min;
+		int64_t validity = 1 + ((vec->null_count > 0) ? (vec->length + 7) / 8 : 0);
+		int64_t best = validity + k * column_type_width[vec->type];
+		encoding = SORBET_ENCODING_BITMAP;
+		int64_t rle = sorbet_rle_size(vec);
+		if (rle < best) {
+			best = rle;
+			encoding = SORBET_ENCODING_RLE;
+		}
+		int64_t varint = validity;
+		for (int64_t i = 0; i < k; i++) varint += sorbet_varint_size(sorbet_zigzag(v[i]));
+		if (varint < best) {
+			best = varint;
+			encoding = SORBET_ENCODING_VARINT;
+		}
+		int64_t bitpack = validity + sorbet_frame_size(k, sorbet_bit_width(sorbet_value_spread(v, k, &min)));
+		if (bitpack < best) {
+			best = bitpack;
+			encoding = SORBET_ENCODING_BITPACK;
+		}
+		if (k > 1) {
+			sorbet_delta(v, k);
+			int64_t delta = validity + 8 + sorbet_frame_size(k - 1, sorbet_bit_width(sorbet_value_spread(v + 1, k - 1, &min)));
+			if (delta < best) {
+				best = delta;
+				encoding = SORBET_ENCODING_DELTA;
+			}
+			sorbet_delta(v + 1, k - 1);
+			int64_t delta_delta = validity + 16 + sorbet_frame_size(k - 2, sorbet_bit_width(sorbet_value_spread(v + 2, k - 2, &min)));
+			if (delta_delta < best) {
+				encoding = SORBET_ENCODING_DELTA_DELTA;
+			}
+			// back to the values
+			sorbet_undelta(v + 1, k - 1);
+			sorbet_undelta(v, k);
+		}
+	}
+	switch (encoding) {
+		case SORBET_ENCODING_VARINT: {
+			sorbet_encode_validity(vec, out);
+			for (int64_t i = 0; i < k; i++) {
+				sorbet_buffer_append_varint(out, sorbet_zigzag(v[i]));
+			}
+			break;
+		}
+		case SORBET_ENCODING_BITPACK: {
+			sorbet_encode_validity(vec, out);
+			sorbet_pack_frame(v, k, out);
+			break;
+		}
+		case SORBET_ENCODING_RLE: {
+			sorbet_encode_rle(vec, out);
+			break;
+		}
+		case SORBET_ENCODING_DELTA:
+		case SORBET_ENCODING_DELTA_DELTA: {
+			// the head always has its full size, so readers know where the frame starts
+			int64_t head = (encoding == SORBET_ENCODING_DELTA) ? 1 : 2;
+			sorbet_encode_validity(vec, out);
+			sorbet_delta(v, k);
+			if (head == 2) sorbet_delta(v + 1, (k > 1) ? k - 1 : 0);
+			sorbet_buffer_append(out, v, head * 8);
+			sorbet_pack_frame(v + head, (k > head) ? k - head : 0, out);
+			break;
+		}
+		default: {
+			encoding = SORBET_ENCODING_BITMAP;
+			sorbet_encode_bitmap(vec, out);
+		}
+	}
+	free(v);
+	return encoding;
+}
+
+// reads n values of a chunk written by sorbet_encode_integers
+bool sorbet_decode_integers(sorbet_buffer *in, sorbet_vector *vec, int64_t n, uint8_t encoding, sorbet_arena *scratch) {
+	if (!sorbet_decode_validity(in, vec, n)) return false;
+	int64_t k = n - vec->null_count;
+	// two extra so the heads of the delta encodings always fit
+	int64_t *v = (int64_t *)sorbet_arena_alloc(scratch, (k + 2) * sizeof(int64_t));
+	if (v == NULL) return false;
+	bool ok = true;
+	switch (encoding) {
+		case SORBET_ENCODING_VARINT: {
+			for (int64_t i = 0; i < k && ok; i++) {
+				uint64_t u = 0;
+				ok = sorbet_buffer_read_varint(in, &u);
+				v[i] = sorbet_unzigzag(u);
+			}
+			break;
+		}
+		case SORBET_ENCODING_BITPACK: {
+			ok = sorbet_unpack_frame(in, v, k);
+			break;
+		}
+		case SORBET_ENCODING_DELTA:
+		case SORBET_ENCODING_DELTA_DELTA: {
+			int64_t head = (encoding == SORBET_ENCODING_DELTA) ? 1 : 2;
+			ok = sorbet_buffer_read(in, v, head * 8) &&
+					sorbet_unpack_frame(in, v + head, (k > head) ? k - head : 0);
+			if (ok && head == 2) sorbet_undelta(v + 1, (k > 1) ? k - 1 : 0);
+			if (ok) sorbet_undelta(v, k);
+			break;
+		}
+		default: {
+			ok = false;
+		}
+	}
+	if (ok) {
+		// spread the values back out over the rows that aren't null, which hold zeros
+		bool wide = (column_type_width[vec->type] == 8);
+		int64_t j = 0;
+		for (int64_t i = 0; i < n; i++) {
+			int64_t x = 0;
+			if (vec->null_count == 0 || sorbet_vector_is_valid(vec, i)) x = v[j++];
+			if (wide) {
+				vec->values.longval[i] = x;
+			} else {
+				vec->values.intval[i] = (int32_t)x;
+			}
+		}
+	}
+	sorbet_arena_pop(scratch, v);
+	return ok;
+}
+
+// encodes column col's chunk the way sdef->encodings asks for, or else the smallest
+// way its type allows, and returns the encoding
+uint8_t sorbet_encode_chunk(sorbet_def *sdef, int col, const sorbet_vector *vec, sorbet_buffer *out) {
+	column_encoding encoding = SORBET_ENCODING_AUTO;
+	if (sdef->encodings != NULL && sorbet_encoding_fits(vec->type, sdef->encodings[col])) {
+		encoding = sdef->encodings[col];
+	}
+	if (encoding == SORBET_ENCODING_PLAIN) {
+		sorbet_encode_plain(vec, out);
+		return SORBET_ENCODING_PLAIN;
+	}
+	if (sorbet_is_integer_type(vec->type)) {
+		return sorbet_encode_integers(vec, encoding, out);
+	}
+	if (encoding == SORBET_ENCODING_XOR) {
+		sorbet_encode_xor(vec, out);
+		return SORBET_ENCODING_XOR;
+	}
+	if (vec->type != STRING && vec->type != BINARY && encoding != SORBET_ENCODING_BITMAP) {
+		bool use = (encoding == SORBET_ENCODING_RLE);
+		if (!use) {
+			int64_t k = vec->length - vec->null_count;
+			int64_t bitmap_size = 1 + ((vec->null_count > 0) ? (vec->length + 7) / 8 : 0);
+			bitmap_size += (vec->type == BOOLEAN) ? (k + 7) / 8 : k * column_type_width[vec->type];
+			use = (sorbet_rle_size(vec) < bitmap_size);
+		}
+		if (use) {
+			sorbet_encode_rle(vec, out);
+			return SORBET_ENCODING_RLE;
+		}
+	}
+	bool try_dict = (encoding == SORBET_ENCODING_DICTIONARY ||
+			(encoding == SORBET_ENCODING_AUTO && sdef->dict_max_entries >= 0));
+	if ((vec->type == STRING || vec->type == BINARY) && try_dict && vec->length > 0) {
+		int32_t max_entries = (sdef->dict_max_entries > 0) ? sdef->dict_max_entries : SORBET_DEFAULT_DICT_ENTRIES;
+		sorbet_vector dict;
+		sorbet_vector_init(&dict, vec->type);
+		int32_t *codes = (int32_t *)malloc(vec->length * sizeof(int32_t));
+		bool use = sorbet_build_dictionary(vec, max_entries, &dict, codes);
+		if (use) {
+			// values take a length each in BITMAP, and only a code here
+			int64_t bitmap_size = 1 + (vec->length - vec->null_count) * 4;
+			if (vec->null_count > 0) bitmap_size += (vec->length + 7) / 8;
+			int64_t dict_size = 5 + dict.length * 4 + dict.data_size + vec->length * dictionary_code_width(dict.length);
+			for (int64_t i = 0; i < vec->length; i++) {
+				int32_t len;
+				if (sorbet_vector_is_valid(vec, i)) {
+					sorbet_vector_bytes(vec, i, &len);
+					bitmap_size += len;
+				}
+			}
+			use = (dict_size < bitmap_size || encoding == SORBET_ENCODING_DICTIONARY);
+		}
+		if (use) {
+			sorbet_encode_dictionary(vec, &dict, codes, out);
+		}
+		free(codes);
+		sorbet_vector_free(&dict);
+		if (use) return SORBET_ENCODING_DICTIONARY;
+	}
+	sorbet_encode_bitmap(vec, out);
+	return SORBET_ENCODING_BITMAP;
+}
+
+// a row group (or block) moving through sdef->io. writers hand each block's buffer
+// to a slot until its write completes. readers read whole row groups into slots,
+// which keep their buffers (registered with the kernel) for the life of the reader.
+typedef enum s_io_slot_state {
+	IO_SLOT_FREE,
+	IO_SLOT_BUSY,
+	IO_SLOT_DONE,
+} io_slot_state;
+
+struct s_io_slot {
+	io_slot_state state;
+	int32_t group;
+	bool ok;
+	// readers: when the read completed, so the oldest one is reused first
+	uint64_t seq;
+	sorbet_buffer buf;
+};
+
+// passes sdef->advice on to the kernel
+void sorbet_advise_file(sorbet_def *sdef) {
+	if (sdef->advice == SORBET_ADVICE_NORMAL) return;
+	int fd = fileno(sdef->f);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (sdef->advice == SORBET_ADVICE_NOREUSE) {
+		// only a hint, and a no-op on older kernels. the dropping is done by hand
+		posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+	}
+}
+
+// where the next block goes
+uint64_t writer_tell(sorbet_def *sdef) {
+	return (sdef->io != NULL) ? sdef->io_offset : (uint64_t)ftello(sdef->f);
+}
+
+// takes one completed write, returning false if there wasn't one
+bool writer_io_reap(sorbet_def *sdef, bool wait) {
+	uint64_t tag;
+	int64_t res;
+	if (!sorbet_io_complete(sdef->io, wait, &tag, &res)) return false;
+	io_slot *slot = &sdef->io_slots[tag];
+	if (res != (int64_t)slot->buf.size) {
+		printf("ERROR: asked to write %d bytes but wrote %d\n", (int)slot->buf.size, (int)res);
+		sdef->write_failed = true;
+	}
+	slot->state = IO_SLOT_FREE;
+	return true;
+}
+
+// writes b at the end of the file and empties it. with io_uring the write is only
+// queued: a free slot takes b's memory until the write completes and b gets the
+// slot's old buffer to fill next. returns false, and sets write_failed, if b
+// couldn't be written or queued
+bool writer_write(sorbet_def *sdef, sorbet_buffer *b) {
+	if (sdef->io == NULL) {
+		size_t written = fwrite(b->data, sizeof(uint8_t), b->size, sdef->f);
+		bool ok = (written == b->size);
+		if (!ok) {
+			printf("ERROR: asked to write %d bytes but wrote %d\n", (int)b->size, (int)written);
+			sdef->write_failed = true;
+		}
+		b->size = 0;
+		return ok;
+	}
+	if (b->size == 0) return true;
+	io_slot *slot = NULL;
+	while (slot == NULL) {
+		for (int i = 0; i < sdef->n_io_slots && slot == NULL; i++) {
+			if (sdef->io_slots[i].state == IO_SLOT_FREE) slot = &sdef->io_slots[i];
+		}
+		if (slot == NULL && !writer_io_reap(sdef, true)) {
+			printf("ERROR: no write completed to free a slot for %d bytes\n", (int)b->size);
+			sdef->write_failed = true;
+			b->size = 0;
+			return false;
+		}
+	}
+	sorbet_buffer tmp = slot->buf;
+	slot->buf = *b;
+	*b = tmp;
+	b->size = 0;
+	slot->state = IO_SLOT_BUSY;
+	sorbet_io_write(sdef->io, fileno(sdef->f), slot->buf.data, slot->buf.size, sdef->io_offset, slot - sdef->io_slots);
+	sorbet_io_submit(sdef->io);
+	sdef->io_offset += slot->buf.size;
+	return true;
+}
+
+void writer_io_start(sorbet_def *sdef) {
+	// everything stdio buffered has to be in the file before writes bypass it
+	fflush(sdef->f);
+	sdef->io_offset = ftello(sdef->f);
+	sdef->n_io_slots = (sdef->io_depth > 0) ? sdef->io_depth : SORBET_DEFAULT_IO_DEPTH;
+	sdef->io_slots = (io_slot *)calloc(sdef->n_io_slots, sizeof(io_slot));
+	sdef->io = sorbet_io_open(sdef->n_io_slots);
+}
+
+// waits for the writes in flight and hands the file back to stdio at the end of them
+void writer_io_stop(sorbet_def *sdef) {
+	while (sorbet_io_pending(sdef->io) > 0 && writer_io_reap(sdef, true));
+	sorbet_io_close(sdef->io);
+	sdef->io = NULL;
+	for (int i = 0; i < sdef->n_io_slots; i++) {
+		sorbet_buffer_free(&sdef->io_slots[i].buf);
 	}
-	sdef->buf_offset = 0;
+	free(sdef->io_slots);
+	sdef->io_slots = NULL;
+	fseeko(sdef->f, sdef->io_offset, SEEK_SET);
+}
+
+void sorbet_flush_write_buffer_uncompressed(sorbet_def *sdef) {
+	if (sdef->gbuf.size <= 0) return;
+	writer_write(sdef, &sdef->gbuf);
+}
+
+// compresses in into out as one self-contained block
+bool sorbet_compress_block(const sorbet_codec *codec, void *ctx, const sorbet_buffer *in, sorbet_buffer *out) {
+	out->size = 0;
+	sorbet_buffer_reserve(out, codec->bound(ctx, in->size));
+	int64_t size = codec->compress(ctx, in->data, in->size, out->data, out->capacity);
+	if (size < 0) return false;
+	out->size = size;
+	return true;
 }
 
+// compresses the whole write buffer as one block
 void sorbet_flush_write_buffer_compressed(sorbet_def *sdef) {
-	if (sdef->buf_offset <= 0) return;
-	sdef->zstrm.avail_in = sdef->buf_offset;
-	sdef->zstrm.next_in = sdef->buf;
-	do {
-		sdef->zstrm.avail_out = BUF_SIZE;
-		sdef->zstrm.next_out = sdef->zbuf;
-		int ret = deflate(&sdef->zstrm, sdef->zflush);
-		int have = BUF_SIZE - sdef->zstrm.avail_out;
-		size_t written = fwrite(sdef->zbuf, sizeof(uint8_t), have, sdef->f);
-		if (written != have) {
-			printf("ERROR: asked to write %d bytes but wrote %d\n", have, (int)written);
-		}
-	} while (sdef->zstrm.avail_out == 0);
-	if (sdef->zflush == Z_FINISH) {
-		deflateEnd(&sdef->zstrm);
+	if (sdef->gbuf.size <= 0) return;
+	if (!sorbet_compress_block(sdef->codec, sdef->codec_ctx, &sdef->gbuf, &sdef->cbuf)) {
+		printf("ERROR: couldn't compress row group %d\n", sdef->n_groups);
+		sdef->write_failed = true;
+	} else {
+		writer_write(sdef, &sdef->cbuf);
 	}
-	sdef->buf_offset = 0;
+	sdef->gbuf.size = 0;
 }
 
 void sorbet_flush_write_buffer(sorbet_def *sdef) {
-	if (sdef->buf_offset <= 0) return;
-	if (sdef->compression == 0) {
+	if (sdef->gbuf.size <= 0) return;
+	if (sdef->write_failed) {
+		sdef->gbuf.size = 0;
+	} else if (sdef->compression == 0) {
 		sorbet_flush_write_buffer_uncompressed(sdef);
 	} else {
 		sorbet_flush_write_buffer_compressed(sdef);
@@ -50,64 +1472,25 @@ void sorbet_flush_write_buffer(sorbet_def *sdef) {
 }
 
 void sorbet_write_type_tag(sorbet_def *sdef, column_type type) {
-	if ((sdef->buf_offset + 1) > BUF_SIZE) {
-		sorbet_flush_write_buffer(sdef);
-	}
-	uint8_t *tbuf = sdef->buf + sdef->buf_offset;
-	tbuf[0] = column_type_tag[type];
-	sdef->buf_offset += 1;
+	sorbet_buffer_reserve(&sdef->gbuf, 1);
+	sdef->gbuf.data[sdef->gbuf.size] = column_type_tag[type];
+	sdef->gbuf.size += 1;
 	sdef->uc_size += 1;
 }
 
 void sorbet_write_null_type_tag(sorbet_def *sdef, column_type type) {
-	if ((sdef->buf_offset + 1) > BUF_SIZE) {
-		sorbet_flush_write_buffer(sdef);
-	}
-	uint8_t *tbuf = sdef->buf + sdef->buf_offset;
-	tbuf[0] = column_type_null_tag[type];
+	sorbet_buffer_reserve(&sdef->gbuf, 1);
+	sdef->gbuf.data[sdef->gbuf.size] = column_type_null_tag[type];
 	sdef->cstats[sdef->cur_col].cnulls++;
-	sdef->buf_offset += 1;
+	sdef->gbuf.size += 1;
 	sdef->uc_size += 1;
 }
 
 void sorbet_write_bytes_raw(sorbet_def *sdef, const uint8_t *v, int32_t len) {
-	uint8_t *tbuf = sdef->buf + sdef->buf_offset;
-	if ((sdef->buf_offset + len) < BUF_SIZE) {
-		// the whole thing fits in the buffer
-		for (int i=0; i<len; i++) {
-			tbuf[i] = v[i];
-		}
-		sdef->buf_offset += len;
-	} else {
-		// need to span multiple buffers
-		uint8_t *pv = (uint8_t *)v;
-		int plen = len;
-		// copy to the end of the current buffer and flush
-		int remainingLen = BUF_SIZE-sdef->buf_offset;
-		for (int i=0; i<remainingLen; i++) {
-			tbuf[i] = pv[i];
-		}
-		sdef->buf_offset += remainingLen;
-		sorbet_flush_write_buffer(sdef);
-		pv += remainingLen;
-		plen -= remainingLen;
-		// write
-		while (plen > 0) {
-			tbuf = sdef->buf;
-			int bytesToWrite = (plen >= BUF_SIZE) ? BUF_SIZE : plen;
-			for (int i=0; i<bytesToWrite; i++) {
-				tbuf[i] = pv[i];
-			}
-			if (bytesToWrite == BUF_SIZE) {
-				sdef->buf_offset = BUF_SIZE;
-				sorbet_flush_write_buffer(sdef);
-			} else {
-				sdef->buf_offset += bytesToWrite;
-			}
-			pv += bytesToWrite;
-			plen -= bytesToWrite;
-		}
-	}
+	// the buffer holds a whole row group, so it grows rather than flushing
+	sorbet_buffer_reserve(&sdef->gbuf, len);
+	memcpy(sdef->gbuf.data + sdef->gbuf.size, v, len);
+	sdef->gbuf.size += len;
 	sdef->uc_size += len;
 }
 
@@ -151,160 +1534,1109 @@ void sorbet_write_double_raw(sorbet_def *sdef, float64_t v) {
 	sorbet_write_bytes_raw(sdef, uv.bytes, 8);
 }
 
+int sorbet_compare_bytes(const uint8_t *a, int32_t a_len, const uint8_t *b, int32_t b_len) {
+	int c = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+	if (c != 0) return c;
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+// widens a value in its on-disk representation to what a zone keeps
+void sorbet_zone_value(column_type type, const void *v, zone_value *zv) {
+	switch (type) {
+		case INTEGER:
+		case DATE:
+		case TIME: {
+			int32_t i;
+			memcpy(&i, v, 4);
+			zv->longval = i;
+			break;
+		}
+		case LONG:
+		case DATETIME: {
+			memcpy(&zv->longval, v, 8);
+			break;
+		}
+		case BOOLEAN: {
+			zv->longval = *(const uint8_t *)v;
+			break;
+		}
+		case FLOAT: {
+			float32_t f;
+			memcpy(&f, v, 4);
+			zv->doubleval = f;
+			break;
+		}
+		default: {
+			memcpy(&zv->doubleval, v, 8);
+		}
+	}
+}
+
+// adds a value in its on-disk representation to a zone. len is only used by STRING
+// and BINARY
+void sorbet_zone_add(sorbet_zone *z, column_type type, const void *v, int32_t len) {
+	if (type == STRING || type == BINARY) {
+		int32_t plen = (len < SORBET_ZONE_BYTES) ? len : SORBET_ZONE_BYTES;
+		bool first = !z->has_values;
+		if (first || sorbet_compare_bytes(v, plen, z->min.bytes, z->min_len) < 0) {
+			memcpy(z->min.bytes, v, plen);
+			z->min_len = plen;
+		}
+		int c = first ? 1 : sorbet_compare_bytes(v, plen, z->max.bytes, z->max_len);
+		if (c > 0) {
+			memcpy(z->max.bytes, v, plen);
+			z->max_len = plen;
+			z->max_truncated = (len > plen);
+		} else if (c == 0 && len > plen) {
+			z->max_truncated = true;
+		}
+		z->has_values = true;
+		return;
+	}
+	zone_value zv;
+	sorbet_zone_value(type, v, &zv);
+	if (type == FLOAT || type == DOUBLE) {
+		// NaN isn't above or below anything
+		if (isnan(zv.doubleval)) return;
+		if (!z->has_values || zv.doubleval < z->min.doubleval) z->min.doubleval = zv.doubleval;
+		if (!z->has_values || zv.doubleval > z->max.doubleval) z->max.doubleval = zv.doubleval;
+	} else {
+		if (!z->has_values || zv.longval < z->min.longval) z->min.longval = zv.longval;
+		if (!z->has_values || zv.longval > z->max.longval) z->max.longval = zv.longval;
+	}
+	z->has_values = true;
+}
+
+// adds values start..start+n of a batch column to a zone
+void writer_batch_zone(sorbet_zone *z, const sorbet_vector *vec, int64_t start, int64_t n) {
+	int32_t width = column_type_width[vec->type];
+	for (int64_t i = start; i < start + n; i++) {
+		if (vec->validity != NULL && !sorbet_vector_is_valid(vec, i)) {
+			z->n_nulls++;
+		} else if (vec->type == STRING || vec->type == BINARY) {
+			int32_t len;
+			const uint8_t *v = sorbet_vector_bytes(vec, i, &len);
+			sorbet_zone_add(z, vec->type, v, len);
+		} else {
+			sorbet_zone_add(z, vec->type, (uint8_t *)vec->values.ptr + i * width, width);
+		}
+	}
+}
+
+// widens zone a to take in zone b's values
+void sorbet_zone_merge(sorbet_zone *a, const sorbet_zone *b, column_type type) {
+	if (!b->has_values) return;
+	if (type == STRING || type == BINARY) {
+		if (!a->has_values || sorbet_compare_bytes(b->min.bytes, b->min_len, a->min.bytes, a->min_len) < 0) {
+			a->min = b->min;
+			a->min_len = b->min_len;
+		}
+		int c = a->has_values ? sorbet_compare_bytes(b->max.bytes, b->max_len, a->max.bytes, a->max_len) : 1;
+		if (c > 0) {
+			a->max = b->max;
+			a->max_len = b->max_len;
+			a->max_truncated = b->max_truncated;
+		} else if (c == 0) {
+			a->max_truncated |= b->max_truncated;
+		}
+	} else if (type == FLOAT || type == DOUBLE) {
+		if (!a->has_values || b->min.doubleval < a->min.doubleval) a->min.doubleval = b->min.doubleval;
+		if (!a->has_values || b->max.doubleval > a->max.doubleval) a->max.doubleval = b->max.doubleval;
+	} else {
+		if (!a->has_values || b->min.longval < a->min.longval) a->min.longval = b->min.longval;
+		if (!a->has_values || b->max.longval > a->max.longval) a->max.longval = b->max.longval;
+	}
+	a->has_values = true;
+}
+
+// moves the zones of the row group being finished into the index, and adds them to
+// the file's ranges
+void writer_store_zones(sorbet_def *sdef) {
+	int num_cols = sdef->schema.numCols;
+	for (int c = 0; c < num_cols; c++) {
+		sorbet_zone_merge(&sdef->cstats[c].range, &sdef->gzones[c], sdef->schema.cols[c].type);
+	}
+	sdef->zones = (sorbet_zone *)realloc(sdef->zones, sdef->groups_cap * num_cols * sizeof(sorbet_zone));
+	memcpy(&sdef->zones[sdef->n_groups * num_cols], sdef->gzones, num_cols * sizeof(sorbet_zone));
+	memset(sdef->gzones, 0, num_cols * sizeof(sorbet_zone));
+}
+
+// the salts of a split-block Bloom filter: each picks one bit in one 32-bit word of
+// a block, so setting or probing a key is eight independent lanes
+const uint32_t bloom_salts[8] = {
+	0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+	0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+bool sorbet_bloom_fits(column_type type) {
+	return sorbet_is_integer_type(type) || type == STRING || type == BINARY;
+}
+
+// the murmur3 finalizer: every bit of h affects every bit of the result
+uint64_t sorbet_mix64(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t sorbet_hash64(const uint8_t *v, int32_t len) {
+	// FNV-1a, then mixed so the high bits (which pick the block) depend on every byte
+	uint64_t h = 14695981039346656037ull;
+	for (int32_t i = 0; i < len; i++) {
+		h = (h ^ v[i]) * 1099511628211ull;
+	}
+	return sorbet_mix64(h);
+}
+
+// hashes a value in its on-disk representation. integer-valued types are widened
+// first so readers can hash a predicate's value the same way
+uint64_t sorbet_bloom_hash(column_type type, const void *v, int32_t len) {
+	if (type == STRING || type == BINARY) return sorbet_hash64((const uint8_t *)v, len);
+	zone_value zv;
+	sorbet_zone_value(type, v, &zv);
+	return sorbet_hash64((const uint8_t *)&zv.longval, sizeof(int64_t));
+}
+
+// the filter's n_blocks blocks of 8 words each
+void sorbet_bloom_insert(uint32_t *words, uint32_t n_blocks, uint64_t h) {
+	uint32_t *block = words + (((h >> 32) * n_blocks) >> 32) * 8;
+	uint32_t key = (uint32_t)h;
+	for (int i = 0; i < 8; i++) {
+		block[i] |= 1u << ((key * bloom_salts[i]) >> 27);
+	}
+}
+
+bool sorbet_bloom_check(const uint32_t *words, uint32_t n_blocks, uint64_t h) {
+	const uint32_t *block = words + (((h >> 32) * n_blocks) >> 32) * 8;
+	uint32_t key = (uint32_t)h;
+	uint32_t miss = 0;
+	// no early exit, so the eight lanes compile to a few vector instructions
+	for (int i = 0; i < 8; i++) {
+		miss |= ~block[i] & (1u << ((key * bloom_salts[i]) >> 27));
+	}
+	return miss == 0;
+}
+
+// true if the writer keeps a Bloom filter for column col
+bool writer_bloom_column(const sorbet_def *sdef, int col) {
+	return sdef->ghashes != NULL && sdef->bloom_filters[col] && sorbet_bloom_fits(sdef->schema.cols[col].type);
+}
+
+// adds the hashes of values start..start+n of a batch column
+void writer_batch_bloom(sorbet_buffer *hashes, const sorbet_vector *vec, int64_t start, int64_t n) {
+	int32_t width = column_type_width[vec->type];
+	sorbet_buffer_reserve(hashes, n * sizeof(uint64_t));
+	for (int64_t i = start; i < start + n; i++) {
+		if (vec->validity != NULL && !sorbet_vector_is_valid(vec, i)) continue;
+		uint64_t h;
+		if (vec->type == STRING || vec->type == BINARY) {
+			int32_t len;
+			const uint8_t *v = sorbet_vector_bytes(vec, i, &len);
+			h = sorbet_bloom_hash(vec->type, v, len);
+		} else {
+			h = sorbet_bloom_hash(vec->type, (uint8_t *)vec->values.ptr + i * width, width);
+		}
+		sorbet_buffer_append(hashes, &h, sizeof(uint64_t));
+	}
+}
+
+int compare_hashes(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// builds the filters of the row group being finished from the hashes of its values,
+// sized for the number of distinct ones, and adds them to the footer's section
+void writer_store_blooms(sorbet_def *sdef) {
+	if (sdef->ghashes == NULL) return;
+	int32_t bits = (sdef->bloom_bits > 0) ? sdef->bloom_bits : SORBET_DEFAULT_BLOOM_BITS;
+	for (int c = 0; c < sdef->schema.numCols; c++) {
+		sorbet_buffer *hb = &sdef->ghashes[c];
+		int64_t n = hb->size / sizeof(uint64_t);
+		if (n == 0) continue;
+		uint64_t *hashes = (uint64_t *)hb->data;
+		qsort(hashes, n, sizeof(uint64_t), compare_hashes);
+		int64_t n_distinct = 1;
+		for (int64_t i = 1; i < n; i++) {
+			if (hashes[i] != hashes[n_distinct - 1]) hashes[n_distinct++] = hashes[i];
+		}
+		uint32_t n_blocks = (uint32_t)((n_distinct * bits + 255) / 256);
+		size_t n_bytes = (size_t)n_blocks * 8 * sizeof(uint32_t);
+		uint32_t head[3] = {(uint32_t)sdef->n_groups, (uint32_t)c, n_blocks};
+		sorbet_buffer_append(&sdef->blooms, head, sizeof(head));
+		sorbet_buffer_reserve(&sdef->blooms, n_bytes);
+		uint32_t *words = (uint32_t *)(sdef->blooms.data + sdef->blooms.size);
+		memset(words, 0, n_bytes);
+		for (int64_t i = 0; i < n_distinct; i++) {
+			sorbet_bloom_insert(words, n_blocks, hashes[i]);
+		}
+		sdef->blooms.size += n_bytes;
+		hb->size = 0;
+	}
+}
+
+// points at entry i of a vector in its on-disk representation
+const void *sorbet_vector_value(const sorbet_vector *vec, int64_t i, int32_t *len) {
+	if (vec->type == STRING || vec->type == BINARY) return sorbet_vector_bytes(vec, i, len);
+	*len = column_type_width[vec->type];
+	return (const uint8_t *)vec->values.ptr + i * *len;
+}
+
+// compares two values of a column in their on-disk representation
+int sorbet_compare_raw(column_type type, const void *a, int32_t a_len, const void *b, int32_t b_len) {
+	if (type == STRING || type == BINARY) return sorbet_compare_bytes(a, a_len, b, b_len);
+	zone_value x, y;
+	sorbet_zone_value(type, a, &x);
+	sorbet_zone_value(type, b, &y);
+	if (type == FLOAT || type == DOUBLE) return (x.doubleval > y.doubleval) - (x.doubleval < y.doubleval);
+	return (x.longval > y.longval) - (x.longval < y.longval);
+}
+
+// true if a value of the sort column (NULL for a null) can follow prev, the last
+// value that wasn't null (NULL before the first one). nulls come first
+bool writer_key_follows(const sorbet_def *sdef, const void *v, int32_t len, const void *prev, int32_t prev_len) {
+	if (prev == NULL) return true;
+	return v != NULL && sorbet_compare_raw(sdef->key_index->type, v, len, prev, prev_len) >= 0;
+}
+
+// the rows aren't sorted, so the file goes without a key index
+void writer_drop_keys(sorbet_def *sdef, uint64_t row) {
+	printf("ERROR: the rows aren't sorted on column %d (row %ld). writing the file without a key index\n", sdef->sort_column, (long)row);
+	sorbet_vector_free(sdef->key_index);
+	free(sdef->key_index);
+	sdef->key_index = NULL;
+}
+
+// adds a sample of the sort column (NULL for a null) to the key index
+void writer_add_key(sorbet_def *sdef, const void *v, int32_t len) {
+	if (v == NULL) {
+		sorbet_vector_append_null(sdef->key_index);
+	} else {
+		sorbet_vector_append(sdef->key_index, v, len);
+	}
+}
+
+// checks the current value (NULL for a null) follows the one before it when it's in
+// the sort column, and adds it to the key index every key_interval rows
+void writer_key_value(sorbet_def *sdef, const void *v, int32_t len) {
+	if (sdef->key_index == NULL || sdef->cur_col != sdef->sort_column) return;
+	const void *prev = sdef->key_seen ? sdef->last_key.data : NULL;
+	if (!writer_key_follows(sdef, v, len, prev, sdef->last_key.size)) {
+		writer_drop_keys(sdef, sdef->n_rows);
+		return;
+	}
+	if (v != NULL) {
+		sdef->last_key.size = 0;
+		sorbet_buffer_append(&sdef->last_key, v, len);
+		sdef->key_seen = true;
+	}
+	if (sdef->n_rows % sdef->key_interval == 0) {
+		writer_add_key(sdef, v, len);
+	}
+}
+
+// checks rows start..start+n of a batch's sort column are in order, and adds the
+// samples among them
+void writer_batch_keys(sorbet_def *sdef, const sorbet_vector *vec, int64_t start, int64_t n) {
+	const void *prev = sdef->key_seen ? sdef->last_key.data : NULL;
+	int32_t prev_len = sdef->last_key.size;
+	bool moved = false;
+	for (int64_t i = start; i < start + n; i++) {
+		uint64_t row = sdef->n_rows + (i - start);
+		const void *v = NULL;
+		int32_t len = 0;
+		if (vec->validity == NULL || sorbet_vector_is_valid(vec, i)) {
+			v = sorbet_vector_value(vec, i, &len);
+		}
+		if (!writer_key_follows(sdef, v, len, prev, prev_len)) {
+			writer_drop_keys(sdef, row);
+			return;
+		}
+		if (v != NULL) {
+			prev = v;
+			prev_len = len;
+			moved = true;
+		}
+		if (row % sdef->key_interval == 0) {
+			writer_add_key(sdef, v, len);
+		}
+	}
+	// the batch's last value is checked against the next one written
+	if (moved) {
+		sdef->last_key.size = 0;
+		sorbet_buffer_append(&sdef->last_key, prev, prev_len);
+		sdef->key_seen = true;
+	}
+}
+
+// adds a value's hash to a HyperLogLog sketch: the top bits pick the register, which
+// keeps the longest run of leading zeros seen in the rest
+void sorbet_hll_add(uint8_t *hll, int32_t precision, uint64_t h) {
+	uint64_t idx = h >> (64 - precision);
+	uint8_t rank = __builtin_clzll((h << precision) | (1ull << (precision - 1))) + 1;
+	if (rank > hll[idx]) hll[idx] = rank;
+}
+
+sorbet_quantiles *sorbet_quantiles_new(int32_t k) {
+	sorbet_quantiles *q = (sorbet_quantiles *)calloc(1, sizeof(sorbet_quantiles));
+	q->k = k;
+	return q;
+}
+
+void sorbet_quantiles_free(sorbet_quantiles *q) {
+	if (q == NULL) return;
+	free(q->sizes);
+	free(q->items);
+	free(q);
+}
+
+void sorbet_quantiles_grow(sorbet_quantiles *q) {
+	q->n_levels++;
+	q->sizes = (int32_t *)realloc(q->sizes, q->n_levels * sizeof(int32_t));
+	q->items = (float64_t *)realloc(q->items, (int64_t)q->n_levels * q->k * sizeof(float64_t));
+	q->sizes[q->n_levels - 1] = 0;
+}
+
+int compare_doubles(const void *a, const void *b) {
+	float64_t x = *(const float64_t *)a;
+	float64_t y = *(const float64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// moves every other value of full level l up a level, alternating between the odd
+// and even ones so the errors cancel out
+void sorbet_quantiles_compact(sorbet_quantiles *q, int32_t l) {
+	if (l + 1 == q->n_levels) sorbet_quantiles_grow(q);
+	float64_t *level = q->items + (int64_t)l * q->k;
+	float64_t *up = q->items + (int64_t)(l + 1) * q->k;
+	qsort(level, q->sizes[l], sizeof(float64_t), compare_doubles);
+	for (int32_t j = (q->flips++ & 1); j < q->sizes[l]; j += 2) {
+		up[q->sizes[l + 1]++] = level[j];
+	}
+	q->sizes[l] = 0;
+	if (q->sizes[l + 1] >= q->k) sorbet_quantiles_compact(q, l + 1);
+}
+
+void sorbet_quantiles_add(sorbet_quantiles *q, float64_t v) {
+	if (q->n_levels == 0) sorbet_quantiles_grow(q);
+	q->items[q->sizes[0]++] = v;
+	if (q->sizes[0] == q->k) sorbet_quantiles_compact(q, 0);
+}
+
+// adds a non-null value in its on-disk representation to a column's stats. the
+// range comes from the zones when each row group is finished
+void sorbet_stats_add(column_stats *st, column_type type, const void *v, int32_t len) {
+	st->count++;
+	if (type == STRING || type == BINARY) {
+		if (len > st->cwidth) st->cwidth = len;
+		if (st->hll != NULL) sorbet_hll_add(st->hll, st->hll_precision, sorbet_hash64(v, len));
+		return;
+	}
+	zone_value zv;
+	sorbet_zone_value(type, v, &zv);
+	if (type == FLOAT || type == DOUBLE) {
+		st->sum.doubleval += zv.doubleval;
+		if (st->quantiles != NULL && !isnan(zv.doubleval)) sorbet_quantiles_add(st->quantiles, zv.doubleval);
+	} else {
+		st->sum.longval = (int64_t)((uint64_t)st->sum.longval + (uint64_t)zv.longval);
+		if (st->quantiles != NULL) sorbet_quantiles_add(st->quantiles, (float64_t)zv.longval);
+	}
+	// fixed-width values only need mixing, not a byte-at-a-time hash
+	if (st->hll != NULL) sorbet_hll_add(st->hll, st->hll_precision, sorbet_mix64(zv.longval));
+}
+
+void free_column_stats(sorbet_def *sdef) {
+	for (int i = 0; i < sdef->schema.numCols && sdef->cstats != NULL; i++) {
+		free(sdef->cstats[i].hll);
+		sorbet_quantiles_free(sdef->cstats[i].quantiles);
+	}
+	free(sdef->cstats);
+	sdef->cstats = NULL;
+}
+
+// writes a value of the current column in its on-disk representation: a tagged
+// value in the ROW layout, or an entry in the column's vector in the COLUMNAR layout.
+// len is the value's width, or its length for STRING and BINARY.
+void sorbet_write_value(sorbet_def *sdef, column_type type, const void *v, int32_t len) {
+	sorbet_zone_add(&sdef->gzones[sdef->cur_col], type, v, len);
+	sorbet_stats_add(&sdef->cstats[sdef->cur_col], type, v, len);
+	if (writer_bloom_column(sdef, sdef->cur_col)) {
+		uint64_t h = sorbet_bloom_hash(type, v, len);
+		sorbet_buffer_append(&sdef->ghashes[sdef->cur_col], &h, sizeof(uint64_t));
+	}
+	writer_key_value(sdef, v, len);
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		sorbet_vector_append(&sdef->gcols[sdef->cur_col], v, len);
+		return;
+	}
+	sorbet_write_type_tag(sdef, type);
+	if (type == STRING || type == BINARY) {
+		sorbet_write_int_raw(sdef, len);
+	}
+	sorbet_write_bytes_raw(sdef, v, len);
+}
+
+void sorbet_write_null(sorbet_def *sdef, column_type type) {
+	sdef->gzones[sdef->cur_col].n_nulls++;
+	writer_key_value(sdef, NULL, 0);
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		sdef->cstats[sdef->cur_col].cnulls++;
+		sorbet_vector_append_null(&sdef->gcols[sdef->cur_col]);
+		return;
+	}
+	sorbet_write_null_type_tag(sdef, type);
+}
+
+// makes room in the chunk index for every row group the group index has room for
+void writer_reserve_chunks(sorbet_def *sdef) {
+	sdef->chunks = (sorbet_column_chunk *)realloc(sdef->chunks, sdef->groups_cap * sdef->schema.numCols * sizeof(sorbet_column_chunk));
+}
+
+// a block for the compression workers: a whole row group in the ROW layout, or one
+// column chunk (col >= 0) in the COLUMNAR layout
+typedef struct s_sorbet_job {
+	sorbet_buffer in;
+	sorbet_buffer out;
+	int32_t group;
+	int32_t col;
+	bool done;
+	bool failed;
+} sorbet_job;
+
+// the writer's compression workers. jobs is a ring: jobs from head to next are
+// being compressed or are done, jobs from next to tail are waiting for a worker.
+// only the writer's thread writes jobs out, always starting at head, so the file
+// comes out the same whatever order the workers finish in.
+struct s_sorbet_pool {
+	pthread_t *threads;
+	int32_t n_threads;
+	sorbet_job *jobs;
+	int32_t n_jobs;
+	int64_t head;
+	int64_t next;
+	int64_t tail;
+	bool stop;
+	const sorbet_def *sdef;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+};
+
+void *sorbet_pool_worker(void *arg) {
+	sorbet_pool *pool = (sorbet_pool *)arg;
+	const sorbet_codec *codec = pool->sdef->codec;
+	void *ctx = codec->open(pool->sdef, true);
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->stop && pool->next == pool->tail) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+		if (pool->next == pool->tail) break;
+		sorbet_job *job = &pool->jobs[pool->next % pool->n_jobs];
+		pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		bool failed = (ctx == NULL || !sorbet_compress_block(codec, ctx, &job->in, &job->out));
+		pthread_mutex_lock(&pool->lock);
+		job->failed = failed;
+		job->done = true;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (ctx != NULL) {
+		codec->close(ctx, true);
+	}
+	return NULL;
+}
+
+void sorbet_pool_start(sorbet_def *sdef) {
+	sorbet_pool *pool = (sorbet_pool *)calloc(1, sizeof(sorbet_pool));
+	pool->n_threads = sdef->n_threads;
+	pool->sdef = sdef;
+	// enough queued jobs to keep every worker busy while the writer fills the next
+	// row group, without buffering the whole file
+	pool->n_jobs = sdef->n_threads * 2;
+	pool->jobs = (sorbet_job *)calloc(pool->n_jobs, sizeof(sorbet_job));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->threads = (pthread_t *)malloc(pool->n_threads * sizeof(pthread_t));
+	for (int i = 0; i < pool->n_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, sorbet_pool_worker, pool) != 0) {
+			printf("ERROR: couldn't start compression thread %d\n", i);
+			pool->n_threads = i;
+			break;
+		}
+	}
+	if (pool->n_threads == 0) {
+		// compress on the writer's thread after all
+		free(pool->threads);
+		free(pool->jobs);
+		free(pool);
+		return;
+	}
+	sdef->pool = pool;
+}
+
+// waits for the oldest job to be compressed, then writes it and records where it went
+void sorbet_pool_write_oldest(sorbet_def *sdef) {
+	sorbet_pool *pool = sdef->pool;
+	sorbet_job *job = &pool->jobs[pool->head % pool->n_jobs];
+	pthread_mutex_lock(&pool->lock);
+	while (!job->done) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	pool->head++;
+	if (job->failed && !sdef->write_failed) {
+		printf("ERROR: couldn't compress row group %d\n", job->group);
+		sdef->write_failed = true;
+	}
+	if (sdef->write_failed) return;
+	uint64_t offset = writer_tell(sdef);
+	uint64_t size = job->out.size;
+	if (!writer_write(sdef, &job->out)) return;
+	sorbet_row_group *rg = &sdef->groups[job->group];
+	if (job->col <= 0) {
+		rg->offset = offset;
+	}
+	if (job->col >= 0) {
+		sorbet_column_chunk *chunk = &sdef->chunks[job->group * sdef->schema.numCols + job->col];
+		chunk->offset = offset;
+		chunk->c_len = size;
+	}
+	rg->c_len = offset + size - rg->offset;
+}
+
+// writes out jobs that are done, oldest first. with wait set it writes all of them
+void sorbet_pool_drain(sorbet_def *sdef, bool wait) {
+	sorbet_pool *pool = sdef->pool;
+	while (pool->head < pool->tail) {
+		if (!wait) {
+			pthread_mutex_lock(&pool->lock);
+			bool done = pool->jobs[pool->head % pool->n_jobs].done;
+			pthread_mutex_unlock(&pool->lock);
+			if (!done) break;
+		}
+		sorbet_pool_write_oldest(sdef);
+	}
+}
+
+// a free job to fill, writing out the oldest one first if they are all in use
+sorbet_job *sorbet_pool_next_job(sorbet_def *sdef, int32_t group, int32_t col) {
+	sorbet_pool *pool = sdef->pool;
+	if (pool->tail - pool->head == pool->n_jobs) {
+		sorbet_pool_write_oldest(sdef);
+	}
+	sorbet_job *job = &pool->jobs[pool->tail % pool->n_jobs];
+	job->group = group;
+	job->col = col;
+	job->done = false;
+	job->failed = false;
+	job->in.size = 0;
+	return job;
+}
+
+void sorbet_pool_submit(sorbet_pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->tail++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void sorbet_pool_stop(sorbet_def *sdef) {
+	sorbet_pool *pool = sdef->pool;
+	sorbet_pool_drain(sdef, true);
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->n_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	for (int i = 0; i < pool->n_jobs; i++) {
+		sorbet_buffer_free(&pool->jobs[i].in);
+		sorbet_buffer_free(&pool->jobs[i].out);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool->jobs);
+	free(pool);
+	sdef->pool = NULL;
+}
+
+// hands the buffered row group to the compression workers. its offsets and
+// compressed lengths are filled in when its blocks are written out
+void sorbet_pool_submit_group(sorbet_def *sdef, int32_t g) {
+	sorbet_row_group *rg = &sdef->groups[g];
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		int num_cols = sdef->schema.numCols;
+		writer_reserve_chunks(sdef);
+		rg->u_len = 0;
+		for (int i = 0; i < num_cols; i++) {
+			sorbet_job *job = sorbet_pool_next_job(sdef, g, i);
+			sorbet_column_chunk *chunk = &sdef->chunks[g * num_cols + i];
+			chunk->encoding = sorbet_encode_chunk(sdef, i, &sdef->gcols[i], &job->in);
+			chunk->u_len = job->in.size;
+			sdef->uc_size += job->in.size;
+			rg->u_len += job->in.size;
+			sorbet_vector_clear(&sdef->gcols[i]);
+			sorbet_pool_submit(sdef->pool);
+		}
+	} else {
+		// the job takes the row group buffer and the writer carries on with the
+		// job's old one
+		sorbet_job *job = sorbet_pool_next_job(sdef, g, -1);
+		sorbet_buffer b = job->in;
+		job->in = sdef->gbuf;
+		sdef->gbuf = b;
+		sdef->gbuf.size = 0;
+		rg->u_len = job->in.size;
+		sorbet_pool_submit(sdef->pool);
+	}
+	sorbet_pool_drain(sdef, false);
+}
+
+// encodes and writes each column of the buffered row group as its own chunk
+void sorbet_write_column_chunks(sorbet_def *sdef, sorbet_row_group *rg) {
+	int num_cols = sdef->schema.numCols;
+	writer_reserve_chunks(sdef);
+	sorbet_column_chunk *chunks = &sdef->chunks[sdef->n_groups * num_cols];
+	rg->u_len = 0;
+	for (int i = 0; i < num_cols; i++) {
+		sorbet_vector *vec = &sdef->gcols[i];
+		chunks[i].offset = writer_tell(sdef);
+		chunks[i].encoding = sorbet_encode_chunk(sdef, i, vec, &sdef->gbuf);
+		chunks[i].u_len = sdef->gbuf.size;
+		sdef->uc_size += sdef->gbuf.size;
+		rg->u_len += sdef->gbuf.size;
+		sorbet_flush_write_buffer(sdef);
+		chunks[i].c_len = writer_tell(sdef) - chunks[i].offset;
+		sorbet_vector_clear(vec);
+	}
+}
+
+// SORBET_ADVICE_NOREUSE: starts writing back what has been written since the last
+// row group, and drops what was written before that from the page cache. dirty
+// pages can't be dropped, so each range gets a row group's time to reach the disk.
+void writer_drop_behind(sorbet_def *sdef) {
+	if (sdef->advice != SORBET_ADVICE_NOREUSE) return;
+	int fd = fileno(sdef->f);
+	if (sdef->io == NULL) {
+		fflush(sdef->f);
+	}
+	uint64_t end = writer_tell(sdef);
+	if (sdef->flushing_to > sdef->dropped_to) {
+		uint64_t len = sdef->flushing_to - sdef->dropped_to;
+		sync_file_range(fd, sdef->dropped_to, len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, sdef->dropped_to, len, POSIX_FADV_DONTNEED);
+		sdef->dropped_to = sdef->flushing_to;
+	}
+	if (end > sdef->flushing_to) {
+		sync_file_range(fd, sdef->flushing_to, end - sdef->flushing_to, SYNC_FILE_RANGE_WRITE);
+		sdef->flushing_to = end;
+	}
+}
+
+// once a block has failed nothing more goes in the file, so the buffered row group
+// is dropped
+void writer_drop_row_group(sorbet_def *sdef) {
+	int num_cols = sdef->schema.numCols;
+	sdef->gbuf.size = 0;
+	for (int i = 0; i < num_cols; i++) {
+		if (sdef->layout == SORBET_LAYOUT_COLUMNAR) sorbet_vector_clear(&sdef->gcols[i]);
+		if (sdef->ghashes != NULL) sdef->ghashes[i].size = 0;
+	}
+	memset(sdef->gzones, 0, num_cols * sizeof(sorbet_zone));
+	sdef->group_rows = 0;
+}
+
+// writes the buffered row group to the file and records it in the index
+void sorbet_finish_row_group(sorbet_def *sdef) {
+	if (sdef->group_rows == 0) return;
+	if (sdef->write_failed) {
+		writer_drop_row_group(sdef);
+		return;
+	}
+	if (sdef->n_groups >= sdef->groups_cap) {
+		sdef->groups_cap = (sdef->groups_cap > 0) ? sdef->groups_cap * 2 : 64;
+		sdef->groups = (sorbet_row_group *)realloc(sdef->groups, sdef->groups_cap * sizeof(sorbet_row_group));
+	}
+	sorbet_row_group *rg = &sdef->groups[sdef->n_groups];
+	rg->first_row = sdef->n_rows - sdef->group_rows;
+	rg->n_rows = sdef->group_rows;
+	writer_store_zones(sdef);
+	writer_store_blooms(sdef);
+	if (sdef->pool != NULL) {
+		sorbet_pool_submit_group(sdef, sdef->n_groups);
+		sdef->n_groups++;
+		sdef->group_rows = 0;
+		writer_drop_behind(sdef);
+		return;
+	}
+	rg->offset = writer_tell(sdef);
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		sorbet_write_column_chunks(sdef, rg);
+	} else {
+		rg->u_len = sdef->gbuf.size;
+		sorbet_flush_write_buffer(sdef);
+	}
+	rg->c_len = writer_tell(sdef) - rg->offset;
+	sdef->n_groups++;
+	sdef->group_rows = 0;
+	writer_drop_behind(sdef);
+}
+
 void writer_inc_col(sorbet_def *sdef) {
 	sdef->cur_col++;
 	if (sdef->cur_col >= sdef->schema.numCols) {
 		sdef->cur_col = 0;
 		sdef->n_rows++;
+		sdef->group_rows++;
+		if (sdef->group_rows >= sdef->row_group_size) {
+			sorbet_finish_row_group(sdef);
+		}
 	}
 }
 
 void sorbet_write_int(sorbet_def *sdef, const int32_t *v) {
 	if (v != NULL) {
-		if (abs(*v) > sdef->cstats[sdef->cur_col].max_int) sdef->cstats[sdef->cur_col].max_int = *v;
-		sorbet_write_type_tag(sdef, column_type_tag[INTEGER]);
-		sorbet_write_int_raw(sdef, *v);
+		sorbet_write_value(sdef, INTEGER, v, 4);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[INTEGER]);
+		sorbet_write_null(sdef, INTEGER);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_long(sorbet_def *sdef, const int64_t *v) {
 	if (v != NULL) {
-		if (labs(*v) > sdef->cstats[sdef->cur_col].max_long) sdef->cstats[sdef->cur_col].max_long = *v;
-		sorbet_write_type_tag(sdef, column_type_tag[LONG]);
-		sorbet_write_long_raw(sdef, *v);
+		sorbet_write_value(sdef, LONG, v, 8);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[LONG]);
+		sorbet_write_null(sdef, LONG);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_float(sorbet_def *sdef, const float32_t *v) {
 	if (v != NULL) {
-		if (fabsf(*v) > sdef->cstats[sdef->cur_col].max_float) sdef->cstats[sdef->cur_col].max_float = *v;
-		sorbet_write_type_tag(sdef, column_type_tag[FLOAT]);
-		sorbet_write_float_raw(sdef, *v);
+		sorbet_write_value(sdef, FLOAT, v, 4);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[FLOAT]);
+		sorbet_write_null(sdef, FLOAT);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_double(sorbet_def *sdef, const float64_t *v) {
 	if (v != NULL) {
-		if (fabs(*v) > sdef->cstats[sdef->cur_col].max_double) sdef->cstats[sdef->cur_col].max_double = *v;
-		sorbet_write_type_tag(sdef, column_type_tag[DOUBLE]);
-		sorbet_write_double_raw(sdef, *v);
+		sorbet_write_value(sdef, DOUBLE, v, 8);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[DOUBLE]);
+		sorbet_write_null(sdef, DOUBLE);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_boolean(sorbet_def *sdef, const bool *v) {
 	if (v != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[BOOLEAN]);
 		uint8_t bv = (*v) ? 1 : 0;
-		sorbet_write_byte_raw(sdef, bv);
+		sorbet_write_value(sdef, BOOLEAN, &bv, 1);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[BOOLEAN]);
+		sorbet_write_null(sdef, BOOLEAN);
 	}
 	writer_inc_col(sdef);
 }
 
-void sorbet_write_string(sorbet_def *sdef, const uint8_t *v, int32_t len) {
+bool sorbet_write_string(sorbet_def *sdef, const uint8_t *v, int32_t len) {
+	if (v != NULL && sdef->utf8_policy != SORBET_UTF8_UNCHECKED && !utf8_valid(v, len)) {
+		if (sdef->utf8_policy == SORBET_UTF8_REJECT) return false;
+		sdef->cstats[sdef->cur_col].cbads++;
+		if (sdef->utf8_policy == SORBET_UTF8_NULL) v = NULL;
+	}
 	if (v != NULL) {
-		if (len > sdef->cstats[sdef->cur_col].cwidth) sdef->cstats[sdef->cur_col].cwidth = len;
-		sorbet_write_type_tag(sdef, column_type_tag[STRING]);
-		sorbet_write_int_raw(sdef, len);
-		sorbet_write_bytes_raw(sdef, v, len);
+		sorbet_write_value(sdef, STRING, v, len);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[STRING]);
+		sorbet_write_null(sdef, STRING);
 	}
 	writer_inc_col(sdef);
+	return true;
 }
 
 void sorbet_write_binary(sorbet_def *sdef, const uint8_t *v, int32_t len) {
 	if (v != NULL) {
-		if (len > sdef->cstats[sdef->cur_col].cwidth) sdef->cstats[sdef->cur_col].cwidth = len;
-		sorbet_write_type_tag(sdef, column_type_tag[BINARY]);
-		sorbet_write_int_raw(sdef, len);
-		sorbet_write_bytes_raw(sdef, v, len);
+		sorbet_write_value(sdef, BINARY, v, len);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[BINARY]);
+		sorbet_write_null(sdef, BINARY);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_date(sorbet_def *sdef, const sorbet_date *v) {
 	if (v != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[DATE]);
 		int32_t dt = (v->y * 10000) + (v->m * 100) + (v->d);
-		sorbet_write_int_raw(sdef, dt);
+		sorbet_write_value(sdef, DATE, &dt, 4);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[DATE]);
+		sorbet_write_null(sdef, DATE);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_date_time_t(sorbet_def *sdef, const time_t *v) {
 	if (v != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[DATE]);
 		struct tm *ltime = localtime(v);
 		int32_t dt = (ltime->tm_year * 10000) + ((ltime->tm_mon+1) * 100) + (ltime->tm_mday);
-		sorbet_write_int_raw(sdef, dt);
+		sorbet_write_value(sdef, DATE, &dt, 4);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[DATE]);
+		sorbet_write_null(sdef, DATE);
 	}
 	writer_inc_col(sdef);
 }
 
 void sorbet_write_datetime(sorbet_def *sdef, const int64_t *dt) {
 	if (dt != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[DATETIME]);
-		sorbet_write_long_raw(sdef, *dt);
+		sorbet_write_value(sdef, DATETIME, dt, 8);
+	} else {
+		sorbet_write_null(sdef, DATETIME);
+	}
+	writer_inc_col(sdef);
+}
+
+void sorbet_write_datetime_time_t(sorbet_def *sdef, const time_t *dt) {
+	if (dt != NULL) {
+		int64_t v = (int64_t )*dt;
+		sorbet_write_value(sdef, DATETIME, &v, 8);
+	} else {
+		sorbet_write_null(sdef, DATETIME);
+	}
+	writer_inc_col(sdef);
+}
+
+void sorbet_write_time(sorbet_def *sdef, const sorbet_time *v) {
+	if (v != NULL) {
+		int32_t dt = (v->h * 10000) + (v->m * 100) + (v->s);
+		sorbet_write_value(sdef, TIME, &dt, 4);
+	} else {
+		sorbet_write_null(sdef, TIME);
+	}
+	writer_inc_col(sdef);
+}
+
+void sorbet_write_time_time_t(sorbet_def *sdef, const time_t *v) {
+	if (v != NULL) {
+		struct tm *ltime = localtime(v);
+		int32_t dt = (ltime->tm_hour * 10000) + (ltime->tm_min * 100) + (ltime->tm_sec);
+		sorbet_write_value(sdef, TIME, &dt, 4);
 	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[DATETIME]);
+		sorbet_write_null(sdef, TIME);
+	}
+	writer_inc_col(sdef);
+}
+
+// updates a column's stats with values start..start+n of a batch column
+void writer_batch_stats(column_stats *stats, const sorbet_vector *vec, int64_t start, int64_t n) {
+	for (int64_t i = start; i < start + n; i++) {
+		if (vec->validity != NULL && !sorbet_vector_is_valid(vec, i)) {
+			stats->cnulls++;
+			continue;
+		}
+		int32_t len;
+		const void *v = sorbet_vector_value(vec, i, &len);
+		sorbet_stats_add(stats, vec->type, v, len);
+	}
+}
+
+// appends rows start..start+n of a batch to the buffered row group as tagged
+// values (ROW layout), sizing the buffer for all of them up front
+void writer_batch_rows(sorbet_def *sdef, const sorbet_batch *batch, int64_t start, int64_t n) {
+	int num_cols = sdef->schema.numCols;
+	size_t len = 0;
+	for (int c = 0; c < num_cols; c++) {
+		const sorbet_vector *vec = &batch->cols[c];
+		if (vec->dictionary != NULL) {
+			for (int64_t i = start; i < start + n; i++) {
+				int32_t vlen;
+				sorbet_vector_bytes(vec, i, &vlen);
+				len += 5 + vlen;
+			}
+		} else if (vec->type == STRING || vec->type == BINARY) {
+			len += n * 5 + (vec->offsets[start + n] - vec->offsets[start]);
+		} else {
+			len += n * (1 + column_type_width[vec->type]);
+		}
+	}
+	sorbet_buffer *b = &sdef->gbuf;
+	sorbet_buffer_reserve(b, len);
+	size_t begin = b->size;
+	for (int64_t i = start; i < start + n; i++) {
+		for (int c = 0; c < num_cols; c++) {
+			const sorbet_vector *vec = &batch->cols[c];
+			if (vec->validity != NULL && !sorbet_vector_is_valid(vec, i)) {
+				b->data[b->size++] = column_type_null_tag[vec->type];
+				continue;
+			}
+			b->data[b->size++] = column_type_tag[vec->type];
+			if (vec->type == STRING || vec->type == BINARY) {
+				int32_t vlen;
+				const uint8_t *v = sorbet_vector_bytes(vec, i, &vlen);
+				memcpy(b->data + b->size, &vlen, 4);
+				memcpy(b->data + b->size + 4, v, vlen);
+				b->size += 4 + vlen;
+			} else {
+				int32_t width = column_type_width[vec->type];
+				memcpy(b->data + b->size, (uint8_t *)vec->values.ptr + i * width, width);
+				b->size += width;
+			}
+		}
 	}
-	writer_inc_col(sdef);
+	sdef->uc_size += b->size - begin;
 }
 
-void sorbet_write_datetime_time_t(sorbet_def *sdef, const time_t *dt) {
-	if (dt != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[DATETIME]);
-		sorbet_write_long_raw(sdef, (int64_t )*dt);
-	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[DATETIME]);
+// true if every value of the first n of a STRING vector is valid UTF-8. the bytes of
+// all the values are checked in one pass, which is enough when none of the values
+// starts in the middle of a character
+bool sorbet_vector_utf8_valid(const sorbet_vector *vec, int64_t n) {
+	if (vec->dictionary != NULL) return sorbet_vector_utf8_valid(vec->dictionary, vec->dictionary->length);
+	if (n == 0) return true;
+	for (int64_t i = 0; i < n; i++) {
+		if (vec->offsets[i + 1] > vec->offsets[i] && (vec->data[vec->offsets[i]] & 0xc0) == 0x80) return false;
 	}
-	writer_inc_col(sdef);
+	return utf8_valid(vec->data + vec->offsets[0], vec->offsets[n] - vec->offsets[0]);
 }
 
-void sorbet_write_time(sorbet_def *sdef, const sorbet_time *v) {
-	if (v != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[TIME]);
-		int32_t dt = (v->h * 10000) + (v->m * 100) + (v->s);
-		sorbet_write_int_raw(sdef, dt);
-	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[TIME]);
+// counts the values of the first n of a STRING vector that aren't valid UTF-8. with
+// fixed set it gets a copy of the vector with them nulled out
+int64_t writer_check_utf8(const sorbet_vector *vec, int64_t n, sorbet_vector *fixed) {
+	if (sorbet_vector_utf8_valid(vec, n)) return 0;
+	int64_t bad = 0;
+	for (int64_t i = 0; i < n; i++) {
+		bool valid = vec->validity == NULL || sorbet_vector_is_valid(vec, i);
+		int32_t len = 0;
+		const uint8_t *v = valid ? sorbet_vector_bytes(vec, i, &len) : NULL;
+		if (valid && !utf8_valid(v, len)) {
+			bad++;
+			valid = false;
+		}
+		if (fixed == NULL) continue;
+		if (valid) {
+			sorbet_vector_append(fixed, v, len);
+		} else {
+			sorbet_vector_append_null(fixed);
+		}
 	}
-	writer_inc_col(sdef);
+	return bad;
 }
 
-void sorbet_write_time_time_t(sorbet_def *sdef, const time_t *v) {
-	if (v != NULL) {
-		sorbet_write_type_tag(sdef, column_type_tag[TIME]);
-		struct tm *ltime = localtime(v);
-		int32_t dt = (ltime->tm_hour * 10000) + (ltime->tm_min * 100) + (ltime->tm_sec);
-		sorbet_write_int_raw(sdef, dt);
-	} else {
-		sorbet_write_null_type_tag(sdef, column_type_null_tag[TIME]);
+bool sorbet_write_batch(sorbet_def *sdef, const sorbet_batch *batch) {
+	int num_cols = sdef->schema.numCols;
+	if (sdef->cur_col != 0) {
+		printf("ERROR: a batch has to start at the beginning of a row\n");
+		return false;
 	}
-	writer_inc_col(sdef);
+	if (batch->numCols != num_cols) {
+		printf("ERROR: the batch has %d columns but the schema has %d\n", batch->numCols, num_cols);
+		return false;
+	}
+	for (int c = 0; c < num_cols; c++) {
+		if (batch->cols[c].type != sdef->schema.cols[c].type || batch->cols[c].length < batch->n_rows) {
+			printf("ERROR: column %d of the batch doesn't match the schema\n", c);
+			return false;
+		}
+	}
+	if (sdef->utf8_policy != SORBET_UTF8_UNCHECKED) {
+		// STRING columns with values that aren't valid UTF-8 are checked up front, so a
+		// rejected batch writes nothing, and nulled out in a copy
+		sorbet_batch fixed = *batch;
+		for (int c = 0; c < num_cols; c++) {
+			if (batch->cols[c].type != STRING) continue;
+			int64_t bad = writer_check_utf8(&batch->cols[c], batch->n_rows, NULL);
+			if (bad == 0) continue;
+			if (sdef->utf8_policy == SORBET_UTF8_REJECT) {
+				printf("ERROR: column %d of the batch has %ld values that aren't valid UTF-8\n", c, (long)bad);
+				return false;
+			}
+			sdef->cstats[c].cbads += bad;
+			if (sdef->utf8_policy != SORBET_UTF8_NULL) continue;
+			if (fixed.cols == batch->cols) {
+				fixed.cols = (sorbet_vector *)malloc(num_cols * sizeof(sorbet_vector));
+				memcpy(fixed.cols, batch->cols, num_cols * sizeof(sorbet_vector));
+			}
+			sorbet_vector_init(&fixed.cols[c], STRING);
+			writer_check_utf8(&batch->cols[c], batch->n_rows, &fixed.cols[c]);
+		}
+		if (fixed.cols != batch->cols) {
+			bool ok = sorbet_write_batch(sdef, &fixed);
+			for (int c = 0; c < num_cols; c++) {
+				if (fixed.cols[c].data != batch->cols[c].data) sorbet_vector_free(&fixed.cols[c]);
+			}
+			free(fixed.cols);
+			return ok;
+		}
+	}
+	// columns holding runs are written from a copy with a value per row
+	sorbet_batch expanded = *batch;
+	for (int c = 0; c < num_cols; c++) {
+		if (batch->cols[c].n_runs == 0) continue;
+		if (expanded.cols == batch->cols) {
+			expanded.cols = (sorbet_vector *)malloc(num_cols * sizeof(sorbet_vector));
+			memcpy(expanded.cols, batch->cols, num_cols * sizeof(sorbet_vector));
+		}
+		sorbet_vector_init(&expanded.cols[c], batch->cols[c].type);
+		sorbet_vector_append_slice(&expanded.cols[c], &batch->cols[c], 0, batch->n_rows);
+	}
+	if (expanded.cols != batch->cols) {
+		bool ok = sorbet_write_batch(sdef, &expanded);
+		for (int c = 0; c < num_cols; c++) {
+			if (batch->cols[c].n_runs > 0) sorbet_vector_free(&expanded.cols[c]);
+		}
+		free(expanded.cols);
+		return ok;
+	}
+	int64_t start = 0;
+	while (start < batch->n_rows) {
+		// fill the current row group, then flush it like the per-value writers do
+		int64_t n = sdef->row_group_size - sdef->group_rows;
+		if (n > batch->n_rows - start) n = batch->n_rows - start;
+		for (int c = 0; c < num_cols; c++) {
+			writer_batch_stats(&sdef->cstats[c], &batch->cols[c], start, n);
+			writer_batch_zone(&sdef->gzones[c], &batch->cols[c], start, n);
+			if (writer_bloom_column(sdef, c)) {
+				writer_batch_bloom(&sdef->ghashes[c], &batch->cols[c], start, n);
+			}
+		}
+		if (sdef->key_index != NULL) {
+			writer_batch_keys(sdef, &batch->cols[sdef->sort_column], start, n);
+		}
+		if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+			for (int c = 0; c < num_cols; c++) {
+				sorbet_vector_append_slice(&sdef->gcols[c], &batch->cols[c], start, n);
+			}
+		} else {
+			writer_batch_rows(sdef, batch, start, n);
+		}
+		sdef->n_rows += n;
+		sdef->group_rows += n;
+		if (sdef->group_rows >= sdef->row_group_size) {
+			sorbet_finish_row_group(sdef);
+		}
+		start += n;
+	}
+	return !sdef->write_failed;
 }
 
-void sorbet_write_row(sorbet_def *sdef, col_val *row) {
+bool sorbet_write_row(sorbet_def *sdef, col_val *row) {
+	if (sdef->utf8_policy == SORBET_UTF8_REJECT) {
+		// checked up front, so a rejected row writes nothing
+		for (int i=0; i<sdef->schema.numCols; i++) {
+			if (sdef->schema.cols[i].type == STRING && row[i].strval.val != NULL &&
+					!utf8_valid(row[i].strval.val, row[i].strval.len)) {
+				printf("ERROR: column %d of the row isn't valid UTF-8\n", i);
+				return false;
+			}
+		}
+	}
 	for (int i=0; i<sdef->schema.numCols; i++) {
 		switch (sdef->schema.cols[i].type) {
 			case INTEGER: {
@@ -352,30 +2684,28 @@ void sorbet_write_row(sorbet_def *sdef, col_val *row) {
 			}
 		}
 	}
+	return !sdef->write_failed;
 }
 
 int64_t col_width_from_stats(column_stats *stats, column_type col_type) {
 	int64_t max;
-	char strbuf[256];
+	char strbuf[512];
+	const sorbet_zone *r = &stats->range;
 	switch (col_type) {
-		case INTEGER: {
-			sprintf(strbuf, "%d", stats->max_int);
-			max = strlen(strbuf);
-			break;
-		}
+		case INTEGER:
 		case LONG: {
-			sprintf(strbuf, "%ld", stats->max_long);
-			max = strlen(strbuf);
-			break;
-		}
-		case FLOAT: {
-			sprintf(strbuf, "%d", (int32_t )stats->max_float);
-			max = strlen(strbuf);
+			// the widest of the smallest and largest values, so negatives count
+			int lo = sprintf(strbuf, "%ld", r->has_values ? r->min.longval : 0);
+			int hi = sprintf(strbuf, "%ld", r->has_values ? r->max.longval : 0);
+			max = (lo > hi) ? lo : hi;
 			break;
 		}
+		case FLOAT:
 		case DOUBLE: {
-			sprintf(strbuf, "%ld", (int64_t)stats->max_double);
-			max = strlen(strbuf);
+			// the integer part
+			int lo = sprintf(strbuf, "%.0f", r->has_values ? trunc(r->min.doubleval) : 0.0);
+			int hi = sprintf(strbuf, "%.0f", r->has_values ? trunc(r->max.doubleval) : 0.0);
+			max = (lo > hi) ? lo : hi;
 			break;
 		}
 		case STRING:
@@ -399,6 +2729,10 @@ void write_header(sorbet_def *sdef) {
 	sorbet_write_long_raw(sdef, sdef->n_rows);
 	// uncompressed size including header
 	sorbet_write_long_raw(sdef, sdef->uc_size);
+	// rows per row group and where the footer (row group index) starts
+	sorbet_write_int_raw(sdef, sdef->row_group_size);
+	sorbet_write_long_raw(sdef, sdef->index_offset);
+	sorbet_write_byte_raw(sdef, sdef->layout);
 	sorbet_write_int_raw(sdef, sdef->schema.numCols);
 	for (int i = 0; i < sdef->schema.numCols; i++) {
 		data_column dc = sdef->schema.cols[i];
@@ -429,63 +2763,318 @@ void write_metadata(sorbet_def *sdef) {
 	}
 }
 
+void free_column_group(sorbet_def *sdef) {
+	if (sdef->gcols != NULL) {
+		for (int i = 0; i < sdef->schema.numCols; i++) {
+			sorbet_vector_free(&sdef->gcols[i]);
+		}
+	}
+	if (sdef->gdicts != NULL) {
+		for (int i = 0; i < sdef->schema.numCols; i++) {
+			sorbet_vector_free(&sdef->gdicts[i]);
+			sorbet_vector_free(&sdef->gruns[i]);
+		}
+	}
+	free(sdef->gcols);
+	sdef->gcols = NULL;
+	free(sdef->gdicts);
+	sdef->gdicts = NULL;
+	free(sdef->gruns);
+	sdef->gruns = NULL;
+	free(sdef->chunks);
+	sdef->chunks = NULL;
+}
+
+// the column stats footer section. each column has its count, sum and range (as a
+// zone is stored), its HyperLogLog precision and registers (none if 0), and its
+// quantile sketch's k (0 if there's none), level sizes and values
+void writer_encode_stats(sorbet_def *sdef, sorbet_buffer *out) {
+	for (int i = 0; i < sdef->schema.numCols; i++) {
+		column_stats *st = &sdef->cstats[i];
+		sorbet_zone *z = &st->range;
+		uint8_t flags = z->has_values | (z->max_truncated << 1);
+		sorbet_buffer_append(out, &st->count, 8);
+		sorbet_buffer_append(out, &st->sum.longval, 8);
+		sorbet_buffer_append(out, &flags, 1);
+		sorbet_buffer_append(out, &z->min_len, 1);
+		sorbet_buffer_append(out, &z->max_len, 1);
+		sorbet_buffer_append(out, z->min.bytes, SORBET_ZONE_BYTES);
+		sorbet_buffer_append(out, z->max.bytes, SORBET_ZONE_BYTES);
+		uint8_t precision = (st->hll != NULL) ? st->hll_precision : 0;
+		sorbet_buffer_append(out, &precision, 1);
+		if (precision > 0) sorbet_buffer_append(out, st->hll, (size_t)1 << precision);
+		sorbet_quantiles *q = st->quantiles;
+		int32_t k = (q != NULL) ? q->k : 0;
+		sorbet_buffer_append(out, &k, 4);
+		if (q == NULL) continue;
+		sorbet_buffer_append(out, &q->n_levels, 4);
+		for (int32_t l = 0; l < q->n_levels; l++) {
+			sorbet_buffer_append(out, &q->sizes[l], 4);
+			sorbet_buffer_append(out, q->items + (int64_t)l * k, q->sizes[l] * sizeof(float64_t));
+		}
+	}
+}
+
+void write_footer(sorbet_def *sdef) {
+	sorbet_write_int_raw(sdef, SECTION_ROW_GROUPS);
+	sorbet_write_long_raw(sdef, 4 + (int64_t)sdef->n_groups * 36);
+	sorbet_write_int_raw(sdef, sdef->n_groups);
+	for (int i = 0; i < sdef->n_groups; i++) {
+		sorbet_row_group *rg = &sdef->groups[i];
+		sorbet_write_long_raw(sdef, rg->first_row);
+		sorbet_write_int_raw(sdef, rg->n_rows);
+		sorbet_write_long_raw(sdef, rg->offset);
+		sorbet_write_long_raw(sdef, rg->c_len);
+		sorbet_write_long_raw(sdef, rg->u_len);
+	}
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		int64_t n_chunks = (int64_t)sdef->n_groups * sdef->schema.numCols;
+		sorbet_write_int_raw(sdef, SECTION_COLUMN_CHUNKS);
+		sorbet_write_long_raw(sdef, n_chunks * 25);
+		for (int64_t i = 0; i < n_chunks; i++) {
+			sorbet_write_long_raw(sdef, sdef->chunks[i].offset);
+			sorbet_write_long_raw(sdef, sdef->chunks[i].c_len);
+			sorbet_write_long_raw(sdef, sdef->chunks[i].u_len);
+			sorbet_write_byte_raw(sdef, sdef->chunks[i].encoding);
+		}
+	}
+	int64_t n_zones = (int64_t)sdef->n_groups * sdef->schema.numCols;
+	sorbet_write_int_raw(sdef, SECTION_ZONE_MAPS);
+	sorbet_write_long_raw(sdef, n_zones * ZONE_RECORD_SIZE);
+	for (int64_t i = 0; i < n_zones; i++) {
+		sorbet_zone *z = &sdef->zones[i];
+		sorbet_write_int_raw(sdef, z->n_nulls);
+		sorbet_write_byte_raw(sdef, z->has_values | (z->max_truncated << 1));
+		sorbet_write_byte_raw(sdef, z->min_len);
+		sorbet_write_byte_raw(sdef, z->max_len);
+		sorbet_write_bytes_raw(sdef, z->min.bytes, SORBET_ZONE_BYTES);
+		sorbet_write_bytes_raw(sdef, z->max.bytes, SORBET_ZONE_BYTES);
+	}
+	if (sdef->blooms.size > 0) {
+		sorbet_write_int_raw(sdef, SECTION_BLOOM_FILTERS);
+		sorbet_write_long_raw(sdef, sdef->blooms.size);
+		sorbet_write_bytes_raw(sdef, sdef->blooms.data, sdef->blooms.size);
+	}
+	if (sdef->key_index != NULL) {
+		sorbet_buffer keys = {0};
+		sorbet_encode_bitmap(sdef->key_index, &keys);
+		sorbet_write_int_raw(sdef, SECTION_KEY_INDEX);
+		sorbet_write_long_raw(sdef, 16 + keys.size);
+		sorbet_write_int_raw(sdef, sdef->sort_column);
+		sorbet_write_int_raw(sdef, sdef->key_interval);
+		sorbet_write_long_raw(sdef, sdef->key_index->length);
+		sorbet_write_bytes_raw(sdef, keys.data, keys.size);
+		sorbet_buffer_free(&keys);
+	}
+	sorbet_buffer stats = {0};
+	writer_encode_stats(sdef, &stats);
+	sorbet_write_int_raw(sdef, SECTION_COLUMN_STATS);
+	sorbet_write_long_raw(sdef, stats.size);
+	sorbet_write_bytes_raw(sdef, stats.data, stats.size);
+	sorbet_buffer_free(&stats);
+	if (sdef->compression == SORBET_COMPRESSION_ZSTD && sdef->dictionary_size > 0) {
+		sorbet_write_int_raw(sdef, SECTION_DICTIONARY);
+		sorbet_write_long_raw(sdef, sdef->dictionary_size);
+		sorbet_write_bytes_raw(sdef, sdef->dictionary, sdef->dictionary_size);
+	}
+	sorbet_write_int_raw(sdef, SECTION_END);
+	sorbet_write_long_raw(sdef, 0);
+}
+
 void sorbet_writer_open(sorbet_def *sdef) {
 	sdef->f = fopen(sdef->filename, "wb");
-	sdef->buf_size = BUF_SIZE;
+	sorbet_advise_file(sdef);
+	// writers don't use the stream buffers
+	sdef->buf = NULL;
+	sdef->zbuf = NULL;
+	sdef->buf_cap = 0;
+	sdef->buf_size = 0;
 	sdef->buf_offset = 0;
+	sdef->direct_fd = -1;
+	sdef->dropped_to = 0;
+	sdef->flushing_to = 0;
 	sdef->uc_size = 0;
 	sdef->n_rows = 0;
-	sdef->cstats = (column_stats *)malloc(sdef->schema.numCols * sizeof(column_stats));
+	sdef->write_failed = false;
+	sdef->cstats = (column_stats *)calloc(sdef->schema.numCols, sizeof(column_stats));
+	if (sdef->hll_precision == 0) {
+		sdef->hll_precision = SORBET_DEFAULT_HLL_PRECISION;
+	} else if (sdef->hll_precision > 0 && sdef->hll_precision < 4) {
+		sdef->hll_precision = 4;
+	} else if (sdef->hll_precision > 16) {
+		sdef->hll_precision = 16;
+	}
+	for (int i = 0; i < sdef->schema.numCols; i++) {
+		column_stats *st = &sdef->cstats[i];
+		if (sdef->hll_precision > 0) {
+			st->hll_precision = sdef->hll_precision;
+			st->hll = (uint8_t *)calloc((size_t)1 << st->hll_precision, 1);
+		}
+		if (sdef->quantile_sketches == NULL || !sdef->quantile_sketches[i]) continue;
+		column_type type = sdef->schema.cols[i].type;
+		if (type == STRING || type == BINARY) {
+			printf("ERROR: column %d can't have a quantile sketch. writing it without one\n", i);
+			continue;
+		}
+		st->quantiles = sorbet_quantiles_new(SORBET_QUANTILE_K);
+	}
 	sdef->cur_col = 0;
-	sdef->zflush = Z_NO_FLUSH;
-	if (sdef->compression == 1) {
-		sdef->zstrm.zalloc = Z_NULL;
-		sdef->zstrm.zfree = Z_NULL;
-		sdef->zstrm.opaque = Z_NULL;
-		int ret = deflateInit2(&sdef->zstrm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, Z_WINDOW_BITS | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY);
-		if (ret != Z_OK) {
-			printf("ERROR: deflateInit returned %d\n", ret);
-			sdef->compression = 0;
+	if (sdef->row_group_size == 0) {
+		sdef->row_group_size = SORBET_DEFAULT_ROW_GROUP_SIZE;
+	}
+	sdef->index_offset = 0;
+	sdef->groups = NULL;
+	sdef->n_groups = 0;
+	sdef->groups_cap = 0;
+	sdef->group_rows = 0;
+	sdef->zones = NULL;
+	sdef->gzones = (sorbet_zone *)calloc(sdef->schema.numCols, sizeof(sorbet_zone));
+	sdef->group_skip = NULL;
+	sdef->ghashes = NULL;
+	sdef->bloom_index = NULL;
+	memset(&sdef->blooms, 0, sizeof(sorbet_buffer));
+	if (sdef->bloom_filters != NULL) {
+		bool any = false;
+		for (int i = 0; i < sdef->schema.numCols; i++) {
+			if (!sdef->bloom_filters[i]) continue;
+			if (sorbet_bloom_fits(sdef->schema.cols[i].type)) {
+				any = true;
+			} else {
+				printf("ERROR: column %d can't have a Bloom filter. writing it without one\n", i);
+			}
+		}
+		if (any) sdef->ghashes = (sorbet_buffer *)calloc(sdef->schema.numCols, sizeof(sorbet_buffer));
+	}
+	sdef->key_index = NULL;
+	memset(&sdef->last_key, 0, sizeof(sorbet_buffer));
+	sdef->key_seen = false;
+	if (sdef->sorted) {
+		if (sdef->sort_column < 0 || sdef->sort_column >= sdef->schema.numCols ||
+				sdef->schema.cols[sdef->sort_column].type == NULL_COL_TYPE) {
+			printf("ERROR: can't keep a key index on column %d. writing the file without one\n", sdef->sort_column);
+		} else {
+			if (sdef->key_interval <= 0) sdef->key_interval = SORBET_DEFAULT_KEY_INTERVAL;
+			sdef->key_index = (sorbet_vector *)malloc(sizeof(sorbet_vector));
+			sorbet_vector_init(sdef->key_index, sdef->schema.cols[sdef->sort_column].type);
+		}
+	}
+	memset(&sdef->gbuf, 0, sizeof(sorbet_buffer));
+	memset(&sdef->cbuf, 0, sizeof(sorbet_buffer));
+	sdef->chunks = NULL;
+	sdef->gcols = NULL;
+	sdef->gdicts = NULL;
+	sdef->gruns = NULL;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		sdef->gcols = (sorbet_vector *)malloc(sdef->schema.numCols * sizeof(sorbet_vector));
+		for (int i = 0; i < sdef->schema.numCols; i++) {
+			sorbet_vector_init(&sdef->gcols[i], sdef->schema.cols[i].type);
+		}
+		for (int i = 0; i < sdef->schema.numCols && sdef->encodings != NULL; i++) {
+			if (!sorbet_encoding_fits(sdef->schema.cols[i].type, sdef->encodings[i])) {
+				printf("ERROR: column %d can't use encoding %d. the writer will choose one\n", i, sdef->encodings[i]);
+			}
 		}
 	} else {
-		sdef -> compression = 0;
+		sdef->layout = SORBET_LAYOUT_ROW;
+	}
+	sdef->pool = NULL;
+	sdef->io = NULL;
+	sdef->codec = NULL;
+	sdef->codec_ctx = NULL;
+	if (sdef->compression != 0) {
+		sdef->codec = sorbet_find_codec(sdef->compression);
+		if (sdef->codec == NULL) {
+			printf("ERROR: compression type %d isn't available. writing uncompressed\n", sdef->compression);
+		} else {
+			sdef->codec_ctx = sdef->codec->open(sdef, true);
+		}
+		if (sdef->codec_ctx == NULL) {
+			sdef->codec = NULL;
+			sdef->compression = 0;
+		} else if (sdef->n_threads > 1) {
+			sorbet_pool_start(sdef);
+		}
 	}
 	write_header(sdef);
 	write_metadata(sdef);
 	// header and metadata are not compressed
 	sorbet_flush_write_buffer_uncompressed(sdef);
+	if (sdef->use_io_uring) {
+		writer_io_start(sdef);
+	}
 }
 
-void sorbet_writer_close(sorbet_def *sdef) {
-	sdef->zflush = Z_FINISH;
-	sorbet_flush_write_buffer(sdef);
-	fseeko(sdef->f, 0, 0);
-	write_header(sdef);
-	// header and metadata are not compressed
-	sorbet_flush_write_buffer_uncompressed(sdef);
+bool sorbet_writer_close(sorbet_def *sdef) {
+	sorbet_finish_row_group(sdef);
+	if (sdef->pool != NULL) {
+		sorbet_pool_stop(sdef);
+	}
+	if (sdef->io != NULL) {
+		writer_io_stop(sdef);
+	}
+	if (sdef->codec_ctx != NULL) {
+		sdef->codec->close(sdef->codec_ctx, true);
+		sdef->codec_ctx = NULL;
+	}
+	if (!sdef->write_failed) {
+		sdef->index_offset = ftello(sdef->f);
+		write_footer(sdef);
+		// the footer is not compressed either
+		sorbet_flush_write_buffer_uncompressed(sdef);
+		fseeko(sdef->f, 0, 0);
+		write_header(sdef);
+		sorbet_flush_write_buffer_uncompressed(sdef);
+	}
+	if (sdef->advice == SORBET_ADVICE_NOREUSE) {
+		fflush(sdef->f);
+		fdatasync(fileno(sdef->f));
+		posix_fadvise(fileno(sdef->f), 0, 0, POSIX_FADV_DONTNEED);
+	}
 	fclose(sdef->f);
-	free(sdef->cstats);
+	free_column_stats(sdef);
+	free(sdef->groups);
+	sdef->groups = NULL;
+	free(sdef->zones);
+	free(sdef->gzones);
+	sdef->zones = NULL;
+	sdef->gzones = NULL;
+	for (int i = 0; i < sdef->schema.numCols && sdef->ghashes != NULL; i++) {
+		sorbet_buffer_free(&sdef->ghashes[i]);
+	}
+	free(sdef->ghashes);
+	sdef->ghashes = NULL;
+	sorbet_buffer_free(&sdef->blooms);
+	if (sdef->key_index != NULL) {
+		sorbet_vector_free(sdef->key_index);
+		free(sdef->key_index);
+		sdef->key_index = NULL;
+	}
+	sorbet_buffer_free(&sdef->last_key);
+	sorbet_buffer_free(&sdef->gbuf);
+	sorbet_buffer_free(&sdef->cbuf);
+	free_column_group(sdef);
+	return !sdef->write_failed;
 }
 
 void sorbet_fill_read_buffer_uncompressed(sorbet_def *sdef) {
-	if (sdef->buf_size < BUF_SIZE) return; // TODO: throw an error?
+	if (sdef->buf_size < sdef->buf_cap) return; // TODO: throw an error?
 	if (sdef->buf_offset == 0) return; // we haven't used any of the buffer yet
-	if (sdef->buf_offset < BUF_SIZE) {
+	if (sdef->buf_offset < sdef->buf_cap) {
 		// we need to read a partial buffer
 		uint8_t *src = sdef->buf + sdef->buf_offset;
 		// move the tail of the buffer to the beginning
-		int left = BUF_SIZE-sdef->buf_offset;
+		int left = sdef->buf_cap-sdef->buf_offset;
 		memmove(sdef->buf, src, left);
 		// read in the remainder of the buffer
 		uint8_t *dst = sdef->buf + left;
-		int bytes_read = (int)fread(dst, sizeof(uint8_t), BUF_SIZE-left, sdef->f);
-		if (bytes_read < (BUF_SIZE-left)) {
+		int bytes_read = (int)fread(dst, sizeof(uint8_t), sdef->buf_cap-left, sdef->f);
+		if (bytes_read < (sdef->buf_cap-left)) {
 			sdef->buf_size = left + bytes_read;
 		}
 	} else {
 		// We're at the very end -- we can just read the whole buffer
-		int bytes_read = (int)fread(sdef->buf, sizeof(uint8_t), BUF_SIZE, sdef->f);
-		if (bytes_read < BUF_SIZE) {
+		int bytes_read = (int)fread(sdef->buf, sizeof(uint8_t), sdef->buf_cap, sdef->f);
+		if (bytes_read < sdef->buf_cap) {
 			sdef->buf_size = bytes_read;
 		}
 	}
@@ -499,16 +3088,19 @@ void sorbet_fill_read_buffer_compressed(sorbet_def *sdef) {
 	}
 	printf("\n-=-=sorbet_fill_read_buffer_compressed\n");
 	uint8_t *dst = sdef->buf;
-	int bytes_needed = BUF_SIZE;
-	if (sdef->buf_offset < BUF_SIZE) {
+	int bytes_needed = sdef->buf_cap;
+	if (sdef->buf_offset < sdef->buf_cap) {
 		// we need to read a partial buffer
 		uint8_t *src = sdef->buf + sdef->buf_offset;
 		// move the tail of the buffer to the beginning
-		int left = BUF_SIZE-sdef->buf_offset;
+		int left = sdef->buf_cap-sdef->buf_offset;
 		memmove(sdef->buf, src, left);
 		// read in the remainder of the buffer
 		dst = sdef->buf + left;
-		bytes_needed = BUF_SIZE - left;
+		bytes_needed = sdef->buf_cap - left;
+	}
+	if (sdef->zbuf == NULL) {
+		sdef->zbuf = sorbet_alloc_aligned(sdef->buf_cap);
 	}
 	sdef->buf_offset = 0;
 	int bytes_left_to_read = bytes_needed;
@@ -517,7 +3109,7 @@ void sorbet_fill_read_buffer_compressed(sorbet_def *sdef) {
 		if (sdef->zstrm.avail_in == 0) {
 			// read from the file
 			sdef->zstrm.next_in = sdef->zbuf;
-			sdef->zstrm.avail_in = fread(sdef->zbuf, sizeof(uint8_t), BUF_SIZE, sdef->f);
+			sdef->zstrm.avail_in = fread(sdef->zbuf, sizeof(uint8_t), sdef->buf_cap, sdef->f);
 			if (sdef->zstrm.avail_in == 0) {
 				printf("we hit the end of the file\n");
 				// TODO: we hit the end of the file. do something smart
@@ -538,18 +3130,696 @@ void sorbet_fill_read_buffer_compressed(sorbet_def *sdef) {
 			sdef->buf_size = (bytes_needed - bytes_left_to_read);
 			bytes_left_to_read = 0;
 		}
-	} while (bytes_left_to_read > 0);
+	} while (bytes_left_to_read > 0);
+}
+
+// SORBET_ADVICE_NOREUSE: drops the part of the file that has been read into buffers
+// from the page cache
+void reader_drop_behind(sorbet_def *sdef, uint64_t offset, uint64_t len) {
+	if (sdef->advice != SORBET_ADVICE_NOREUSE || sdef->map != NULL || len == 0) return;
+	posix_fadvise(fileno(sdef->f), offset, len, POSIX_FADV_DONTNEED);
+}
+
+void sorbet_fill_read_buffer(sorbet_def *sdef) {
+	if (sdef->compression == 1) {
+		sorbet_fill_read_buffer_compressed(sdef);
+	} else {
+		sorbet_fill_read_buffer_uncompressed(sdef);
+	}
+	if (sdef->advice == SORBET_ADVICE_NOREUSE) {
+		uint64_t pos = ftello(sdef->f);
+		if (pos > sdef->dropped_to) {
+			reader_drop_behind(sdef, sdef->dropped_to, pos - sdef->dropped_to);
+			sdef->dropped_to = pos;
+		}
+	}
+}
+
+// finds the row group that contains the given row
+int32_t sorbet_find_row_group(sorbet_def *sdef, uint64_t row) {
+	int32_t lo = 0;
+	int32_t hi = sdef->n_groups - 1;
+	while (lo < hi) {
+		int32_t mid = (lo + hi + 1) / 2;
+		if (sdef->groups[mid].first_row <= row) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return lo;
+}
+
+// decompresses a block of c_len bytes into gbuf
+bool sorbet_decompress_block(sorbet_def *sdef, const uint8_t *src, uint64_t c_len, uint64_t u_len) {
+	sorbet_buffer_reserve(&sdef->gbuf, u_len);
+	if (!sdef->codec->decompress(sdef->codec_ctx, src, c_len, sdef->gbuf.data, u_len)) return false;
+	sdef->gbuf.size = u_len;
+	return true;
+}
+
+// puts a block read into memory of the reader's own into gbuf, decompressing it if
+// need be
+bool reader_take_block(sorbet_def *sdef, const uint8_t *src, uint64_t c_len, uint64_t u_len) {
+	sdef->gbuf.size = 0;
+	sdef->gbuf.offset = 0;
+	if (sdef->compression != 0) {
+		return sorbet_decompress_block(sdef, src, c_len, u_len);
+	}
+	sorbet_buffer_append(&sdef->gbuf, src, c_len);
+	return true;
+}
+
+// the aligned span of the file O_DIRECT has to read to get len bytes at offset
+uint64_t direct_start(uint64_t offset) {
+	return offset & ~(uint64_t)(SORBET_DIRECT_ALIGN - 1);
+}
+
+uint64_t direct_span(uint64_t offset, uint64_t len) {
+	uint64_t end = (offset + len + SORBET_DIRECT_ALIGN - 1) & ~(uint64_t)(SORBET_DIRECT_ALIGN - 1);
+	return end - direct_start(offset);
+}
+
+// reads len bytes at offset through an O_DIRECT descriptor into scratch and returns
+// where they start in it, or NULL
+const uint8_t *sorbet_read_direct(int fd, sorbet_buffer *scratch, uint64_t offset, uint64_t len) {
+	uint64_t start = direct_start(offset);
+	uint64_t span = direct_span(offset, len);
+	uint64_t need = offset + len - start;
+	if (!sorbet_buffer_reserve_aligned(scratch, span)) return NULL;
+	while (scratch->size < need) {
+		// the last block of the file comes back short, which is fine
+		ssize_t n = pread(fd, scratch->data + scratch->size, span - scratch->size, start + scratch->size);
+		if (n <= 0) return NULL;
+		scratch->size += n;
+	}
+	return scratch->data + (offset - start);
+}
+
+// reads c_len bytes at offset into gbuf, decompressing them to u_len bytes if the
+// file is compressed. when the file is mapped, uncompressed blocks aren't copied at all:
+// gbuf just points into the mapping.
+bool sorbet_read_block(sorbet_def *sdef, uint64_t offset, uint64_t c_len, uint64_t u_len) {
+	sdef->gbuf.size = 0;
+	sdef->gbuf.offset = 0;
+	if (sdef->map != NULL) {
+		if (offset + c_len > sdef->map_size) {
+			printf("ERROR: block at %ld is past the end of the file\n", (long)offset);
+			return false;
+		}
+		if (sdef->compression == 0) {
+			sorbet_buffer_free(&sdef->gbuf);
+			sdef->gbuf.data = sdef->map + offset;
+			sdef->gbuf.size = c_len;
+			return true;
+		}
+		return sorbet_decompress_block(sdef, sdef->map + offset, c_len, u_len);
+	}
+	if (sdef->direct_fd >= 0) {
+		const uint8_t *src = sorbet_read_direct(sdef->direct_fd, &sdef->cbuf, offset, c_len);
+		if (src == NULL) {
+			printf("ERROR: couldn't read the block at %ld\n", (long)offset);
+			return false;
+		}
+		return reader_take_block(sdef, src, c_len, u_len);
+	}
+	sorbet_buffer *dst = (sdef->compression == 0) ? &sdef->gbuf : &sdef->cbuf;
+	dst->size = 0;
+	sorbet_buffer_reserve(dst, c_len);
+	fseeko(sdef->f, offset, SEEK_SET);
+	size_t bytes_read = fread(dst->data, sizeof(uint8_t), c_len, sdef->f);
+	if (bytes_read != c_len) {
+		printf("ERROR: block at %ld is truncated (%d of %d bytes)\n", (long)offset, (int)bytes_read, (int)c_len);
+		return false;
+	}
+	dst->size = c_len;
+	if (sdef->compression != 0) {
+		return sorbet_decompress_block(sdef, sdef->cbuf.data, c_len, u_len);
+	}
+	return true;
+}
+
+// asks the kernel to start paging in row group g of a mapped file
+void sorbet_advise_row_group(sorbet_def *sdef, int32_t g) {
+	if (sdef->map == NULL || g < 0 || g >= sdef->n_groups) return;
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t start = sdef->groups[g].offset & ~(page - 1);
+	madvise(sdef->map + start, sdef->groups[g].offset + sdef->groups[g].c_len - start, MADV_WILLNEED);
+}
+
+// a row group read (and decompressed) ahead of the reader. bufs holds the whole
+// group in the ROW layout, or one buffer per projected column in the COLUMNAR layout
+typedef struct s_ahead_slot {
+	int32_t group;
+	uint32_t gen;
+	bool ready;
+	bool ok;
+	sorbet_buffer *bufs;
+} ahead_slot;
+
+// the read-ahead thread. it loads groups want..want+n_slots-1 in order, each into
+// slot group % n_slots, while the reader decodes. gen changes whenever the reader
+// jumps somewhere else or changes its projection, which makes everything loaded
+// before that stale.
+struct s_sorbet_ahead {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	ahead_slot *slots;
+	int32_t n_slots;
+	int32_t want;
+	int32_t next_group;
+	// a group the reader asked for that its predicates rule out
+	int32_t forced;
+	uint32_t gen;
+	bool stop;
+	bool *cols;
+	void *codec_ctx;
+	const sorbet_def *sdef;
+};
+
+// sorbet_read_block for the read-ahead thread. it uses pread so it doesn't share
+// the reader's file position, and its own codec context
+bool ahead_read_block(sorbet_ahead *ah, sorbet_buffer *scratch, sorbet_buffer *dst, uint64_t offset, uint64_t c_len, uint64_t u_len) {
+	const sorbet_def *sdef = ah->sdef;
+	sorbet_buffer *in = (sdef->compression == 0) ? dst : scratch;
+	const uint8_t *src;
+	dst->size = 0;
+	dst->offset = 0;
+	if (sdef->map != NULL) {
+		if (offset + c_len > sdef->map_size) return false;
+		src = sdef->map + offset;
+	} else if (sdef->direct_fd >= 0) {
+		src = sorbet_read_direct(sdef->direct_fd, scratch, offset, c_len);
+		if (src == NULL) return false;
+		if (sdef->compression == 0) {
+			sorbet_buffer_append(dst, src, c_len);
+			return true;
+		}
+	} else {
+		in->size = 0;
+		sorbet_buffer_reserve(in, c_len);
+		if (pread(fileno(sdef->f), in->data, c_len, offset) != (ssize_t)c_len) return false;
+		in->size = c_len;
+		src = in->data;
+	}
+	if (sdef->compression == 0) return true;
+	sorbet_buffer_reserve(dst, u_len);
+	if (!sdef->codec->decompress(ah->codec_ctx, src, c_len, dst->data, u_len)) return false;
+	dst->size = u_len;
+	return true;
+}
+
+void *sorbet_ahead_worker(void *arg) {
+	sorbet_ahead *ah = (sorbet_ahead *)arg;
+	const sorbet_def *sdef = ah->sdef;
+	int num_cols = sdef->schema.numCols;
+	bool *cols = (bool *)malloc(num_cols * sizeof(bool));
+	sorbet_buffer scratch;
+	memset(&scratch, 0, sizeof(sorbet_buffer));
+	pthread_mutex_lock(&ah->lock);
+	while (true) {
+		while (!ah->stop) {
+			// groups the reader's predicates rule out aren't read, unless the reader
+			// asks for one anyway
+			while (sdef->group_skip != NULL && ah->next_group < sdef->n_groups &&
+					sdef->group_skip[ah->next_group] && ah->next_group != ah->forced) {
+				ah->next_group++;
+			}
+			if (ah->next_group < sdef->n_groups && ah->next_group < ah->want + ah->n_slots) break;
+			pthread_cond_wait(&ah->cond, &ah->lock);
+		}
+		if (ah->stop) break;
+		int32_t g = ah->next_group++;
+		ahead_slot *slot = &ah->slots[g % ah->n_slots];
+		slot->group = g;
+		slot->gen = ah->gen;
+		slot->ready = false;
+		memcpy(cols, ah->cols, num_cols * sizeof(bool));
+		pthread_mutex_unlock(&ah->lock);
+		bool ok = true;
+		if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+			for (int i = 0; i < num_cols && ok; i++) {
+				if (!cols[i]) continue;
+				sorbet_column_chunk *chunk = &sdef->chunks[g * num_cols + i];
+				ok = ahead_read_block(ah, &scratch, &slot->bufs[i], chunk->offset, chunk->c_len, chunk->u_len);
+			}
+		} else {
+			sorbet_row_group *rg = &sdef->groups[g];
+			ok = ahead_read_block(ah, &scratch, &slot->bufs[0], rg->offset, rg->c_len, rg->u_len);
+		}
+		pthread_mutex_lock(&ah->lock);
+		slot->ok = ok;
+		slot->ready = true;
+		pthread_cond_broadcast(&ah->cond);
+	}
+	pthread_mutex_unlock(&ah->lock);
+	free(cols);
+	sorbet_buffer_free(&scratch);
+	return NULL;
+}
+
+void ahead_copy_projection(sorbet_def *sdef) {
+	for (int i = 0; i < sdef->schema.numCols; i++) {
+		sdef->ahead->cols[i] = (sdef->projection == NULL || sdef->projection[i]);
+	}
+}
+
+void sorbet_ahead_stop(sorbet_def *sdef) {
+	sorbet_ahead *ah = sdef->ahead;
+	int n_bufs = (sdef->layout == SORBET_LAYOUT_COLUMNAR) ? sdef->schema.numCols : 1;
+	pthread_mutex_lock(&ah->lock);
+	bool started = !ah->stop;
+	ah->stop = true;
+	pthread_cond_broadcast(&ah->cond);
+	pthread_mutex_unlock(&ah->lock);
+	if (started) {
+		pthread_join(ah->thread, NULL);
+	}
+	for (int i = 0; i < ah->n_slots; i++) {
+		for (int j = 0; j < n_bufs; j++) {
+			sorbet_buffer_free(&ah->slots[i].bufs[j]);
+		}
+		free(ah->slots[i].bufs);
+	}
+	if (ah->codec_ctx != NULL) {
+		sdef->codec->close(ah->codec_ctx, false);
+	}
+	pthread_mutex_destroy(&ah->lock);
+	pthread_cond_destroy(&ah->cond);
+	free(ah->slots);
+	free(ah->cols);
+	free(ah);
+	sdef->ahead = NULL;
+}
+
+void sorbet_ahead_start(sorbet_def *sdef) {
+	sorbet_ahead *ah = (sorbet_ahead *)calloc(1, sizeof(sorbet_ahead));
+	int num_cols = sdef->schema.numCols;
+	int n_bufs = (sdef->layout == SORBET_LAYOUT_COLUMNAR) ? num_cols : 1;
+	ah->sdef = sdef;
+	ah->forced = -1;
+	ah->n_slots = sdef->read_ahead;
+	ah->slots = (ahead_slot *)calloc(ah->n_slots, sizeof(ahead_slot));
+	for (int i = 0; i < ah->n_slots; i++) {
+		ah->slots[i].group = -1;
+		ah->slots[i].bufs = (sorbet_buffer *)calloc(n_bufs, sizeof(sorbet_buffer));
+	}
+	ah->cols = (bool *)malloc(num_cols * sizeof(bool));
+	if (sdef->codec != NULL) {
+		ah->codec_ctx = sdef->codec->open(sdef, false);
+	}
+	pthread_mutex_init(&ah->lock, NULL);
+	pthread_cond_init(&ah->cond, NULL);
+	sdef->ahead = ah;
+	ahead_copy_projection(sdef);
+	bool ok = (sdef->codec == NULL || ah->codec_ctx != NULL);
+	if (!ok || pthread_create(&ah->thread, NULL, sorbet_ahead_worker, ah) != 0) {
+		printf("ERROR: couldn't start the read-ahead thread. reading without it\n");
+		ah->stop = true;
+		sorbet_ahead_stop(sdef);
+	}
+}
+
+// the reader's projection changed, so the groups loaded so far may be missing columns
+void sorbet_ahead_reproject(sorbet_def *sdef) {
+	sorbet_ahead *ah = sdef->ahead;
+	pthread_mutex_lock(&ah->lock);
+	ahead_copy_projection(sdef);
+	ah->gen++;
+	ah->next_group = ah->want;
+	pthread_cond_broadcast(&ah->cond);
+	pthread_mutex_unlock(&ah->lock);
+}
+
+// waits for row group g to be read, restarting the read-ahead at g if the reader
+// jumped outside the window or g was passed over (its predicates ruled it out
+// then). the slot is the reader's until sorbet_ahead_release
+ahead_slot *sorbet_ahead_take(sorbet_def *sdef, int32_t g) {
+	sorbet_ahead *ah = sdef->ahead;
+	pthread_mutex_lock(&ah->lock);
+	ah->forced = -1;
+	if (sdef->group_skip != NULL && sdef->group_skip[g]) {
+		ah->forced = g;
+	}
+	ahead_slot *slot = &ah->slots[g % ah->n_slots];
+	bool passed_over = g < ah->next_group && (slot->group != g || slot->gen != ah->gen);
+	if (g < ah->want || g > ah->next_group || ah->forced == g || passed_over) {
+		ah->next_group = g;
+		ah->gen++;
+	}
+	ah->want = g;
+	pthread_cond_broadcast(&ah->cond);
+	while (slot->group != g || slot->gen != ah->gen || !slot->ready) {
+		pthread_cond_wait(&ah->cond, &ah->lock);
+	}
+	pthread_mutex_unlock(&ah->lock);
+	return slot;
+}
+
+// lets the read-ahead thread reuse row group g's slot
+void sorbet_ahead_release(sorbet_def *sdef, int32_t g) {
+	sorbet_ahead *ah = sdef->ahead;
+	pthread_mutex_lock(&ah->lock);
+	if (ah->want == g) ah->want = g + 1;
+	pthread_cond_broadcast(&ah->cond);
+	pthread_mutex_unlock(&ah->lock);
+}
+
+void reader_io_start(sorbet_def *sdef) {
+	uint64_t max_len = 0;
+	for (int32_t g = 0; g < sdef->n_groups; g++) {
+		if (sdef->groups[g].c_len > max_len) max_len = sdef->groups[g].c_len;
+	}
+	// every slot can hold the largest row group, so the buffers can be allocated
+	// and registered once. O_DIRECT reads can take up to a block more on each side
+	size_t len = direct_span(0, max_len);
+	if (sdef->direct_fd >= 0) len += 2 * SORBET_DIRECT_ALIGN;
+	sdef->n_io_slots = (sdef->io_depth > 0) ? sdef->io_depth : SORBET_DEFAULT_IO_DEPTH;
+	sdef->io_slots = (io_slot *)calloc(sdef->n_io_slots, sizeof(io_slot));
+	uint8_t **bufs = (uint8_t **)malloc(sdef->n_io_slots * sizeof(uint8_t *));
+	for (int i = 0; i < sdef->n_io_slots; i++) {
+		bufs[i] = sorbet_alloc_aligned(len);
+		if (bufs[i] == NULL) {
+			for (int j = 0; j < i; j++) {
+				free(bufs[j]);
+			}
+			free(bufs);
+			free(sdef->io_slots);
+			sdef->io_slots = NULL;
+			return;
+		}
+		sdef->io_slots[i].group = -1;
+		sdef->io_slots[i].buf.data = bufs[i];
+		sdef->io_slots[i].buf.capacity = len;
+	}
+	sdef->io = sorbet_io_open(sdef->n_io_slots);
+	// reads still work into unregistered buffers, just with more work per read
+	sorbet_io_register_buffers(sdef->io, bufs, len, sdef->n_io_slots);
+	free(bufs);
+	sdef->io_seq = 0;
+}
+
+void reader_io_stop(sorbet_def *sdef) {
+	// waits for reads into the slots that are still in flight
+	sorbet_io_close(sdef->io);
+	sdef->io = NULL;
+	for (int i = 0; i < sdef->n_io_slots; i++) {
+		sorbet_buffer_free(&sdef->io_slots[i].buf);
+	}
+	free(sdef->io_slots);
+	sdef->io_slots = NULL;
+}
+
+// takes one completed read and returns its row group, or -1 if there wasn't one
+int32_t reader_io_reap(sorbet_def *sdef, bool wait) {
+	uint64_t tag;
+	int64_t res;
+	if (!sorbet_io_complete(sdef->io, wait, &tag, &res)) return -1;
+	io_slot *slot = &sdef->io_slots[tag];
+	sorbet_row_group *rg = &sdef->groups[slot->group];
+	// the group starts buf.offset bytes into the read (O_DIRECT reads start on a block)
+	uint64_t start = rg->offset - slot->buf.offset;
+	uint64_t need = slot->buf.offset + rg->c_len;
+	int64_t n = res;
+	// reads can come back short. finish them off synchronously
+	while (n >= 0 && (uint64_t)n < need) {
+		ssize_t more = pread(fileno(sdef->f), slot->buf.data + n, need - n, start + n);
+		if (more <= 0) break;
+		n += more;
+	}
+	slot->ok = (n >= 0 && (uint64_t)n >= need);
+	if (!slot->ok) {
+		printf("ERROR: row group %d is truncated (%ld of %ld bytes)\n", slot->group, (long)n, (long)need);
+	}
+	slot->buf.size = slot->ok ? need : 0;
+	slot->state = IO_SLOT_DONE;
+	slot->seq = ++sdef->io_seq;
+	return slot->group;
+}
+
+// the slot holding (or reading) row group g, or NULL
+io_slot *reader_io_find(sorbet_def *sdef, int32_t g) {
+	for (int i = 0; i < sdef->n_io_slots; i++) {
+		if (sdef->io_slots[i].state != IO_SLOT_FREE && sdef->io_slots[i].group == g) {
+			return &sdef->io_slots[i];
+		}
+	}
+	return NULL;
+}
+
+// starts reading row group g into a free slot. with evict set it can also reuse the
+// slot of the group that finished reading longest ago. returns false if there's
+// no slot to read into
+bool reader_io_submit_group(sorbet_def *sdef, int32_t g, bool evict) {
+	if (reader_io_find(sdef, g) != NULL) return true;
+	io_slot *slot = NULL;
+	for (int i = 0; i < sdef->n_io_slots && slot == NULL; i++) {
+		if (sdef->io_slots[i].state == IO_SLOT_FREE) slot = &sdef->io_slots[i];
+	}
+	for (int i = 0; i < sdef->n_io_slots && slot == NULL && evict; i++) {
+		io_slot *s = &sdef->io_slots[i];
+		if (s->state == IO_SLOT_DONE && (slot == NULL || s->seq < slot->seq)) slot = s;
+	}
+	if (slot == NULL) return false;
+	sorbet_row_group *rg = &sdef->groups[g];
+	int fd = fileno(sdef->f);
+	uint64_t offset = rg->offset;
+	uint64_t len = rg->c_len;
+	if (sdef->direct_fd >= 0) {
+		fd = sdef->direct_fd;
+		offset = direct_start(rg->offset);
+		len = direct_span(rg->offset, rg->c_len);
+	}
+	slot->state = IO_SLOT_BUSY;
+	slot->group = g;
+	slot->buf.size = 0;
+	slot->buf.offset = rg->offset - offset;
+	if (!sorbet_io_read(sdef->io, fd, slot->buf.data, len, offset, slot - sdef->io_slots, slot - sdef->io_slots)) {
+		slot->state = IO_SLOT_FREE;
+		return false;
+	}
+	return sorbet_io_submit(sdef->io);
+}
+
+// waits until row group g has been read, starting the read if nobody has
+io_slot *reader_io_take(sorbet_def *sdef, int32_t g) {
+	io_slot *slot = reader_io_find(sdef, g);
+	while (slot == NULL) {
+		if (!reader_io_submit_group(sdef, g, true) && reader_io_reap(sdef, true) < 0) return NULL;
+		slot = reader_io_find(sdef, g);
+	}
+	while (slot->state == IO_SLOT_BUSY) {
+		if (reader_io_reap(sdef, true) < 0) return NULL;
+	}
+	return slot;
+}
+
+// frees row group g's slot and keeps the groups after it reading in the slots that
+// are free
+void reader_io_release(sorbet_def *sdef, io_slot *slot, int32_t g) {
+	slot->state = IO_SLOT_FREE;
+	slot->group = -1;
+	for (int32_t k = g + 1; k < g + sdef->n_io_slots && k < sdef->n_groups; k++) {
+		if (sdef->groups[k].first_row >= sdef->end_row) break;
+		if (sdef->group_skip != NULL && sdef->group_skip[k]) continue;
+		if (!reader_io_submit_group(sdef, k, false)) break;
+	}
+}
+
+// reads row group g into gbuf, inflating it if the file is compressed, and
+// positions the reader at the group's first row
+bool sorbet_load_row_group(sorbet_def *sdef, int32_t g) {
+	if (g < 0 || g >= sdef->n_groups) return false;
+	sorbet_row_group *rg = &sdef->groups[g];
+	if (g != sdef->cur_group && sdef->ahead != NULL) {
+		sdef->cur_group = -1;
+		ahead_slot *slot = sorbet_ahead_take(sdef, g);
+		if (!slot->ok) {
+			sorbet_ahead_release(sdef, g);
+			return false;
+		}
+		// take the slot's buffer and leave it the old one to fill next time
+		sorbet_buffer b = sdef->gbuf;
+		sdef->gbuf = slot->bufs[0];
+		slot->bufs[0] = b;
+		sorbet_ahead_release(sdef, g);
+		sdef->cur_group = g;
+		reader_drop_behind(sdef, rg->offset, rg->c_len);
+	} else if (g != sdef->cur_group && sdef->io != NULL) {
+		sdef->cur_group = -1;
+		io_slot *slot = reader_io_take(sdef, g);
+		if (slot == NULL) return false;
+		bool ok = slot->ok && reader_take_block(sdef, slot->buf.data + slot->buf.offset, rg->c_len, rg->u_len);
+		reader_io_release(sdef, slot, g);
+		if (!ok) return false;
+		sdef->cur_group = g;
+		reader_drop_behind(sdef, rg->offset, rg->c_len);
+	} else if (g != sdef->cur_group) {
+		sdef->cur_group = -1;
+		if (!sorbet_read_block(sdef, rg->offset, rg->c_len, rg->u_len)) return false;
+		sdef->cur_group = g;
+		sorbet_advise_row_group(sdef, g + 1);
+		reader_drop_behind(sdef, rg->offset, rg->c_len);
+	}
+	sdef->gbuf.offset = 0;
+	sdef->row_cnt = rg->first_row;
+	sdef->cur_col = 0;
+	return true;
+}
+
+// loads the chunks of the projected columns of row group g into gcols. unlike
+// sorbet_load_row_group this leaves the reader's position alone.
+bool sorbet_load_column_group(sorbet_def *sdef, int32_t g) {
+	if (g < 0 || g >= sdef->n_groups) return false;
+	sdef->cur_group = -1;
+	int num_cols = sdef->schema.numCols;
+	ahead_slot *slot = NULL;
+	if (sdef->ahead != NULL) {
+		slot = sorbet_ahead_take(sdef, g);
+		if (!slot->ok) {
+			sorbet_ahead_release(sdef, g);
+			return false;
+		}
+	}
+	// with io_uring the whole row group comes in with one read, and each chunk is
+	// decoded from where it sits in it
+	io_slot *islot = NULL;
+	if (sdef->io != NULL) {
+		islot = reader_io_take(sdef, g);
+		if (islot == NULL) return false;
+		if (!islot->ok) {
+			reader_io_release(sdef, islot, g);
+			return false;
+		}
+	}
+	for (int i = 0; i < num_cols; i++) {
+		sorbet_vector *vec = &sdef->gcols[i];
+		sorbet_vector_clear(vec);
+		sorbet_vector_clear(&sdef->gruns[i]);
+		if (sdef->projection != NULL && !sdef->projection[i]) continue;
+		sorbet_column_chunk *chunk = &sdef->chunks[g * num_cols + i];
+		sorbet_buffer *b = &sdef->gbuf;
+		if (slot != NULL) {
+			b = &slot->bufs[i];
+		} else if (islot != NULL) {
+			const uint8_t *src = islot->buf.data + islot->buf.offset + (chunk->offset - sdef->groups[g].offset);
+			if (!reader_take_block(sdef, src, chunk->c_len, chunk->u_len)) {
+				reader_io_release(sdef, islot, g);
+				return false;
+			}
+		} else if (!sorbet_read_block(sdef, chunk->offset, chunk->c_len, chunk->u_len)) {
+			return false;
+		}
+		bool ok = false;
+		switch (chunk->encoding) {
+			case SORBET_ENCODING_PLAIN: {
+				ok = sorbet_decode_plain(b, vec, sdef->groups[g].n_rows);
+				break;
+			}
+			case SORBET_ENCODING_DICTIONARY: {
+				ok = (vec->type == STRING || vec->type == BINARY) &&
+						sorbet_decode_dictionary(b, vec, &sdef->gdicts[i], sdef->groups[g].n_rows);
+				break;
+			}
+			case SORBET_ENCODING_BITMAP: {
+				ok = sorbet_decode_bitmap(b, vec, sdef->groups[g].n_rows);
+				break;
+			}
+			case SORBET_ENCODING_XOR: {
+				ok = (vec->type == FLOAT || vec->type == DOUBLE) &&
+						sorbet_decode_xor(b, vec, sdef->groups[g].n_rows);
+				break;
+			}
+			case SORBET_ENCODING_RLE: {
+				// the runs are kept for batches that want them, and spread out for
+				// everything else
+				sorbet_vector *runs = &sdef->gruns[i];
+				ok = sorbet_encoding_fits(vec->type, SORBET_ENCODING_RLE) &&
+						sorbet_decode_rle(b, runs, sdef->groups[g].n_rows);
+				if (ok) sorbet_vector_append_slice(vec, runs, 0, runs->length);
+				break;
+			}
+			case SORBET_ENCODING_VARINT:
+			case SORBET_ENCODING_BITPACK:
+			case SORBET_ENCODING_DELTA:
+			case SORBET_ENCODING_DELTA_DELTA: {
+				ok = sorbet_is_integer_type(vec->type) &&
+						sorbet_decode_integers(b, vec, sdef->groups[g].n_rows, chunk->encoding, &sdef->scratch);
+				break;
+			}
+			default: {
+				printf("ERROR: column %d of row group %d has unknown encoding %d\n", i, g, chunk->encoding);
+			}
+		}
+		if (!ok) {
+			printf("ERROR: column %d of row group %d is corrupt\n", i, g);
+			if (slot != NULL) sorbet_ahead_release(sdef, g);
+			if (islot != NULL) reader_io_release(sdef, islot, g);
+			return false;
+		}
+	}
+	if (slot != NULL) {
+		sorbet_ahead_release(sdef, g);
+	}
+	if (islot != NULL) {
+		reader_io_release(sdef, islot, g);
+	}
+	sdef->cur_group = g;
+	sorbet_advise_row_group(sdef, g + 1);
+	reader_drop_behind(sdef, sdef->groups[g].offset, sdef->groups[g].c_len);
+	return true;
 }
 
-void sorbet_fill_read_buffer(sorbet_def *sdef) {
-	if (sdef->compression == 1) {
-		sorbet_fill_read_buffer_compressed(sdef);
-	} else {
-		sorbet_fill_read_buffer_uncompressed(sdef);
+// the current column's vector and the current row's index in it (COLUMNAR layout),
+// loading the row group that holds the row if it isn't loaded already
+sorbet_vector *reader_vector(sorbet_def *sdef, int64_t *idx) {
+	sorbet_row_group *rg = (sdef->cur_group >= 0) ? &sdef->groups[sdef->cur_group] : NULL;
+	if (rg == NULL || sdef->row_cnt < rg->first_row || sdef->row_cnt >= rg->first_row + rg->n_rows) {
+		if (sdef->row_cnt >= sdef->n_rows) return NULL;
+		if (!sorbet_load_column_group(sdef, sorbet_find_row_group(sdef, sdef->row_cnt))) return NULL;
+		rg = &sdef->groups[sdef->cur_group];
+	}
+	sorbet_vector *vec = &sdef->gcols[sdef->cur_col];
+	*idx = sdef->row_cnt - rg->first_row;
+	if (*idx >= vec->length) return NULL;
+	return vec;
+}
+
+// copies the current column's value out of its vector. returns false if it's null
+bool reader_vector_value(sorbet_def *sdef, void *v) {
+	int64_t i;
+	sorbet_vector *vec = reader_vector(sdef, &i);
+	if (vec == NULL || !sorbet_vector_is_valid(vec, i)) return false;
+	int32_t width = column_type_width[vec->type];
+	memcpy(v, (uint8_t *)vec->values.ptr + i * width, width);
+	return true;
+}
+
+// points at the current column's STRING/BINARY value in its vector
+bool reader_vector_bytes(sorbet_def *sdef, const uint8_t **v, int32_t *len) {
+	int64_t i;
+	sorbet_vector *vec = reader_vector(sdef, &i);
+	if (vec == NULL || !sorbet_vector_is_valid(vec, i)) {
+		*len = 0;
+		return false;
 	}
+	*v = sorbet_vector_bytes(vec, i, len);
+	return true;
 }
 
 void sorbet_read_bytes_raw(sorbet_def *sdef, uint8_t *v, int32_t len) {
+	if (sdef->version > 3) {
+		// values never span row groups, so running out of buffer means the
+		// next value is at the start of the next group
+		if (!sorbet_buffer_read(&sdef->gbuf, v, len)) {
+			if (!sorbet_load_row_group(sdef, sdef->cur_group + 1) || !sorbet_buffer_read(&sdef->gbuf, v, len)) {
+				memset(v, 0, len);
+			}
+		}
+		sdef->read_cnt += len;
+		return;
+	}
 	// TODO: test whether the length requested goes past the end of the file
 	if ((sdef->buf_offset + len) <= sdef->buf_size) {
 		// desired number of bytes already in the buffer. just read it.
@@ -568,8 +3838,8 @@ void sorbet_read_bytes_raw(sorbet_def *sdef, uint8_t *v, int32_t len) {
 		while (bytes_left > 0) {
 			sorbet_fill_read_buffer(sdef);
 			int bytes_to_read = (bytes_left >= sdef->buf_size) ? sdef->buf_size : bytes_left;
-			memcpy(dst, sdef->buf, sdef->buf_size);
-			dst += sdef->buf_size;
+			memcpy(dst, sdef->buf, bytes_to_read);
+			dst += bytes_to_read;
 			sdef->buf_offset += bytes_to_read;
 			bytes_left -= bytes_to_read;
 		}
@@ -628,13 +3898,103 @@ void reader_inc_col(sorbet_def *sdef) {
 	//sdef->cur_col = (sdef->cur_col + 1) % sdef->schema.numCols;
 }
 
+void sorbet_skip_bytes_raw(sorbet_def *sdef, int32_t len) {
+	if (sdef->version > 3) {
+		if (sdef->gbuf.offset + len > sdef->gbuf.size) {
+			if (!sorbet_load_row_group(sdef, sdef->cur_group + 1)) return;
+		}
+		sdef->gbuf.offset += len;
+		if (sdef->gbuf.offset > sdef->gbuf.size) sdef->gbuf.offset = sdef->gbuf.size;
+		sdef->read_cnt += len;
+		return;
+	}
+	uint8_t scratch[256];
+	while (len > 0) {
+		int32_t n = (len > sizeof(scratch)) ? sizeof(scratch) : len;
+		sorbet_read_bytes_raw(sdef, scratch, n);
+		len -= n;
+	}
+}
+
+// steps over the current column's value using its tag and length prefix
+void sorbet_skip_value(sorbet_def *sdef, column_type type) {
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		// values are looked up by row, so there is nothing to step over
+		reader_inc_col(sdef);
+		return;
+	}
+	uint8_t typ = sorbet_read_byte_raw(sdef);
+	if (typ == column_type_tag[type]) {
+		if (type == STRING || type == BINARY) {
+			sorbet_skip_bytes_raw(sdef, sorbet_read_int_raw(sdef));
+		} else {
+			sorbet_skip_bytes_raw(sdef, column_type_width[type]);
+		}
+	}
+	reader_inc_col(sdef);
+}
+
+// skips the rest of the current row
+void sorbet_skip_row(sorbet_def *sdef) {
+	do {
+		sorbet_skip_value(sdef, sdef->schema.cols[sdef->cur_col].type);
+	} while (sdef->cur_col != 0);
+}
+
+// moves the reader to a row, keeping the range it reads to
+bool reader_seek_row(sorbet_def *sdef, uint64_t row) {
+	if (row > sdef->n_rows) return false;
+	if (row == sdef->n_rows) {
+		// positioned at the end. the next sorbet_read_row returns NULL
+		sdef->row_cnt = sdef->n_rows;
+		sdef->cur_col = 0;
+		return true;
+	}
+	if (sdef->version < 4) {
+		// older files have no index, so we can only move forward by decoding
+		if (row < sdef->row_cnt || (row == sdef->row_cnt && sdef->cur_col != 0)) return false;
+		while (sdef->row_cnt < row) {
+			sorbet_skip_row(sdef);
+		}
+		return true;
+	}
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		// the row group is loaded when its first value is read
+		sdef->row_cnt = row;
+		sdef->cur_col = 0;
+		return true;
+	}
+	int32_t g = sorbet_find_row_group(sdef, row);
+	if (g != sdef->cur_group || row < sdef->row_cnt || sdef->cur_col != 0) {
+		if (!sorbet_load_row_group(sdef, g)) return false;
+	}
+	while (sdef->row_cnt < row) {
+		sorbet_skip_row(sdef);
+	}
+	return true;
+}
+
+bool sorbet_seek_row(sorbet_def *sdef, uint64_t row) {
+	// reads go back to stopping at the end of the file or split
+	sdef->end_row = sdef->last_row;
+	return reader_seek_row(sdef, row);
+}
+
+bool sorbet_skip_rows(sorbet_def *sdef, uint64_t n) {
+	return reader_seek_row(sdef, sdef->row_cnt + n);
+}
+
 bool sorbet_read_int(sorbet_def *sdef, int32_t *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[INTEGER]) {
-		*v = sorbet_read_int_raw(sdef);
-	} else if (typ == column_type_null_tag[INTEGER]) {
-		ret = false;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, v);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[INTEGER]) {
+			*v = sorbet_read_int_raw(sdef);
+		} else if (typ == column_type_null_tag[INTEGER]) {
+			ret = false;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -642,11 +4002,15 @@ bool sorbet_read_int(sorbet_def *sdef, int32_t *v) {
 
 bool sorbet_read_long(sorbet_def *sdef, int64_t *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[LONG]) {
-		*v = sorbet_read_long_raw(sdef);
-	} else if (typ == column_type_null_tag[LONG]) {
-		ret = false;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, v);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[LONG]) {
+			*v = sorbet_read_long_raw(sdef);
+		} else if (typ == column_type_null_tag[LONG]) {
+			ret = false;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -654,11 +4018,15 @@ bool sorbet_read_long(sorbet_def *sdef, int64_t *v) {
 
 bool sorbet_read_float(sorbet_def *sdef, float32_t *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[FLOAT]) {
-		*v = sorbet_read_float_raw(sdef);
-	} else if (typ == column_type_null_tag[FLOAT]) {
-		ret = false;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, v);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[FLOAT]) {
+			*v = sorbet_read_float_raw(sdef);
+		} else if (typ == column_type_null_tag[FLOAT]) {
+			ret = false;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -666,11 +4034,15 @@ bool sorbet_read_float(sorbet_def *sdef, float32_t *v) {
 
 bool sorbet_read_double(sorbet_def *sdef, float64_t *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[DOUBLE]) {
-		*v = sorbet_read_double_raw(sdef);
-	} else if (typ == column_type_null_tag[DOUBLE]) {
-		ret = false;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, v);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[DOUBLE]) {
+			*v = sorbet_read_double_raw(sdef);
+		} else if (typ == column_type_null_tag[DOUBLE]) {
+			ret = false;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -678,12 +4050,18 @@ bool sorbet_read_double(sorbet_def *sdef, float64_t *v) {
 
 bool sorbet_read_boolean(sorbet_def *sdef, bool *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[BOOLEAN]) {
-		uint8_t bv = sorbet_read_byte_raw(sdef);
-		*v = (bv == 0) ? false : true;
-	} else if (typ == column_type_null_tag[BOOLEAN]) {
-		ret = false;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		uint8_t bv;
+		ret = reader_vector_value(sdef, &bv);
+		if (ret) *v = (bv == 0) ? false : true;
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[BOOLEAN]) {
+			uint8_t bv = sorbet_read_byte_raw(sdef);
+			*v = (bv == 0) ? false : true;
+		} else if (typ == column_type_null_tag[BOOLEAN]) {
+			ret = false;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -691,15 +4069,24 @@ bool sorbet_read_boolean(sorbet_def *sdef, bool *v) {
 
 bool sorbet_read_string(sorbet_def *sdef, char *v, int32_t *len) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[STRING]) {
-		int32_t alen = sorbet_read_int_raw(sdef);
-		sorbet_read_bytes_raw(sdef, (uint8_t *)v, alen);
-		v[alen] = 0;
-		*len = alen;
-	} else if (typ == column_type_null_tag[STRING]) {
-		ret = false;
-		*len = 0;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		const uint8_t *src;
+		ret = reader_vector_bytes(sdef, &src, len);
+		if (ret) {
+			memcpy(v, src, *len);
+			v[*len] = 0;
+		}
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[STRING]) {
+			int32_t alen = sorbet_read_int_raw(sdef);
+			sorbet_read_bytes_raw(sdef, (uint8_t *)v, alen);
+			v[alen] = 0;
+			*len = alen;
+		} else if (typ == column_type_null_tag[STRING]) {
+			ret = false;
+			*len = 0;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -707,14 +4094,20 @@ bool sorbet_read_string(sorbet_def *sdef, char *v, int32_t *len) {
 
 bool sorbet_read_binary(sorbet_def *sdef, uint8_t *v, int32_t *len) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[BINARY]) {
-		int32_t alen = sorbet_read_int_raw(sdef);
-		sorbet_read_bytes_raw(sdef, v, alen);
-		*len = alen;
-	} else if (typ == column_type_null_tag[BINARY]) {
-		ret = false;
-		*len = 0;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		const uint8_t *src;
+		ret = reader_vector_bytes(sdef, &src, len);
+		if (ret) memcpy(v, src, *len);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[BINARY]) {
+			int32_t alen = sorbet_read_int_raw(sdef);
+			sorbet_read_bytes_raw(sdef, v, alen);
+			*len = alen;
+		} else if (typ == column_type_null_tag[BINARY]) {
+			ret = false;
+			*len = 0;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -722,14 +4115,21 @@ bool sorbet_read_binary(sorbet_def *sdef, uint8_t *v, int32_t *len) {
 
 bool sorbet_read_date(sorbet_def *sdef, sorbet_date *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[DATE]) {
-		int32_t dt = sorbet_read_int_raw(sdef);
+	int32_t dt = 0;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, &dt);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[DATE]) {
+			dt = sorbet_read_int_raw(sdef);
+		} else if (typ == column_type_null_tag[DATE]) {
+			ret = false;
+		}
+	}
+	if (ret) {
 		v->y = dt / 10000;
 		v->m = (dt - (10000 * v->y)) / 100;
 		v->d = (dt - ((10000 * v->y)+(100 * v->m)));
-	} else if (typ == column_type_null_tag[DATE]) {
-		ret = false;
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -737,11 +4137,15 @@ bool sorbet_read_date(sorbet_def *sdef, sorbet_date *v) {
 
 bool sorbet_read_datetime(sorbet_def *sdef, int64_t *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[DATETIME]) {
-		*v = sorbet_read_long_raw(sdef);
-	} else if (typ == column_type_null_tag[DATETIME]) {
-		ret = false;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, v);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[DATETIME]) {
+			*v = sorbet_read_long_raw(sdef);
+		} else if (typ == column_type_null_tag[DATETIME]) {
+			ret = false;
+		}
 	}
 	reader_inc_col(sdef);
 	return ret;
@@ -749,65 +4153,732 @@ bool sorbet_read_datetime(sorbet_def *sdef, int64_t *v) {
 
 bool sorbet_read_time(sorbet_def *sdef, sorbet_time *v) {
 	bool ret = true;
-	uint8_t typ = sorbet_read_byte_raw(sdef);
-	if (typ == column_type_tag[TIME]) {
-		int32_t dt = sorbet_read_int_raw(sdef);
+	int32_t dt = 0;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_value(sdef, &dt);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[TIME]) {
+			dt = sorbet_read_int_raw(sdef);
+		} else if (typ == column_type_null_tag[TIME]) {
+			ret = false;
+		}
+	}
+	if (ret) {
 		v->h = dt / 10000;
 		v->m = (dt - (10000 * v->h)) / 100;
 		v->s = (dt - ((10000 * v->h)+(100 * v->m)));
-	} else if (typ == column_type_null_tag[TIME]) {
-		v = NULL;
 	}
 	reader_inc_col(sdef);
+	return ret;
+}
+
+// points v at the current column's STRING/BINARY value instead of copying it out.
+// sorbet_read_row keeps the reference when the file is mapped and copies it otherwise.
+bool sorbet_read_bytes_ref(sorbet_def *sdef, column_type type, bin_val *v) {
+	bool ret = true;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		ret = reader_vector_bytes(sdef, (const uint8_t **)&v->val, &v->len);
+	} else {
+		uint8_t typ = sorbet_read_byte_raw(sdef);
+		if (typ == column_type_tag[type]) {
+			// the tag and length are in the same row group as the value, so the
+			// group is already loaded
+			v->len = sorbet_read_int_raw(sdef);
+			v->val = sdef->gbuf.data + sdef->gbuf.offset;
+			sorbet_skip_bytes_raw(sdef, v->len);
+		} else if (typ == column_type_null_tag[type]) {
+			ret = false;
+			v->len = 0;
+		}
+	}
+	reader_inc_col(sdef);
+	return ret;
+}
+
+// copies the current column's STRING/BINARY value into the scratch arena for
+// sorbet_read_row, with a 0 after it so STRING values are C strings. nulls read as
+// empty values
+bool reader_copy_bytes(sorbet_def *sdef, column_type type, bin_val *v) {
+	bin_val ref = {0, NULL};
+	bool ret = true;
+	if (sdef->version > 3) {
+		ret = sorbet_read_bytes_ref(sdef, type, &ref);
+	} else {
+		ret = (sorbet_read_byte_raw(sdef) == column_type_tag[type]);
+		if (ret) ref.len = sorbet_read_int_raw(sdef);
+	}
+	v->len = (ret && ref.len > 0) ? ref.len : 0;
+	v->val = (uint8_t *)sorbet_arena_alloc(&sdef->scratch, v->len + 1);
+	if (ref.val != NULL) {
+		memcpy(v->val, ref.val, v->len);
+	} else if (v->len > 0) {
+		// files before version 4 are streamed, so the value is read straight into place
+		sorbet_read_bytes_raw(sdef, v->val, v->len);
+	}
+	v->val[v->len] = 0;
+	if (sdef->version < 4) reader_inc_col(sdef);
+	return ret;
+}
+
+// moves a reader at the start of a row past the row groups its predicates rule out.
+// returns false if it couldn't seek
+bool reader_skip_groups(sorbet_def *sdef) {
+	if (sdef->group_skip == NULL || sdef->cur_col != 0 || sdef->row_cnt >= sdef->end_row) return true;
+	int32_t g = sorbet_find_row_group(sdef, sdef->row_cnt);
+	if (g < 0 || !sdef->group_skip[g]) return true;
+	while (g < sdef->n_groups && sdef->group_skip[g]) g++;
+	if (g == sdef->n_groups || sdef->groups[g].first_row >= sdef->end_row) {
+		sdef->row_cnt = sdef->end_row;
+		return true;
+	}
+	return reader_seek_row(sdef, sdef->groups[g].first_row);
+}
+
+// reads column i's value into the row. returns false if it's null
+bool reader_read_column(sorbet_def *sdef, int i) {
+	switch (sdef->schema.cols[i].type) {
+		case INTEGER: {
+			return sorbet_read_int(sdef, &sdef->row[i].intval);
+		}
+		case LONG: {
+			return sorbet_read_long(sdef, &sdef->row[i].longval);
+		}
+		case FLOAT: {
+			return sorbet_read_float(sdef, &sdef->row[i].floatval);
+		}
+		case DOUBLE: {
+			return sorbet_read_double(sdef, &sdef->row[i].doubleval);
+		}
+		case BOOLEAN: {
+			return sorbet_read_boolean(sdef, &sdef->row[i].boolval);
+		}
+		case STRING: {
+			if (sdef->map != NULL) {
+				return sorbet_read_bytes_ref(sdef, STRING, &sdef->row[i].strval);
+			}
+			return reader_copy_bytes(sdef, STRING, &sdef->row[i].strval);
+		}
+		case BINARY: {
+			if (sdef->map != NULL) {
+				return sorbet_read_bytes_ref(sdef, BINARY, &sdef->row[i].binval);
+			}
+			return reader_copy_bytes(sdef, BINARY, &sdef->row[i].binval);
+		}
+		case DATE: {
+			return sorbet_read_date(sdef, &sdef->row[i].dateval);
+		}
+		case DATETIME: {
+			return sorbet_read_datetime(sdef, &sdef->row[i].datetimeval);
+		}
+		case TIME: {
+			return sorbet_read_time(sdef, &sdef->row[i].timeval);
+		}
+		case NULL_COL_TYPE: {
+			return false;
+		}
+	}
+	return false;
 }
 
 col_val *sorbet_read_row(sorbet_def *sdef) {
+	sorbet_arena_reset(&sdef->scratch);
+	if (!reader_skip_groups(sdef)) return NULL;
+	if (sdef->row_cnt >= sdef->end_row) return NULL;
 	for (int i=0; i<sdef->schema.numCols; i++) {
-		switch (sdef->schema.cols[i].type) {
-			case INTEGER: {
-				sorbet_read_int(sdef, &sdef->row[i].intval);
-				break;
+		if (sdef->projection != NULL && !sdef->projection[i]) {
+			// not wanted. step over it without copying it into the row
+			sorbet_skip_value(sdef, sdef->schema.cols[i].type);
+			continue;
+		}
+		reader_read_column(sdef, i);
+	}
+	return sdef->row;
+}
+
+void sorbet_batch_init(sorbet_batch *batch, const sorbet_schema *schema) {
+	batch->numCols = schema->numCols;
+	batch->n_rows = 0;
+	batch->cols = (sorbet_vector *)malloc(schema->numCols * sizeof(sorbet_vector));
+	for (int i = 0; i < schema->numCols; i++) {
+		sorbet_vector_init(&batch->cols[i], schema->cols[i].type);
+	}
+}
+
+void sorbet_batch_free(sorbet_batch *batch) {
+	for (int i = 0; i < batch->numCols; i++) {
+		sorbet_vector_free(&batch->cols[i]);
+	}
+	free(batch->cols);
+	batch->cols = NULL;
+	batch->numCols = 0;
+	batch->n_rows = 0;
+}
+
+// decodes the next n rows of the loaded row group (ROW layout) straight out of gbuf
+bool reader_decode_rows(sorbet_def *sdef, sorbet_batch *batch, int64_t n) {
+	sorbet_buffer *b = &sdef->gbuf;
+	size_t start = b->offset;
+	int num_cols = sdef->schema.numCols;
+	for (int c = 0; c < num_cols; c++) {
+		sorbet_vector_reserve(&batch->cols[c], n);
+	}
+	for (int64_t r = 0; r < n; r++) {
+		for (int c = 0; c < num_cols; c++) {
+			sorbet_vector *vec = &batch->cols[c];
+			bool wanted = (sdef->projection == NULL || sdef->projection[c]);
+			uint8_t typ;
+			if (!sorbet_buffer_read(b, &typ, 1)) return false;
+			if (typ == column_type_null_tag[vec->type]) {
+				if (wanted) sorbet_vector_append_null(vec);
+				continue;
 			}
-			case LONG: {
-				sorbet_read_long(sdef, &sdef->row[i].longval);
-				break;
+			if (typ != column_type_tag[vec->type]) return false;
+			int32_t len = column_type_width[vec->type];
+			if (vec->type == STRING || vec->type == BINARY) {
+				if (!sorbet_buffer_read(b, &len, 4)) return false;
 			}
-			case FLOAT: {
-				sorbet_read_float(sdef, &sdef->row[i].floatval);
+			if (len < 0 || b->offset + len > b->size) return false;
+			if (wanted) sorbet_vector_append(vec, b->data + b->offset, len);
+			b->offset += len;
+		}
+	}
+	sdef->read_cnt += b->offset - start;
+	sdef->row_cnt += n;
+	return true;
+}
+
+// reads the current column's value with the stream reader and appends it to vec.
+// files older than version 4 have no row groups to decode in one go.
+void reader_append_value(sorbet_def *sdef, sorbet_vector *vec) {
+	uint8_t typ = sorbet_read_byte_raw(sdef);
+	if (typ != column_type_tag[vec->type]) {
+		sorbet_vector_append_null(vec);
+	} else if (vec->type == STRING || vec->type == BINARY) {
+		int32_t len = sorbet_read_int_raw(sdef);
+		sdef->cbuf.size = 0;
+		sorbet_buffer_reserve(&sdef->cbuf, len);
+		sorbet_read_bytes_raw(sdef, sdef->cbuf.data, len);
+		sorbet_vector_append(vec, sdef->cbuf.data, len);
+	} else {
+		uint8_t v[8];
+		sorbet_read_bytes_raw(sdef, v, column_type_width[vec->type]);
+		sorbet_vector_append(vec, v, 0);
+	}
+	reader_inc_col(sdef);
+}
+
+int64_t sorbet_read_batch(sorbet_def *sdef, sorbet_batch *batch, int64_t max_rows) {
+	int num_cols = sdef->schema.numCols;
+	for (int c = 0; c < num_cols; c++) {
+		sorbet_vector_clear(&batch->cols[c]);
+	}
+	batch->n_rows = 0;
+	sorbet_arena_reset(&sdef->scratch);
+	if (sdef->row_cnt >= sdef->end_row || max_rows <= 0) return 0;
+	if (sdef->cur_col != 0) {
+		printf("ERROR: a batch has to start at the beginning of a row\n");
+		return -1;
+	}
+	if (!reader_skip_groups(sdef)) return -1;
+	if (sdef->row_cnt >= sdef->end_row) return 0;
+	int64_t n = sdef->end_row - sdef->row_cnt;
+	if (n > max_rows) n = max_rows;
+	if (sdef->version < 4) {
+		for (int64_t r = 0; r < n; r++) {
+			for (int c = 0; c < num_cols; c++) {
+				if (sdef->projection != NULL && !sdef->projection[c]) {
+					sorbet_skip_value(sdef, sdef->schema.cols[c].type);
+				} else {
+					reader_append_value(sdef, &batch->cols[c]);
+				}
+			}
+		}
+		batch->n_rows = n;
+		return n;
+	}
+	// batches stop at the end of the row group, so only one group is ever decoded
+	int32_t g = sorbet_find_row_group(sdef, sdef->row_cnt);
+	sorbet_row_group *rg = &sdef->groups[g];
+	if (n > rg->first_row + rg->n_rows - sdef->row_cnt) n = rg->first_row + rg->n_rows - sdef->row_cnt;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		if (g != sdef->cur_group && !sorbet_load_column_group(sdef, g)) return -1;
+		int64_t start = sdef->row_cnt - rg->first_row;
+		for (int c = 0; c < num_cols; c++) {
+			if (sdef->projection != NULL && !sdef->projection[c]) continue;
+			if (sdef->rle_runs && sdef->gruns[c].n_runs > 0) {
+				sorbet_vector_slice_runs(&batch->cols[c], &sdef->gruns[c], start, n);
+				continue;
+			}
+			if (sdef->dictionary_codes && sdef->gcols[c].dictionary != NULL) {
+				sorbet_vector_set_dictionary(&batch->cols[c], sdef->gcols[c].dictionary);
+			}
+			sorbet_vector_append_slice(&batch->cols[c], &sdef->gcols[c], start, n);
+		}
+		sdef->row_cnt += n;
+	} else {
+		if (g != sdef->cur_group && !reader_seek_row(sdef, sdef->row_cnt)) return -1;
+		if (!reader_decode_rows(sdef, batch, n)) {
+			printf("ERROR: row group %d is corrupt\n", g);
+			return -1;
+		}
+	}
+	batch->n_rows = n;
+	return n;
+}
+
+// days from 1970-01-01 to a date in the proleptic Gregorian calendar
+int32_t sorbet_days_from_civil(int32_t y, int32_t m, int32_t d) {
+	y -= (m <= 2);
+	int32_t era = ((y >= 0) ? y : y - 399) / 400;
+	int32_t yoe = y - era * 400;
+	int32_t doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+	int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+// the Arrow format string of each column type
+const char *arrow_format[] = {"n", "i", "l", "f", "g", "b", "u", "z", "tdD", "tss:", "tts"};
+
+// an exported column. the array's buffers point into vec, which it owns
+typedef struct s_arrow_column {
+	sorbet_vector vec;
+	const void *buffers[3];
+} arrow_column;
+
+// an exported batch and its children
+typedef struct s_arrow_batch {
+	struct ArrowArray **children;
+	struct ArrowArray *arrays;
+} arrow_batch;
+
+void arrow_release_column(struct ArrowArray *a) {
+	arrow_column *col = (arrow_column *)a->private_data;
+	sorbet_vector_free(&col->vec);
+	free(col);
+	a->release = NULL;
+}
+
+void arrow_release_batch(struct ArrowArray *a) {
+	arrow_batch *ab = (arrow_batch *)a->private_data;
+	for (int64_t i = 0; i < a->n_children; i++) {
+		// the consumer may have moved a child out and released it already
+		if (ab->arrays[i].release != NULL) ab->arrays[i].release(&ab->arrays[i]);
+	}
+	free(ab->children);
+	free(ab->arrays);
+	free(ab);
+	a->release = NULL;
+}
+
+// a child schema's private data is its name, and a struct's is its children
+void arrow_release_column_schema(struct ArrowSchema *s) {
+	free(s->private_data);
+	s->release = NULL;
+}
+
+void arrow_release_schema(struct ArrowSchema *s) {
+	for (int64_t i = 0; i < s->n_children; i++) {
+		if (s->children[i]->release != NULL) s->children[i]->release(s->children[i]);
+	}
+	free(s->children);
+	free(s->private_data);
+	s->release = NULL;
+}
+
+bool reader_arrow_wanted(const sorbet_def *sdef, int c) {
+	return (sdef->projection == NULL || sdef->projection[c]);
+}
+
+void reader_arrow_schema(sorbet_def *sdef, struct ArrowSchema *schema) {
+	int64_t n = 0;
+	for (int c = 0; c < sdef->schema.numCols; c++) {
+		if (reader_arrow_wanted(sdef, c)) n++;
+	}
+	struct ArrowSchema **children = (struct ArrowSchema **)malloc(n * sizeof(struct ArrowSchema *));
+	struct ArrowSchema *fields = (struct ArrowSchema *)malloc(n * sizeof(struct ArrowSchema));
+	int64_t i = 0;
+	for (int c = 0; c < sdef->schema.numCols; c++) {
+		if (!reader_arrow_wanted(sdef, c)) continue;
+		struct ArrowSchema *f = &fields[i];
+		memset(f, 0, sizeof(struct ArrowSchema));
+		f->format = arrow_format[sdef->schema.cols[c].type];
+		f->private_data = strdup(sdef->schema.cols[c].name);
+		f->name = (const char *)f->private_data;
+		f->flags = ARROW_FLAG_NULLABLE;
+		f->release = arrow_release_column_schema;
+		children[i++] = f;
+	}
+	memset(schema, 0, sizeof(struct ArrowSchema));
+	schema->format = "+s";
+	schema->name = "";
+	schema->n_children = n;
+	schema->children = children;
+	schema->release = arrow_release_schema;
+	schema->private_data = fields;
+}
+
+// turns the vector's values into Arrow's representation where it differs: BOOLEAN
+// bytes into bits, and packed DATE (years since 1900, like sorbet_date) and TIME
+// values into days and seconds. done in place, since none of them gets wider
+void arrow_convert_values(sorbet_vector *vec) {
+	int64_t n = vec->length;
+	switch (vec->type) {
+		case BOOLEAN: {
+			uint8_t *v = vec->values.boolval;
+			for (int64_t i = 0; i < n; i += 8) {
+				uint8_t bits = 0;
+				for (int64_t j = i; j < n && j < i + 8; j++) {
+					bits |= (v[j] != 0) << (j - i);
+				}
+				v[i >> 3] = bits;
+			}
+			break;
+		}
+		case DATE: {
+			for (int64_t i = 0; i < n; i++) {
+				int32_t dt = vec->values.dateval[i];
+				vec->values.dateval[i] = sorbet_days_from_civil(1900 + dt / 10000, (dt / 100) % 100, dt % 100);
+			}
+			break;
+		}
+		case TIME: {
+			for (int64_t i = 0; i < n; i++) {
+				int32_t t = vec->values.timeval[i];
+				vec->values.timeval[i] = (t / 10000) * 3600 + ((t / 100) % 100) * 60 + t % 100;
+			}
+			break;
+		}
+		default: {
+		}
+	}
+}
+
+// moves vec's values into an Arrow array, leaving vec empty
+void arrow_export_column(sorbet_vector *vec, struct ArrowArray *a) {
+	// buffers Arrow needs but an empty vector never allocated
+	static const int32_t empty[2] = {0, 0};
+	arrow_column *col = (arrow_column *)malloc(sizeof(arrow_column));
+	col->vec = *vec;
+	sorbet_vector_init(vec, vec->type);
+	arrow_convert_values(&col->vec);
+	memset(a, 0, sizeof(struct ArrowArray));
+	a->length = col->vec.length;
+	a->null_count = col->vec.null_count;
+	col->buffers[0] = (col->vec.null_count > 0) ? col->vec.validity : NULL;
+	if (col->vec.type == STRING || col->vec.type == BINARY) {
+		col->buffers[1] = (col->vec.offsets != NULL) ? (const void *)col->vec.offsets : empty;
+		col->buffers[2] = (col->vec.data != NULL) ? (const void *)col->vec.data : empty;
+		a->n_buffers = 3;
+	} else {
+		col->buffers[1] = (col->vec.values.ptr != NULL) ? col->vec.values.ptr : empty;
+		a->n_buffers = 2;
+	}
+	a->buffers = col->buffers;
+	a->release = arrow_release_column;
+	a->private_data = col;
+}
+
+// hands the decoded columns of the row group at the reader over to batch whole
+// (COLUMNAR layout), so they don't have to be copied. returns the number of rows,
+// 0 if the reader isn't at the start of a group it can hand over and -1 on error
+int64_t reader_take_group(sorbet_def *sdef, sorbet_batch *batch) {
+	if (sdef->layout != SORBET_LAYOUT_COLUMNAR || sdef->cur_col != 0) return 0;
+	if (!reader_skip_groups(sdef)) return -1;
+	if (sdef->row_cnt >= sdef->end_row) return 0;
+	int32_t g = sorbet_find_row_group(sdef, sdef->row_cnt);
+	sorbet_row_group *rg = &sdef->groups[g];
+	if (sdef->row_cnt != rg->first_row || rg->first_row + rg->n_rows > sdef->end_row) return 0;
+	if (g != sdef->cur_group && !sorbet_load_column_group(sdef, g)) return -1;
+	for (int c = 0; c < sdef->schema.numCols; c++) {
+		if (sdef->projection != NULL && !sdef->projection[c]) continue;
+		sorbet_vector *vec = &batch->cols[c];
+		if (sdef->gcols[c].dictionary != NULL) {
+			// the dictionary goes with the row group, so its values are copied out
+			sorbet_vector_append_slice(vec, &sdef->gcols[c], 0, rg->n_rows);
+		} else {
+			sorbet_vector tmp = *vec;
+			*vec = sdef->gcols[c];
+			sdef->gcols[c] = tmp;
+		}
+	}
+	// the group's vectors are gone, so it has to be loaded again to be read
+	sdef->cur_group = -1;
+	sdef->row_cnt += rg->n_rows;
+	batch->n_rows = rg->n_rows;
+	return rg->n_rows;
+}
+
+int64_t sorbet_read_arrow_batch(sorbet_def *sdef, struct ArrowArray *out, struct ArrowSchema *schema) {
+	// nothing is handed over unless rows are read
+	out->release = NULL;
+	if (schema != NULL) schema->release = NULL;
+	// Arrow arrays hold values, not dictionary codes or runs
+	bool codes = sdef->dictionary_codes;
+	bool runs = sdef->rle_runs;
+	sdef->dictionary_codes = false;
+	sdef->rle_runs = false;
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef->schema);
+	int64_t n = reader_take_group(sdef, &batch);
+	if (n == 0) n = sorbet_read_batch(sdef, &batch, SORBET_DEFAULT_ROW_GROUP_SIZE);
+	sdef->dictionary_codes = codes;
+	sdef->rle_runs = runs;
+	if (n > 0) {
+		arrow_batch *ab = (arrow_batch *)malloc(sizeof(arrow_batch));
+		int64_t k = 0;
+		for (int c = 0; c < batch.numCols; c++) {
+			if (reader_arrow_wanted(sdef, c)) k++;
+		}
+		ab->children = (struct ArrowArray **)malloc(k * sizeof(struct ArrowArray *));
+		ab->arrays = (struct ArrowArray *)malloc(k * sizeof(struct ArrowArray));
+		int64_t i = 0;
+		for (int c = 0; c < batch.numCols; c++) {
+			if (!reader_arrow_wanted(sdef, c)) continue;
+			arrow_export_column(&batch.cols[c], &ab->arrays[i]);
+			ab->children[i] = &ab->arrays[i];
+			i++;
+		}
+		static const void *no_buffers[1] = {NULL};
+		memset(out, 0, sizeof(struct ArrowArray));
+		out->length = n;
+		out->n_buffers = 1;
+		out->buffers = no_buffers;
+		out->n_children = k;
+		out->children = ab->children;
+		out->release = arrow_release_batch;
+		out->private_data = ab;
+		if (schema != NULL) reader_arrow_schema(sdef, schema);
+	}
+	sorbet_batch_free(&batch);
+	return n;
+}
+
+// false if the group count doesn't match the section's length, as a corrupt footer
+// would otherwise send the reader past the end of the index
+bool read_row_group_index(sorbet_def *sdef, sorbet_buffer *b, int64_t len) {
+	int32_t n_groups = (len >= 4) ? sorbet_buffer_read_int(b) : -1;
+	if (n_groups < 0 || len != 4 + (int64_t)n_groups * 36) {
+		printf("%s has a row group index of the wrong size\n", sdef->filename);
+		return false;
+	}
+	sdef->n_groups = n_groups;
+	sdef->groups_cap = sdef->n_groups;
+	sdef->groups = (sorbet_row_group *)sorbet_arena_alloc(&sdef->arena, sdef->n_groups * sizeof(sorbet_row_group));
+	for (int i=0; i<sdef->n_groups; i++) {
+		sorbet_row_group *rg = &sdef->groups[i];
+		rg->first_row = sorbet_buffer_read_long(b);
+		rg->n_rows = sorbet_buffer_read_int(b);
+		rg->offset = sorbet_buffer_read_long(b);
+		rg->c_len = sorbet_buffer_read_long(b);
+		rg->u_len = sorbet_buffer_read_long(b);
+	}
+	return true;
+}
+
+void read_zone_maps(sorbet_def *sdef, sorbet_buffer *b, int64_t len) {
+	int64_t n_zones = (int64_t)sdef->n_groups * sdef->schema.numCols;
+	if (len != n_zones * ZONE_RECORD_SIZE) {
+		printf("%s has a zone map section of the wrong size. reading without it\n", sdef->filename);
+		return;
+	}
+	sdef->zones = (sorbet_zone *)sorbet_arena_calloc(&sdef->arena, n_zones, sizeof(sorbet_zone));
+	for (int64_t i = 0; i < n_zones; i++) {
+		sorbet_zone *z = &sdef->zones[i];
+		uint8_t flags = 0;
+		z->n_nulls = sorbet_buffer_read_int(b);
+		sorbet_buffer_read(b, &flags, 1);
+		sorbet_buffer_read(b, &z->min_len, 1);
+		sorbet_buffer_read(b, &z->max_len, 1);
+		sorbet_buffer_read(b, z->min.bytes, SORBET_ZONE_BYTES);
+		sorbet_buffer_read(b, z->max.bytes, SORBET_ZONE_BYTES);
+		z->has_values = flags & 1;
+		z->max_truncated = (flags >> 1) & 1;
+		if (z->min_len > SORBET_ZONE_BYTES) z->min_len = SORBET_ZONE_BYTES;
+		if (z->max_len > SORBET_ZONE_BYTES) z->max_len = SORBET_ZONE_BYTES;
+	}
+}
+
+// keeps the Bloom filter section and indexes its filters by row group and column
+void read_bloom_filters(sorbet_def *sdef, sorbet_buffer *b, int64_t len) {
+	sorbet_buffer_reserve(&sdef->blooms, len);
+	sorbet_buffer_read(b, sdef->blooms.data, len);
+	sdef->blooms.size = len;
+	int num_cols = sdef->schema.numCols;
+	sdef->bloom_index = (sorbet_bloom *)sorbet_arena_calloc(&sdef->arena, (int64_t)sdef->n_groups * num_cols, sizeof(sorbet_bloom));
+	int64_t pos = 0;
+	while (pos + 12 <= len) {
+		uint32_t head[3];
+		memcpy(head, sdef->blooms.data + pos, sizeof(head));
+		pos += sizeof(head);
+		int64_t n_bytes = (int64_t)head[2] * 8 * sizeof(uint32_t);
+		if (head[0] >= (uint32_t)sdef->n_groups || head[1] >= (uint32_t)num_cols || pos + n_bytes > len) {
+			printf("%s has a bad Bloom filter section. reading without it\n", sdef->filename);
+			memset(sdef->bloom_index, 0, (int64_t)sdef->n_groups * num_cols * sizeof(sorbet_bloom));
+			return;
+		}
+		sorbet_bloom *bf = &sdef->bloom_index[(int64_t)head[0] * num_cols + head[1]];
+		bf->n_blocks = head[2];
+		bf->words = (const uint32_t *)(sdef->blooms.data + pos);
+		pos += n_bytes;
+	}
+}
+
+// the key index: the sort column, the interval between samples and their count, then
+// the samples as a BITMAP chunk
+void read_key_index(sorbet_def *sdef, sorbet_buffer *b, int64_t len) {
+	int32_t col = sorbet_buffer_read_int(b);
+	int32_t interval = sorbet_buffer_read_int(b);
+	int64_t n = sorbet_buffer_read_long(b);
+	if (len < 16 || col < 0 || col >= sdef->schema.numCols || interval <= 0 ||
+			n != ((int64_t)sdef->n_rows + interval - 1) / interval) {
+		printf("%s has a bad key index. reading without it\n", sdef->filename);
+		return;
+	}
+	sdef->key_index = (sorbet_vector *)malloc(sizeof(sorbet_vector));
+	sorbet_vector_init(sdef->key_index, sdef->schema.cols[col].type);
+	if (!sorbet_decode_bitmap(b, sdef->key_index, n)) {
+		printf("%s has a bad key index. reading without it\n", sdef->filename);
+		sorbet_vector_free(sdef->key_index);
+		free(sdef->key_index);
+		sdef->key_index = NULL;
+		return;
+	}
+	sdef->sorted = true;
+	sdef->sort_column = col;
+	sdef->key_interval = interval;
+}
+
+void read_column_stats(sorbet_def *sdef, sorbet_buffer *b, int64_t len) {
+	size_t end = b->offset + len;
+	for (int i = 0; i < sdef->schema.numCols; i++) {
+		column_stats *st = &sdef->cstats[i];
+		sorbet_zone *z = &st->range;
+		uint8_t flags = 0;
+		uint8_t precision = 0;
+		int32_t k = 0;
+		bool ok = sorbet_buffer_read(b, &st->count, 8) &&
+				sorbet_buffer_read(b, &st->sum.longval, 8) &&
+				sorbet_buffer_read(b, &flags, 1) &&
+				sorbet_buffer_read(b, &z->min_len, 1) &&
+				sorbet_buffer_read(b, &z->max_len, 1) &&
+				sorbet_buffer_read(b, z->min.bytes, SORBET_ZONE_BYTES) &&
+				sorbet_buffer_read(b, z->max.bytes, SORBET_ZONE_BYTES) &&
+				sorbet_buffer_read(b, &precision, 1);
+		z->has_values = flags & 1;
+		z->max_truncated = (flags >> 1) & 1;
+		if (ok && precision >= 4 && precision <= 16 && b->offset + ((size_t)1 << precision) <= end) {
+			st->hll_precision = precision;
+			st->hll = (uint8_t *)sorbet_arena_alloc(&sdef->arena, (size_t)1 << precision);
+			sorbet_buffer_read(b, st->hll, (size_t)1 << precision);
+		} else if (precision != 0) {
+			ok = false;
+		}
+		ok = ok && sorbet_buffer_read(b, &k, 4);
+		if (ok && k > 0 && k <= 65536) {
+			sorbet_quantiles *q = sorbet_quantiles_new(k);
+			int32_t n_levels = sorbet_buffer_read_int(b);
+			for (int32_t l = 0; ok && l < n_levels && l < 64; l++) {
+				sorbet_quantiles_grow(q);
+				int32_t size = sorbet_buffer_read_int(b);
+				ok = (size >= 0 && size <= k && sorbet_buffer_read(b, q->items + (int64_t)l * k, size * sizeof(float64_t)));
+				if (ok) q->sizes[l] = size;
+			}
+			st->quantiles = q;
+		} else if (k != 0) {
+			ok = false;
+		}
+		if (!ok || b->offset > end) {
+			printf("%s has corrupt column stats\n", sdef->filename);
+			return;
+		}
+	}
+}
+
+// false unless there's a chunk for every column of every row group, as the groups
+// are read by indexing into the chunks
+bool read_column_chunk_index(sorbet_def *sdef, sorbet_buffer *b, int64_t len) {
+	int64_t n_chunks = (int64_t)sdef->n_groups * sdef->schema.numCols;
+	if (len != n_chunks * 25) {
+		printf("%s has a column chunk index of the wrong size\n", sdef->filename);
+		return false;
+	}
+	sdef->chunks = (sorbet_column_chunk *)sorbet_arena_alloc(&sdef->arena, n_chunks * sizeof(sorbet_column_chunk));
+	for (int64_t i = 0; i < n_chunks; i++) {
+		sdef->chunks[i].offset = sorbet_buffer_read_long(b);
+		sdef->chunks[i].c_len = sorbet_buffer_read_long(b);
+		sdef->chunks[i].u_len = sorbet_buffer_read_long(b);
+		sorbet_buffer_read(b, &sdef->chunks[i].encoding, 1);
+	}
+	return true;
+}
+
+bool read_footer(sorbet_def *sdef) {
+	fseeko(sdef->f, 0, SEEK_END);
+	int64_t end = ftello(sdef->f);
+	if (sdef->index_offset <= 0 || sdef->index_offset >= end) {
+		printf("%s has no row group index. was the writer closed?\n", sdef->filename);
+		return false;
+	}
+	sorbet_buffer *b = &sdef->cbuf;
+	b->size = 0;
+	b->offset = 0;
+	sorbet_buffer_reserve(b, end - sdef->index_offset);
+	fseeko(sdef->f, sdef->index_offset, SEEK_SET);
+	b->size = fread(b->data, sizeof(uint8_t), end - sdef->index_offset, sdef->f);
+	b->offset = 0;
+	while (true) {
+		int32_t id = sorbet_buffer_read_int(b);
+		int64_t len = sorbet_buffer_read_long(b);
+		if (id == SECTION_END) break;
+		if (len < 0 || b->offset + len > b->size) {
+			printf("%s has a truncated footer\n", sdef->filename);
+			return false;
+		}
+		size_t next = b->offset + len;
+		switch (id) {
+			case SECTION_ROW_GROUPS: {
+				if (!read_row_group_index(sdef, b, len)) return false;
 				break;
 			}
-			case DOUBLE: {
-				sorbet_read_double(sdef, &sdef->row[i].doubleval);
+			case SECTION_COLUMN_CHUNKS: {
+				if (!read_column_chunk_index(sdef, b, len)) return false;
 				break;
 			}
-			case BOOLEAN: {
-				sorbet_read_boolean(sdef, &sdef->row[i].boolval);
+			case SECTION_ZONE_MAPS: {
+				read_zone_maps(sdef, b, len);
 				break;
 			}
-			case STRING: {
-				sorbet_read_string(sdef, sdef->row[i].strval.val, &sdef->row[i].strval.len);
+			case SECTION_BLOOM_FILTERS: {
+				read_bloom_filters(sdef, b, len);
 				break;
 			}
-			case BINARY: {
-				int len;
-				sorbet_read_binary(sdef, sdef->row[i].binval.val, &sdef->row[i].binval.len);
+			case SECTION_KEY_INDEX: {
+				read_key_index(sdef, b, len);
 				break;
 			}
-			case DATE: {
-				sorbet_read_date(sdef, &sdef->row[i].dateval);
+			case SECTION_COLUMN_STATS: {
+				read_column_stats(sdef, b, len);
 				break;
 			}
-			case DATETIME: {
-				sorbet_read_datetime(sdef, &sdef->row[i].datetimeval);
+			case SECTION_DICTIONARY: {
+				uint8_t *dict = (uint8_t *)sorbet_arena_alloc(&sdef->arena, len);
+				sorbet_buffer_read(b, dict, len);
+				sdef->dictionary = dict;
+				sdef->dictionary_size = len;
 				break;
 			}
-			case TIME: {
-				sorbet_read_time(sdef, &sdef->row[i].timeval);
-				break;
+			default: {
+				// a section written by a newer version. skip it
 			}
 		}
+		b->offset = next;
 	}
-	return sdef->row;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR && sdef->chunks == NULL) {
+		printf("%s has no column chunk index\n", sdef->filename);
+		return false;
+	}
+	return true;
 }
 
 bool read_header(sorbet_def *sdef) {
@@ -829,14 +4900,27 @@ bool read_header(sorbet_def *sdef) {
 	// TODO: do something about negative rows
 	sdef->uc_size = sorbet_read_long_raw(sdef);
 	// TODO: do something about 0 or negative size
+	if (ver > 3) {
+		sdef->row_group_size = sorbet_read_int_raw(sdef);
+		sdef->index_offset = sorbet_read_long_raw(sdef);
+	} else {
+		sdef->row_group_size = 0;
+		sdef->index_offset = 0;
+	}
+	if (ver > 4) {
+		sdef->layout = sorbet_read_byte_raw(sdef);
+	} else {
+		sdef->layout = SORBET_LAYOUT_ROW;
+	}
 	sdef->schema.numCols = sorbet_read_int_raw(sdef);
 	// TODO: do something about 0 or negative cols
-	sdef->schema.cols = (data_column *)malloc(sdef->schema.numCols * sizeof(data_column));
-	sdef->cstats = (column_stats *)malloc(sdef->schema.numCols * sizeof(column_stats));
+	sdef->schema.cols = (data_column *)sorbet_arena_alloc(&sdef->arena, sdef->schema.numCols * sizeof(data_column));
+	sdef->cstats = (column_stats *)sorbet_arena_calloc(&sdef->arena, sdef->schema.numCols, sizeof(column_stats));
 	for (int i=0; i<sdef->schema.numCols; i++) {
 		int name_len = sorbet_read_int_raw(sdef);
-		char *namebuf = (char *)malloc(name_len * sizeof(uint8_t));
+		char *namebuf = (char *)sorbet_arena_alloc(&sdef->arena, (name_len + 1) * sizeof(uint8_t));
 		sorbet_read_bytes_raw(sdef, (uint8_t *)namebuf, name_len);
+		namebuf[name_len] = 0;
 		sdef->schema.cols[i].name = namebuf;
 		sdef->schema.cols[i].type = sorbet_read_byte_raw(sdef);
 		sdef->schema.cols[i].valType = sorbet_read_byte_raw(sdef);
@@ -852,14 +4936,27 @@ bool read_header(sorbet_def *sdef) {
 	sdef->metadataType = sorbet_read_int_raw(sdef);
 	sdef->metadataSize = sorbet_read_int_raw(sdef);
 	if (sdef->metadataSize > 0) {
-		sdef->metadata = (uint8_t *)malloc(sdef->metadataSize * sizeof(uint8_t));
+		sdef->metadata = (uint8_t *)sorbet_arena_alloc(&sdef->arena, sdef->metadataSize * sizeof(uint8_t));
 		sorbet_read_bytes_raw(sdef, sdef->metadata, sdef->metadataSize);
 	} else {
 		sdef->metadata = NULL;
 	}
+	const sorbet_codec *codec = NULL;
+	if (compression != 0) {
+		codec = sorbet_find_codec(compression);
+		// files before version 4 are read as one gzip stream, without the codec layer
+		if (codec == NULL || (ver < 4 && compression != SORBET_COMPRESSION_GZIP)) {
+			printf("%s uses unknown compression type %d\n", sdef->filename, compression);
+			return false;
+		}
+	}
+	if (sdef->layout > SORBET_LAYOUT_COLUMNAR) {
+		printf("%s uses unknown layout %d\n", sdef->filename, sdef->layout);
+		return false;
+	}
 	// turn compression on if needed
 	sdef->compression = compression;
-	if (compression == 1) {
+	if (compression == 1 && ver < 4) {
 		sdef->zstrm.zalloc = Z_NULL;
 		sdef->zstrm.zfree = Z_NULL;
 		sdef->zstrm.opaque = Z_NULL;
@@ -872,47 +4969,970 @@ bool read_header(sorbet_def *sdef) {
 			printf("ERROR: inflateInit returned %d\n", ret);
 		}
 	}
-	printf("seeking to %ld\n", sdef->read_cnt);
+	sdef->row_cnt = 0;
+	sdef->first_row = 0;
+	sdef->last_row = sdef->n_rows;
+	sdef->end_row = sdef->n_rows;
+	if (ver > 3) {
+		// row groups are loaded on demand using the index in the footer
+		if (!read_footer(sdef)) return false;
+		sdef->version = ver;
+		if (codec != NULL) {
+			// opened after the footer is read, since it may hold the dictionary
+			sdef->codec_ctx = codec->open(sdef, false);
+			if (sdef->codec_ctx == NULL) return false;
+			sdef->codec = codec;
+		}
+		return true;
+	}
 	fseek(sdef->f, sdef->read_cnt, 0);
-	sdef->buf_offset = BUF_SIZE;
+	// start the stream over from the end of the header. the first fill may have hit
+	// the end of a file smaller than the buffer, so it isn't full
+	sdef->buf_size = sdef->buf_cap;
+	sdef->buf_offset = sdef->buf_cap;
 	sorbet_fill_read_buffer(sdef);
-	sdef->row_cnt = 0;
+	sdef->version = ver;
+	return true;
+}
+
+bool sorbet_reader_set_projection(sorbet_def *sdef, const int *cols, int n) {
+	if (cols == NULL || n <= 0) {
+		// back to reading every column
+		free(sdef->projection);
+		sdef->projection = NULL;
+		if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+			sdef->cur_group = -1;
+			if (sdef->ahead != NULL) sorbet_ahead_reproject(sdef);
+		}
+		return true;
+	}
+	bool *projection = (bool *)calloc(sdef->schema.numCols, sizeof(bool));
+	for (int i=0; i<n; i++) {
+		if (cols[i] < 0 || cols[i] >= sdef->schema.numCols) {
+			printf("ERROR: column %d is not in the schema\n", cols[i]);
+			free(projection);
+			return false;
+		}
+		projection[cols[i]] = true;
+	}
+	free(sdef->projection);
+	sdef->projection = projection;
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		// the loaded row group may be missing newly projected columns
+		sdef->cur_group = -1;
+		if (sdef->ahead != NULL) sorbet_ahead_reproject(sdef);
+	}
+	return true;
+}
+
+// a predicate's value widened to what a zone keeps. STRING and BINARY values are
+// compared whole, through value
+void sorbet_predicate_value(column_type type, const col_val *value, zone_value *zv) {
+	switch (type) {
+		case INTEGER: {
+			zv->longval = value->intval;
+			break;
+		}
+		case LONG: {
+			zv->longval = value->longval;
+			break;
+		}
+		case DATETIME: {
+			zv->longval = value->datetimeval;
+			break;
+		}
+		case BOOLEAN: {
+			zv->longval = value->boolval ? 1 : 0;
+			break;
+		}
+		case DATE: {
+			// packed the way sorbet_write_date packs it
+			zv->longval = (value->dateval.y * 10000) + (value->dateval.m * 100) + value->dateval.d;
+			break;
+		}
+		case TIME: {
+			zv->longval = (value->timeval.h * 10000) + (value->timeval.m * 100) + value->timeval.s;
+			break;
+		}
+		case FLOAT: {
+			zv->doubleval = value->floatval;
+			break;
+		}
+		default: {
+			zv->doubleval = value->doubleval;
+		}
+	}
+}
+
+// compares a predicate's value with a zone bound: below 0, 0 or above 0 as the value
+// is below, equal to or above it. len cuts STRING and BINARY values short
+int sorbet_zone_compare(column_type type, const col_val *value, const zone_value *zv, int32_t len, const zone_value *bound, uint8_t bound_len) {
+	if (type == STRING || type == BINARY) {
+		return sorbet_compare_bytes(value->strval.val, len, bound->bytes, bound_len);
+	}
+	if (type == FLOAT || type == DOUBLE) {
+		return (zv->doubleval > bound->doubleval) - (zv->doubleval < bound->doubleval);
+	}
+	return (zv->longval > bound->longval) - (zv->longval < bound->longval);
+}
+
+// false if no row of the zone's row group (of n_rows rows) can satisfy the predicate
+bool sorbet_zone_may_match(const sorbet_zone *z, uint32_t n_rows, column_type type, sorbet_op op, const col_val *value) {
+	if (op == SORBET_OP_IS_NULL) return z->n_nulls > 0;
+	if (op == SORBET_OP_IS_NOT_NULL || op == SORBET_OP_NE) return z->n_nulls < n_rows;
+	if (!z->has_values) return false;
+	zone_value zv;
+	sorbet_predicate_value(type, value, &zv);
+	if ((type == FLOAT || type == DOUBLE) && isnan(zv.doubleval)) return true;
+	int32_t len = (type == STRING || type == BINARY) ? value->strval.len : 0;
+	int lo = sorbet_zone_compare(type, value, &zv, len, &z->min, z->min_len);
+	int hi;
+	if (z->max_truncated) {
+		// only the value's first bytes can be compared with the max, and a tie
+		// doesn't say which side of the real max it's on
+		hi = sorbet_zone_compare(type, value, &zv, (len < SORBET_ZONE_BYTES) ? len : SORBET_ZONE_BYTES, &z->max, z->max_len);
+		if (hi == 0) hi = -1;
+	} else {
+		hi = sorbet_zone_compare(type, value, &zv, len, &z->max, z->max_len);
+	}
+	switch (op) {
+		case SORBET_OP_EQ: return lo >= 0 && hi <= 0;
+		case SORBET_OP_LT: return lo > 0;
+		case SORBET_OP_LE: return lo >= 0;
+		case SORBET_OP_GT: return hi < 0;
+		case SORBET_OP_GE: return hi <= 0;
+		default: return true;
+	}
+}
+
+// false if the row group's Bloom filter for col shows value isn't in it
+bool sorbet_bloom_may_contain(const sorbet_def *sdef, int32_t g, int col, const col_val *value) {
+	const sorbet_bloom *bf = &sdef->bloom_index[(int64_t)g * sdef->schema.numCols + col];
+	if (bf->n_blocks == 0) return true;
+	column_type type = sdef->schema.cols[col].type;
+	uint64_t h;
+	if (type == STRING || type == BINARY) {
+		h = sorbet_hash64(value->strval.val, value->strval.len);
+	} else {
+		zone_value zv;
+		sorbet_predicate_value(type, value, &zv);
+		h = sorbet_hash64((const uint8_t *)&zv.longval, sizeof(int64_t));
+	}
+	return sorbet_bloom_check(bf->words, bf->n_blocks, h);
+}
+
+bool sorbet_reader_add_predicate(sorbet_def *sdef, int col, sorbet_op op, const col_val *value) {
+	if (col < 0 || col >= sdef->schema.numCols) {
+		printf("ERROR: column %d is not in the schema\n", col);
+		return false;
+	}
+	if (value == NULL && op != SORBET_OP_IS_NULL && op != SORBET_OP_IS_NOT_NULL) {
+		printf("ERROR: the predicate on column %d needs a value\n", col);
+		return false;
+	}
+	if (sdef->zones == NULL && sdef->bloom_index == NULL) return true;
+	// the read-ahead thread looks at group_skip to pass over groups
+	if (sdef->ahead != NULL) pthread_mutex_lock(&sdef->ahead->lock);
+	if (sdef->group_skip == NULL) {
+		sdef->group_skip = (bool *)calloc(sdef->n_groups, sizeof(bool));
+	}
+	column_type type = sdef->schema.cols[col].type;
+	for (int32_t g = 0; g < sdef->n_groups; g++) {
+		if (sdef->zones != NULL) {
+			const sorbet_zone *z = &sdef->zones[(int64_t)g * sdef->schema.numCols + col];
+			if (!sorbet_zone_may_match(z, sdef->groups[g].n_rows, type, op, value)) sdef->group_skip[g] = true;
+		}
+		if (op == SORBET_OP_EQ && sdef->bloom_index != NULL && !sorbet_bloom_may_contain(sdef, g, col, value)) {
+			sdef->group_skip[g] = true;
+		}
+	}
+	if (sdef->ahead != NULL) pthread_mutex_unlock(&sdef->ahead->lock);
+	return true;
+}
+
+void sorbet_reader_clear_predicates(sorbet_def *sdef) {
+	if (sdef->ahead != NULL) pthread_mutex_lock(&sdef->ahead->lock);
+	free(sdef->group_skip);
+	sdef->group_skip = NULL;
+	if (sdef->ahead != NULL) pthread_mutex_unlock(&sdef->ahead->lock);
+}
+
+// compares a key with a value of the sort column in its on-disk representation
+int sorbet_compare_key(column_type type, const col_val *key, const void *v, int32_t len) {
+	if (type == STRING || type == BINARY) return sorbet_compare_bytes(key->strval.val, key->strval.len, v, len);
+	zone_value k, x;
+	sorbet_predicate_value(type, key, &k);
+	sorbet_zone_value(type, v, &x);
+	if (type == FLOAT || type == DOUBLE) return (k.doubleval > x.doubleval) - (k.doubleval < x.doubleval);
+	return (k.longval > x.longval) - (k.longval < x.longval);
+}
+
+// compares two keys in the form sorbet_read_row returns
+int sorbet_compare_values(column_type type, const col_val *a, const col_val *b) {
+	if (type == STRING || type == BINARY) {
+		return sorbet_compare_bytes(a->strval.val, a->strval.len, b->strval.val, b->strval.len);
+	}
+	zone_value x, y;
+	sorbet_predicate_value(type, a, &x);
+	sorbet_predicate_value(type, b, &y);
+	if (type == FLOAT || type == DOUBLE) return (x.doubleval > y.doubleval) - (x.doubleval < y.doubleval);
+	return (x.longval > y.longval) - (x.longval < y.longval);
+}
+
+// reads rows from the reader's position up to row limit, stopping at the start of the
+// first whose sort key is at least key (above it with after set). nulls come first
+bool reader_scan_key(sorbet_def *sdef, const col_val *key, bool after, uint64_t limit) {
+	int col = sdef->sort_column;
+	column_type type = sdef->schema.cols[col].type;
+	while (sdef->row_cnt < limit) {
+		uint64_t row = sdef->row_cnt;
+		int32_t g = sdef->cur_group;
+		size_t mark = sdef->gbuf.offset;
+		bool found = false;
+		for (int i = 0; i < sdef->schema.numCols; i++) {
+			if (i != col) {
+				sorbet_skip_value(sdef, sdef->schema.cols[i].type);
+			} else if (reader_read_column(sdef, i)) {
+				int c = sorbet_compare_values(type, &sdef->row[i], key);
+				found = after ? (c > 0) : (c >= 0);
+			}
+		}
+		if (!found) continue;
+		if (sdef->layout == SORBET_LAYOUT_ROW) {
+			// back up to the start of the row without reloading its group. a row that
+			// loaded a new group starts it
+			sdef->gbuf.offset = (sdef->cur_group == g) ? mark : 0;
+			sdef->row_cnt = row;
+			sdef->cur_col = 0;
+			return true;
+		}
+		return reader_seek_row(sdef, row);
+	}
+	return true;
+}
+
+// moves the reader to the first row whose sort key is at least key (above it with
+// after set). the index narrows it down to the rows between two samples
+bool reader_seek_key(sorbet_def *sdef, const col_val *key, bool after) {
+	sorbet_vector *keys = sdef->key_index;
+	column_type type = keys->type;
+	// the first sample at or above the key (or above it)
+	int64_t lo = 0;
+	int64_t hi = keys->length;
+	while (lo < hi) {
+		int64_t mid = lo + (hi - lo) / 2;
+		int c = 1;
+		if (sorbet_vector_is_valid(keys, mid)) {
+			int32_t len;
+			const void *v = sorbet_vector_value(keys, mid, &len);
+			c = sorbet_compare_key(type, key, v, len);
+		}
+		if (after ? (c < 0) : (c <= 0)) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	uint64_t start = (lo > 0) ? (uint64_t)(lo - 1) * sdef->key_interval : 0;
+	uint64_t limit = (lo < keys->length) ? (uint64_t)lo * sdef->key_interval : sdef->n_rows;
+	if (!reader_seek_row(sdef, start)) return false;
+	return reader_scan_key(sdef, key, after, limit);
+}
+
+bool sorbet_range(sorbet_def *sdef, const col_val *lo, const col_val *hi) {
+	if (sdef->key_index == NULL) {
+		printf("ERROR: %s has no key index\n", sdef->filename);
+		return false;
+	}
+	if (sdef->projection != NULL && !sdef->projection[sdef->sort_column]) {
+		printf("ERROR: the sort column %d isn't in the projection\n", sdef->sort_column);
+		return false;
+	}
+	// the range is cut down to the rows the reader was opened on
+	sdef->end_row = sdef->last_row;
+	uint64_t end = sdef->last_row;
+	if (hi != NULL) {
+		if (!reader_seek_key(sdef, hi, true)) return false;
+		if (sdef->row_cnt < end) end = sdef->row_cnt;
+	}
+	if (lo != NULL) {
+		if (!reader_seek_key(sdef, lo, false)) return false;
+	}
+	if ((lo == NULL || sdef->row_cnt < sdef->first_row) && !reader_seek_row(sdef, sdef->first_row)) {
+		return false;
+	}
+	sdef->end_row = end;
+	return sdef->row_cnt < end;
+}
+
+bool sorbet_lookup(sorbet_def *sdef, const col_val *key) {
+	return sorbet_range(sdef, key, key);
+}
+
+// true if a value in its on-disk representation compares to value as op says
+bool sorbet_filter_holds(column_type type, sorbet_op op, const col_val *value, const void *v, int32_t len) {
+	if (type == FLOAT || type == DOUBLE) {
+		zone_value k, x;
+		sorbet_predicate_value(type, value, &k);
+		sorbet_zone_value(type, v, &x);
+		if (isnan(k.doubleval) || isnan(x.doubleval)) return op == SORBET_OP_NE;
+	}
+	int c = sorbet_compare_key(type, value, v, len);
+	switch (op) {
+		case SORBET_OP_EQ: return c == 0;
+		case SORBET_OP_NE: return c != 0;
+		case SORBET_OP_LT: return c > 0;
+		case SORBET_OP_LE: return c >= 0;
+		case SORBET_OP_GT: return c < 0;
+		case SORBET_OP_GE: return c <= 0;
+		default: return false;
+	}
+}
+
+// true if row i of vec satisfies the filter
+bool sorbet_filter_row(const sorbet_vector *vec, int64_t i, sorbet_op op, const col_val *value) {
+	bool valid = (vec->validity == NULL || sorbet_vector_is_valid(vec, i));
+	if (op == SORBET_OP_IS_NULL) return !valid;
+	if (op == SORBET_OP_IS_NOT_NULL) return valid;
+	if (!valid) return false;
+	int32_t len;
+	const void *v = sorbet_vector_value(vec, (vec->n_runs > 0) ? sorbet_vector_find_run(vec, i) : i, &len);
+	return sorbet_filter_holds(vec->type, op, value, v, len);
+}
+
+// the batch's column col, or NULL if it isn't there
+const sorbet_vector *sorbet_batch_column(const sorbet_batch *batch, int col) {
+	if (col < 0 || col >= batch->numCols) {
+		printf("ERROR: column %d is not in the schema\n", col);
+		return NULL;
+	}
+	if (batch->cols[col].length < batch->n_rows) {
+		printf("ERROR: column %d is not in the batch\n", col);
+		return NULL;
+	}
+	return &batch->cols[col];
+}
+
+int64_t sorbet_filter(const sorbet_batch *batch, int col, sorbet_op op, const col_val *value, int32_t *sel, int64_t n_sel) {
+	const sorbet_vector *vec = sorbet_batch_column(batch, col);
+	if (vec == NULL) return -1;
+	bool null_op = (op == SORBET_OP_IS_NULL || op == SORBET_OP_IS_NOT_NULL);
+	if (value == NULL && !null_op) {
+		printf("ERROR: the filter on column %d needs a value\n", col);
+		return -1;
+	}
+	int64_t n = batch->n_rows;
+	int64_t k = 0;
+	if (n_sel >= 0) {
+		for (int64_t j = 0; j < n_sel; j++) {
+			if (sorbet_filter_row(vec, sel[j], op, value)) sel[k++] = sel[j];
+		}
+		return k;
+	}
+	if (null_op) {
+		for (int64_t i = 0; i < n; i++) {
+			if (sorbet_filter_row(vec, i, op, value)) sel[k++] = (int32_t)i;
+		}
+		return k;
+	}
+	if (vec->n_runs > 0) {
+		// each run's value is only compared once
+		int64_t start = 0;
+		for (int64_t r = 0; r < vec->n_runs; r++) {
+			int32_t len;
+			const void *v = sorbet_vector_value(vec, r, &len);
+			if (sorbet_filter_holds(vec->type, op, value, v, len)) {
+				for (int64_t i = start; i < vec->run_ends[r]; i++) {
+					if (vec->validity == NULL || sorbet_vector_is_valid(vec, i)) sel[k++] = (int32_t)i;
+				}
+			}
+			start = vec->run_ends[r];
+		}
+		return k;
+	}
+	if (vec->dictionary != NULL) {
+		// nor each dictionary entry's
+		const sorbet_vector *dict = vec->dictionary;
+		bool *hits = (bool *)malloc(dict->length * sizeof(bool) + 1);
+		for (int64_t e = 0; e < dict->length; e++) {
+			int32_t len;
+			const void *v = sorbet_vector_value(dict, e, &len);
+			hits[e] = sorbet_filter_holds(vec->type, op, value, v, len);
+		}
+		for (int64_t i = 0; i < n; i++) {
+			if ((vec->validity == NULL || sorbet_vector_is_valid(vec, i)) && hits[vec->codes[i]]) sel[k++] = (int32_t)i;
+		}
+		free(hits);
+		return k;
+	}
+	const sorbet_kernels *kern = sorbet_find_kernels();
+	zone_value c;
+	sorbet_predicate_value(vec->type, value, &c);
+	switch (vec->type) {
+		case INTEGER:
+		case DATE:
+		case TIME: {
+			// DATE and TIME values are packed so they sort as integers
+			return kern->filter_i32(vec->values.intval, vec->validity, n, op, (int32_t)c.longval, sel);
+		}
+		case LONG:
+		case DATETIME: {
+			return kern->filter_i64(vec->values.longval, vec->validity, n, op, c.longval, sel);
+		}
+		case FLOAT: {
+			return kern->filter_f32(vec->values.floatval, vec->validity, n, op, value->floatval, sel);
+		}
+		case DOUBLE: {
+			return kern->filter_f64(vec->values.doubleval, vec->validity, n, op, value->doubleval, sel);
+		}
+		default: {
+			for (int64_t i = 0; i < n; i++) {
+				if (sorbet_filter_row(vec, i, op, value)) sel[k++] = (int32_t)i;
+			}
+			return k;
+		}
+	}
+}
+
+// runs the aggregate kernel for the column type over n values
+void sorbet_aggregate_values(const sorbet_kernels *kern, column_type type, const void *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	switch (type) {
+		case INTEGER: {
+			kern->agg_i32((const int32_t *)v, valid, n, agg, res);
+			break;
+		}
+		case FLOAT: {
+			kern->agg_f32((const float32_t *)v, valid, n, agg, res);
+			break;
+		}
+		case DOUBLE: {
+			kern->agg_f64((const float64_t *)v, valid, n, agg, res);
+			break;
+		}
+		default: {
+			kern->agg_i64((const int64_t *)v, valid, n, agg, res);
+		}
+	}
+}
+
+// the aggregate of a value in its on-disk representation repeated times times
+void sorbet_aggregate_repeat(column_type type, const void *v, int64_t times, sorbet_agg agg, sorbet_agg_result *res) {
+	zone_value x;
+	sorbet_zone_value(type, v, &x);
+	res->count = times;
+	res->longval = times;
+	res->doubleval = 0;
+	if (type == FLOAT || type == DOUBLE) {
+		if (agg == SORBET_AGG_SUM) {
+			res->doubleval = x.doubleval * times;
+		} else if (isnan(x.doubleval) && agg != SORBET_AGG_COUNT) {
+			// a run of NaNs has no MIN or MAX
+			res->count = 0;
+			res->longval = 0;
+			res->doubleval = NAN;
+		} else {
+			res->doubleval = x.doubleval;
+		}
+	} else if (agg == SORBET_AGG_SUM) {
+		res->longval = (int64_t)((uint64_t)x.longval * (uint64_t)times);
+	} else if (agg != SORBET_AGG_COUNT) {
+		res->longval = x.longval;
+	}
+}
+
+bool sorbet_aggregate_batch(const sorbet_batch *batch, int col, sorbet_agg agg, const int32_t *sel, int64_t n_sel, sorbet_agg_result *res) {
+	const sorbet_vector *vec = sorbet_batch_column(batch, col);
+	if (vec == NULL) return false;
+	column_type type = vec->type;
+	if (agg != SORBET_AGG_COUNT && type != INTEGER && type != LONG && type != FLOAT && type != DOUBLE && type != DATETIME) {
+		printf("ERROR: column %d can only be counted\n", col);
+		return false;
+	}
+	bool is_float = (type == FLOAT || type == DOUBLE);
+	int64_t n = (n_sel >= 0) ? n_sel : batch->n_rows;
+	sorbet_agg_result part = {0};
+	if (agg == SORBET_AGG_COUNT) {
+		int64_t count = n;
+		if (vec->validity != NULL) {
+			count = 0;
+			for (int64_t j = 0; j < n; j++) {
+				if (sorbet_vector_is_valid(vec, (n_sel >= 0) ? sel[j] : j)) count++;
+			}
+		}
+		part.count = count;
+		part.longval = count;
+	} else if (n_sel < 0 && vec->n_runs == 0) {
+		sorbet_aggregate_values(sorbet_find_kernels(), type, vec->values.ptr, vec->validity, n, agg, &part);
+	} else if (n_sel < 0) {
+		// each run's value once, times its non-null rows
+		int64_t start = 0;
+		for (int64_t r = 0; r < vec->n_runs; r++) {
+			int64_t valid = 0;
+			for (int64_t i = start; i < vec->run_ends[r]; i++) {
+				if (vec->validity == NULL || sorbet_vector_is_valid(vec, i)) valid++;
+			}
+			if (valid > 0) {
+				sorbet_agg_result run;
+				int32_t len;
+				const void *v = sorbet_vector_value(vec, r, &len);
+				sorbet_aggregate_repeat(type, v, valid, agg, &run);
+				sorbet_agg_merge(agg, is_float, &part, &run);
+			}
+			start = vec->run_ends[r];
+		}
+	} else {
+		// the selected values are gathered a block at a time for the kernels
+		const sorbet_kernels *kern = sorbet_find_kernels();
+		int64_t block[1024];
+		int32_t width = column_type_width[type];
+		int64_t m = 0;
+		for (int64_t j = 0; j < n; j++) {
+			int64_t i = sel[j];
+			if (vec->validity == NULL || sorbet_vector_is_valid(vec, i)) {
+				int32_t len;
+				const void *v = sorbet_vector_value(vec, (vec->n_runs > 0) ? sorbet_vector_find_run(vec, i) : i, &len);
+				memcpy((uint8_t *)block + m * width, v, width);
+				m++;
+			}
+			if (m == 1024 || (j == n - 1 && m > 0)) {
+				sorbet_agg_result gathered;
+				sorbet_aggregate_values(kern, type, block, NULL, m, agg, &gathered);
+				sorbet_agg_merge(agg, is_float, &part, &gathered);
+				m = 0;
+			}
+		}
+	}
+	sorbet_agg_merge(agg, is_float, res, &part);
+	// no value to take the MIN or MAX of, or only NaNs
+	if (is_float && res->count == 0 && (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX)) res->doubleval = NAN;
+	return true;
+}
+
+bool sorbet_aggregate(sorbet_def *sdef, int col, sorbet_agg agg, const sorbet_predicate *pred, sorbet_agg_result *res) {
+	memset(res, 0, sizeof(sorbet_agg_result));
+	int num_cols = sdef->schema.numCols;
+	int pred_col = (pred != NULL) ? pred->col : col;
+	if (col < 0 || col >= num_cols || pred_col < 0 || pred_col >= num_cols) {
+		printf("ERROR: column %d is not in the schema\n", (col < 0 || col >= num_cols) ? col : pred_col);
+		return false;
+	}
+	bool projected = false;
+	if (sdef->projection == NULL) {
+		// only decode the columns it needs
+		int cols[2] = {col, pred_col};
+		if (!sorbet_reader_set_projection(sdef, cols, 2)) return false;
+		projected = true;
+	} else if (!sdef->projection[col] || !sdef->projection[pred_col]) {
+		printf("ERROR: column %d is not in the projection\n", sdef->projection[col] ? pred_col : col);
+		return false;
+	}
+	// the predicate rules out row groups for this scan only, so the reader's own
+	// predicates are put back afterwards
+	bool *group_skip = NULL;
+	bool added = false;
+	if (pred != NULL && (sdef->zones != NULL || sdef->bloom_index != NULL)) {
+		if (sdef->group_skip != NULL) {
+			group_skip = (bool *)malloc(sdef->n_groups * sizeof(bool));
+			memcpy(group_skip, sdef->group_skip, sdef->n_groups * sizeof(bool));
+		}
+		added = sorbet_reader_add_predicate(sdef, pred->col, pred->op, &pred->value);
+	}
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef->schema);
+	int32_t *sel = (pred != NULL) ? (int32_t *)malloc(SORBET_AGGREGATE_ROWS * sizeof(int32_t)) : NULL;
+	bool ok = true;
+	int64_t n;
+	while (ok && (n = sorbet_read_batch(sdef, &batch, SORBET_AGGREGATE_ROWS)) > 0) {
+		if (pred != NULL) {
+			int64_t k = sorbet_filter(&batch, pred->col, pred->op, &pred->value, sel, -1);
+			ok = (k >= 0 && sorbet_aggregate_batch(&batch, col, agg, sel, k, res));
+		} else {
+			ok = sorbet_aggregate_batch(&batch, col, agg, NULL, -1, res);
+		}
+	}
+	if (ok && n < 0) ok = false;
+	free(sel);
+	sorbet_batch_free(&batch);
+	if (added) {
+		if (sdef->ahead != NULL) pthread_mutex_lock(&sdef->ahead->lock);
+		free(sdef->group_skip);
+		sdef->group_skip = group_skip;
+		if (sdef->ahead != NULL) pthread_mutex_unlock(&sdef->ahead->lock);
+	} else {
+		free(group_skip);
+	}
+	if (projected) sorbet_reader_set_projection(sdef, NULL, 0);
+	return ok;
+}
+
+int64_t sorbet_distinct_count(const sorbet_def *sdef, int col) {
+	if (col < 0 || col >= sdef->schema.numCols || sdef->cstats[col].hll == NULL) return -1;
+	const column_stats *st = &sdef->cstats[col];
+	int64_t m = (int64_t)1 << st->hll_precision;
+	float64_t sum = 0;
+	int64_t zeros = 0;
+	for (int64_t i = 0; i < m; i++) {
+		sum += ldexp(1.0, -st->hll[i]);
+		if (st->hll[i] == 0) zeros++;
+	}
+	float64_t alpha;
+	switch (m) {
+		case 16: alpha = 0.673; break;
+		case 32: alpha = 0.697; break;
+		case 64: alpha = 0.709; break;
+		default: alpha = 0.7213 / (1 + 1.079 / m);
+	}
+	float64_t e = alpha * m * m / sum;
+	// small counts leave registers empty, and counting those is more accurate
+	if (e <= 2.5 * m && zeros > 0) e = m * log((float64_t)m / zeros);
+	return llround(e);
+}
+
+// a value of a quantile sketch and how many of the column's it stands for
+typedef struct s_weighted_value {
+	float64_t v;
+	int64_t weight;
+} weighted_value;
+
+int compare_weighted(const void *a, const void *b) {
+	return compare_doubles(&((const weighted_value *)a)->v, &((const weighted_value *)b)->v);
+}
+
+bool sorbet_quantile(const sorbet_def *sdef, int col, float64_t q, float64_t *v) {
+	if (col < 0 || col >= sdef->schema.numCols || sdef->cstats[col].quantiles == NULL) return false;
+	const sorbet_quantiles *qs = sdef->cstats[col].quantiles;
+	int64_t n = 0;
+	for (int32_t l = 0; l < qs->n_levels; l++) n += qs->sizes[l];
+	if (n == 0) return false;
+	weighted_value *all = (weighted_value *)malloc(n * sizeof(weighted_value));
+	int64_t total = 0;
+	n = 0;
+	for (int32_t l = 0; l < qs->n_levels; l++) {
+		for (int32_t j = 0; j < qs->sizes[l]; j++) {
+			all[n].v = qs->items[(int64_t)l * qs->k + j];
+			all[n].weight = (int64_t)1 << l;
+			total += all[n++].weight;
+		}
+	}
+	qsort(all, n, sizeof(weighted_value), compare_weighted);
+	float64_t want = q * total;
+	int64_t seen = 0;
+	int64_t i = 0;
+	for (; i < n - 1; i++) {
+		seen += all[i].weight;
+		if (seen > want) break;
+	}
+	*v = all[i].v;
+	free(all);
 	return true;
 }
 
-void sorbet_reader_open(sorbet_def *sdef) {
-	sdef->buf_size = BUF_SIZE;
+// maps the file so row groups are read straight out of the page cache
+void sorbet_reader_map(sorbet_def *sdef) {
+	if (sdef->version < 4) {
+		// older files don't have row groups and are always read as a stream
+		return;
+	}
+	struct stat st;
+	if (fstat(fileno(sdef->f), &st) != 0 || st.st_size == 0) return;
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(sdef->f), 0);
+	if (map == MAP_FAILED) {
+		printf("ERROR: couldn't map %s. reading it with stdio instead\n", sdef->filename);
+		return;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	sdef->map = (uint8_t *)map;
+	sdef->map_size = st.st_size;
+}
+
+// opens a second descriptor with O_DIRECT for reading row groups. everything else
+// (the header and footer) is still read through stdio
+void reader_open_direct(sorbet_def *sdef) {
+	sdef->direct_fd = open(sdef->filename, O_RDONLY | O_DIRECT);
+	if (sdef->direct_fd < 0) {
+		printf("ERROR: couldn't open %s with O_DIRECT. reading it through the page cache\n", sdef->filename);
+	}
+}
+
+bool sorbet_reader_open(sorbet_def *sdef) {
+	// the arena's first chunk is allocated before the buffers, so that with malloc
+	// freeing them on close doesn't hand the top of the heap back to the kernel on
+	// every open
+	memset(&sdef->arena, 0, sizeof(sorbet_arena));
+	sdef->arena.allocator = sdef->allocator;
+	sdef->scratch = sdef->arena;
+	sorbet_arena_grow(&sdef->arena, SORBET_ARENA_CHUNK);
+	sdef->buf_cap = (sdef->buffer_size > 0) ? sdef->buffer_size : BUF_SIZE;
+	sdef->buf = sorbet_alloc_aligned(sdef->buf_cap);
+	sdef->buf_size = sdef->buf_cap;
+	sdef->zbuf = NULL;
+	sdef->direct_fd = -1;
+	sdef->dropped_to = 0;
+	sdef->version = 0;
+	sdef->groups = NULL;
+	sdef->n_groups = 0;
+	sdef->cur_group = -1;
+	sdef->projection = NULL;
+	sdef->chunks = NULL;
+	sdef->gcols = NULL;
+	sdef->gdicts = NULL;
+	sdef->gruns = NULL;
+	sdef->zones = NULL;
+	sdef->gzones = NULL;
+	sdef->group_skip = NULL;
+	sdef->ghashes = NULL;
+	sdef->bloom_index = NULL;
+	sdef->cstats = NULL;
+	sdef->ahead = NULL;
+	sdef->io = NULL;
+	sdef->io_slots = NULL;
+	memset(&sdef->blooms, 0, sizeof(sorbet_buffer));
+	sdef->key_index = NULL;
+	sdef->sorted = false;
+	sdef->map = NULL;
+	sdef->map_size = 0;
+	sdef->codec = NULL;
+	sdef->codec_ctx = NULL;
+	sdef->dictionary = NULL;
+	sdef->dictionary_size = 0;
+	memset(&sdef->gbuf, 0, sizeof(sorbet_buffer));
+	memset(&sdef->cbuf, 0, sizeof(sorbet_buffer));
 	sdef->f = fopen(sdef->filename, "rb");
-	sdef->buf_offset = BUF_SIZE;
+	if (sdef->f == NULL) {
+		printf("ERROR: couldn't open %s\n", sdef->filename);
+		sdef->compression = 0;
+		sorbet_reader_close(sdef);
+		return false;
+	}
+	sorbet_advise_file(sdef);
+	sdef->buf_offset = sdef->buf_cap;
 	sorbet_fill_read_buffer(sdef);
-	read_header(sdef);
+	if (!read_header(sdef)) {
+		// the zlib stream of an old file isn't set up until the header is read
+		sdef->compression = 0;
+		sorbet_reader_close(sdef);
+		return false;
+	}
+	if (sdef->use_mmap) {
+		sorbet_reader_map(sdef);
+	}
+	if (sdef->use_direct_io && sdef->version > 3 && sdef->map == NULL) {
+		reader_open_direct(sdef);
+	}
+	// reading ahead needs row groups, and a mapped uncompressed file has nothing
+	// to read or decompress
+	if (sdef->read_ahead > 0 && sdef->version > 3 && sdef->n_groups > 0 &&
+			!(sdef->map != NULL && sdef->compression == 0)) {
+		sorbet_ahead_start(sdef);
+	}
+	if (sdef->use_io_uring && sdef->version > 3 && sdef->n_groups > 0 && sdef->map == NULL && sdef->ahead == NULL) {
+		reader_io_start(sdef);
+	}
 	sdef->cur_col = 0;
-	sdef->row = (col_val *)malloc(sizeof(col_val) * sdef->schema.numCols);
-	for (int i=0; i<sdef->schema.numCols; i++) {
-		if (sdef->schema.cols[i].type == STRING) {
-			sdef->row[i].strval.val = (char *)malloc(sdef->cstats[i].cwidth + 1);
-		} else if (sdef->schema.cols[i].type == BINARY) {
-			sdef->row[i].binval.val = (uint8_t *)malloc(sdef->cstats[i].cwidth);
+	sdef->row = (col_val *)sorbet_arena_calloc(&sdef->arena, sdef->schema.numCols, sizeof(col_val));
+	if (sdef->layout == SORBET_LAYOUT_COLUMNAR) {
+		sdef->gcols = (sorbet_vector *)malloc(sdef->schema.numCols * sizeof(sorbet_vector));
+		sdef->gdicts = (sorbet_vector *)malloc(sdef->schema.numCols * sizeof(sorbet_vector));
+		sdef->gruns = (sorbet_vector *)malloc(sdef->schema.numCols * sizeof(sorbet_vector));
+		for (int i=0; i<sdef->schema.numCols; i++) {
+			sorbet_vector_init(&sdef->gcols[i], sdef->schema.cols[i].type);
+			sorbet_vector_init(&sdef->gdicts[i], sdef->schema.cols[i].type);
+			sorbet_vector_init(&sdef->gruns[i], sdef->schema.cols[i].type);
 		}
 	}
+	return true;
 }
 
 void sorbet_reader_close(sorbet_def *sdef) {
-	fclose(sdef->f);
-	for (int i=0; i<sdef->schema.numCols; i++) {
-		free(sdef->schema.cols[i].name);
+	if (sdef->ahead != NULL) {
+		sorbet_ahead_stop(sdef);
 	}
-	free(sdef->schema.cols);
-	free(sdef->cstats);
-	if (sdef->metadata != NULL) {
-		free(sdef->metadata);
+	if (sdef->io != NULL) {
+		reader_io_stop(sdef);
 	}
-	for (int i=0; i<sdef->schema.numCols; i++) {
-		if (sdef->schema.cols[i].type == STRING) {
-			free(sdef->row[i].strval.val);
-		} else if (sdef->schema.cols[i].type == BINARY) {
-			free(sdef->row[i].binval.val);
+	if (sdef->direct_fd >= 0) {
+		close(sdef->direct_fd);
+		sdef->direct_fd = -1;
+	}
+	if (sdef->f != NULL) {
+		fclose(sdef->f);
+		sdef->f = NULL;
+	}
+	free(sdef->buf);
+	free(sdef->zbuf);
+	sdef->buf = NULL;
+	sdef->zbuf = NULL;
+	free(sdef->projection);
+	sdef->projection = NULL;
+	// the chunk index is in the arena
+	sdef->chunks = NULL;
+	free_column_group(sdef);
+	sorbet_buffer_free(&sdef->gbuf);
+	if (sdef->map != NULL) {
+		munmap(sdef->map, sdef->map_size);
+		sdef->map = NULL;
+	}
+	for (int i=0; i<sdef->schema.numCols && sdef->cstats != NULL; i++) {
+		sorbet_quantiles_free(sdef->cstats[i].quantiles);
+	}
+	if (sdef->codec_ctx != NULL) {
+		sdef->codec->close(sdef->codec_ctx, false);
+		sdef->codec_ctx = NULL;
+	} else if (sdef->compression == 1 && sdef->version < 4) {
+		inflateEnd(&sdef->zstrm);
+	}
+	free(sdef->group_skip);
+	sdef->group_skip = NULL;
+	sorbet_buffer_free(&sdef->blooms);
+	if (sdef->key_index != NULL) {
+		sorbet_vector_free(sdef->key_index);
+		free(sdef->key_index);
+		sdef->key_index = NULL;
+	}
+	sorbet_buffer_free(&sdef->gbuf);
+	sorbet_buffer_free(&sdef->cbuf);
+	// the schema, stats, metadata, row, dictionary and footer index were all in the
+	// arena
+	sorbet_arena_free(&sdef->scratch);
+	sorbet_arena_free(&sdef->arena);
+	sdef->schema.cols = NULL;
+	sdef->cstats = NULL;
+	sdef->metadata = NULL;
+	sdef->row = NULL;
+	sdef->dictionary = NULL;
+	sdef->dictionary_size = 0;
+	sdef->groups = NULL;
+	sdef->zones = NULL;
+	sdef->bloom_index = NULL;
+}
+
+bool sorbet_reader_submit(sorbet_def *sdef, int32_t g) {
+	if (sdef->io == NULL || g < 0 || g >= sdef->n_groups) return false;
+	return reader_io_submit_group(sdef, g, true);
+}
+
+int32_t sorbet_reader_complete(sorbet_def *sdef, bool wait) {
+	if (sdef->io == NULL) return -1;
+	return reader_io_reap(sdef, wait);
+}
+
+int sorbet_reader_event_fd(sorbet_def *sdef) {
+	return (sdef->io != NULL) ? sorbet_io_event_fd(sdef->io) : -1;
+}
+
+int32_t sorbet_reader_splits(sorbet_def *sdef, sorbet_split *splits, int32_t n) {
+	if (sdef->version < 4 || sdef->n_groups == 0 || n < 1) {
+		// no index to split on. the whole file is one split
+		splits[0].filename = sdef->filename;
+		splits[0].first_group = 0;
+		splits[0].n_groups = sdef->n_groups;
+		splits[0].first_row = 0;
+		splits[0].n_rows = sdef->n_rows;
+		return 1;
+	}
+	if (n > sdef->n_groups) n = sdef->n_groups;
+	for (int32_t i = 0; i < n; i++) {
+		int32_t g0 = (int64_t)i * sdef->n_groups / n;
+		int32_t g1 = (int64_t)(i + 1) * sdef->n_groups / n;
+		sorbet_row_group *last = &sdef->groups[g1 - 1];
+		splits[i].filename = sdef->filename;
+		splits[i].first_group = g0;
+		splits[i].n_groups = g1 - g0;
+		splits[i].first_row = sdef->groups[g0].first_row;
+		splits[i].n_rows = last->first_row + last->n_rows - splits[i].first_row;
+	}
+	return n;
+}
+
+bool sorbet_reader_open_split(sorbet_def *sdef, const sorbet_split *split) {
+	sdef->filename = split->filename;
+	if (!sorbet_reader_open(sdef)) return false;
+	if (!reader_seek_row(sdef, split->first_row)) {
+		printf("ERROR: couldn't seek to row %ld of %s\n", (long)split->first_row, split->filename);
+		sorbet_reader_close(sdef);
+		return false;
+	}
+	sdef->first_row = split->first_row;
+	sdef->last_row = split->first_row + split->n_rows;
+	sdef->end_row = sdef->last_row;
+	return true;
+}
+
+// one thread of a parallel scan
+typedef struct s_scan_state {
+	sorbet_split split;
+	sorbet_scan_fn fn;
+	void *ctx;
+	pthread_mutex_t *lock;
+	bool *stop;
+	bool ok;
+} scan_state;
+
+void *sorbet_scan_worker(void *arg) {
+	scan_state *st = (scan_state *)arg;
+	sorbet_def sdef;
+	memset(&sdef, 0, sizeof(sorbet_def));
+	st->ok = sorbet_reader_open_split(&sdef, &st->split);
+	if (!st->ok) return NULL;
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	while (st->ok) {
+		pthread_mutex_lock(st->lock);
+		bool stop = *st->stop;
+		pthread_mutex_unlock(st->lock);
+		if (stop) break;
+		uint64_t first_row = sdef.row_cnt;
+		int64_t n = sorbet_read_batch(&sdef, &batch, SORBET_DEFAULT_ROW_GROUP_SIZE);
+		if (n < 0) st->ok = false;
+		if (n <= 0) break;
+		if (!st->fn(&batch, first_row, st->ctx)) {
+			pthread_mutex_lock(st->lock);
+			*st->stop = true;
+			pthread_mutex_unlock(st->lock);
+		}
+	}
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+	return NULL;
+}
+
+bool sorbet_parallel_scan(const char *path, int n_threads, sorbet_scan_fn fn, void *ctx) {
+	if (n_threads < 1) n_threads = 1;
+	sorbet_def sdef;
+	memset(&sdef, 0, sizeof(sorbet_def));
+	sdef.filename = path;
+	if (!sorbet_reader_open(&sdef)) return false;
+	sorbet_split *splits = (sorbet_split *)malloc(n_threads * sizeof(sorbet_split));
+	int32_t n = sorbet_reader_splits(&sdef, splits, n_threads);
+	sorbet_reader_close(&sdef);
+
+	pthread_mutex_t lock;
+	pthread_mutex_init(&lock, NULL);
+	bool stop = false;
+	bool ok = true;
+	scan_state *states = (scan_state *)calloc(n, sizeof(scan_state));
+	pthread_t *threads = (pthread_t *)malloc(n * sizeof(pthread_t));
+	int32_t started = 0;
+	for (int32_t i = 0; i < n; i++) {
+		states[i].split = splits[i];
+		states[i].fn = fn;
+		states[i].ctx = ctx;
+		states[i].lock = &lock;
+		states[i].stop = &stop;
+		if (pthread_create(&threads[i], NULL, sorbet_scan_worker, &states[i]) != 0) {
+			printf("ERROR: couldn't start scan thread %d\n", i);
+			ok = false;
+			break;
 		}
+		started++;
+	}
+	for (int32_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		if (!states[i].ok) ok = false;
 	}
-	free(sdef->row);
+	pthread_mutex_destroy(&lock);
+	free(threads);
+	free(states);
+	free(splits);
+	return ok;
 }
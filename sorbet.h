@@ -9,7 +9,21 @@
 #include <time.h>
 #include <zlib.h>
 
+// the default size of sorbet_def.buffer_size
 #define BUF_SIZE 16384
+#define SORBET_DEFAULT_ROW_GROUP_SIZE 65536
+#define SORBET_DEFAULT_IO_DEPTH 8
+#define SORBET_DEFAULT_DICT_ENTRIES 65535
+#define SORBET_DEFAULT_BLOOM_BITS 10
+#define SORBET_DEFAULT_KEY_INTERVAL 1024
+#define SORBET_DEFAULT_HLL_PRECISION 12
+#define SORBET_QUANTILE_K 256
+// values of sorbet_def.compression. LZ4 and ZSTD are only available when the
+// library was built with them
+#define SORBET_COMPRESSION_NONE 0
+#define SORBET_COMPRESSION_GZIP 1
+#define SORBET_COMPRESSION_LZ4 2
+#define SORBET_COMPRESSION_ZSTD 3
 #define Z_WINDOW_BITS 15
 #define GZIP_ENCODING 16
 
@@ -119,15 +133,31 @@ typedef struct s_data_column {
 	column_type keyType;
 } data_column;
 
-typedef struct s_column_stats {
-	int32_t cwidth;
-	int64_t cnulls;
-	int64_t cbads;
-	int32_t max_int;
-	int64_t max_long;
-	float32_t max_float;
-	float64_t max_double;
-} column_stats;
+// hints for the kernel about how the file will be used (sorbet_def.advice)
+typedef enum s_sorbet_advice {
+	SORBET_ADVICE_NORMAL,
+	// read the file front to back, so the kernel reads further ahead
+	SORBET_ADVICE_SEQUENTIAL,
+	// sequential, and the file won't be needed again soon: pages are dropped from
+	// the page cache once they've been read or written, so a bulk scan or export
+	// doesn't push everything else out
+	SORBET_ADVICE_NOREUSE,
+} sorbet_advice;
+
+typedef struct s_sorbet_pool sorbet_pool;
+typedef struct s_sorbet_ahead sorbet_ahead;
+typedef struct s_sorbet_io sorbet_io;
+typedef struct s_io_slot io_slot;
+
+// a range of whole row groups of a file. each split can be opened and read by its
+// own sorbet_def, so separate threads can scan separate parts of one file.
+typedef struct s_sorbet_split {
+	const char *filename;
+	int32_t first_group;
+	int32_t n_groups;
+	uint64_t first_row;
+	uint64_t n_rows;
+} sorbet_split;
 
 // a struct that defines the file's schema (just an ordered list of columns)
 typedef struct s_sorbet_schema {
@@ -135,15 +165,410 @@ typedef struct s_sorbet_schema {
 	data_column *cols;
 } sorbet_schema;
 
+// how values are laid out inside a row group. ROW stores each row's values one
+// after the other. COLUMNAR stores each column's values for the whole row group
+// as a separate chunk, so readers only have to read and inflate the columns they use.
+typedef enum s_sorbet_layout {
+	SORBET_LAYOUT_ROW,
+	SORBET_LAYOUT_COLUMNAR,
+} sorbet_layout;
+
+// how a column chunk's values are encoded (COLUMNAR layout). PLAIN is the same
+// tagged encoding as the ROW layout.
+typedef enum s_column_encoding {
+	SORBET_ENCODING_PLAIN,
+	// STRING and BINARY: the chunk's distinct values once each, then an entry number
+	// (code) per value
+	SORBET_ENCODING_DICTIONARY,
+	// integer-valued types (INTEGER, LONG, DATE, DATETIME, TIME). these start with a
+	// validity bitmap (left out when there are no nulls) and only store the values
+	// that aren't null. VARINT: zigzag varints
+	SORBET_ENCODING_VARINT,
+	// frame of reference: the smallest value, then each value minus it bit-packed
+	// into as few bits as the largest one needs
+	SORBET_ENCODING_BITPACK,
+	// the first value, then the differences between neighbouring values as a
+	// bit-packed frame. suits sorted keys and counters
+	SORBET_ENCODING_DELTA,
+	// the first value and difference, then the differences between differences as a
+	// bit-packed frame. suits timestamps taken at regular intervals
+	SORBET_ENCODING_DELTA_DELTA,
+	// any type: a validity bitmap (left out when there are no nulls), then the values
+	// that aren't null with no tags. BOOLEAN values are bit-packed. the writer uses
+	// it for the types nothing smaller fits
+	SORBET_ENCODING_BITMAP,
+	// fixed-width types: the validity bitmap, then runs of equal values, each as its
+	// length and (unless it's a run of nulls) the value
+	SORBET_ENCODING_RLE,
+	// FLOAT and DOUBLE: each value XORed with the one before, keeping only the bits
+	// that changed (Gorilla). suits slowly changing measurements. the writer only
+	// uses it when sorbet_def.encodings asks for it
+	SORBET_ENCODING_XOR,
+	// writer only (sorbet_def.encodings): let the writer choose. never stored
+	SORBET_ENCODING_AUTO = 0xff,
+} column_encoding;
+
+// the values of a vector, one pointer per column type. DATE and TIME values are
+// kept in their packed on-disk form and BOOLEAN values are one byte each.
+typedef union u_vector_values {
+	void *ptr;
+	int32_t *intval;
+	int64_t *longval;
+	float32_t *floatval;
+	float64_t *doubleval;
+	uint8_t *boolval;
+	int32_t *dateval;
+	int64_t *datetimeval;
+	int32_t *timeval;
+} vector_values;
+
+// the values of one column in struct-of-arrays form. bit i of validity is set when
+// value i is not null. STRING and BINARY values are stored back to back in data,
+// with value i running from offsets[i] to offsets[i+1].
+typedef struct s_sorbet_vector {
+	column_type type;
+	int64_t length;
+	int64_t capacity;
+	int64_t null_count;
+	uint8_t *validity;
+	vector_values values;
+	int32_t *offsets;
+	uint8_t *data;
+	int64_t data_size;
+	int64_t data_capacity;
+	// STRING and BINARY vectors can hold dictionary codes instead: value i is entry
+	// codes[i] of dictionary, and offsets and data are unused. the dictionary
+	// belongs to whoever filled the vector in (for a reader, it's valid until the
+	// reader moves to another row group)
+	int32_t *codes;
+	const struct s_sorbet_vector *dictionary;
+	// fixed-width vectors can hold runs instead (see sorbet_def.rle_runs): run r is
+	// values entry r repeated up to row run_ends[r], starting where run r-1 ended.
+	// validity still has a bit per row, and runs of nulls hold zeros
+	int64_t n_runs;
+	int32_t *run_ends;
+} sorbet_vector;
+
+static inline bool sorbet_vector_is_valid(const sorbet_vector *vec, int64_t i) {
+	return (vec->validity[i >> 3] >> (i & 7)) & 1;
+}
+
+// value i of a STRING or BINARY vector, going through the dictionary if it holds codes
+static inline const uint8_t *sorbet_vector_bytes(const sorbet_vector *vec, int64_t i, int32_t *len) {
+	if (vec->dictionary != NULL) {
+		i = vec->codes[i];
+		vec = vec->dictionary;
+	}
+	*len = vec->offsets[i + 1] - vec->offsets[i];
+	return vec->data + vec->offsets[i];
+}
+
+// a batch of rows in struct-of-arrays form, one vector per column in schema order.
+// columns left out of the reader's projection stay empty.
+typedef struct s_sorbet_batch {
+	int32_t numCols;
+	int64_t n_rows;
+	sorbet_vector *cols;
+} sorbet_batch;
+
+// the Apache Arrow C Data Interface (https://arrow.apache.org/docs/format/CDataInterface.html).
+// it's an ABI, so these are declared here rather than taken from Arrow
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	const char *format;
+	const char *name;
+	const char *metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema **children;
+	struct ArrowSchema *dictionary;
+	void (*release)(struct ArrowSchema *);
+	void *private_data;
+};
+
+struct ArrowArray {
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void **buffers;
+	struct ArrowArray **children;
+	struct ArrowArray *dictionary;
+	void (*release)(struct ArrowArray *);
+	void *private_data;
+};
+
+#endif
+
+// a growable byte buffer. writers append to it, readers consume it from offset.
+typedef struct s_sorbet_buffer {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	size_t offset;
+} sorbet_buffer;
+
+// where a reader gets its memory (sorbet_def.allocator). alloc returns len bytes
+// aligned for any type, or NULL, and release gives back what alloc returned. both
+// get ctx
+typedef struct s_sorbet_allocator {
+	void *(*alloc)(void *ctx, size_t len);
+	void (*release)(void *ctx, void *p);
+	void *ctx;
+} sorbet_allocator;
+
+// a bump allocator. blocks are carved out of the current chunk and given back all
+// at once when the arena is reset or freed
+typedef struct s_sorbet_arena {
+	const sorbet_allocator *allocator;
+	struct s_arena_chunk *chunk;
+	// bytes used in the current chunk, and in all of them together
+	size_t used;
+	size_t size;
+} sorbet_arena;
+
+// an entry in the row group index stored in the file footer. each row group is
+// compressed independently, so any group can be read without touching the others.
+typedef struct s_sorbet_row_group {
+	uint64_t first_row;
+	uint32_t n_rows;
+	uint64_t offset;
+	uint64_t c_len;
+	uint64_t u_len;
+} sorbet_row_group;
+
+// where one column of one row group is stored (COLUMNAR layout). each chunk is
+// compressed independently.
+typedef struct s_sorbet_column_chunk {
+	uint64_t offset;
+	uint64_t c_len;
+	uint64_t u_len;
+	uint8_t encoding;
+} sorbet_column_chunk;
+
+#define SORBET_ZONE_BYTES 16
+
+// a bound of a zone. integer-valued types and BOOLEAN keep their on-disk value in
+// longval, FLOAT and DOUBLE keep doubleval. STRING and BINARY keep their first
+// SORBET_ZONE_BYTES bytes
+typedef union u_zone_value {
+	int64_t longval;
+	float64_t doubleval;
+	uint8_t bytes[SORBET_ZONE_BYTES];
+} zone_value;
+
+// the range of one column's values in one row group (a zone map), kept in the footer
+// so readers can skip groups without reading them. NaNs are left out of the range.
+// a STRING or BINARY max that was cut short is below the real max
+typedef struct s_sorbet_zone {
+	uint32_t n_nulls;
+	// false when every value is null (or NaN)
+	bool has_values;
+	bool max_truncated;
+	uint8_t min_len;
+	uint8_t max_len;
+	zone_value min;
+	zone_value max;
+} sorbet_zone;
+
+// a row group's Bloom filter for one column: n_blocks blocks of eight 32-bit words
+typedef struct s_sorbet_bloom {
+	uint32_t n_blocks;
+	const uint32_t *words;
+} sorbet_bloom;
+
+// a quantile sketch of a column's values. level l holds sizes[l] values (at items +
+// l * k), each standing for 2^l of the column's. when a level fills up it's sorted
+// and every other value moves up a level
+typedef struct s_sorbet_quantiles {
+	int32_t k;
+	int32_t n_levels;
+	int32_t *sizes;
+	float64_t *items;
+	// which half of a level the next compaction keeps
+	uint32_t flips;
+} sorbet_quantiles;
+
+// statistics about a column's values over the whole file. writers keep them as they
+// go. readers get cwidth, cnulls and cbads from the header and the rest from the
+// footer (files written before it was added only have the first three)
+typedef struct s_column_stats {
+	// the longest STRING or BINARY value, or the most characters a number printed
+	// in (INTEGER, LONG, FLOAT and DOUBLE)
+	int32_t cwidth;
+	int64_t cnulls;
+	int64_t cbads;
+	// the number of non-null values, and their sum: in doubleval for FLOAT and
+	// DOUBLE, in longval (wrapping around) for integer-valued types and BOOLEAN
+	int64_t count;
+	zone_value sum;
+	// the smallest and largest values, kept the way zone maps keep them. its n_nulls
+	// is unused
+	sorbet_zone range;
+	// a HyperLogLog sketch of the distinct values, 2^hll_precision one-byte
+	// registers. NULL when it's turned off
+	int32_t hll_precision;
+	uint8_t *hll;
+	// NULL unless sorbet_def.quantile_sketches asked for one
+	sorbet_quantiles *quantiles;
+} column_stats;
+
+// what writers do with STRING values that aren't valid UTF-8 (sorbet_def.utf8_policy)
+typedef enum s_sorbet_utf8_policy {
+	// write them without checking
+	SORBET_UTF8_UNCHECKED = 0,
+	// refuse them: sorbet_write_string returns false without writing the value, so
+	// another can be written in its place, and sorbet_write_batch writes nothing
+	SORBET_UTF8_REJECT,
+	// write a null in their place, and count them in the column's cbads
+	SORBET_UTF8_NULL,
+	// write them anyway, and count them in the column's cbads
+	SORBET_UTF8_COUNT,
+} sorbet_utf8_policy;
+
+// comparisons for sorbet_reader_add_predicate and sorbet_filter
+typedef enum s_sorbet_op {
+	SORBET_OP_EQ,
+	SORBET_OP_NE,
+	SORBET_OP_LT,
+	SORBET_OP_LE,
+	SORBET_OP_GT,
+	SORBET_OP_GE,
+	SORBET_OP_IS_NULL,
+	SORBET_OP_IS_NOT_NULL,
+} sorbet_op;
+
+// aggregates for sorbet_aggregate
+typedef enum s_sorbet_agg {
+	SORBET_AGG_COUNT,
+	SORBET_AGG_SUM,
+	SORBET_AGG_MIN,
+	SORBET_AGG_MAX,
+} sorbet_agg;
+
+// an aggregate's result. zero it before adding the first batch to it. count is the
+// number of non-null values. the SUM, MIN or MAX of FLOAT and DOUBLE columns is in
+// doubleval, and of the others in longval (integer sums wrap around). MIN and MAX
+// are only meaningful when count isn't 0. NaNs have no order, so the MIN and MAX of
+// FLOAT and DOUBLE columns skip them and leave them out of count: a column of
+// nulls and NaNs has a count of 0 and a doubleval of NaN. SUM takes NaNs in
+typedef struct s_sorbet_agg_result {
+	int64_t count;
+	int64_t longval;
+	float64_t doubleval;
+} sorbet_agg_result;
+
+// a column compared with a value, as for sorbet_reader_add_predicate
+typedef struct s_sorbet_predicate {
+	int col;
+	sorbet_op op;
+	col_val value;
+} sorbet_predicate;
+
+// Zero-initialize a sorbet_def before filling in the fields you care about. Options
+// left at zero get their default values.
 typedef struct s_sorbet_def {
 	const char *filename;
 	sorbet_schema schema;
 	uint8_t compression;
+	// writer: the codec's compression level (gzip 1-9, zstd 1-22). 0 uses the
+	// codec's default. LZ4 has no levels
+	int32_t compression_level;
+	// writer: a zstd dictionary (for example one trained with zstd --train). it is
+	// stored in the file, and readers load it from there
+	const uint8_t *dictionary;
+	int32_t dictionary_size;
+	uint8_t version;
+	sorbet_layout layout;
+	uint32_t row_group_size;
+	// writer: compress row groups on this many threads while the caller keeps writing.
+	// the file is the same as the one a single thread writes. 0 or 1 compresses on
+	// the calling thread
+	int32_t n_threads;
+	// reader: map the file instead of reading it with stdio. STRING and BINARY values
+	// in the rows returned by sorbet_read_row then point into the file (or the
+	// decompressed row group) and are only valid until the next call. ignored for
+	// files written before version 4
+	bool use_mmap;
+	// reader: read and decompress up to this many row groups ahead on a background
+	// thread while the caller decodes. memory use grows by one row group per slot.
+	// 0 reads each group when it's needed. ignored for files written before
+	// version 4
+	int32_t read_ahead;
+	// reader and writer: move row groups with io_uring, keeping up to io_depth of
+	// them in flight (0 uses SORBET_DEFAULT_IO_DEPTH). readers read each group with
+	// one request into buffers registered with the kernel, and can be driven from an
+	// event loop with sorbet_reader_submit. falls back to pread/pwrite where io_uring
+	// isn't available. readers ignore it when use_mmap or read_ahead is set, and for
+	// files written before version 4
+	bool use_io_uring;
+	int32_t io_depth;
+	// reader: the size of the buffer files written before version 4 are streamed
+	// through. 0 uses BUF_SIZE. bulk scans of those files want 1-16 MB
+	int32_t buffer_size;
+	// reader and writer: see sorbet_advice
+	sorbet_advice advice;
+	// writer: dictionary-encode STRING and BINARY chunks (COLUMNAR layout) that have
+	// at most this many distinct values, when that's smaller than writing them out.
+	// 0 uses SORBET_DEFAULT_DICT_ENTRIES and -1 turns dictionary encoding off
+	int32_t dict_max_entries;
+	// reader: sorbet_read_batch returns dictionary-encoded columns as codes (see
+	// sorbet_vector) instead of copying out every value, so consumers can group and
+	// filter on the codes. codes from different batches are only comparable when
+	// the batches have the same dictionary
+	bool dictionary_codes;
+	// reader: sorbet_read_batch returns RLE-encoded columns as runs (see sorbet_vector)
+	// instead of a value per row, so aggregations can work a run at a time
+	bool rle_runs;
+	// writer: the encoding of each column's chunks (COLUMNAR layout), numCols
+	// entries. NULL, or SORBET_ENCODING_AUTO for a column, has the writer pick the
+	// smallest encoding that fits the column's type for each chunk
+	const column_encoding *encodings;
+	// writer: keep a Bloom filter of each row group's values for the columns set
+	// here (numCols entries), so EQ predicates can skip the groups a value isn't in
+	// even when the zone maps can't. for integer-valued types, STRING and BINARY
+	const bool *bloom_filters;
+	// writer: bits per distinct value in the Bloom filters. 0 uses
+	// SORBET_DEFAULT_BLOOM_BITS, about 1% false positives
+	int32_t bloom_bits;
+	// writer: the rows are in ascending order of column sort_column (nulls first), so
+	// keep a sparse index of every key_interval-th key (0 uses
+	// SORBET_DEFAULT_KEY_INTERVAL) for sorbet_lookup and sorbet_range. the writer
+	// drops the index at the first key that's out of order. readers set these
+	// from the file
+	bool sorted;
+	int32_t sort_column;
+	int32_t key_interval;
+	// writer: check STRING values are valid UTF-8, and what to do with those that
+	// aren't (see sorbet_utf8_policy)
+	sorbet_utf8_policy utf8_policy;
+	// writer: the precision of each column's HyperLogLog sketch (see column_stats),
+	// from 4 to 16. the sketch takes 2^hll_precision bytes and its estimates are off
+	// by about 1.04 / sqrt(2^hll_precision). 0 uses SORBET_DEFAULT_HLL_PRECISION
+	// (1.6%) and -1 turns the sketches off
+	int32_t hll_precision;
+	// writer: keep a quantile sketch of the values of the columns set here (numCols
+	// entries) for sorbet_quantile. STRING and BINARY columns can't have one
+	const bool *quantile_sketches;
+	// reader: read row groups with O_DIRECT so they bypass the page cache. falls back
+	// to normal reads if the file system doesn't support it. ignored with use_mmap
+	bool use_direct_io;
+	// reader: where the arenas below get their memory. NULL uses malloc and free
+	const sorbet_allocator *allocator;
 	int metadataType;
 	int metadataSize;
 	uint8_t* metadata;
 	FILE *f;
-	uint8_t buf[BUF_SIZE];
+	// the stream buffer (buf_cap bytes, buf_size of them filled)
+	uint8_t *buf;
+	int buf_cap;
 	int buf_size;
 	int buf_offset;
 	uint64_t n_rows;
@@ -151,24 +576,103 @@ typedef struct s_sorbet_def {
 	column_stats *cstats;
 	int32_t cur_col;
 	z_stream zstrm;
-	uint8_t zbuf[BUF_SIZE];
-	int zflush;
+	// compressed input for zstrm, allocated when a gzip stream is first read
+	uint8_t *zbuf;
 	long read_cnt;
 	long row_cnt;
+	// the rows the reader was opened on: the whole file or a split
+	uint64_t first_row;
+	uint64_t last_row;
+	// reads stop here: last_row, or the end of the range sorbet_range set
+	uint64_t end_row;
 	col_val *row;
+	// row group index
+	int64_t index_offset;
+	sorbet_row_group *groups;
+	int32_t n_groups;
+	int32_t groups_cap;
+	int32_t cur_group;
+	uint32_t group_rows;
+	// the current row group, uncompressed and compressed
+	sorbet_buffer gbuf;
+	sorbet_buffer cbuf;
+	// COLUMNAR layout: the chunk index (n_groups * numCols entries) and the current
+	// row group, column by column
+	sorbet_column_chunk *chunks;
+	sorbet_vector *gcols;
+	// the dictionaries of the current row group's dictionary-encoded chunks
+	sorbet_vector *gdicts;
+	// the runs of the current row group's RLE-encoded chunks
+	sorbet_vector *gruns;
+	// zone maps, n_groups * numCols of them (NULL for files written without them).
+	// writers build the current row group's in gzones. group_skip marks the groups
+	// the reader's predicates rule out, and is NULL when there are none
+	sorbet_zone *zones;
+	sorbet_zone *gzones;
+	bool *group_skip;
+	// writers collect the hashes of the current row group's values in ghashes
+	// (numCols of them, NULL without Bloom filters) and the finished filters in
+	// blooms. readers keep the footer's filters in blooms and find them through
+	// bloom_index (n_groups * numCols, n_blocks 0 where there's none)
+	sorbet_buffer *ghashes;
+	sorbet_buffer blooms;
+	sorbet_bloom *bloom_index;
+	// the sampled keys, one per key_interval rows. NULL for files without a key index
+	sorbet_vector *key_index;
+	// writers check each key against the last one that wasn't null (once key_seen)
+	sorbet_buffer last_key;
+	bool key_seen;
+	// columns sorbet_read_row decodes. NULL means all of them
+	bool *projection;
+	// readers keep the header, schema and footer index in arena, which is freed in
+	// one go on close. scratch holds the STRING/BINARY values of the row sorbet_read_row
+	// returned and decoding space, and is reset by each sorbet_read_row and
+	// sorbet_read_batch
+	sorbet_arena arena;
+	sorbet_arena scratch;
+	// the codec for compression and its context for this thread
+	const struct s_sorbet_codec *codec;
+	void *codec_ctx;
+	// the compression workers when n_threads is set
+	sorbet_pool *pool;
+	// set when a block couldn't be compressed or written. nothing more is written
+	// and sorbet_writer_close returns false
+	bool write_failed;
+	// the read-ahead thread when read_ahead is set
+	sorbet_ahead *ahead;
+	// the mapped file when use_mmap is set
+	uint8_t *map;
+	size_t map_size;
+	// the io_uring queue and its buffers when use_io_uring is set. writers keep the
+	// file offset in io_offset, since their blocks don't go through stdio
+	sorbet_io *io;
+	io_slot *io_slots;
+	int32_t n_io_slots;
+	uint64_t io_offset;
+	uint64_t io_seq;
+	// the O_DIRECT descriptor when use_direct_io is set, or -1
+	int direct_fd;
+	// SORBET_ADVICE_NOREUSE: the file has been dropped from the page cache up to
+	// dropped_to, and writers have started writing it back up to flushing_to
+	uint64_t dropped_to;
+	uint64_t flushing_to;
 } sorbet_def;
 
 int sorbet_version();
 
 // open a sorbet writer
 void sorbet_writer_open(sorbet_def *sdef);
-void sorbet_writer_close(sorbet_def *sdef);
+// false if a row group couldn't be compressed or written, in which case the file
+// is incomplete
+bool sorbet_writer_close(sorbet_def *sdef);
 void sorbet_write_int(sorbet_def *sdef, const int32_t *v);
 void sorbet_write_long(sorbet_def *sdef, const int64_t *v);
 void sorbet_write_float(sorbet_def *sdef, const float32_t *v);
 void sorbet_write_double(sorbet_def *sdef, const float64_t *v);
 void sorbet_write_boolean(sorbet_def *sdef, const bool *v);
-void sorbet_write_string(sorbet_def *sdef, const uint8_t *v, int32_t len);
+// false if sdef->utf8_policy rejected the value. nothing was written, and the
+// column still needs a value
+bool sorbet_write_string(sorbet_def *sdef, const uint8_t *v, int32_t len);
 void sorbet_write_binary(sorbet_def *sdef, const uint8_t *v, int32_t len);
 void sorbet_write_date(sorbet_def *sdef, const sorbet_date *v);
 void sorbet_write_date_time_t(sorbet_def *sdef, const time_t *v);
@@ -176,9 +680,42 @@ void sorbet_write_datetime(sorbet_def *sdef, const int64_t *dt);
 void sorbet_write_datetime_time_t(sorbet_def *sdef, const time_t *dt);
 void sorbet_write_time(sorbet_def *sdef, const sorbet_time *v);
 void sorbet_write_time_time_t(sorbet_def *sdef, const time_t *v);
-void sorbet_write_row(sorbet_def *sdef, col_val *row);
+// false if sdef->utf8_policy rejected one of the row's STRING values, in which
+// case nothing was written. also false once a row group couldn't be compressed or
+// written: the writer stops writing, and sorbet_writer_close returns false too
+bool sorbet_write_row(sorbet_def *sdef, col_val *row);
+// writes batch->n_rows rows from column vectors. the vectors only have to be
+// filled in, not allocated by the library: they can point at the caller's own
+// arrays, and validity can be NULL for a column with no nulls. values use the
+// same representation sorbet_read_batch returns. false on a bad batch, or once a
+// row group couldn't be compressed or written.
+bool sorbet_write_batch(sorbet_def *sdef, const sorbet_batch *batch);
 
-void sorbet_reader_open(sorbet_def *sdef);
+// false if the file can't be opened or its header or footer can't be read. the
+// reader is closed again, so there's nothing to pass to sorbet_reader_close
+bool sorbet_reader_open(sorbet_def *sdef);
+// only decode the listed columns in sorbet_read_row. the other entries in the
+// returned row are left untouched. pass NULL or 0 to go back to all columns.
+bool sorbet_reader_set_projection(sorbet_def *sdef, const int *cols, int n);
+// sorbet_read_row and sorbet_read_batch skip the row groups whose zone maps show
+// they have no row where column col's value compares to value as op says. value is
+// in the form sorbet_read_row returns, and unused for IS_NULL and IS_NOT_NULL. EQ
+// predicates also check the column's Bloom filters. a group is skipped if any
+// predicate rules it out. rows of the groups that are read
+// come back whether they match or not. files written without zone maps are read whole
+bool sorbet_reader_add_predicate(sorbet_def *sdef, int col, sorbet_op op, const col_val *value);
+void sorbet_reader_clear_predicates(sorbet_def *sdef);
+// positions the reader at the first row whose sort key is at least lo, and stops
+// reads after the last one at or below hi (NULL for either leaves that end open).
+// a reader opened on a split only looks at the split's rows. only the row groups
+// holding those rows are read. keys are in the form sorbet_read_row returns, and
+// the sort column has to be in the projection. the range lasts until the next
+// sorbet_range or sorbet_seek_row. returns false if no row is in the range or the
+// file has no key index
+bool sorbet_range(sorbet_def *sdef, const col_val *lo, const col_val *hi);
+// sorbet_range from key to key: the next sorbet_read_row returns the first row with
+// that key, and reads stop after the last one
+bool sorbet_lookup(sorbet_def *sdef, const col_val *key);
 bool sorbet_read_int(sorbet_def *sdef, int32_t *v);
 bool sorbet_read_long(sorbet_def *sdef, int64_t *v);
 bool sorbet_read_float(sorbet_def *sdef, float32_t *v);
@@ -189,6 +726,78 @@ bool sorbet_read_binary(sorbet_def *sdef, uint8_t *v, int32_t *len);
 bool sorbet_read_date(sorbet_def *sdef, sorbet_date *v);
 bool sorbet_read_datetime(sorbet_def *sdef, int64_t *v);
 bool sorbet_read_time(sorbet_def *sdef, sorbet_time *v);
+// the row's STRING and BINARY values are only valid until the next sorbet_read_row
 col_val *sorbet_read_row(sorbet_def *sdef);
+void sorbet_batch_init(sorbet_batch *batch, const sorbet_schema *schema);
+void sorbet_batch_free(sorbet_batch *batch);
+// reads up to max_rows rows into the batch, replacing what it held. a batch never
+// crosses a row group boundary, so it can hold fewer rows even when more are left.
+// returns the number of rows read, 0 at the end of the file and -1 on error. the
+// reader has to be at the start of a row.
+int64_t sorbet_read_batch(sorbet_def *sdef, sorbet_batch *batch, int64_t max_rows);
+// reads the next batch of rows (up to a row group) as an Arrow struct array with a
+// child per projected column, and its schema when schema isn't NULL. INTEGER, LONG,
+// FLOAT and DOUBLE are i, l, f and g, BOOLEAN is b, STRING is utf8 and BINARY binary,
+// DATE is date32, DATETIME a timestamp in seconds and TIME time32 in seconds. the
+// arrays own the decoded values, so nothing is copied to build them, and a whole
+// COLUMNAR row group is handed over as decoded. returns the number of rows, 0 at the
+// end of the file and -1 on error. out and schema are only filled in when rows were
+// read, and then belong to the caller, who has to call their release. on 0 and -1
+// their release is set to NULL and there's nothing to release
+int64_t sorbet_read_arrow_batch(sorbet_def *sdef, struct ArrowArray *out, struct ArrowSchema *schema);
+// writes the indexes of the batch's rows whose value in column col compares to value
+// as op says to sel, in increasing order, and returns how many there were (-1 on
+// error). nulls only match IS_NULL, and NaNs only match NE. with n_sel of 0 or more
+// only the first n_sel rows listed in sel are tested, so filters can be chained.
+// otherwise sel needs room for every row of the batch
+int64_t sorbet_filter(const sorbet_batch *batch, int col, sorbet_op op, const col_val *value, int32_t *sel, int64_t n_sel);
+// adds column col of the batch's rows to res, or only the n_sel rows in sel when
+// n_sel is 0 or more. COUNT works on any column, SUM, MIN and MAX on INTEGER, LONG,
+// FLOAT, DOUBLE and DATETIME columns
+bool sorbet_aggregate_batch(const sorbet_batch *batch, int col, sorbet_agg agg, const int32_t *sel, int64_t n_sel, sorbet_agg_result *res);
+// aggregates column col over the rows from the reader's position to the end of the
+// file (or split), only counting those that satisfy pred unless it's NULL. the row
+// groups pred rules out are skipped as if it had been added as a predicate. reads
+// with sorbet_read_batch, so the reader is left at the end
+bool sorbet_aggregate(sorbet_def *sdef, int col, sorbet_agg agg, const sorbet_predicate *pred, sorbet_agg_result *res);
+// estimates the number of distinct non-null values in column col from its
+// HyperLogLog sketch. -1 if the file has none
+int64_t sorbet_distinct_count(const sorbet_def *sdef, int col);
+// estimates the value below which a fraction q (0 to 1) of column col's non-null
+// values fall, from its quantile sketch. NaNs are left out. DATE and TIME values
+// come back packed the way zones keep them. false if the column has no sketch
+bool sorbet_quantile(const sorbet_def *sdef, int col, float64_t q, float64_t *v);
+// moves the reader to a row, and ends the range sorbet_range set
+bool sorbet_seek_row(sorbet_def *sdef, uint64_t row);
+// moves the reader n rows on, keeping the range sorbet_range set
+bool sorbet_skip_rows(sorbet_def *sdef, uint64_t n);
 void sorbet_reader_close(sorbet_def *sdef);
+// divides an open reader's file into at most n splits of whole row groups and
+// returns how many it made. files without a row group index make one split.
+int32_t sorbet_reader_splits(sorbet_def *sdef, sorbet_split *splits, int32_t n);
+// opens a reader positioned at the start of a split that stops at its end. set any
+// reader options on sdef first, as for sorbet_reader_open. false, with nothing to
+// close, if the file can't be opened or the split's first row can't be found.
+bool sorbet_reader_open_split(sorbet_def *sdef, const sorbet_split *split);
+
+// asynchronous reads for readers opened with use_io_uring. sorbet_reader_submit
+// starts reading row group g and returns without waiting (false if io_depth reads
+// are already in flight). sorbet_reader_complete returns a row group whose read has
+// finished, or -1 if there isn't one (with wait set it blocks while reads are in
+// flight). that includes groups the reader queued itself to read ahead. once a
+// group is complete, seeking to its first row and reading it doesn't block on I/O.
+// sorbet_reader_event_fd is an eventfd that becomes readable when reads finish, for
+// poll/epoll loops, or -1.
+bool sorbet_reader_submit(sorbet_def *sdef, int32_t g);
+int32_t sorbet_reader_complete(sorbet_def *sdef, bool wait);
+int sorbet_reader_event_fd(sorbet_def *sdef);
+
+// called by sorbet_parallel_scan with each batch and the file row of its first
+// row. return false to stop the scan.
+typedef bool (*sorbet_scan_fn)(const sorbet_batch *batch, uint64_t first_row, void *ctx);
+// reads the file on n_threads threads, each decoding its own split, and passes
+// every batch to fn. fn is called from several threads at once and batches
+// arrive in no particular order. returns false if any part of the file
+// couldn't be read.
+bool sorbet_parallel_scan(const char *path, int n_threads, sorbet_scan_fn fn, void *ctx);
 #endif //LIBSORBET_LIBRARY_H
@@ -0,0 +1,223 @@
+#include "sorbet_codec.h"
+#include <stdlib.h>
+#include <zlib.h>
+#ifdef SORBET_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef SORBET_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// gzip. each block is a complete gzip stream, the same as files written before
+// the codec layer existed
+
+void *gzip_open(const sorbet_def *sdef, bool compress) {
+	z_stream *zstrm = (z_stream *)calloc(1, sizeof(z_stream));
+	int ret;
+	if (compress) {
+		int level = (sdef->compression_level != 0) ? sdef->compression_level : Z_DEFAULT_COMPRESSION;
+		ret = deflateInit2(zstrm, level, Z_DEFLATED, Z_WINDOW_BITS | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY);
+	} else {
+		ret = inflateInit2(zstrm, GZIP_ENCODING);
+	}
+	if (ret != Z_OK) {
+		printf("ERROR: %s returned %d\n", compress ? "deflateInit" : "inflateInit", ret);
+		free(zstrm);
+		return NULL;
+	}
+	return zstrm;
+}
+
+void gzip_close(void *ctx, bool compress) {
+	if (compress) {
+		deflateEnd((z_stream *)ctx);
+	} else {
+		inflateEnd((z_stream *)ctx);
+	}
+	free(ctx);
+}
+
+uint64_t gzip_bound(void *ctx, uint64_t len) {
+	return deflateBound((z_stream *)ctx, len);
+}
+
+int64_t gzip_compress(void *ctx, const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t cap) {
+	z_stream *zstrm = (z_stream *)ctx;
+	zstrm->next_in = (uint8_t *)src;
+	zstrm->avail_in = len;
+	zstrm->next_out = dst;
+	zstrm->avail_out = cap;
+	int ret = deflate(zstrm, Z_FINISH);
+	int64_t size = cap - zstrm->avail_out;
+	deflateReset(zstrm);
+	if (ret != Z_STREAM_END) {
+		printf("ERROR: deflate returned %d\n", ret);
+		return -1;
+	}
+	return size;
+}
+
+bool gzip_decompress(void *ctx, const uint8_t *src, uint64_t c_len, uint8_t *dst, uint64_t u_len) {
+	z_stream *zstrm = (z_stream *)ctx;
+	inflateReset(zstrm);
+	zstrm->next_in = (uint8_t *)src;
+	zstrm->avail_in = c_len;
+	zstrm->next_out = dst;
+	zstrm->avail_out = u_len;
+	int ret = inflate(zstrm, Z_FINISH);
+	if (ret != Z_STREAM_END || zstrm->avail_out != 0) {
+		printf("ERROR: inflate returned %d\n", ret);
+		return false;
+	}
+	return true;
+}
+
+const sorbet_codec gzip_codec = {
+	SORBET_COMPRESSION_GZIP, "gzip", gzip_open, gzip_close, gzip_bound, gzip_compress, gzip_decompress
+};
+
+#ifdef SORBET_HAVE_LZ4
+// LZ4 block format. it has no levels and no context, so the context is just a
+// non-NULL placeholder
+
+void *lz4_open(const sorbet_def *sdef, bool compress) {
+	return (void *)&lz4_open;
+}
+
+void lz4_close(void *ctx, bool compress) {
+}
+
+uint64_t lz4_bound(void *ctx, uint64_t len) {
+	return LZ4_compressBound(len);
+}
+
+int64_t lz4_compress(void *ctx, const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t cap) {
+	int size = LZ4_compress_default((const char *)src, (char *)dst, len, cap);
+	if (size <= 0 && len > 0) {
+		printf("ERROR: LZ4_compress_default couldn't compress %ld bytes\n", (long)len);
+		return -1;
+	}
+	return size;
+}
+
+bool lz4_decompress(void *ctx, const uint8_t *src, uint64_t c_len, uint8_t *dst, uint64_t u_len) {
+	int size = LZ4_decompress_safe((const char *)src, (char *)dst, c_len, u_len);
+	if (size < 0 || (uint64_t)size != u_len) {
+		printf("ERROR: LZ4_decompress_safe returned %d\n", size);
+		return false;
+	}
+	return true;
+}
+
+const sorbet_codec lz4_codec = {
+	SORBET_COMPRESSION_LZ4, "lz4", lz4_open, lz4_close, lz4_bound, lz4_compress, lz4_decompress
+};
+#endif
+
+#ifdef SORBET_HAVE_ZSTD
+// Zstandard, optionally with a dictionary. the dictionary is stored in the file's
+// footer, so readers always have the one the file was written with
+
+typedef struct s_zstd_ctx {
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+	ZSTD_CDict *cdict;
+	ZSTD_DDict *ddict;
+} zstd_ctx;
+
+void *zstd_open(const sorbet_def *sdef, bool compress) {
+	zstd_ctx *z = (zstd_ctx *)calloc(1, sizeof(zstd_ctx));
+	int level = (sdef->compression_level != 0) ? sdef->compression_level : ZSTD_CLEVEL_DEFAULT;
+	if (compress) {
+		z->cctx = ZSTD_createCCtx();
+		if (sdef->dictionary_size > 0) {
+			z->cdict = ZSTD_createCDict(sdef->dictionary, sdef->dictionary_size, level);
+		}
+		ZSTD_CCtx_setParameter(z->cctx, ZSTD_c_compressionLevel, level);
+	} else {
+		z->dctx = ZSTD_createDCtx();
+		if (sdef->dictionary_size > 0) {
+			z->ddict = ZSTD_createDDict(sdef->dictionary, sdef->dictionary_size);
+		}
+	}
+	if ((compress && z->cctx == NULL) || (!compress && z->dctx == NULL) ||
+			(sdef->dictionary_size > 0 && z->cdict == NULL && z->ddict == NULL)) {
+		printf("ERROR: couldn't create a zstd context\n");
+		ZSTD_freeCCtx(z->cctx);
+		ZSTD_freeDCtx(z->dctx);
+		ZSTD_freeCDict(z->cdict);
+		ZSTD_freeDDict(z->ddict);
+		free(z);
+		return NULL;
+	}
+	return z;
+}
+
+void zstd_close(void *ctx, bool compress) {
+	zstd_ctx *z = (zstd_ctx *)ctx;
+	ZSTD_freeCCtx(z->cctx);
+	ZSTD_freeDCtx(z->dctx);
+	ZSTD_freeCDict(z->cdict);
+	ZSTD_freeDDict(z->ddict);
+	free(z);
+}
+
+uint64_t zstd_bound(void *ctx, uint64_t len) {
+	return ZSTD_compressBound(len);
+}
+
+int64_t zstd_compress(void *ctx, const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t cap) {
+	zstd_ctx *z = (zstd_ctx *)ctx;
+	size_t size;
+	if (z->cdict != NULL) {
+		size = ZSTD_compress_usingCDict(z->cctx, dst, cap, src, len, z->cdict);
+	} else {
+		size = ZSTD_compress2(z->cctx, dst, cap, src, len);
+	}
+	if (ZSTD_isError(size)) {
+		printf("ERROR: zstd compression failed: %s\n", ZSTD_getErrorName(size));
+		return -1;
+	}
+	return size;
+}
+
+bool zstd_decompress(void *ctx, const uint8_t *src, uint64_t c_len, uint8_t *dst, uint64_t u_len) {
+	zstd_ctx *z = (zstd_ctx *)ctx;
+	size_t size;
+	if (z->ddict != NULL) {
+		size = ZSTD_decompress_usingDDict(z->dctx, dst, u_len, src, c_len, z->ddict);
+	} else {
+		size = ZSTD_decompressDCtx(z->dctx, dst, u_len, src, c_len);
+	}
+	if (ZSTD_isError(size) || size != u_len) {
+		printf("ERROR: zstd decompression failed: %s\n", ZSTD_isError(size) ? ZSTD_getErrorName(size) : "short block");
+		return false;
+	}
+	return true;
+}
+
+const sorbet_codec zstd_codec = {
+	SORBET_COMPRESSION_ZSTD, "zstd", zstd_open, zstd_close, zstd_bound, zstd_compress, zstd_decompress
+};
+#endif
+
+const sorbet_codec *sorbet_find_codec(uint8_t id) {
+	switch (id) {
+		case SORBET_COMPRESSION_GZIP: {
+			return &gzip_codec;
+		}
+#ifdef SORBET_HAVE_LZ4
+		case SORBET_COMPRESSION_LZ4: {
+			return &lz4_codec;
+		}
+#endif
+#ifdef SORBET_HAVE_ZSTD
+		case SORBET_COMPRESSION_ZSTD: {
+			return &zstd_codec;
+		}
+#endif
+		default: {
+			return NULL;
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef SORBET_CODEC_H
+#define SORBET_CODEC_H
+
+#include "sorbet.h"
+
+// a block compression codec, selected by the compression byte in the header.
+// every block is compressed on its own, so a context only holds settings and
+// scratch space, never data from an earlier block.
+typedef struct s_sorbet_codec {
+	uint8_t id;
+	const char *name;
+	// creates a context for compressing (writers) or decompressing (readers) with
+	// sdef's compression level and dictionary. returns NULL on failure
+	void *(*open)(const sorbet_def *sdef, bool compress);
+	void (*close)(void *ctx, bool compress);
+	// the most bytes compressing len bytes can produce
+	uint64_t (*bound)(void *ctx, uint64_t len);
+	// returns the compressed size, or -1 on failure
+	int64_t (*compress)(void *ctx, const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t cap);
+	// decompresses exactly u_len bytes
+	bool (*decompress)(void *ctx, const uint8_t *src, uint64_t c_len, uint8_t *dst, uint64_t u_len);
+} sorbet_codec;
+
+// the codec for a compression id, or NULL if it's unknown or wasn't built in
+const sorbet_codec *sorbet_find_codec(uint8_t id);
+
+#endif //SORBET_CODEC_H
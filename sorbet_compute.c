@@ -0,0 +1,657 @@
+#include "sorbet_compute.h"
+#include <math.h>
+
+// plain C kernels, for any CPU. the vector kernels finish the rows after their last
+// whole vector with these
+
+#define KERNEL_VALID(valid, i) ((valid) == NULL || (((valid)[(i) >> 3] >> ((i) & 7)) & 1))
+
+// integer sums wrap around in 64 bits rather than overflow
+#define SCALAR_AGG_INT(name, T) \
+void name(const T *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) { \
+	int64_t count = 0; \
+	uint64_t sum = 0; \
+	int64_t acc = (agg == SORBET_AGG_MIN) ? INT64_MAX : INT64_MIN; \
+	for (int64_t i = 0; i < n; i++) { \
+		if (!KERNEL_VALID(valid, i)) continue; \
+		count++; \
+		if (agg == SORBET_AGG_SUM) { \
+			sum += (uint64_t)(int64_t)v[i]; \
+		} else if (agg == SORBET_AGG_MIN) { \
+			if (v[i] < acc) acc = v[i]; \
+		} else if (agg == SORBET_AGG_MAX) { \
+			if (v[i] > acc) acc = v[i]; \
+		} \
+	} \
+	res->count = count; \
+	res->longval = (agg == SORBET_AGG_SUM) ? (int64_t)sum : (agg == SORBET_AGG_COUNT) ? count : acc; \
+	res->doubleval = 0; \
+}
+
+// NaNs have no order, so MIN and MAX skip them and leave them out of the count. with
+// nothing left the result is NaN
+#define SCALAR_AGG_FLOAT(name, T) \
+void name(const T *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) { \
+	bool ordered = (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX); \
+	int64_t count = 0; \
+	float64_t sum = 0; \
+	float64_t acc = (agg == SORBET_AGG_MIN) ? INFINITY : -INFINITY; \
+	for (int64_t i = 0; i < n; i++) { \
+		if (!KERNEL_VALID(valid, i) || (ordered && isnan(v[i]))) continue; \
+		count++; \
+		if (agg == SORBET_AGG_SUM) { \
+			sum += v[i]; \
+		} else if (agg == SORBET_AGG_MIN) { \
+			if (v[i] < acc) acc = v[i]; \
+		} else if (agg == SORBET_AGG_MAX) { \
+			if (v[i] > acc) acc = v[i]; \
+		} \
+	} \
+	if (ordered && count == 0) acc = NAN; \
+	res->count = count; \
+	res->longval = count; \
+	res->doubleval = (agg == SORBET_AGG_SUM) ? sum : acc; \
+}
+
+#define SCALAR_FILTER(name, T) \
+int64_t name(const T *v, const uint8_t *valid, int64_t n, sorbet_op op, T c, int32_t *sel) { \
+	int64_t k = 0; \
+	for (int64_t i = 0; i < n; i++) { \
+		bool hit; \
+		switch (op) { \
+			case SORBET_OP_EQ: hit = v[i] == c; break; \
+			case SORBET_OP_NE: hit = v[i] != c; break; \
+			case SORBET_OP_LT: hit = v[i] < c; break; \
+			case SORBET_OP_LE: hit = v[i] <= c; break; \
+			case SORBET_OP_GT: hit = v[i] > c; break; \
+			case SORBET_OP_GE: hit = v[i] >= c; break; \
+			default: hit = false; break; \
+		} \
+		if (hit && KERNEL_VALID(valid, i)) sel[k++] = (int32_t)i; \
+	} \
+	return k; \
+}
+
+SCALAR_AGG_INT(agg_i32_scalar, int32_t)
+SCALAR_AGG_INT(agg_i64_scalar, int64_t)
+SCALAR_AGG_FLOAT(agg_f32_scalar, float32_t)
+SCALAR_AGG_FLOAT(agg_f64_scalar, float64_t)
+SCALAR_FILTER(filter_i32_scalar, int32_t)
+SCALAR_FILTER(filter_i64_scalar, int64_t)
+SCALAR_FILTER(filter_f32_scalar, float32_t)
+SCALAR_FILTER(filter_f64_scalar, float64_t)
+
+const sorbet_kernels scalar_kernels = {
+	"scalar",
+	agg_i32_scalar, agg_i64_scalar, agg_f32_scalar, agg_f64_scalar,
+	filter_i32_scalar, filter_i64_scalar, filter_f32_scalar, filter_f64_scalar,
+};
+
+void sorbet_agg_merge(sorbet_agg agg, bool is_float, sorbet_agg_result *res, const sorbet_agg_result *part) {
+	if (part->count == 0) return;
+	if (res->count == 0) {
+		*res = *part;
+		return;
+	}
+	res->count += part->count;
+	switch (agg) {
+		case SORBET_AGG_COUNT: {
+			res->longval = res->count;
+			break;
+		}
+		case SORBET_AGG_SUM: {
+			if (is_float) {
+				res->doubleval += part->doubleval;
+			} else {
+				res->longval = (int64_t)((uint64_t)res->longval + (uint64_t)part->longval);
+			}
+			break;
+		}
+		case SORBET_AGG_MIN: {
+			if (is_float) {
+				if (part->doubleval < res->doubleval) res->doubleval = part->doubleval;
+			} else {
+				if (part->longval < res->longval) res->longval = part->longval;
+			}
+			break;
+		}
+		case SORBET_AGG_MAX: {
+			if (is_float) {
+				if (part->doubleval > res->doubleval) res->doubleval = part->doubleval;
+			} else {
+				if (part->longval > res->longval) res->longval = part->longval;
+			}
+			break;
+		}
+	}
+	if (is_float) res->longval = res->count;
+}
+
+// counts the non-null values among the first n (a multiple of 8)
+int64_t kernel_count(const uint8_t *valid, int64_t n) {
+	if (valid == NULL) return n;
+	int64_t count = 0;
+	for (int64_t i = 0; i < n >> 3; i++) count += __builtin_popcount(valid[i]);
+	return count;
+}
+
+// finishes a vector kernel's aggregate of the first m values with the scalar kernel's
+// aggregate of the rest
+#define KERNEL_AGG_TAIL(scalar, is_float) \
+	if (m < n) { \
+		sorbet_agg_result tail; \
+		scalar(v + m, (valid != NULL) ? valid + (m >> 3) : NULL, n - m, agg, &tail); \
+		sorbet_agg_merge(agg, is_float, res, &tail); \
+	}
+
+// the same for a filter. the tail's indexes are relative to row m
+#define KERNEL_FILTER_TAIL(scalar) \
+	if (m < n) { \
+		int64_t t = scalar(v + m, (valid != NULL) ? valid + (m >> 3) : NULL, n - m, op, c, sel + k); \
+		for (int64_t j = k; j < k + t; j++) sel[j] += (int32_t)m; \
+		k += t; \
+	} \
+	return k;
+
+// picks a filter's hits out of its comparison bitmasks
+#define KERNEL_FILTER_BITS(op, eq, lt, gt, full) \
+	(((op) == SORBET_OP_EQ) ? (eq) : \
+	 ((op) == SORBET_OP_NE) ? (~(eq) & (full)) : \
+	 ((op) == SORBET_OP_LT) ? (lt) : \
+	 ((op) == SORBET_OP_LE) ? ((lt) | (eq)) : \
+	 ((op) == SORBET_OP_GT) ? (gt) : \
+	 ((op) == SORBET_OP_GE) ? ((gt) | (eq)) : 0)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// AVX2 kernels, eight rows (one validity byte) at a time. null lanes are replaced by
+// the aggregate's identity before they reach the accumulator
+
+// all ones in lane j of the 32-bit and 64-bit masks when bit j of b is set
+#define AVX2_MASK32(b) _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(b), bits32), bits32)
+#define AVX2_MASK64(b) _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(b), bits64), bits64)
+
+__attribute__((target("avx2")))
+void agg_i32_avx2(const int32_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	const __m256i bits32 = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	int64_t m = n & ~7;
+	int64_t out = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m256i acc = _mm256_setzero_si256();
+		for (int64_t i = 0; i < m; i += 8) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+			if (valid != NULL) x = _mm256_and_si256(x, AVX2_MASK32(valid[i >> 3]));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+		}
+		uint64_t lanes[4];
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		out = (int64_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+	} else if (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX) {
+		__m256i id = _mm256_set1_epi32((agg == SORBET_AGG_MIN) ? INT32_MAX : INT32_MIN);
+		__m256i acc = id;
+		for (int64_t i = 0; i < m; i += 8) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+			if (valid != NULL) x = _mm256_blendv_epi8(id, x, AVX2_MASK32(valid[i >> 3]));
+			acc = (agg == SORBET_AGG_MIN) ? _mm256_min_epi32(acc, x) : _mm256_max_epi32(acc, x);
+		}
+		int32_t lanes[8];
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		out = lanes[0];
+		for (int j = 1; j < 8; j++) {
+			if ((agg == SORBET_AGG_MIN) ? lanes[j] < out : lanes[j] > out) out = lanes[j];
+		}
+	}
+	res->count = kernel_count(valid, m);
+	res->longval = (agg == SORBET_AGG_COUNT) ? res->count : out;
+	res->doubleval = 0;
+	KERNEL_AGG_TAIL(agg_i32_scalar, false)
+}
+
+__attribute__((target("avx2")))
+void agg_i64_avx2(const int64_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	const __m256i bits64 = _mm256_setr_epi64x(1, 2, 4, 8);
+	int64_t m = n & ~7;
+	int64_t out = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m256i acc = _mm256_setzero_si256();
+		for (int64_t i = 0; i < m; i += 8) {
+			__m256i x0 = _mm256_loadu_si256((const __m256i *)(v + i));
+			__m256i x1 = _mm256_loadu_si256((const __m256i *)(v + i + 4));
+			if (valid != NULL) {
+				x0 = _mm256_and_si256(x0, AVX2_MASK64(valid[i >> 3] & 0xf));
+				x1 = _mm256_and_si256(x1, AVX2_MASK64(valid[i >> 3] >> 4));
+			}
+			acc = _mm256_add_epi64(acc, _mm256_add_epi64(x0, x1));
+		}
+		uint64_t lanes[4];
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		out = (int64_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+	} else if (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX) {
+		// AVX2 has no 64-bit min or max, so compare and blend
+		bool min = (agg == SORBET_AGG_MIN);
+		__m256i id = _mm256_set1_epi64x(min ? INT64_MAX : INT64_MIN);
+		__m256i acc = id;
+		for (int64_t i = 0; i < m; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+			if (valid != NULL) x = _mm256_blendv_epi8(id, x, AVX2_MASK64((valid[i >> 3] >> (i & 4)) & 0xf));
+			__m256i take = min ? _mm256_cmpgt_epi64(acc, x) : _mm256_cmpgt_epi64(x, acc);
+			acc = _mm256_blendv_epi8(acc, x, take);
+		}
+		int64_t lanes[4];
+		_mm256_storeu_si256((__m256i *)lanes, acc);
+		out = lanes[0];
+		for (int j = 1; j < 4; j++) {
+			if (min ? lanes[j] < out : lanes[j] > out) out = lanes[j];
+		}
+	}
+	res->count = kernel_count(valid, m);
+	res->longval = (agg == SORBET_AGG_COUNT) ? res->count : out;
+	res->doubleval = 0;
+	KERNEL_AGG_TAIL(agg_i64_scalar, false)
+}
+
+// min_ps and min_pd return their second operand when either is NaN, so putting the
+// accumulator second skips NaNs
+__attribute__((target("avx2")))
+void agg_f32_avx2(const float32_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	const __m256i bits32 = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	int64_t m = n & ~7;
+	float64_t out = 0;
+	// MIN and MAX count the values that aren't NaN
+	int64_t count = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m256d acc = _mm256_setzero_pd();
+		for (int64_t i = 0; i < m; i += 8) {
+			__m256 x = _mm256_loadu_ps(v + i);
+			if (valid != NULL) x = _mm256_and_ps(x, _mm256_castsi256_ps(AVX2_MASK32(valid[i >> 3])));
+			acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+			acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+		}
+		float64_t lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		out = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	} else if (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX) {
+		bool min = (agg == SORBET_AGG_MIN);
+		__m256 id = _mm256_set1_ps(min ? INFINITY : -INFINITY);
+		__m256 acc = id;
+		for (int64_t i = 0; i < m; i += 8) {
+			__m256 x = _mm256_loadu_ps(v + i);
+			// min and max return acc when x is NaN
+			int ord = _mm256_movemask_ps(_mm256_cmp_ps(x, x, _CMP_ORD_Q));
+			if (valid != NULL) {
+				x = _mm256_blendv_ps(id, x, _mm256_castsi256_ps(AVX2_MASK32(valid[i >> 3])));
+				ord &= valid[i >> 3];
+			}
+			count += __builtin_popcount(ord);
+			acc = min ? _mm256_min_ps(x, acc) : _mm256_max_ps(x, acc);
+		}
+		float32_t lanes[8];
+		_mm256_storeu_ps(lanes, acc);
+		out = lanes[0];
+		for (int j = 1; j < 8; j++) {
+			if (min ? lanes[j] < out : lanes[j] > out) out = lanes[j];
+		}
+		if (count == 0) out = NAN;
+	}
+	if (agg != SORBET_AGG_MIN && agg != SORBET_AGG_MAX) count = kernel_count(valid, m);
+	res->count = count;
+	res->longval = res->count;
+	res->doubleval = out;
+	KERNEL_AGG_TAIL(agg_f32_scalar, true)
+}
+
+__attribute__((target("avx2")))
+void agg_f64_avx2(const float64_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	const __m256i bits64 = _mm256_setr_epi64x(1, 2, 4, 8);
+	int64_t m = n & ~7;
+	float64_t out = 0;
+	int64_t count = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m256d acc = _mm256_setzero_pd();
+		for (int64_t i = 0; i < m; i += 4) {
+			__m256d x = _mm256_loadu_pd(v + i);
+			if (valid != NULL) x = _mm256_and_pd(x, _mm256_castsi256_pd(AVX2_MASK64((valid[i >> 3] >> (i & 4)) & 0xf)));
+			acc = _mm256_add_pd(acc, x);
+		}
+		float64_t lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		out = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	} else if (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX) {
+		bool min = (agg == SORBET_AGG_MIN);
+		__m256d id = _mm256_set1_pd(min ? INFINITY : -INFINITY);
+		__m256d acc = id;
+		for (int64_t i = 0; i < m; i += 4) {
+			__m256d x = _mm256_loadu_pd(v + i);
+			int ord = _mm256_movemask_pd(_mm256_cmp_pd(x, x, _CMP_ORD_Q));
+			if (valid != NULL) {
+				int b = (valid[i >> 3] >> (i & 4)) & 0xf;
+				x = _mm256_blendv_pd(id, x, _mm256_castsi256_pd(AVX2_MASK64(b)));
+				ord &= b;
+			}
+			count += __builtin_popcount(ord);
+			acc = min ? _mm256_min_pd(x, acc) : _mm256_max_pd(x, acc);
+		}
+		float64_t lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		out = lanes[0];
+		for (int j = 1; j < 4; j++) {
+			if (min ? lanes[j] < out : lanes[j] > out) out = lanes[j];
+		}
+		if (count == 0) out = NAN;
+	}
+	if (agg != SORBET_AGG_MIN && agg != SORBET_AGG_MAX) count = kernel_count(valid, m);
+	res->count = count;
+	res->longval = res->count;
+	res->doubleval = out;
+	KERNEL_AGG_TAIL(agg_f64_scalar, true)
+}
+
+// the filters compare a vector at a time, turn the lanes into bitmasks with movemask
+// and write out the index of each set bit. NE is the inverse of EQ, so NaNs are NE
+// everything, as in C
+#define KERNEL_EMIT(bits, base) \
+	while (bits != 0) { \
+		sel[k++] = (int32_t)((base) + __builtin_ctz(bits)); \
+		bits &= bits - 1; \
+	}
+
+__attribute__((target("avx2")))
+int64_t filter_i32_avx2(const int32_t *v, const uint8_t *valid, int64_t n, sorbet_op op, int32_t c, int32_t *sel) {
+	__m256i cv = _mm256_set1_epi32(c);
+	int64_t m = n & ~7;
+	int64_t k = 0;
+	for (int64_t i = 0; i < m; i += 8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+		uint32_t eq = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, cv)));
+		uint32_t gt = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, cv)));
+		uint32_t lt = ~(eq | gt) & 0xff;
+		uint32_t bits = KERNEL_FILTER_BITS(op, eq, lt, gt, 0xff);
+		if (valid != NULL) bits &= valid[i >> 3];
+		KERNEL_EMIT(bits, i)
+	}
+	KERNEL_FILTER_TAIL(filter_i32_scalar)
+}
+
+__attribute__((target("avx2")))
+int64_t filter_i64_avx2(const int64_t *v, const uint8_t *valid, int64_t n, sorbet_op op, int64_t c, int32_t *sel) {
+	__m256i cv = _mm256_set1_epi64x(c);
+	int64_t m = n & ~7;
+	int64_t k = 0;
+	for (int64_t i = 0; i < m; i += 8) {
+		__m256i x0 = _mm256_loadu_si256((const __m256i *)(v + i));
+		__m256i x1 = _mm256_loadu_si256((const __m256i *)(v + i + 4));
+		uint32_t eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x0, cv))) |
+				(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(x1, cv))) << 4);
+		uint32_t gt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x0, cv))) |
+				(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x1, cv))) << 4);
+		uint32_t lt = ~(eq | gt) & 0xff;
+		uint32_t bits = KERNEL_FILTER_BITS(op, eq, lt, gt, 0xff);
+		if (valid != NULL) bits &= valid[i >> 3];
+		KERNEL_EMIT(bits, i)
+	}
+	KERNEL_FILTER_TAIL(filter_i64_scalar)
+}
+
+__attribute__((target("avx2")))
+int64_t filter_f32_avx2(const float32_t *v, const uint8_t *valid, int64_t n, sorbet_op op, float32_t c, int32_t *sel) {
+	__m256 cv = _mm256_set1_ps(c);
+	int64_t m = n & ~7;
+	int64_t k = 0;
+	for (int64_t i = 0; i < m; i += 8) {
+		__m256 x = _mm256_loadu_ps(v + i);
+		uint32_t eq = _mm256_movemask_ps(_mm256_cmp_ps(x, cv, _CMP_EQ_OQ));
+		uint32_t lt = _mm256_movemask_ps(_mm256_cmp_ps(x, cv, _CMP_LT_OQ));
+		uint32_t gt = _mm256_movemask_ps(_mm256_cmp_ps(x, cv, _CMP_GT_OQ));
+		uint32_t bits = KERNEL_FILTER_BITS(op, eq, lt, gt, 0xff);
+		if (valid != NULL) bits &= valid[i >> 3];
+		KERNEL_EMIT(bits, i)
+	}
+	KERNEL_FILTER_TAIL(filter_f32_scalar)
+}
+
+__attribute__((target("avx2")))
+int64_t filter_f64_avx2(const float64_t *v, const uint8_t *valid, int64_t n, sorbet_op op, float64_t c, int32_t *sel) {
+	__m256d cv = _mm256_set1_pd(c);
+	int64_t m = n & ~7;
+	int64_t k = 0;
+	for (int64_t i = 0; i < m; i += 8) {
+		__m256d x0 = _mm256_loadu_pd(v + i);
+		__m256d x1 = _mm256_loadu_pd(v + i + 4);
+		uint32_t eq = _mm256_movemask_pd(_mm256_cmp_pd(x0, cv, _CMP_EQ_OQ)) |
+				(_mm256_movemask_pd(_mm256_cmp_pd(x1, cv, _CMP_EQ_OQ)) << 4);
+		uint32_t lt = _mm256_movemask_pd(_mm256_cmp_pd(x0, cv, _CMP_LT_OQ)) |
+				(_mm256_movemask_pd(_mm256_cmp_pd(x1, cv, _CMP_LT_OQ)) << 4);
+		uint32_t gt = _mm256_movemask_pd(_mm256_cmp_pd(x0, cv, _CMP_GT_OQ)) |
+				(_mm256_movemask_pd(_mm256_cmp_pd(x1, cv, _CMP_GT_OQ)) << 4);
+		uint32_t bits = KERNEL_FILTER_BITS(op, eq, lt, gt, 0xff);
+		if (valid != NULL) bits &= valid[i >> 3];
+		KERNEL_EMIT(bits, i)
+	}
+	KERNEL_FILTER_TAIL(filter_f64_scalar)
+}
+
+const sorbet_kernels avx2_kernels = {
+	"avx2",
+	agg_i32_avx2, agg_i64_avx2, agg_f32_avx2, agg_f64_avx2,
+	filter_i32_avx2, filter_i64_avx2, filter_f32_avx2, filter_f64_avx2,
+};
+
+// AVX-512 kernels. the validity bytes are the lane masks, so nulls cost nothing, and
+// the filters write their indexes with a compressing store. 64-bit types take eight
+// rows at a time and 32-bit types sixteen
+
+// _mm512_reduce_add_epi64 adds as signed, which mustn't overflow
+__attribute__((target("avx512f")))
+int64_t kernel_sum_epi64(__m512i acc) {
+	uint64_t lanes[8];
+	_mm512_storeu_si512(lanes, acc);
+	uint64_t sum = 0;
+	for (int j = 0; j < 8; j++) sum += lanes[j];
+	return (int64_t)sum;
+}
+
+// the validity of rows i to i+15 (i a multiple of 8)
+#define AVX512_MASK16(valid, i) ((valid) == NULL ? (__mmask16)0xffff : \
+		(__mmask16)((valid)[(i) >> 3] | ((valid)[((i) >> 3) + 1] << 8)))
+#define AVX512_MASK8(valid, i) ((valid) == NULL ? (__mmask8)0xff : (__mmask8)(valid)[(i) >> 3])
+
+__attribute__((target("avx512f")))
+void agg_i32_avx512(const int32_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	int64_t m = n & ~15;
+	int64_t out = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m512i acc = _mm512_setzero_si512();
+		for (int64_t i = 0; i < m; i += 8) {
+			__m512i x = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)(v + i)));
+			acc = _mm512_mask_add_epi64(acc, AVX512_MASK8(valid, i), acc, x);
+		}
+		out = kernel_sum_epi64(acc);
+	} else if (agg == SORBET_AGG_MIN) {
+		__m512i acc = _mm512_set1_epi32(INT32_MAX);
+		for (int64_t i = 0; i < m; i += 16) {
+			acc = _mm512_mask_min_epi32(acc, AVX512_MASK16(valid, i), acc, _mm512_loadu_si512(v + i));
+		}
+		out = _mm512_reduce_min_epi32(acc);
+	} else if (agg == SORBET_AGG_MAX) {
+		__m512i acc = _mm512_set1_epi32(INT32_MIN);
+		for (int64_t i = 0; i < m; i += 16) {
+			acc = _mm512_mask_max_epi32(acc, AVX512_MASK16(valid, i), acc, _mm512_loadu_si512(v + i));
+		}
+		out = _mm512_reduce_max_epi32(acc);
+	}
+	res->count = kernel_count(valid, m);
+	res->longval = (agg == SORBET_AGG_COUNT) ? res->count : out;
+	res->doubleval = 0;
+	KERNEL_AGG_TAIL(agg_i32_scalar, false)
+}
+
+__attribute__((target("avx512f")))
+void agg_i64_avx512(const int64_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	int64_t m = n & ~7;
+	int64_t out = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m512i acc = _mm512_setzero_si512();
+		for (int64_t i = 0; i < m; i += 8) {
+			acc = _mm512_mask_add_epi64(acc, AVX512_MASK8(valid, i), acc, _mm512_loadu_si512(v + i));
+		}
+		out = kernel_sum_epi64(acc);
+	} else if (agg == SORBET_AGG_MIN) {
+		__m512i acc = _mm512_set1_epi64(INT64_MAX);
+		for (int64_t i = 0; i < m; i += 8) {
+			acc = _mm512_mask_min_epi64(acc, AVX512_MASK8(valid, i), acc, _mm512_loadu_si512(v + i));
+		}
+		out = _mm512_reduce_min_epi64(acc);
+	} else if (agg == SORBET_AGG_MAX) {
+		__m512i acc = _mm512_set1_epi64(INT64_MIN);
+		for (int64_t i = 0; i < m; i += 8) {
+			acc = _mm512_mask_max_epi64(acc, AVX512_MASK8(valid, i), acc, _mm512_loadu_si512(v + i));
+		}
+		out = _mm512_reduce_max_epi64(acc);
+	}
+	res->count = kernel_count(valid, m);
+	res->longval = (agg == SORBET_AGG_COUNT) ? res->count : out;
+	res->doubleval = 0;
+	KERNEL_AGG_TAIL(agg_i64_scalar, false)
+}
+
+__attribute__((target("avx512f")))
+void agg_f32_avx512(const float32_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	int64_t m = n & ~15;
+	float64_t out = 0;
+	int64_t count = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m512d acc = _mm512_setzero_pd();
+		for (int64_t i = 0; i < m; i += 8) {
+			__m512d x = _mm512_cvtps_pd(_mm256_loadu_ps(v + i));
+			acc = _mm512_mask_add_pd(acc, AVX512_MASK8(valid, i), acc, x);
+		}
+		out = _mm512_reduce_add_pd(acc);
+	} else if (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX) {
+		// NaN lanes are masked off and left out of the count
+		bool min = (agg == SORBET_AGG_MIN);
+		__m512 acc = _mm512_set1_ps(min ? INFINITY : -INFINITY);
+		for (int64_t i = 0; i < m; i += 16) {
+			__m512 x = _mm512_loadu_ps(v + i);
+			__mmask16 k = _mm512_mask_cmp_ps_mask(AVX512_MASK16(valid, i), x, x, _CMP_ORD_Q);
+			count += __builtin_popcount(k);
+			acc = min ? _mm512_mask_min_ps(acc, k, x, acc) : _mm512_mask_max_ps(acc, k, x, acc);
+		}
+		out = (count == 0) ? NAN : min ? _mm512_reduce_min_ps(acc) : _mm512_reduce_max_ps(acc);
+	}
+	if (agg != SORBET_AGG_MIN && agg != SORBET_AGG_MAX) count = kernel_count(valid, m);
+	res->count = count;
+	res->longval = res->count;
+	res->doubleval = out;
+	KERNEL_AGG_TAIL(agg_f32_scalar, true)
+}
+
+__attribute__((target("avx512f")))
+void agg_f64_avx512(const float64_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res) {
+	int64_t m = n & ~7;
+	float64_t out = 0;
+	int64_t count = 0;
+	if (agg == SORBET_AGG_SUM) {
+		__m512d acc = _mm512_setzero_pd();
+		for (int64_t i = 0; i < m; i += 8) {
+			acc = _mm512_mask_add_pd(acc, AVX512_MASK8(valid, i), acc, _mm512_loadu_pd(v + i));
+		}
+		out = _mm512_reduce_add_pd(acc);
+	} else if (agg == SORBET_AGG_MIN || agg == SORBET_AGG_MAX) {
+		bool min = (agg == SORBET_AGG_MIN);
+		__m512d acc = _mm512_set1_pd(min ? INFINITY : -INFINITY);
+		for (int64_t i = 0; i < m; i += 8) {
+			__m512d x = _mm512_loadu_pd(v + i);
+			__mmask8 k = _mm512_mask_cmp_pd_mask(AVX512_MASK8(valid, i), x, x, _CMP_ORD_Q);
+			count += __builtin_popcount(k);
+			acc = min ? _mm512_mask_min_pd(acc, k, x, acc) : _mm512_mask_max_pd(acc, k, x, acc);
+		}
+		out = (count == 0) ? NAN : min ? _mm512_reduce_min_pd(acc) : _mm512_reduce_max_pd(acc);
+	}
+	if (agg != SORBET_AGG_MIN && agg != SORBET_AGG_MAX) count = kernel_count(valid, m);
+	res->count = count;
+	res->longval = res->count;
+	res->doubleval = out;
+	KERNEL_AGG_TAIL(agg_f64_scalar, true)
+}
+
+// the comparison has to be a constant, so each op gets its own instance of the loop
+#define AVX512_FILTER_LOOP(step, load, cmp, pred, mask) \
+	for (int64_t i = 0; i < m; i += step) { \
+		__mmask16 hits = (__mmask16)cmp(mask(valid, i), load(v + i), cv, pred); \
+		_mm512_mask_compressstoreu_epi32(sel + k, hits, _mm512_add_epi32(iota, _mm512_set1_epi32((int32_t)i))); \
+		k += __builtin_popcount(hits); \
+	}
+
+#define AVX512_FILTER(step, load, cmp, mask, EQ, NE, LT, LE, GT, GE) \
+	const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); \
+	int64_t m = n & ~(int64_t)(step - 1); \
+	int64_t k = 0; \
+	switch (op) { \
+		case SORBET_OP_EQ: AVX512_FILTER_LOOP(step, load, cmp, EQ, mask) break; \
+		case SORBET_OP_NE: AVX512_FILTER_LOOP(step, load, cmp, NE, mask) break; \
+		case SORBET_OP_LT: AVX512_FILTER_LOOP(step, load, cmp, LT, mask) break; \
+		case SORBET_OP_LE: AVX512_FILTER_LOOP(step, load, cmp, LE, mask) break; \
+		case SORBET_OP_GT: AVX512_FILTER_LOOP(step, load, cmp, GT, mask) break; \
+		case SORBET_OP_GE: AVX512_FILTER_LOOP(step, load, cmp, GE, mask) break; \
+		default: return 0; \
+	}
+
+__attribute__((target("avx512f")))
+int64_t filter_i32_avx512(const int32_t *v, const uint8_t *valid, int64_t n, sorbet_op op, int32_t c, int32_t *sel) {
+	__m512i cv = _mm512_set1_epi32(c);
+	AVX512_FILTER(16, _mm512_loadu_si512, _mm512_mask_cmp_epi32_mask, AVX512_MASK16,
+			_MM_CMPINT_EQ, _MM_CMPINT_NE, _MM_CMPINT_LT, _MM_CMPINT_LE, _MM_CMPINT_NLE, _MM_CMPINT_NLT)
+	KERNEL_FILTER_TAIL(filter_i32_scalar)
+}
+
+__attribute__((target("avx512f")))
+int64_t filter_i64_avx512(const int64_t *v, const uint8_t *valid, int64_t n, sorbet_op op, int64_t c, int32_t *sel) {
+	__m512i cv = _mm512_set1_epi64(c);
+	AVX512_FILTER(8, _mm512_loadu_si512, _mm512_mask_cmp_epi64_mask, AVX512_MASK8,
+			_MM_CMPINT_EQ, _MM_CMPINT_NE, _MM_CMPINT_LT, _MM_CMPINT_LE, _MM_CMPINT_NLE, _MM_CMPINT_NLT)
+	KERNEL_FILTER_TAIL(filter_i64_scalar)
+}
+
+__attribute__((target("avx512f")))
+int64_t filter_f32_avx512(const float32_t *v, const uint8_t *valid, int64_t n, sorbet_op op, float32_t c, int32_t *sel) {
+	__m512 cv = _mm512_set1_ps(c);
+	AVX512_FILTER(16, _mm512_loadu_ps, _mm512_mask_cmp_ps_mask, AVX512_MASK16,
+			_CMP_EQ_OQ, _CMP_NEQ_UQ, _CMP_LT_OQ, _CMP_LE_OQ, _CMP_GT_OQ, _CMP_GE_OQ)
+	KERNEL_FILTER_TAIL(filter_f32_scalar)
+}
+
+__attribute__((target("avx512f")))
+int64_t filter_f64_avx512(const float64_t *v, const uint8_t *valid, int64_t n, sorbet_op op, float64_t c, int32_t *sel) {
+	__m512d cv = _mm512_set1_pd(c);
+	AVX512_FILTER(8, _mm512_loadu_pd, _mm512_mask_cmp_pd_mask, AVX512_MASK8,
+			_CMP_EQ_OQ, _CMP_NEQ_UQ, _CMP_LT_OQ, _CMP_LE_OQ, _CMP_GT_OQ, _CMP_GE_OQ)
+	KERNEL_FILTER_TAIL(filter_f64_scalar)
+}
+
+const sorbet_kernels avx512_kernels = {
+	"avx512",
+	agg_i32_avx512, agg_i64_avx512, agg_f32_avx512, agg_f64_avx512,
+	filter_i32_avx512, filter_i64_avx512, filter_f32_avx512, filter_f64_avx512,
+};
+#endif
+
+// the kernels for this CPU, picked on the first call
+const sorbet_kernels *sorbet_kernels_impl = NULL;
+
+const sorbet_kernels *sorbet_find_kernels(void) {
+	const sorbet_kernels *kernels = __atomic_load_n(&sorbet_kernels_impl, __ATOMIC_RELAXED);
+	if (kernels != NULL) return kernels;
+	kernels = &scalar_kernels;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		kernels = &avx512_kernels;
+	} else if (__builtin_cpu_supports("avx2")) {
+		kernels = &avx2_kernels;
+	}
+#endif
+	__atomic_store_n(&sorbet_kernels_impl, kernels, __ATOMIC_RELAXED);
+	return kernels;
+}
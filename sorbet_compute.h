@@ -0,0 +1,33 @@
+#ifndef SORBET_COMPUTE_H
+#define SORBET_COMPUTE_H
+
+#include "sorbet.h"
+
+// the kernels sorbet_filter and sorbet_aggregate_batch run over whole columns of
+// fixed-width values, one set per instruction set. v is the first value and valid
+// the column's validity bitmap, or NULL when nothing is null. null values are
+// skipped, whatever they hold.
+typedef struct s_sorbet_kernels {
+	const char *name;
+	// aggregates n values into res: count is the number of non-null values, and
+	// longval (for integers) or doubleval (for floats) is the SUM, MIN or MAX. sums
+	// of INTEGER values are taken in 64 bits and sums of FLOAT values in double.
+	// MIN and MAX skip NaNs and don't count them, and are NaN when no value is left
+	void (*agg_i32)(const int32_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res);
+	void (*agg_i64)(const int64_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res);
+	void (*agg_f32)(const float32_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res);
+	void (*agg_f64)(const float64_t *v, const uint8_t *valid, int64_t n, sorbet_agg agg, sorbet_agg_result *res);
+	// writes the indexes of the n values that compare to c as op says (EQ to GE) to
+	// sel, in increasing order, and returns how many there were
+	int64_t (*filter_i32)(const int32_t *v, const uint8_t *valid, int64_t n, sorbet_op op, int32_t c, int32_t *sel);
+	int64_t (*filter_i64)(const int64_t *v, const uint8_t *valid, int64_t n, sorbet_op op, int64_t c, int32_t *sel);
+	int64_t (*filter_f32)(const float32_t *v, const uint8_t *valid, int64_t n, sorbet_op op, float32_t c, int32_t *sel);
+	int64_t (*filter_f64)(const float64_t *v, const uint8_t *valid, int64_t n, sorbet_op op, float64_t c, int32_t *sel);
+} sorbet_kernels;
+
+// the fastest kernels this CPU can run: AVX-512, AVX2 or plain C
+const sorbet_kernels *sorbet_find_kernels(void);
+// folds part, an aggregate of more values of the same column, into res
+void sorbet_agg_merge(sorbet_agg agg, bool is_float, sorbet_agg_result *res, const sorbet_agg_result *part);
+
+#endif //SORBET_COMPUTE_H
@@ -0,0 +1,343 @@
+#include "sorbet_io.h"
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef SORBET_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// a request as the synchronous fallback keeps it until it's submitted and taken
+typedef struct s_io_request {
+	bool write;
+	int fd;
+	uint8_t *buf;
+	uint32_t len;
+	uint64_t offset;
+	uint64_t tag;
+	int64_t res;
+} io_request;
+
+struct s_sorbet_io {
+	uint32_t depth;
+	// requests queued but not submitted, and submitted but not taken
+	int32_t queued;
+	int32_t in_flight;
+	int event_fd;
+	// synchronous fallback: a ring of requests. head..done have completed,
+	// done..tail are queued
+	io_request *reqs;
+	uint64_t head;
+	uint64_t done;
+	uint64_t tail;
+#ifdef SORBET_HAVE_IO_URING
+	// the ring, or -1 when using the fallback
+	int ring_fd;
+	bool fixed;
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;
+	size_t cq_map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t sq_mask;
+	uint32_t *sq_array;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+	// our copy of the submission tail, published by sorbet_io_submit
+	uint32_t sq_local;
+#endif
+};
+
+#ifdef SORBET_HAVE_IO_URING
+int sorbet_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+	int ret;
+	do {
+		ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+void sorbet_uring_unmap(sorbet_io *io) {
+	if (io->sqes != NULL) munmap(io->sqes, io->sqes_size);
+	if (io->cq_map != NULL && io->cq_map != io->sq_map) munmap(io->cq_map, io->cq_map_size);
+	if (io->sq_map != NULL) munmap(io->sq_map, io->sq_map_size);
+	io->sqes = NULL;
+	io->cq_map = NULL;
+	io->sq_map = NULL;
+}
+
+// sets up the ring. returns false (and leaves ring_fd at -1) if the kernel doesn't
+// have io_uring, doesn't allow it, or is too old for plain reads and writes
+bool sorbet_uring_setup(sorbet_io *io) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = (int)syscall(__NR_io_uring_setup, io->depth, &p);
+	if (fd < 0) return false;
+	// IORING_OP_READ and IORING_OP_WRITE came in with this feature (5.6)
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(fd);
+		return false;
+	}
+	io->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	io->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io->cq_map_size > io->sq_map_size) io->sq_map_size = io->cq_map_size;
+		io->cq_map_size = io->sq_map_size;
+	}
+	io->sq_map = mmap(NULL, io->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (io->sq_map == MAP_FAILED) {
+		io->sq_map = NULL;
+		close(fd);
+		return false;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		io->cq_map = io->sq_map;
+	} else {
+		io->cq_map = mmap(NULL, io->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (io->cq_map == MAP_FAILED) io->cq_map = NULL;
+	}
+	io->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	io->sqes = (struct io_uring_sqe *)mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (io->sqes == MAP_FAILED) io->sqes = NULL;
+	if (io->cq_map == NULL || io->sqes == NULL) {
+		sorbet_uring_unmap(io);
+		close(fd);
+		return false;
+	}
+	uint8_t *sq = (uint8_t *)io->sq_map;
+	uint8_t *cq = (uint8_t *)io->cq_map;
+	io->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	io->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	io->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	io->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	io->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	io->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	io->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	io->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	io->sq_local = *io->sq_tail;
+	io->ring_fd = fd;
+	io->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (io->event_fd >= 0 && syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &io->event_fd, 1) != 0) {
+		close(io->event_fd);
+		io->event_fd = -1;
+	}
+	return true;
+}
+
+bool sorbet_uring_queue(sorbet_io *io, uint8_t opcode, int fd, uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t tag) {
+	uint32_t idx = io->sq_local & io->sq_mask;
+	struct io_uring_sqe *sqe = &io->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = tag;
+	if (opcode == IORING_OP_READ_FIXED) {
+		sqe->buf_index = (uint16_t)buf_index;
+	}
+	io->sq_array[idx] = idx;
+	io->sq_local++;
+	io->queued++;
+	return true;
+}
+
+// takes a completion off the ring if there is one
+bool sorbet_uring_reap(sorbet_io *io, uint64_t *tag, int64_t *res) {
+	uint32_t head = *io->cq_head;
+	if (head == __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) return false;
+	struct io_uring_cqe *cqe = &io->cqes[head & io->cq_mask];
+	*tag = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(io->cq_head, head + 1, __ATOMIC_RELEASE);
+	io->in_flight--;
+	return true;
+}
+#endif
+
+sorbet_io *sorbet_io_open(uint32_t depth) {
+	sorbet_io *io = (sorbet_io *)calloc(1, sizeof(sorbet_io));
+	io->depth = (depth > 0) ? depth : 1;
+	io->event_fd = -1;
+#ifdef SORBET_HAVE_IO_URING
+	io->ring_fd = -1;
+	if (sorbet_uring_setup(io)) return io;
+	// the fallback can still wake an event loop
+	io->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+	io->reqs = (io_request *)calloc(io->depth, sizeof(io_request));
+	return io;
+}
+
+bool sorbet_io_async(const sorbet_io *io) {
+#ifdef SORBET_HAVE_IO_URING
+	return io->ring_fd >= 0;
+#else
+	return false;
+#endif
+}
+
+void sorbet_io_close(sorbet_io *io) {
+	uint64_t tag;
+	int64_t res;
+	if (sorbet_io_async(io)) {
+		// the kernel may still be reading into or writing from the caller's buffers
+		sorbet_io_submit(io);
+	}
+	while (sorbet_io_complete(io, true, &tag, &res));
+#ifdef SORBET_HAVE_IO_URING
+	if (io->ring_fd >= 0) {
+		sorbet_uring_unmap(io);
+		close(io->ring_fd);
+	}
+#endif
+	if (io->event_fd >= 0) {
+		close(io->event_fd);
+	}
+	free(io->reqs);
+	free(io);
+}
+
+bool sorbet_io_register_buffers(sorbet_io *io, uint8_t **bufs, size_t len, int n) {
+#ifdef SORBET_HAVE_IO_URING
+	if (io->ring_fd < 0) return false;
+	struct iovec *iov = (struct iovec *)malloc(n * sizeof(struct iovec));
+	for (int i = 0; i < n; i++) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = len;
+	}
+	// this pins the pages, which counts against RLIMIT_MEMLOCK on older kernels
+	io->fixed = (syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_BUFFERS, iov, n) == 0);
+	free(iov);
+	return io->fixed;
+#else
+	return false;
+#endif
+}
+
+bool sorbet_io_queue(sorbet_io *io, bool write, int fd, uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t tag) {
+	if (io->queued + io->in_flight >= (int32_t)io->depth) return false;
+#ifdef SORBET_HAVE_IO_URING
+	if (io->ring_fd >= 0) {
+		uint8_t opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+		if (!write && io->fixed && buf_index >= 0) {
+			opcode = IORING_OP_READ_FIXED;
+		}
+		return sorbet_uring_queue(io, opcode, fd, buf, len, offset, buf_index, tag);
+	}
+#endif
+	io_request *req = &io->reqs[io->tail % io->depth];
+	req->write = write;
+	req->fd = fd;
+	req->buf = buf;
+	req->len = len;
+	req->offset = offset;
+	req->tag = tag;
+	io->tail++;
+	io->queued++;
+	return true;
+}
+
+bool sorbet_io_read(sorbet_io *io, int fd, uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t tag) {
+	return sorbet_io_queue(io, false, fd, buf, len, offset, buf_index, tag);
+}
+
+bool sorbet_io_write(sorbet_io *io, int fd, const uint8_t *buf, uint32_t len, uint64_t offset, uint64_t tag) {
+	return sorbet_io_queue(io, true, fd, (uint8_t *)buf, len, offset, -1, tag);
+}
+
+bool sorbet_io_submit(sorbet_io *io) {
+	if (io->queued == 0) return true;
+#ifdef SORBET_HAVE_IO_URING
+	if (io->ring_fd >= 0) {
+		__atomic_store_n(io->sq_tail, io->sq_local, __ATOMIC_RELEASE);
+		while (io->queued > 0) {
+			int ret = sorbet_uring_enter(io->ring_fd, io->queued, 0, 0);
+			if (ret < 0) {
+				printf("ERROR: io_uring_enter failed: %s\n", strerror(errno));
+				return false;
+			}
+			io->queued -= ret;
+			io->in_flight += ret;
+		}
+		return true;
+	}
+#endif
+	for (; io->done < io->tail; io->done++) {
+		io_request *req = &io->reqs[io->done % io->depth];
+		ssize_t n;
+		if (req->write) {
+			n = pwrite(req->fd, req->buf, req->len, req->offset);
+		} else {
+			n = pread(req->fd, req->buf, req->len, req->offset);
+		}
+		req->res = (n < 0) ? -errno : n;
+		io->queued--;
+		io->in_flight++;
+	}
+	if (io->event_fd >= 0) {
+		uint64_t one = 1;
+		if (write(io->event_fd, &one, sizeof(one)) < 0) {
+			// the counter is already set, which is all a waiting event loop needs
+		}
+	}
+	return true;
+}
+
+// clears the eventfd so an event loop doesn't keep waking up for completions it has taken
+void sorbet_io_reset_event(sorbet_io *io) {
+	uint64_t n;
+	if (io->event_fd >= 0 && read(io->event_fd, &n, sizeof(n)) < 0) {
+		// EAGAIN: it wasn't set
+	}
+}
+
+bool sorbet_io_complete(sorbet_io *io, bool wait, uint64_t *tag, int64_t *res) {
+#ifdef SORBET_HAVE_IO_URING
+	if (io->ring_fd >= 0) {
+		if (sorbet_uring_reap(io, tag, res)) return true;
+		if (!wait) {
+			// reset before looking again, so a completion that lands in between still
+			// sets it
+			sorbet_io_reset_event(io);
+			return sorbet_uring_reap(io, tag, res);
+		}
+		while (io->in_flight > 0) {
+			if (sorbet_uring_enter(io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+				printf("ERROR: io_uring_enter failed: %s\n", strerror(errno));
+				return false;
+			}
+			if (sorbet_uring_reap(io, tag, res)) return true;
+		}
+		return false;
+	}
+#endif
+	if (io->head == io->done) {
+		sorbet_io_reset_event(io);
+		return false;
+	}
+	io_request *req = &io->reqs[io->head % io->depth];
+	*tag = req->tag;
+	*res = req->res;
+	io->head++;
+	io->in_flight--;
+	return true;
+}
+
+int32_t sorbet_io_pending(const sorbet_io *io) {
+	return io->queued + io->in_flight;
+}
+
+int sorbet_io_event_fd(const sorbet_io *io) {
+	return io->event_fd;
+}
@@ -0,0 +1,37 @@
+#ifndef SORBET_IO_H
+#define SORBET_IO_H
+
+#include "sorbet.h"
+
+// a queue of reads and writes at file offsets, for keeping several large blocks in
+// flight at once. on Linux it is an io_uring, set up with the raw system calls so
+// there's no liburing dependency. where io_uring isn't available (or the kernel
+// won't set one up) each request is done with pread/pwrite when it's submitted and
+// completes straight away, so callers only need one code path.
+
+// at most depth requests can be queued or in flight at a time. never returns NULL
+sorbet_io *sorbet_io_open(uint32_t depth);
+// waits for requests still in flight, then frees the queue
+void sorbet_io_close(sorbet_io *io);
+// false when requests are done synchronously by pread/pwrite
+bool sorbet_io_async(const sorbet_io *io);
+// registers n buffers of len bytes each with the kernel, so reads into them with
+// buf_index >= 0 don't have to map the pages every time. returns false if they
+// couldn't be registered, in which case buf_index is ignored.
+bool sorbet_io_register_buffers(sorbet_io *io, uint8_t **bufs, size_t len, int n);
+// queue a read or write of len bytes at offset. tag comes back with the completion.
+// returns false if depth requests are already queued or in flight
+bool sorbet_io_read(sorbet_io *io, int fd, uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t tag);
+bool sorbet_io_write(sorbet_io *io, int fd, const uint8_t *buf, uint32_t len, uint64_t offset, uint64_t tag);
+// sends the queued requests to the kernel
+bool sorbet_io_submit(sorbet_io *io);
+// takes one completion: its tag and result (bytes transferred or -errno). with wait
+// set it blocks until one arrives. returns false if there wasn't one
+bool sorbet_io_complete(sorbet_io *io, bool wait, uint64_t *tag, int64_t *res);
+// requests submitted and not completed yet
+int32_t sorbet_io_pending(const sorbet_io *io);
+// an eventfd that becomes readable when completions arrive, or -1. sorbet_io_complete
+// resets it once there are no completions left
+int sorbet_io_event_fd(const sorbet_io *io);
+
+#endif //SORBET_IO_H
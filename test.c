@@ -2,105 +2,2487 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <math.h>
 #include "sorbet.h"
+#include "sorbet_codec.h"
+#include "utf8_val.h"
 
-typedef struct TestRec {
-	int id;
-	const char *name;
-} test_rec_t;
+// run with no arguments to run the tests, or with a file to print its contents
 
-int main(int argc, const char **argv) {
-	sorbet_def sdef;
-	sdef.filename = "/home/dmk/data/file.sorbet";
-/*
-	data_column cols[] = {
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("FAILED %s:%d: %s\n", __func__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+// a scratch file for a test, in $TMPDIR
+const char *test_path(const char *name) {
+	static char path[4][512];
+	static int next = 0;
+	const char *dir = getenv("TMPDIR");
+	char *p = path[next++ % 4];
+	snprintf(p, sizeof(path[0]), "%s/sorbet_test_%s.sorbet", dir != NULL ? dir : "/tmp", name);
+	return p;
+}
+
+// the rows most tests write: id, a name that's null every 7th row, a timestamp
+// that's null every 5th row and a double
+data_column test_cols[] = {
+		{"id",   INTEGER,  NULL_COL_TYPE, NULL_COL_TYPE},
+		{"name", STRING,   NULL_COL_TYPE, NULL_COL_TYPE},
+		{"ts",   DATETIME, NULL_COL_TYPE, NULL_COL_TYPE},
+		{"d",    DOUBLE,   NULL_COL_TYPE, NULL_COL_TYPE},
+};
+
+void write_test_row(sorbet_def *sdef, int i) {
+	char name[32];
+	int32_t id = i;
+	int64_t ts = 1000000 + i;
+	float64_t d = i * 0.5;
+	sorbet_write_int(sdef, &id);
+	if (i % 7 == 0) {
+		sorbet_write_string(sdef, NULL, 0);
+	} else {
+		sprintf(name, "name%d", i);
+		sorbet_write_string(sdef, (const uint8_t *)name, strlen(name));
+	}
+	sorbet_write_datetime(sdef, i % 5 == 0 ? NULL : &ts);
+	sorbet_write_double(sdef, &d);
+}
+
+bool is_test_row(const col_val *row, int i) {
+	char name[32];
+	sprintf(name, "name%d", i);
+	if (row == NULL || row[0].intval != i || row[3].doubleval != i * 0.5) {
+		return false;
+	}
+	if (i % 7 != 0 && (row[1].strval.len != (int32_t)strlen(name) || memcmp(row[1].strval.val, name, strlen(name)) != 0)) {
+		return false;
+	}
+	return i % 5 == 0 || row[2].datetimeval == 1000000 + i;
+}
+
+// writes n test rows with the options already set on sdef
+void write_test_file(sorbet_def *sdef, const char *name, int n) {
+	sdef->filename = test_path(name);
+	sdef->schema.numCols = sizeof(test_cols) / sizeof(data_column);
+	sdef->schema.cols = test_cols;
+	sorbet_writer_open(sdef);
+	for (int i = 0; i < n; i++) {
+		write_test_row(sdef, i);
+	}
+	sorbet_writer_close(sdef);
+}
+
+// reads rows from the reader's position to the end and checks they're rows first
+// to first + n - 1
+void check_test_rows(sorbet_def *sdef, int first, int n) {
+	int i = first;
+	col_val *row;
+	while ((row = sorbet_read_row(sdef)) != NULL) {
+		if (!is_test_row(row, i)) {
+			break;
+		}
+		i++;
+	}
+	CHECK(i == first + n);
+}
+
+void test_row_groups() {
+	for (int compression = 0; compression < 2; compression++) {
+		int n = 10000;
+		sorbet_def w = {0};
+		w.compression = compression;
+		w.row_group_size = 333;
+		write_test_file(&w, "row_groups", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("row_groups");
+		sorbet_reader_open(&sdef);
+		CHECK(sdef.version == sorbet_version());
+		CHECK(sdef.n_rows == n);
+		CHECK(sdef.n_groups == (n + 332) / 333);
+		CHECK(sdef.groups[1].first_row == 333);
+		CHECK(sdef.cstats[1].cnulls == (n + 6) / 7);
+		CHECK(strcmp(sdef.schema.cols[1].name, "name") == 0);
+		check_test_rows(&sdef, 0, n);
+		CHECK(sorbet_seek_row(&sdef, 5000));
+		CHECK(is_test_row(sorbet_read_row(&sdef), 5000));
+		// backwards, within a group and across one
+		CHECK(sorbet_seek_row(&sdef, 17));
+		CHECK(is_test_row(sorbet_read_row(&sdef), 17));
+		CHECK(sorbet_skip_rows(&sdef, 1000));
+		CHECK(is_test_row(sorbet_read_row(&sdef), 1018));
+		CHECK(sorbet_seek_row(&sdef, 332));
+		CHECK(is_test_row(sorbet_read_row(&sdef), 332));
+		CHECK(is_test_row(sorbet_read_row(&sdef), 333));
+		CHECK(sorbet_seek_row(&sdef, n - 1));
+		check_test_rows(&sdef, n - 1, 1);
+		CHECK(!sorbet_seek_row(&sdef, n + 1));
+		sorbet_reader_close(&sdef);
+	}
+}
+
+// overwrites len bytes of a file at offset
+void patch_file(const char *path, long offset, const void *data, size_t len) {
+	FILE *f = fopen(path, "r+b");
+	fseek(f, offset, SEEK_SET);
+	fwrite(data, 1, len, f);
+	fclose(f);
+}
+
+void test_corrupt_footer() {
+	sorbet_def w = {0};
+	w.row_group_size = 100;
+	write_test_file(&w, "corrupt_footer", 1000);
+	int64_t index_offset = w.index_offset;
+	// the row group index is the footer's first section: its id and length, then
+	// the group count
+	int32_t n_groups = 0x7f000000;
+	patch_file(test_path("corrupt_footer"), index_offset + 12, &n_groups, 4);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("corrupt_footer");
+	CHECK(!sorbet_reader_open(&sdef));
+	CHECK(sdef.buf == NULL && sdef.groups == NULL);
+
+	// a column chunk index one chunk short. it follows the row group index
+	sorbet_def c = {0};
+	c.layout = SORBET_LAYOUT_COLUMNAR;
+	c.row_group_size = 100;
+	write_test_file(&c, "corrupt_footer", 1000);
+	int64_t chunks_len = 10 * 4 * 25 - 25;
+	patch_file(test_path("corrupt_footer"), c.index_offset + 16 + 10 * 36 + 4, &chunks_len, 8);
+	sdef.filename = test_path("corrupt_footer");
+	CHECK(!sorbet_reader_open(&sdef));
+	CHECK(sdef.buf == NULL && sdef.chunks == NULL);
+}
+
+void test_projection() {
+	for (int compression = 0; compression < 2; compression++) {
+		int n = 5000;
+		sorbet_def w = {0};
+		w.compression = compression;
+		w.row_group_size = 333;
+		write_test_file(&w, "projection", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("projection");
+		sorbet_reader_open(&sdef);
+		int cols[] = {3, 0};
+		CHECK(sorbet_reader_set_projection(&sdef, cols, 2));
+		// columns left out aren't touched
+		sdef.row[2].datetimeval = -1;
+		int i = 0;
+		col_val *row;
+		while ((row = sorbet_read_row(&sdef)) != NULL) {
+			if (row[0].intval != i || row[3].doubleval != i * 0.5 || row[2].datetimeval != -1) break;
+			i++;
+		}
+		CHECK(i == n);
+		int bad[] = {0, 4};
+		CHECK(!sorbet_reader_set_projection(&sdef, bad, 2));
+		CHECK(sorbet_seek_row(&sdef, 1000));
+		row = sorbet_read_row(&sdef);
+		CHECK(row != NULL && row[0].intval == 1000 && row[2].datetimeval == -1);
+		CHECK(sorbet_reader_set_projection(&sdef, NULL, 0));
+		check_test_rows(&sdef, 1001, n - 1001);
+		sorbet_reader_close(&sdef);
+	}
+}
+
+// a column of every type, with nulls in some of them
+data_column type_cols[] = {
+		{"id",   INTEGER,  NULL_COL_TYPE, NULL_COL_TYPE},
+		{"name", STRING,   NULL_COL_TYPE, NULL_COL_TYPE},
+		{"ts",   DATETIME, NULL_COL_TYPE, NULL_COL_TYPE},
+		{"d",    DOUBLE,   NULL_COL_TYPE, NULL_COL_TYPE},
+		{"b",    BOOLEAN,  NULL_COL_TYPE, NULL_COL_TYPE},
+		{"dt",   DATE,     NULL_COL_TYPE, NULL_COL_TYPE},
+		{"tm",   TIME,     NULL_COL_TYPE, NULL_COL_TYPE},
+		{"bin",  BINARY,   NULL_COL_TYPE, NULL_COL_TYPE},
+		{"f",    FLOAT,    NULL_COL_TYPE, NULL_COL_TYPE},
+		{"l",    LONG,     NULL_COL_TYPE, NULL_COL_TYPE},
+};
+
+void write_types_file(sorbet_def *sdef, const char *name, int n) {
+	sdef->filename = test_path(name);
+	sdef->schema.numCols = sizeof(type_cols) / sizeof(data_column);
+	sdef->schema.cols = type_cols;
+	sorbet_writer_open(sdef);
+	for (int i = 0; i < n; i++) {
+		char str[32];
+		int32_t id = i;
+		int64_t ts = 1000000 + i;
+		float64_t d = i * 0.5;
+		bool b = i & 1;
+		sorbet_date dt = {i % 100, i % 12 + 1, i % 28 + 1};
+		sorbet_time tm = {i % 24, i % 60, i % 59};
+		float32_t f = i * 0.25f;
+		int64_t l = -i * 1000000007LL;
+		sorbet_write_int(sdef, &id);
+		sprintf(str, "name%d", i % 50);
+		sorbet_write_string(sdef, (i % 7 == 0) ? NULL : (const uint8_t *)str, strlen(str));
+		sorbet_write_datetime(sdef, (i % 5 == 0) ? NULL : &ts);
+		sorbet_write_double(sdef, &d);
+		sorbet_write_boolean(sdef, (i % 3 == 0) ? NULL : &b);
+		sorbet_write_date(sdef, &dt);
+		sorbet_write_time(sdef, &tm);
+		sorbet_write_binary(sdef, (const uint8_t *)"0123456789abcdef", i % 11);
+		sorbet_write_float(sdef, &f);
+		sorbet_write_long(sdef, (i % 13 == 0) ? NULL : &l);
+	}
+	sorbet_writer_close(sdef);
+}
+
+bool is_types_row(const col_val *row, int i) {
+	char name[32];
+	sprintf(name, "name%d", i % 50);
+	if (row == NULL || row[0].intval != i || row[3].doubleval != i * 0.5 || row[8].floatval != i * 0.25f) {
+		return false;
+	}
+	if (i % 7 != 0 && (row[1].strval.len != (int32_t)strlen(name) || memcmp(row[1].strval.val, name, strlen(name)) != 0)) {
+		return false;
+	}
+	if ((i % 5 != 0 && row[2].datetimeval != 1000000 + i) || (i % 3 != 0 && row[4].boolval != (i & 1))) {
+		return false;
+	}
+	if (row[5].dateval.y != i % 100 || row[5].dateval.m != i % 12 + 1 || row[5].dateval.d != i % 28 + 1) {
+		return false;
+	}
+	if (row[6].timeval.h != i % 24 || row[6].timeval.m != i % 60 || row[6].timeval.s != i % 59) {
+		return false;
+	}
+	if (row[7].binval.len != i % 11 || memcmp(row[7].binval.val, "0123456789abcdef", i % 11) != 0) {
+		return false;
+	}
+	return i % 13 == 0 || row[9].longval == -i * 1000000007LL;
+}
+
+// reads rows from the reader's position to the end and checks they're rows first
+// to first + n - 1 of a types file
+void check_types_rows(sorbet_def *sdef, int first, int n) {
+	int i = first;
+	col_val *row;
+	while ((row = sorbet_read_row(sdef)) != NULL) {
+		if (!is_types_row(row, i)) {
+			break;
+		}
+		i++;
+	}
+	CHECK(i == first + n);
+}
+
+void test_columnar() {
+	for (int compression = 0; compression < 2; compression++) {
+		int n = 10000;
+		sorbet_def w = {0};
+		w.layout = SORBET_LAYOUT_COLUMNAR;
+		w.compression = compression;
+		w.row_group_size = 333;
+		write_types_file(&w, "columnar", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("columnar");
+		sorbet_reader_open(&sdef);
+		CHECK(sdef.layout == SORBET_LAYOUT_COLUMNAR);
+		CHECK(sdef.n_rows == n && sdef.n_groups == (n + 332) / 333);
+		CHECK(sdef.chunks != NULL);
+		check_types_rows(&sdef, 0, n);
+		CHECK(sorbet_seek_row(&sdef, 5000));
+		CHECK(is_types_row(sorbet_read_row(&sdef), 5000));
+		CHECK(sorbet_seek_row(&sdef, 17));
+		CHECK(sorbet_skip_rows(&sdef, 1000));
+		CHECK(is_types_row(sorbet_read_row(&sdef), 1017));
+		int cols[] = {3, 0};
+		CHECK(sorbet_reader_set_projection(&sdef, cols, 2));
+		CHECK(sorbet_seek_row(&sdef, 332));
+		col_val *row = sorbet_read_row(&sdef);
+		CHECK(row != NULL && row[0].intval == 332 && row[3].doubleval == 166);
+		row = sorbet_read_row(&sdef);
+		CHECK(row != NULL && row[0].intval == 333);
+		CHECK(sorbet_reader_set_projection(&sdef, NULL, 0));
+		check_types_rows(&sdef, 334, n - 334);
+		// a value at a time
+		int32_t id;
+		char str[32];
+		int32_t len;
+		int64_t ts;
+		CHECK(sorbet_seek_row(&sdef, 21));
+		CHECK(sorbet_read_int(&sdef, &id) && id == 21);
+		CHECK(!sorbet_read_string(&sdef, str, &len));
+		CHECK(sorbet_read_datetime(&sdef, &ts) && ts == 1000021);
+		sorbet_reader_close(&sdef);
+	}
+}
+
+// a file as version 3 wrote it: the header, then every value tagged with its type,
+// as one gzip stream when compressed
+void write_v3_file(const char *path, uint8_t compression, int n) {
+	uint8_t *body = malloc(n * 16);
+	size_t len = 0;
+	for (int i = 0; i < n; i++) {
+		char name[32];
+		int32_t name_len = sprintf(name, "n%d", i);
+		body[len++] = INTEGER;
+		memcpy(body + len, &i, 4);
+		len += 4;
+		body[len++] = STRING;
+		memcpy(body + len, &name_len, 4);
+		memcpy(body + len + 4, name, name_len);
+		len += 4 + name_len;
+	}
+	FILE *f = fopen(path, "wb");
+	int64_t sig = -3532510898378833984;
+	uint8_t version = 3;
+	uint64_t n_rows = n;
+	uint64_t uc_size = len;
+	int32_t n_cols = 2;
+	fwrite(&sig, 8, 1, f);
+	fwrite(&version, 1, 1, f);
+	fwrite(&compression, 1, 1, f);
+	fwrite(&n_rows, 8, 1, f);
+	fwrite(&uc_size, 8, 1, f);
+	fwrite(&n_cols, 4, 1, f);
+	const char *names[] = {"id", "name"};
+	const uint8_t types[] = {INTEGER, STRING};
+	const int32_t widths[] = {5, 8};
+	for (int c = 0; c < 2; c++) {
+		int32_t name_len = strlen(names[c]);
+		uint8_t none = NULL_COL_TYPE;
+		int64_t zero = 0;
+		fwrite(&name_len, 4, 1, f);
+		fwrite(names[c], 1, name_len, f);
+		fwrite(&types[c], 1, 1, f);
+		fwrite(&none, 1, 1, f);
+		fwrite(&none, 1, 1, f);
+		fwrite(&widths[c], 4, 1, f);
+		fwrite(&zero, 8, 1, f);
+		fwrite(&zero, 8, 1, f);
+	}
+	int32_t no_metadata[2] = {0, 0};
+	fwrite(no_metadata, 4, 2, f);
+	if (compression == 1) {
+		z_stream z = {0};
+		uLong cap = len + 1024;
+		uint8_t *out = malloc(cap);
+		deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, Z_WINDOW_BITS | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY);
+		z.next_in = body;
+		z.avail_in = len;
+		z.next_out = out;
+		z.avail_out = cap;
+		deflate(&z, Z_FINISH);
+		fwrite(out, 1, cap - z.avail_out, f);
+		deflateEnd(&z);
+		free(out);
+	} else {
+		fwrite(body, 1, len, f);
+	}
+	fclose(f);
+	free(body);
+}
+
+void test_v3_files() {
+	for (uint8_t compression = 0; compression < 2; compression++) {
+		int n = 50000;
+		write_v3_file(test_path("v3"), compression, n);
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("v3");
+		sorbet_reader_open(&sdef);
+		CHECK(sdef.version == 3);
+		CHECK(sdef.n_rows == n);
+		// version 3 files can only skip forward
+		CHECK(sorbet_skip_rows(&sdef, 10));
+		int i = 10;
+		col_val *row;
+		while ((row = sorbet_read_row(&sdef)) != NULL) {
+			char name[32];
+			sprintf(name, "n%d", i);
+			if (row[0].intval != i || strcmp((const char *)row[1].strval.val, name) != 0) {
+				break;
+			}
+			i++;
+		}
+		CHECK(i == n);
+		sorbet_reader_close(&sdef);
+	}
+}
+
+// copies a file batch by batch with sorbet_write_batch, with the options set on w
+void copy_test_file(sorbet_def *w, const char *from, const char *to, int64_t batch_rows) {
+	sorbet_def sdef = {0};
+	sdef.filename = test_path(from);
+	sorbet_reader_open(&sdef);
+	w->filename = test_path(to);
+	w->schema = sdef.schema;
+	sorbet_writer_open(w);
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	int64_t n;
+	while ((n = sorbet_read_batch(&sdef, &batch, batch_rows)) > 0) {
+		CHECK(sorbet_write_batch(w, &batch));
+	}
+	CHECK(n == 0);
+	sorbet_batch_free(&batch);
+	sorbet_writer_close(w);
+	sorbet_reader_close(&sdef);
+}
+
+// true if a batch holds rows first to first + batch->n_rows - 1 of a types file.
+// columns with no values (left out of a projection) aren't checked
+bool is_types_batch(const sorbet_batch *batch, int first) {
+	const sorbet_vector *cols = batch->cols;
+	for (int64_t j = 0; j < batch->n_rows; j++) {
+		int i = first + j;
+		char name[32];
+		sprintf(name, "name%d", i % 50);
+		if (cols[0].length > 0 && cols[0].values.intval[j] != i) return false;
+		if (cols[1].length > 0) {
+			if (sorbet_vector_is_valid(&cols[1], j) != (i % 7 != 0)) return false;
+			int32_t len;
+			const uint8_t *v = sorbet_vector_bytes(&cols[1], j, &len);
+			if (i % 7 != 0 && (len != (int32_t)strlen(name) || memcmp(v, name, len) != 0)) return false;
+		}
+		if (cols[2].length > 0 && sorbet_vector_is_valid(&cols[2], j) != (i % 5 != 0)) return false;
+		if (cols[2].length > 0 && i % 5 != 0 && cols[2].values.datetimeval[j] != 1000000 + i) return false;
+		if (cols[3].length > 0 && cols[3].values.doubleval[j] != i * 0.5) return false;
+		if (cols[4].length > 0 && i % 3 != 0 && cols[4].values.boolval[j] != (i & 1)) return false;
+		// DATE and TIME stay packed
+		if (cols[5].length > 0 && cols[5].values.dateval[j] != (i % 100) * 10000 + (i % 12 + 1) * 100 + i % 28 + 1) return false;
+		if (cols[6].length > 0 && cols[6].values.timeval[j] != (i % 24) * 10000 + (i % 60) * 100 + i % 59) return false;
+		if (cols[7].length > 0) {
+			int32_t len;
+			const uint8_t *v = sorbet_vector_bytes(&cols[7], j, &len);
+			if (len != i % 11 || memcmp(v, "0123456789abcdef", len) != 0) return false;
+		}
+		if (cols[8].length > 0 && cols[8].values.floatval[j] != i * 0.25f) return false;
+		if (cols[9].length > 0 && i % 13 != 0 && cols[9].values.longval[j] != -i * 1000000007LL) return false;
+	}
+	return true;
+}
+
+void test_read_batch() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 10000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_types_file(&w, "read_batch", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("read_batch");
+		sorbet_reader_open(&sdef);
+		sorbet_batch batch;
+		sorbet_batch_init(&batch, &sdef.schema);
+		int rows = 0;
+		int64_t got;
+		bool ok = true;
+		while ((got = sorbet_read_batch(&sdef, &batch, 300)) > 0) {
+			// batches stop at row group boundaries
+			ok = ok && got == batch.n_rows && got == ((rows % 1000 == 900) ? 100 : 300);
+			ok = ok && batch.cols[1].null_count == (rows + got + 6) / 7 - (rows + 6) / 7;
+			ok = ok && is_types_batch(&batch, rows);
+			rows += got;
+		}
+		CHECK(ok && got == 0 && rows == n);
+		// batches and rows can be mixed
+		CHECK(sorbet_seek_row(&sdef, 4990));
+		CHECK(is_types_row(sorbet_read_row(&sdef), 4990));
+		CHECK(sorbet_read_batch(&sdef, &batch, 20) == 9);
+		CHECK(is_types_batch(&batch, 4991));
+		int cols[] = {0, 7};
+		CHECK(sorbet_reader_set_projection(&sdef, cols, 2));
+		CHECK(sorbet_read_batch(&sdef, &batch, 50) == 50);
+		CHECK(batch.cols[3].length == 0 && batch.cols[7].length == 50);
+		CHECK(is_types_batch(&batch, 5000));
+		// a batch has to start at the beginning of a row
+		int32_t id;
+		CHECK(sorbet_read_int(&sdef, &id) && id == 5050);
+		CHECK(sorbet_read_batch(&sdef, &batch, 50) == -1);
+		sorbet_batch_free(&batch);
+		sorbet_reader_close(&sdef);
+	}
+	// files without row groups
+	write_v3_file(test_path("read_batch_v3"), 1, 5000);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("read_batch_v3");
+	sorbet_reader_open(&sdef);
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	int rows = 0;
+	int64_t got;
+	bool ok = true;
+	while ((got = sorbet_read_batch(&sdef, &batch, 1024)) > 0) {
+		for (int64_t j = 0; j < got; j++) {
+			ok = ok && batch.cols[0].values.intval[j] == rows + j;
+		}
+		rows += got;
+	}
+	CHECK(ok && rows == 5000);
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+}
+
+// true if two files have the same contents
+bool same_files(const char *a, const char *b) {
+	FILE *fa = fopen(a, "rb");
+	FILE *fb = fopen(b, "rb");
+	bool same = fa != NULL && fb != NULL;
+	while (same) {
+		int ca = fgetc(fa);
+		same = ca == fgetc(fb);
+		if (ca == EOF) break;
+	}
+	if (fa != NULL) fclose(fa);
+	if (fb != NULL) fclose(fb);
+	return same;
+}
+
+void test_write_batch() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 10000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_types_file(&w, "write_rows", n);
+		// batches that don't line up with row groups write the same file
+		sorbet_def b = {0};
+		b.layout = layout;
+		b.compression = SORBET_COMPRESSION_GZIP;
+		b.row_group_size = 1000;
+		copy_test_file(&b, "write_rows", "write_batch", 777);
+		CHECK(same_files(test_path("write_rows"), test_path("write_batch")));
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("write_batch");
+		sorbet_reader_open(&sdef);
+		CHECK(sdef.n_rows == n && sdef.cstats[1].cnulls == (n + 6) / 7);
+		check_types_rows(&sdef, 0, n);
+		sorbet_reader_close(&sdef);
+	}
+	// vectors pointing at the caller's arrays, without validity bitmaps
+	int32_t ids[100];
+	int32_t offsets[101];
+	char names[1000];
+	offsets[0] = 0;
+	for (int i = 0; i < 100; i++) {
+		ids[i] = i;
+		offsets[i + 1] = offsets[i] + sprintf(names + offsets[i], "name%d", i);
+	}
+	sorbet_vector cols[4] = {{0}};
+	cols[0].type = INTEGER;
+	cols[0].length = 100;
+	cols[0].values.intval = ids;
+	cols[1].type = STRING;
+	cols[1].length = 100;
+	cols[1].offsets = offsets;
+	cols[1].data = (uint8_t *)names;
+	cols[1].data_size = offsets[100];
+	sorbet_batch batch = {2, 100, cols};
+	data_column batch_cols[] = {
 			{"id",   INTEGER, NULL_COL_TYPE, NULL_COL_TYPE},
 			{"name", STRING,  NULL_COL_TYPE, NULL_COL_TYPE},
 	};
-	sorbet_schema schema = {sizeof(cols) / sizeof(data_column), cols};
-	sdef.schema = schema;
-	test_rec_t recs[] = {
-			{ 1, "Moe"},
-			{2, "Shemp"},
-			{3, "Larry"}
-	};
-	sdef.compression = 1;
-	sorbet_writer_open(&sdef);
-	for (int i=0; i<3; i++) {
-		sorbet_write_int(&sdef, &recs[i].id);
-		sorbet_write_string(&sdef, (const uint8_t *)recs[i].name, strlen(recs[i].name));
+	sorbet_def w = {0};
+	w.filename = test_path("write_arrays");
+	w.schema.numCols = 2;
+	w.schema.cols = batch_cols;
+	sorbet_writer_open(&w);
+	CHECK(sorbet_write_batch(&w, &batch));
+	CHECK(sorbet_write_batch(&w, &batch));
+	sorbet_writer_close(&w);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("write_arrays");
+	sorbet_reader_open(&sdef);
+	CHECK(sdef.n_rows == 200 && sdef.cstats[0].cnulls == 0);
+	int i = 0;
+	col_val *row;
+	while ((row = sorbet_read_row(&sdef)) != NULL) {
+		char name[32];
+		int len = sprintf(name, "name%d", i % 100);
+		if (row[0].intval != i % 100 || row[1].strval.len != len || memcmp(row[1].strval.val, name, len) != 0) break;
+		i++;
+	}
+	CHECK(i == 200);
+	sorbet_reader_close(&sdef);
+}
+
+void test_threads() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 20000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 500;
+		write_types_file(&w, "one_thread", n);
+		// the same file, whichever thread compresses each group
+		sorbet_def t = {0};
+		t.layout = layout;
+		t.compression = SORBET_COMPRESSION_GZIP;
+		t.row_group_size = 500;
+		t.n_threads = 4;
+		write_types_file(&t, "threads", n);
+		CHECK(same_files(test_path("one_thread"), test_path("threads")));
+		sorbet_def b = {0};
+		b.layout = layout;
+		b.compression = SORBET_COMPRESSION_GZIP;
+		b.row_group_size = 500;
+		b.n_threads = 3;
+		copy_test_file(&b, "one_thread", "threads_batch", 1234);
+		CHECK(same_files(test_path("one_thread"), test_path("threads_batch")));
+	}
+}
+
+// what a parallel scan saw, added up across its threads
+typedef struct s_scan_totals {
+	int64_t rows;
+	int64_t sum;
+	int64_t batches;
+	int64_t stop_after;
+	int64_t misplaced;
+} scan_totals;
+
+bool scan_batch(const sorbet_batch *batch, uint64_t first_row, void *ctx) {
+	scan_totals *totals = (scan_totals *)ctx;
+	int64_t sum = 0;
+	for (int64_t j = 0; j < batch->n_rows; j++) {
+		if (batch->cols[0].values.intval[j] != (int32_t)(first_row + j)) __atomic_fetch_add(&totals->misplaced, 1, __ATOMIC_RELAXED);
+		sum += batch->cols[0].values.intval[j];
 	}
-	sorbet_writer_close(&sdef);
-*/
+	__atomic_fetch_add(&totals->rows, batch->n_rows, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&totals->sum, sum, __ATOMIC_RELAXED);
+	int64_t batches = __atomic_add_fetch(&totals->batches, 1, __ATOMIC_RELAXED);
+	return totals->stop_after == 0 || batches < totals->stop_after;
+}
+
+void test_splits() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int64_t n = 100500;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_test_file(&w, "splits", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("splits");
+		sorbet_reader_open(&sdef);
+		sorbet_split splits[7];
+		CHECK(sorbet_reader_splits(&sdef, splits, 7) == 7);
+		sorbet_reader_close(&sdef);
+		uint64_t next = 0;
+		for (int i = 0; i < 7; i++) {
+			CHECK(splits[i].first_row == next && splits[i].n_rows > 0);
+			sorbet_def part = {0};
+			CHECK(sorbet_reader_open_split(&part, &splits[i]));
+			check_test_rows(&part, splits[i].first_row, splits[i].n_rows);
+			sorbet_reader_close(&part);
+			next += splits[i].n_rows;
+		}
+		CHECK(next == n);
+		for (int threads = 1; threads <= 16; threads *= 4) {
+			scan_totals totals = {0};
+			CHECK(sorbet_parallel_scan(test_path("splits"), threads, scan_batch, &totals));
+			CHECK(totals.rows == n && totals.sum == n * (n - 1) / 2 && totals.misplaced == 0);
+			// the scan stops soon after the callback returns false
+			scan_totals stopped = {0};
+			stopped.stop_after = 3;
+			CHECK(sorbet_parallel_scan(test_path("splits"), threads, scan_batch, &stopped));
+			CHECK(stopped.batches >= 3 && stopped.batches < 3 + threads);
+		}
+	}
+	// files without row groups make one split
+	write_v3_file(test_path("splits_v3"), 1, 5000);
+	scan_totals totals = {0};
+	CHECK(sorbet_parallel_scan(test_path("splits_v3"), 4, scan_batch, &totals));
+	CHECK(totals.rows == 5000 && totals.misplaced == 0);
+	// a file that isn't there, or isn't a sorbet file
+	remove(test_path("splits_missing"));
+	sorbet_split missing = {0};
+	missing.filename = test_path("splits_missing");
+	missing.n_rows = 100;
+	sorbet_def part = {0};
+	CHECK(!sorbet_reader_open_split(&part, &missing));
+	CHECK(!sorbet_parallel_scan(test_path("splits_missing"), 4, scan_batch, &totals));
+	FILE *f = fopen(test_path("splits_missing"), "wb");
+	fputs("not a sorbet file", f);
+	fclose(f);
+	CHECK(!sorbet_reader_open_split(&part, &missing));
+	CHECK(!sorbet_parallel_scan(test_path("splits_missing"), 4, scan_batch, &totals));
+	CHECK(totals.rows == 5000);
+}
+
+long file_size(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return -1;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+void test_codecs() {
+	int n = 20000;
+	sorbet_def plain = {0};
+	plain.row_group_size = 2000;
+	write_types_file(&plain, "codec_none", n);
+	long plain_size = file_size(test_path("codec_none"));
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		for (uint8_t compression = SORBET_COMPRESSION_GZIP; compression <= SORBET_COMPRESSION_ZSTD; compression++) {
+			for (int level = 0; level <= 9; level += 9) {
+				// codecs that weren't built in write uncompressed files
+				bool built_in = sorbet_find_codec(compression) != NULL;
+				sorbet_def w = {0};
+				w.layout = layout;
+				w.compression = compression;
+				w.compression_level = level;
+				w.row_group_size = 2000;
+				write_types_file(&w, "codec", n);
+				if (built_in && layout == SORBET_LAYOUT_ROW) CHECK(file_size(test_path("codec")) < plain_size);
+
+				sorbet_def sdef = {0};
+				sdef.filename = test_path("codec");
+				sorbet_reader_open(&sdef);
+				CHECK(sdef.compression == (built_in ? compression : SORBET_COMPRESSION_NONE));
+				check_types_rows(&sdef, 0, n);
+				CHECK(sorbet_seek_row(&sdef, 7777));
+				CHECK(is_types_row(sorbet_read_row(&sdef), 7777));
+				sorbet_reader_close(&sdef);
+			}
+		}
+	}
+	CHECK(sorbet_find_codec(SORBET_COMPRESSION_GZIP) != NULL);
+	CHECK(sorbet_find_codec(200) == NULL);
+}
+
+// a compress that always fails
+int64_t failing_compress(void *ctx, const uint8_t *src, uint64_t len, uint8_t *dst, uint64_t cap) {
+	return -1;
+}
+
+void test_compress_failure() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 100;
+		w.filename = test_path("compress_failure");
+		w.schema.numCols = sizeof(test_cols) / sizeof(data_column);
+		w.schema.cols = test_cols;
+		sorbet_writer_open(&w);
+		long header_size = ftell(w.f);
+		sorbet_codec failing = *w.codec;
+		failing.compress = failing_compress;
+		w.codec = &failing;
+		for (int i = 0; i < 1000; i++) {
+			write_test_row(&w, i);
+		}
+		CHECK(w.write_failed);
+		CHECK(!sorbet_writer_close(&w));
+		// nothing was written after the header
+		CHECK(file_size(test_path("compress_failure")) == header_size);
+	}
+}
+
+void test_read_ahead() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 20000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 700;
+		write_types_file(&w, "read_ahead", n);
+
+		for (int ahead = 1; ahead <= 4; ahead *= 4) {
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("read_ahead");
+			sdef.read_ahead = ahead;
+			sorbet_reader_open(&sdef);
+			CHECK(sdef.ahead != NULL);
+			check_types_rows(&sdef, 0, n);
+			// seeking throws away the groups read ahead
+			CHECK(sorbet_seek_row(&sdef, 10000));
+			CHECK(is_types_row(sorbet_read_row(&sdef), 10000));
+			CHECK(sorbet_seek_row(&sdef, 150));
+			CHECK(is_types_row(sorbet_read_row(&sdef), 150));
+			int cols[] = {0, 1};
+			CHECK(sorbet_reader_set_projection(&sdef, cols, 2));
+			sorbet_batch batch;
+			sorbet_batch_init(&batch, &sdef.schema);
+			int rows = 151;
+			int64_t got;
+			bool ok = true;
+			while ((got = sorbet_read_batch(&sdef, &batch, 1000)) > 0) {
+				ok = ok && is_types_batch(&batch, rows);
+				rows += got;
+			}
+			CHECK(ok && rows == n);
+			sorbet_batch_free(&batch);
+			CHECK(sorbet_reader_set_projection(&sdef, NULL, 0));
+			CHECK(sorbet_seek_row(&sdef, 19000));
+			check_types_rows(&sdef, 19000, n - 19000);
+			sorbet_reader_close(&sdef);
+			CHECK(sdef.ahead == NULL);
+		}
+	}
+	// files without row groups are read without it
+	write_v3_file(test_path("read_ahead_v3"), 1, 1000);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("read_ahead_v3");
+	sdef.read_ahead = 2;
 	sorbet_reader_open(&sdef);
-	int max_str_len = 1;
-	int max_bin_len = 1;
-	for (int c=0; c<sdef.schema.numCols; c++) {
-		printf("%d - %s (%s)\n", c, sdef.schema.cols[c].name, column_type_label[sdef.schema.cols[c].type]);
-		if (sdef.schema.cols[c].type == STRING && sdef.cstats[c].cwidth > max_str_len) {
-			max_str_len = sdef.cstats[c].cwidth;
-		} else if (sdef.schema.cols[c].type == BINARY && sdef.cstats[c].cwidth > max_bin_len) {
-			max_bin_len = sdef.cstats[c].cwidth;
-		}
-	}
-	printf("max string length is %d\n", max_str_len);
-	int32_t intval;
-	int64_t longval;
-	float32_t floatval;
-	float64_t doubleval;
-	bool boolval;
-	char *strval[max_str_len+1];
-	uint8_t *binval[max_bin_len];
-	sorbet_date dateval;
-	uint64_t datetimeval;
-	sorbet_time timeval;
-
-	for (uint64_t i=0; i<sdef.n_rows; i++) {
-		col_val *row = sorbet_read_row(&sdef);
-		for (int c=0; c<sdef.schema.numCols; c++) {
-			switch (sdef.schema.cols[c].type) {
-				case INTEGER: {
-					printf(" %d", row[c].intval);
-					break;
+	CHECK(sdef.ahead == NULL);
+	int i = 0;
+	col_val *row;
+	while ((row = sorbet_read_row(&sdef)) != NULL && row[0].intval == i) {
+		i++;
+	}
+	CHECK(i == 1000);
+	sorbet_reader_close(&sdef);
+}
+
+void test_io_uring() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 20000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_types_file(&w, "stdio", n);
+		sorbet_def u = {0};
+		u.layout = layout;
+		u.compression = SORBET_COMPRESSION_GZIP;
+		u.row_group_size = 1000;
+		u.use_io_uring = true;
+		u.io_depth = 3;
+		write_types_file(&u, "io_uring", n);
+		CHECK(same_files(test_path("stdio"), test_path("io_uring")));
+
+		for (int depth = 1; depth <= 4; depth *= 4) {
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("io_uring");
+			sdef.use_io_uring = true;
+			sdef.io_depth = depth;
+			sorbet_reader_open(&sdef);
+			CHECK(sdef.io != NULL);
+			check_types_rows(&sdef, 0, n);
+			CHECK(sorbet_seek_row(&sdef, 15000));
+			CHECK(is_types_row(sorbet_read_row(&sdef), 15000));
+			CHECK(sorbet_seek_row(&sdef, 999));
+			check_types_rows(&sdef, 999, n - 999);
+			// driven like an event loop: start reads, then read the groups as they finish
+			int32_t want[] = {12, 3, 17};
+			int submitted = 0;
+			for (int k = 0; k < 3; k++) {
+				if (sorbet_reader_submit(&sdef, want[k])) submitted++;
+			}
+			CHECK(submitted >= 1 && submitted <= depth);
+			sorbet_batch batch;
+			sorbet_batch_init(&batch, &sdef.schema);
+			int seen = 0;
+			int32_t g;
+			while (seen < submitted && (g = sorbet_reader_complete(&sdef, true)) >= 0) {
+				for (int k = 0; k < submitted; k++) {
+					if (want[k] == g) seen++;
 				}
-				case STRING: {
-					printf(" %s", row[c].strval.val);
-					break;
+				CHECK(sorbet_seek_row(&sdef, sdef.groups[g].first_row));
+				CHECK(sorbet_read_batch(&sdef, &batch, 5000) == 1000);
+				CHECK(is_types_batch(&batch, g * 1000));
+			}
+			CHECK(seen == submitted);
+			sorbet_batch_free(&batch);
+			sorbet_reader_close(&sdef);
+		}
+	}
+}
+
+void test_write_failure() {
+	// every write to /dev/full fails, through stdio and through io_uring
+	for (int io_uring = 0; io_uring < 2; io_uring++) {
+		sorbet_def w = {0};
+		w.filename = "/dev/full";
+		w.schema.numCols = sizeof(test_cols) / sizeof(data_column);
+		w.schema.cols = test_cols;
+		w.row_group_size = 1000;
+		w.use_io_uring = io_uring;
+		sorbet_writer_open(&w);
+		uint8_t name[] = "name";
+		col_val row[4];
+		bool ok = true;
+		for (int i = 0; i < 100000 && ok; i++) {
+			row[0].intval = i;
+			row[1].strval.val = name;
+			row[1].strval.len = 4;
+			row[2].datetimeval = 1000000 + i;
+			row[3].doubleval = i * 0.5;
+			ok = sorbet_write_row(&w, row);
+		}
+		CHECK(!ok && w.write_failed);
+		CHECK(!sorbet_writer_close(&w));
+	}
+}
+
+void test_buffers() {
+	// version 3 files are streamed through a buffer of buffer_size
+	for (uint8_t compression = 0; compression < 2; compression++) {
+		write_v3_file(test_path("buffers_v3"), compression, 20000);
+		for (int size = 256; size <= (1 << 20); size *= 64) {
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("buffers_v3");
+			sdef.buffer_size = size;
+			sorbet_reader_open(&sdef);
+			CHECK(sdef.buf_cap == size);
+			int i = 0;
+			col_val *row;
+			while ((row = sorbet_read_row(&sdef)) != NULL && row[0].intval == i) {
+				i++;
+			}
+			CHECK(i == 20000);
+			sorbet_reader_close(&sdef);
+		}
+	}
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 20000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_types_file(&w, "advice_normal", n);
+		// advice only changes how the kernel caches the file
+		sorbet_def a = {0};
+		a.layout = layout;
+		a.compression = SORBET_COMPRESSION_GZIP;
+		a.row_group_size = 1000;
+		a.advice = SORBET_ADVICE_NOREUSE;
+		write_types_file(&a, "advice_noreuse", n);
+		CHECK(same_files(test_path("advice_normal"), test_path("advice_noreuse")));
+		for (int advice = SORBET_ADVICE_NORMAL; advice <= SORBET_ADVICE_NOREUSE; advice++) {
+			// falls back to the page cache where O_DIRECT isn't supported
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("advice_noreuse");
+			sdef.advice = advice;
+			sdef.use_direct_io = (advice != SORBET_ADVICE_SEQUENTIAL);
+			sorbet_reader_open(&sdef);
+			check_types_rows(&sdef, 0, n);
+			CHECK(sorbet_seek_row(&sdef, 4321));
+			check_types_rows(&sdef, 4321, n - 4321);
+			sorbet_reader_close(&sdef);
+		}
+	}
+}
+
+// the encoding of column col's chunk in row group g
+uint8_t chunk_encoding(const sorbet_def *sdef, int g, int col) {
+	return sdef->chunks[g * sdef->schema.numCols + col].encoding;
+}
+
+void test_dictionary() {
+	int n = 10000;
+	int32_t limits[] = {0, 20, -1};
+	for (int k = 0; k < 3; k++) {
+		sorbet_def w = {0};
+		w.layout = SORBET_LAYOUT_COLUMNAR;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		w.dict_max_entries = limits[k];
+		write_types_file(&w, "dictionary", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("dictionary");
+		sdef.dictionary_codes = true;
+		sorbet_reader_open(&sdef);
+		// name has 50 distinct values in each group and bin has 11
+		CHECK((chunk_encoding(&sdef, 3, 1) == SORBET_ENCODING_DICTIONARY) == (limits[k] == 0));
+		CHECK((chunk_encoding(&sdef, 3, 7) == SORBET_ENCODING_DICTIONARY) == (limits[k] >= 0));
+		check_types_rows(&sdef, 0, n);
+		CHECK(sorbet_seek_row(&sdef, 0));
+		sorbet_batch batch;
+		sorbet_batch_init(&batch, &sdef.schema);
+		int rows = 0;
+		int64_t got;
+		bool ok = true;
+		while ((got = sorbet_read_batch(&sdef, &batch, 400)) > 0) {
+			ok = ok && (batch.cols[1].dictionary != NULL) == (limits[k] == 0);
+			ok = ok && (batch.cols[7].dictionary != NULL) == (limits[k] >= 0);
+			if (batch.cols[1].dictionary != NULL) ok = ok && batch.cols[1].dictionary->length == 50;
+			ok = ok && is_types_batch(&batch, rows);
+			rows += got;
+		}
+		CHECK(ok && rows == n);
+		sorbet_batch_free(&batch);
+		sorbet_reader_close(&sdef);
+	}
+	// without dictionary_codes the values are copied out
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("dictionary");
+	sorbet_reader_open(&sdef);
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	CHECK(sorbet_read_batch(&sdef, &batch, 400) == 400);
+	CHECK(batch.cols[7].dictionary == NULL && is_types_batch(&batch, 0));
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+}
+
+// reads a types file back as rows and as batches
+void check_types_file(const char *name, int n) {
+	sorbet_def sdef = {0};
+	sdef.filename = test_path(name);
+	sorbet_reader_open(&sdef);
+	check_types_rows(&sdef, 0, n);
+	CHECK(sorbet_seek_row(&sdef, 0));
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	int rows = 0;
+	int64_t got;
+	bool ok = true;
+	while ((got = sorbet_read_batch(&sdef, &batch, 333)) > 0) {
+		ok = ok && is_types_batch(&batch, rows);
+		rows += got;
+	}
+	CHECK(ok && rows == n);
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+}
+
+void test_integer_encodings() {
+	int n = 5000;
+	// the integer-valued columns of a types file: id, ts, dt, tm and l
+	int int_cols[] = {0, 2, 5, 6, 9};
+	column_encoding encodings[10];
+	for (int c = 0; c < 10; c++) encodings[c] = SORBET_ENCODING_PLAIN;
+	sorbet_def w = {0};
+	w.layout = SORBET_LAYOUT_COLUMNAR;
+	w.row_group_size = 1000;
+	w.encodings = encodings;
+	write_types_file(&w, "encoding_plain", n);
+	long plain_size = file_size(test_path("encoding_plain"));
+
+	for (int e = SORBET_ENCODING_VARINT; e <= SORBET_ENCODING_DELTA_DELTA; e++) {
+		for (int k = 0; k < 5; k++) encodings[int_cols[k]] = e;
+		// row groups of 1 and 2 rows leave the delta encodings nothing to work on
+		int32_t group_sizes[] = {1000, 2, 1};
+		for (int g = 0; g < 3; g++) {
+			sorbet_def wg = {0};
+			wg.layout = SORBET_LAYOUT_COLUMNAR;
+			wg.row_group_size = group_sizes[g];
+			wg.encodings = encodings;
+			write_types_file(&wg, "encoding", g == 0 ? n : 7);
+			check_types_file("encoding", g == 0 ? n : 7);
+		}
+		sorbet_def wg = {0};
+		wg.layout = SORBET_LAYOUT_COLUMNAR;
+		wg.row_group_size = 1000;
+		wg.encodings = encodings;
+		write_types_file(&wg, "encoding", n);
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("encoding");
+		sorbet_reader_open(&sdef);
+		bool all = true;
+		for (int k = 0; k < 5; k++) all = all && chunk_encoding(&sdef, 2, int_cols[k]) == e;
+		CHECK(all);
+		CHECK(chunk_encoding(&sdef, 2, 3) == SORBET_ENCODING_PLAIN);
+		sorbet_reader_close(&sdef);
+		CHECK(file_size(test_path("encoding")) < plain_size);
+		check_types_file("encoding", n);
+	}
+
+	// left to itself the writer picks something smaller than PLAIN for each
+	sorbet_def wa = {0};
+	wa.layout = SORBET_LAYOUT_COLUMNAR;
+	wa.row_group_size = 1000;
+	write_types_file(&wa, "encoding", n);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("encoding");
+	sorbet_reader_open(&sdef);
+	bool none_plain = true;
+	for (int k = 0; k < 5; k++) none_plain = none_plain && chunk_encoding(&sdef, 2, int_cols[k]) != SORBET_ENCODING_PLAIN;
+	CHECK(none_plain);
+	// ids go up by one
+	CHECK(chunk_encoding(&sdef, 2, 0) == SORBET_ENCODING_DELTA || chunk_encoding(&sdef, 2, 0) == SORBET_ENCODING_DELTA_DELTA);
+	sorbet_reader_close(&sdef);
+	check_types_file("encoding", n);
+}
+
+void test_bitmap_encoding() {
+	int n = 5000;
+	column_encoding encodings[10];
+	for (int c = 0; c < 10; c++) encodings[c] = SORBET_ENCODING_BITMAP;
+	sorbet_def w = {0};
+	w.layout = SORBET_LAYOUT_COLUMNAR;
+	w.row_group_size = 1000;
+	w.encodings = encodings;
+	write_types_file(&w, "bitmap", n);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("bitmap");
+	sorbet_reader_open(&sdef);
+	bool all = true;
+	for (int c = 0; c < 10; c++) all = all && chunk_encoding(&sdef, 1, c) == SORBET_ENCODING_BITMAP;
+	CHECK(all);
+	// the nulls come back from the validity bitmaps
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	int rows = 0;
+	int64_t got;
+	bool ok = true;
+	while ((got = sorbet_read_batch(&sdef, &batch, 333)) > 0) {
+		for (int64_t j = 0; j < got; j++) {
+			int i = rows + j;
+			ok = ok && sorbet_vector_is_valid(&batch.cols[1], j) == (i % 7 != 0);
+			ok = ok && sorbet_vector_is_valid(&batch.cols[4], j) == (i % 3 != 0);
+			ok = ok && sorbet_vector_is_valid(&batch.cols[9], j) == (i % 13 != 0);
+			ok = ok && sorbet_vector_is_valid(&batch.cols[3], j);
+		}
+		ok = ok && is_types_batch(&batch, rows);
+		rows += got;
+	}
+	CHECK(ok && rows == n);
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+	check_types_file("bitmap", n);
+
+	// left to itself the writer uses it for BOOLEAN, FLOAT and DOUBLE
+	sorbet_def wa = {0};
+	wa.layout = SORBET_LAYOUT_COLUMNAR;
+	wa.row_group_size = 1000;
+	write_types_file(&wa, "bitmap", n);
+	sorbet_def sa = {0};
+	sa.filename = test_path("bitmap");
+	sorbet_reader_open(&sa);
+	CHECK(chunk_encoding(&sa, 1, 3) == SORBET_ENCODING_BITMAP);
+	CHECK(chunk_encoding(&sa, 1, 4) == SORBET_ENCODING_BITMAP);
+	CHECK(chunk_encoding(&sa, 1, 8) == SORBET_ENCODING_BITMAP);
+	sorbet_reader_close(&sa);
+	check_types_file("bitmap", n);
+}
+
+// columns that change every few hundred rows, with runs of nulls in tenant
+data_column run_cols[] = {
+		{"day",    DATE,    NULL_COL_TYPE, NULL_COL_TYPE},
+		{"tenant", INTEGER, NULL_COL_TYPE, NULL_COL_TYPE},
+		{"price",  DOUBLE,  NULL_COL_TYPE, NULL_COL_TYPE},
+};
+
+void write_runs_file(sorbet_def *sdef, const char *name, int n) {
+	sdef->filename = test_path(name);
+	sdef->layout = SORBET_LAYOUT_COLUMNAR;
+	sdef->row_group_size = 4000;
+	sdef->schema.numCols = sizeof(run_cols) / sizeof(data_column);
+	sdef->schema.cols = run_cols;
+	sorbet_writer_open(sdef);
+	for (int i = 0; i < n; i++) {
+		sorbet_date day = {20, 1, 1 + i / 2000};
+		int32_t tenant = i / 300;
+		float64_t price = (i / 50) * 1.5;
+		sorbet_write_date(sdef, &day);
+		sorbet_write_int(sdef, ((i / 100) % 9 == 4) ? NULL : &tenant);
+		sorbet_write_double(sdef, &price);
+	}
+	sorbet_writer_close(sdef);
+}
+
+// value i of a runs file column, as held in a vector
+int64_t run_value(int col, int i) {
+	if (col == 0) return 200100 + 1 + i / 2000;
+	if (col == 1) return ((i / 100) % 9 == 4) ? 0 : i / 300;
+	return (i / 50) * 3;
+}
+
+int64_t vector_run_value(const sorbet_vector *vec, int64_t j) {
+	if (vec->n_runs > 0) {
+		int64_t r = 0;
+		while (vec->run_ends[r] <= j) r++;
+		j = r;
+	}
+	if (vec->type == DOUBLE) return (int64_t)(vec->values.doubleval[j] * 2);
+	return vec->values.intval[j];
+}
+
+// reads a runs file as batches and checks every row, and that the vectors hold
+// runs exactly when runs is set
+void check_runs_file(const char *name, int n, bool runs) {
+	sorbet_def sdef = {0};
+	sdef.filename = test_path(name);
+	sdef.rle_runs = runs;
+	sorbet_reader_open(&sdef);
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	int rows = 0;
+	int64_t got;
+	bool ok = true;
+	while ((got = sorbet_read_batch(&sdef, &batch, 999)) > 0) {
+		for (int c = 0; c < 3; c++) {
+			const sorbet_vector *vec = &batch.cols[c];
+			ok = ok && (vec->n_runs > 0) == runs;
+			if (vec->n_runs > 0) {
+				ok = ok && vec->run_ends[vec->n_runs - 1] == got;
+				for (int64_t r = 1; r < vec->n_runs; r++) ok = ok && vec->run_ends[r] > vec->run_ends[r - 1];
+			}
+			for (int64_t j = 0; j < got; j++) {
+				int i = rows + j;
+				ok = ok && sorbet_vector_is_valid(vec, j) == (c != 1 || (i / 100) % 9 != 4);
+				ok = ok && vector_run_value(vec, j) == run_value(c, i);
+			}
+		}
+		rows += got;
+	}
+	CHECK(ok && rows == n);
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+}
+
+void test_rle() {
+	int n = 12345;
+	sorbet_def w = {0};
+	write_runs_file(&w, "runs", n);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("runs");
+	sorbet_reader_open(&sdef);
+	bool all = true;
+	for (int c = 0; c < 3; c++) all = all && chunk_encoding(&sdef, 1, c) == SORBET_ENCODING_RLE;
+	CHECK(all);
+	col_val *row;
+	int i = 0;
+	while ((row = sorbet_read_row(&sdef)) != NULL) {
+		if (row[0].dateval.d != 1 + i / 2000 || row[2].doubleval != (i / 50) * 1.5) break;
+		if ((i / 100) % 9 != 4 && row[1].intval != i / 300) break;
+		i++;
+	}
+	CHECK(i == n);
+	sorbet_reader_close(&sdef);
+	check_runs_file("runs", n, false);
+	check_runs_file("runs", n, true);
+
+	// forced on columns the writer wouldn't pick it for
+	column_encoding encodings[10];
+	for (int c = 0; c < 10; c++) encodings[c] = SORBET_ENCODING_AUTO;
+	encodings[0] = SORBET_ENCODING_RLE;
+	encodings[4] = SORBET_ENCODING_RLE;
+	encodings[8] = SORBET_ENCODING_RLE;
+	sorbet_def wt = {0};
+	wt.layout = SORBET_LAYOUT_COLUMNAR;
+	wt.row_group_size = 1000;
+	wt.encodings = encodings;
+	write_types_file(&wt, "rle_types", 3000);
+	check_types_file("rle_types", 3000);
+
+	// batches of runs write back to the same file, and to the ROW layout
+	sorbet_def in = {0};
+	in.filename = test_path("runs");
+	in.rle_runs = true;
+	sorbet_reader_open(&in);
+	sorbet_def out = {0};
+	out.filename = test_path("runs_copy");
+	out.layout = SORBET_LAYOUT_COLUMNAR;
+	out.row_group_size = 4000;
+	out.schema = in.schema;
+	sorbet_writer_open(&out);
+	sorbet_def out_rows = {0};
+	out_rows.filename = test_path("runs_rows");
+	out_rows.row_group_size = 4000;
+	out_rows.schema = in.schema;
+	sorbet_writer_open(&out_rows);
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &in.schema);
+	bool ok = true;
+	while (sorbet_read_batch(&in, &batch, 4000) > 0) {
+		ok = ok && sorbet_write_batch(&out, &batch) && sorbet_write_batch(&out_rows, &batch);
+	}
+	CHECK(ok);
+	sorbet_batch_free(&batch);
+	sorbet_writer_close(&out);
+	sorbet_writer_close(&out_rows);
+	sorbet_reader_close(&in);
+	CHECK(same_files(test_path("runs"), test_path("runs_copy")));
+	check_runs_file("runs_rows", n, false);
+}
+
+// slowly changing readings, with a NaN, a negative zero and an infinity among them
+data_column reading_cols[] = {
+		{"temp",  DOUBLE, NULL_COL_TYPE, NULL_COL_TYPE},
+		{"level", FLOAT,  NULL_COL_TYPE, NULL_COL_TYPE},
+};
+
+float64_t reading_temp(int i) {
+	if (i == 77) return NAN;
+	if (i == 78) return -0.0;
+	if (i == 79) return INFINITY;
+	return 20.0 + (i / 60) * 0.1;
+}
+
+void write_readings_file(sorbet_def *sdef, const char *name, int n, const column_encoding *encodings) {
+	sdef->filename = test_path(name);
+	sdef->layout = SORBET_LAYOUT_COLUMNAR;
+	sdef->row_group_size = 10000;
+	sdef->encodings = encodings;
+	sdef->schema.numCols = sizeof(reading_cols) / sizeof(data_column);
+	sdef->schema.cols = reading_cols;
+	sorbet_writer_open(sdef);
+	for (int i = 0; i < n; i++) {
+		float64_t temp = reading_temp(i);
+		float32_t level = 100.0f + (float32_t)((i / 10) % 50);
+		sorbet_write_double(sdef, &temp);
+		sorbet_write_float(sdef, (i % 11 == 5) ? NULL : &level);
+	}
+	sorbet_writer_close(sdef);
+}
+
+// the values have to come back bit for bit, NaN and -0.0 included
+void check_readings_file(const char *name, int n) {
+	sorbet_def sdef = {0};
+	sdef.filename = test_path(name);
+	sorbet_reader_open(&sdef);
+	col_val *row;
+	int i = 0;
+	while ((row = sorbet_read_row(&sdef)) != NULL) {
+		float64_t temp = reading_temp(i);
+		if (memcmp(&row[0].doubleval, &temp, sizeof(temp)) != 0) break;
+		if (i % 11 != 5 && row[1].floatval != 100.0f + (float32_t)((i / 10) % 50)) break;
+		i++;
+	}
+	CHECK(i == n);
+	CHECK(sorbet_seek_row(&sdef, 0));
+	sorbet_batch batch;
+	sorbet_batch_init(&batch, &sdef.schema);
+	int rows = 0;
+	int64_t got;
+	bool ok = true;
+	while ((got = sorbet_read_batch(&sdef, &batch, 4096)) > 0) {
+		for (int64_t j = 0; j < got; j++) {
+			i = rows + j;
+			float64_t temp = reading_temp(i);
+			ok = ok && memcmp(&batch.cols[0].values.doubleval[j], &temp, sizeof(temp)) == 0;
+			ok = ok && sorbet_vector_is_valid(&batch.cols[1], j) == (i % 11 != 5);
+			ok = ok && (i % 11 == 5 || batch.cols[1].values.floatval[j] == 100.0f + (float32_t)((i / 10) % 50));
+		}
+		rows += got;
+	}
+	CHECK(ok && rows == n);
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+}
+
+void test_xor_encoding() {
+	int n = 30001;
+	column_encoding encodings[] = {SORBET_ENCODING_XOR, SORBET_ENCODING_XOR};
+	sorbet_def wa = {0};
+	write_readings_file(&wa, "readings_auto", n, NULL);
+	sorbet_def wx = {0};
+	write_readings_file(&wx, "readings_xor", n, encodings);
+	CHECK(file_size(test_path("readings_xor")) < file_size(test_path("readings_auto")));
+
+	// the writer only uses it when asked
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("readings_auto");
+	sorbet_reader_open(&sdef);
+	CHECK(chunk_encoding(&sdef, 0, 0) != SORBET_ENCODING_XOR && chunk_encoding(&sdef, 0, 1) != SORBET_ENCODING_XOR);
+	sorbet_reader_close(&sdef);
+	sdef = (sorbet_def){0};
+	sdef.filename = test_path("readings_xor");
+	sorbet_reader_open(&sdef);
+	bool all = true;
+	for (int g = 0; g < sdef.n_groups; g++) {
+		all = all && chunk_encoding(&sdef, g, 0) == SORBET_ENCODING_XOR && chunk_encoding(&sdef, g, 1) == SORBET_ENCODING_XOR;
+	}
+	CHECK(all);
+	sorbet_reader_close(&sdef);
+	check_readings_file("readings_auto", n);
+	check_readings_file("readings_xor", n);
+
+	// and compressed
+	sorbet_def wz = {0};
+	wz.compression = SORBET_COMPRESSION_GZIP;
+	write_readings_file(&wz, "readings_xor", n, encodings);
+	check_readings_file("readings_xor", n);
+
+	// values that change completely from one row to the next
+	column_encoding type_encodings[10];
+	for (int c = 0; c < 10; c++) type_encodings[c] = SORBET_ENCODING_AUTO;
+	type_encodings[3] = SORBET_ENCODING_XOR;
+	type_encodings[8] = SORBET_ENCODING_XOR;
+	sorbet_def wt = {0};
+	wt.layout = SORBET_LAYOUT_COLUMNAR;
+	wt.row_group_size = 1000;
+	wt.encodings = type_encodings;
+	write_types_file(&wt, "xor_types", 3000);
+	check_types_file("xor_types", 3000);
+}
+
+// reads the rest of a test file's rows, checking each is the row its id says, and
+// returns how many there were. first gets the first id
+int read_test_ids(sorbet_def *sdef, int *first) {
+	int n = 0;
+	*first = -1;
+	col_val *row;
+	while ((row = sorbet_read_row(sdef)) != NULL) {
+		if (n == 0) *first = row[0].intval;
+		if (!is_test_row(row, *first + n)) break;
+		n++;
+	}
+	return n;
+}
+
+void test_predicates() {
+	int n = 20000;
+	for (int layout = 0; layout < 2; layout++) {
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_test_file(&w, "predicates", n);
+		for (int mode = 0; mode < 3; mode++) {
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("predicates");
+			sdef.read_ahead = mode == 1 ? 2 : 0;
+			sdef.use_io_uring = mode == 2;
+			sorbet_reader_open(&sdef);
+			CHECK(sdef.zones != NULL);
+			const sorbet_zone *id_zone = &sdef.zones[7 * 4 + 0];
+			CHECK(id_zone->has_values && id_zone->n_nulls == 0 && id_zone->min.longval == 7000 && id_zone->max.longval == 7999);
+			const sorbet_zone *ts_zone = &sdef.zones[7 * 4 + 2];
+			CHECK(ts_zone->n_nulls == 200 && ts_zone->min.longval == 1000000 + 7001 && ts_zone->max.longval == 1000000 + 7999);
+
+			// only groups 5 to 7 can hold ids in [5500, 7200), and all their rows come back
+			col_val v;
+			v.intval = 5500;
+			CHECK(sorbet_reader_add_predicate(&sdef, 0, SORBET_OP_GE, &v));
+			v.intval = 7200;
+			CHECK(sorbet_reader_add_predicate(&sdef, 0, SORBET_OP_LT, &v));
+			int first;
+			CHECK(read_test_ids(&sdef, &first) == 3000 && first == 5000);
+			CHECK(sorbet_seek_row(&sdef, 0));
+			sorbet_batch batch;
+			sorbet_batch_init(&batch, &sdef.schema);
+			int rows = 0;
+			int64_t got;
+			bool ok = true;
+			while ((got = sorbet_read_batch(&sdef, &batch, 777)) > 0) {
+				ok = ok && batch.cols[0].values.intval[0] == 5000 + rows && batch.cols[0].values.intval[got - 1] == 5000 + rows + got - 1;
+				rows += got;
+			}
+			CHECK(ok && rows == 3000);
+			sorbet_batch_free(&batch);
+
+			sorbet_reader_clear_predicates(&sdef);
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(read_test_ids(&sdef, &first) == n && first == 0);
+
+			// doubles, and a value past the last group
+			v.doubleval = 100.0;
+			CHECK(sorbet_reader_add_predicate(&sdef, 3, SORBET_OP_EQ, &v));
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(read_test_ids(&sdef, &first) == 1000 && first == 0);
+			v.intval = n;
+			CHECK(sorbet_reader_add_predicate(&sdef, 0, SORBET_OP_GE, &v));
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(sorbet_read_row(&sdef) == NULL);
+			sorbet_reader_clear_predicates(&sdef);
+
+			// every group has null timestamps and none has a null id
+			CHECK(sorbet_reader_add_predicate(&sdef, 2, SORBET_OP_IS_NULL, NULL));
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(read_test_ids(&sdef, &first) == n);
+			CHECK(sorbet_reader_add_predicate(&sdef, 0, SORBET_OP_IS_NULL, NULL));
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(sorbet_read_row(&sdef) == NULL);
+			sorbet_reader_clear_predicates(&sdef);
+
+			CHECK(!sorbet_reader_add_predicate(&sdef, 4, SORBET_OP_IS_NULL, NULL));
+			CHECK(!sorbet_reader_add_predicate(&sdef, 0, SORBET_OP_EQ, NULL));
+			sorbet_reader_close(&sdef);
+		}
+	}
+
+	// version 3 files have no zone maps and are read whole
+	write_v3_file(test_path("v3"), 0, 5000);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("v3");
+	sorbet_reader_open(&sdef);
+	col_val v;
+	v.intval = 4000;
+	CHECK(sorbet_reader_add_predicate(&sdef, 0, SORBET_OP_GE, &v));
+	int rows = 0;
+	while (sorbet_read_row(&sdef) != NULL) rows++;
+	CHECK(rows == 5000);
+	sorbet_reader_close(&sdef);
+}
+
+// adds an EQ predicate on a test file's name column and returns how many groups
+// will be read. found says whether the name turned up in them
+int groups_read_for_name(const char *path, const char *name, bool *found) {
+	sorbet_def sdef = {0};
+	sdef.filename = path;
+	sorbet_reader_open(&sdef);
+	col_val v;
+	v.strval.val = (uint8_t *)name;
+	v.strval.len = strlen(name);
+	CHECK(sorbet_reader_add_predicate(&sdef, 1, SORBET_OP_EQ, &v));
+	int groups = 0;
+	for (int g = 0; g < sdef.n_groups; g++) {
+		if (sdef.group_skip == NULL || !sdef.group_skip[g]) groups++;
+	}
+	*found = false;
+	col_val *row;
+	while ((row = sorbet_read_row(&sdef)) != NULL) {
+		if (row[1].strval.len == v.strval.len && memcmp(row[1].strval.val, name, v.strval.len) == 0) *found = true;
+	}
+	sorbet_reader_close(&sdef);
+	return groups;
+}
+
+void test_bloom_filters() {
+	int n = 20000;
+	bool filters[] = {false, true, false, false};
+	for (int layout = 0; layout < 2; layout++) {
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		w.bloom_filters = filters;
+		write_test_file(&w, "bloom", n);
+		sorbet_def wp = {0};
+		wp.layout = layout;
+		wp.compression = SORBET_COMPRESSION_GZIP;
+		wp.row_group_size = 1000;
+		write_test_file(&wp, "no_bloom", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("bloom");
+		sorbet_reader_open(&sdef);
+		CHECK(sdef.bloom_index != NULL);
+		CHECK(sdef.bloom_index[3 * 4 + 1].n_blocks > 0 && sdef.bloom_index[3 * 4 + 0].n_blocks == 0);
+		check_test_rows(&sdef, 0, n);
+		sorbet_reader_close(&sdef);
+
+		// the names' zone maps overlap, so only the filters can rule groups out
+		int with = 0, without = 0, missing = 0;
+		bool all_found = true, none_found = true;
+		for (int k = 0; k < 20; k++) {
+			char name[32];
+			int i = (k * 7919) % n;
+			if (i % 7 == 0) i++;
+			sprintf(name, "name%d", i);
+			bool found;
+			with += groups_read_for_name(test_path("bloom"), name, &found);
+			all_found = all_found && found;
+			without += groups_read_for_name(test_path("no_bloom"), name, &found);
+			all_found = all_found && found;
+			strcat(name, "x");
+			missing += groups_read_for_name(test_path("bloom"), name, &found);
+			none_found = none_found && !found;
+		}
+		CHECK(all_found && none_found);
+		CHECK(with < 40 && missing < 20 && without > with);
+	}
+
+	// the same filters come out of the batch writer and the writer threads
+	sorbet_def w = {0};
+	w.layout = SORBET_LAYOUT_COLUMNAR;
+	w.compression = SORBET_COMPRESSION_GZIP;
+	w.row_group_size = 1000;
+	w.bloom_filters = filters;
+	copy_test_file(&w, "bloom", "bloom_batch", 777);
+	CHECK(same_files(test_path("bloom"), test_path("bloom_batch")));
+	sorbet_def wt = {0};
+	wt.layout = SORBET_LAYOUT_COLUMNAR;
+	wt.compression = SORBET_COMPRESSION_GZIP;
+	wt.row_group_size = 1000;
+	wt.n_threads = 3;
+	wt.bloom_filters = filters;
+	write_test_file(&wt, "bloom_threads", n);
+	CHECK(same_files(test_path("bloom"), test_path("bloom_threads")));
+
+	// DOUBLE columns can't have one
+	bool double_filter[] = {false, false, false, true};
+	sorbet_def wd = {0};
+	wd.layout = SORBET_LAYOUT_COLUMNAR;
+	wd.row_group_size = 1000;
+	wd.bloom_filters = double_filter;
+	write_test_file(&wd, "bloom_double", 3000);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("bloom_double");
+	sorbet_reader_open(&sdef);
+	CHECK(sdef.bloom_index == NULL || sdef.bloom_index[3].n_blocks == 0);
+	check_test_rows(&sdef, 0, 3000);
+	sorbet_reader_close(&sdef);
+}
+
+data_column text_cols[] = {
+		{"id",   INTEGER, NULL_COL_TYPE, NULL_COL_TYPE},
+		{"text", STRING,  NULL_COL_TYPE, NULL_COL_TYPE},
+};
+
+// text i, which isn't valid UTF-8 every 10th row
+void text_value(int i, char *text) {
+	sprintf(text, "v%d\xc3\xa9", i);
+	if (i % 10 == 3) text[1] = (char)0xff;
+}
+
+// counts the null and the invalid texts in a text file, and checks its ids run
+// from 0. returns the number of rows
+int count_texts(const char *name, int64_t cbads, int *nulls, int *bad) {
+	sorbet_def sdef = {0};
+	sdef.filename = test_path(name);
+	sorbet_reader_open(&sdef);
+	CHECK(sdef.cstats[1].cbads == cbads);
+	*nulls = 0;
+	*bad = 0;
+	int i = 0;
+	col_val *row;
+	while ((row = sorbet_read_row(&sdef)) != NULL && row[0].intval == i) {
+		if (row[1].strval.len == 0) (*nulls)++;
+		else if (!utf8_valid(row[1].strval.val, row[1].strval.len)) (*bad)++;
+		i++;
+	}
+	sorbet_reader_close(&sdef);
+	return i;
+}
+
+void test_utf8() {
+	// sequences at every offset of a string long enough for the vector paths
+	const char *good[] = {"a", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf", "\xef\xbf\xbf"};
+	const char *bad[] = {"\xff", "\xc3", "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\x80", "\xe2\x82", "\xf8\x88\x80\x80\x80"};
+	bool ok = true;
+	for (int at = 0; at < 100; at++) {
+		uint8_t text[128];
+		for (int k = 0; k < 6; k++) {
+			size_t len = strlen(good[k]);
+			memset(text, 'a', sizeof(text));
+			memcpy(text + at, good[k], len);
+			ok = ok && utf8_valid(text, at + len) && utf8_valid(text, sizeof(text));
+		}
+		for (int k = 0; k < 9; k++) {
+			size_t len = strlen(bad[k]);
+			memset(text, 'a', sizeof(text));
+			memcpy(text + at, bad[k], len);
+			ok = ok && !utf8_valid(text, at + len) && !utf8_valid(text, sizeof(text));
+		}
+	}
+	CHECK(ok);
+	CHECK(utf8_valid((const uint8_t *)"", 0));
+
+	int n = 1000;
+	for (int layout = 0; layout < 2; layout++) {
+		sorbet_def w = {0};
+		w.filename = test_path("text");
+		w.layout = layout;
+		w.row_group_size = 100;
+		w.schema.numCols = 2;
+		w.schema.cols = text_cols;
+		sorbet_writer_open(&w);
+		for (int i = 0; i < n; i++) {
+			char text[32];
+			text_value(i, text);
+			sorbet_write_int(&w, &i);
+			CHECK(sorbet_write_string(&w, (const uint8_t *)text, strlen(text)));
+		}
+		sorbet_writer_close(&w);
+		int nulls, bads;
+		CHECK(count_texts("text", 0, &nulls, &bads) == n && nulls == 0 && bads == 100);
+
+		for (int policy = SORBET_UTF8_REJECT; policy <= SORBET_UTF8_COUNT; policy++) {
+			// one value at a time. a rejected value gets a null in its place
+			sorbet_def wr = {0};
+			wr.filename = test_path("text_rows");
+			wr.layout = layout;
+			wr.row_group_size = 100;
+			wr.utf8_policy = policy;
+			wr.schema.numCols = 2;
+			wr.schema.cols = text_cols;
+			sorbet_writer_open(&wr);
+			int rejected = 0;
+			for (int i = 0; i < n; i++) {
+				char text[32];
+				text_value(i, text);
+				sorbet_write_int(&wr, &i);
+				if (!sorbet_write_string(&wr, (const uint8_t *)text, strlen(text))) {
+					rejected++;
+					sorbet_write_string(&wr, NULL, 0);
 				}
-				default: {
+			}
+			sorbet_writer_close(&wr);
+			int64_t cbads = policy == SORBET_UTF8_REJECT ? 0 : 100;
+			CHECK(rejected == (policy == SORBET_UTF8_REJECT ? 100 : 0));
+			CHECK(count_texts("text_rows", cbads, &nulls, &bads) == n);
+			CHECK(nulls == (policy == SORBET_UTF8_COUNT ? 0 : 100) && bads == (policy == SORBET_UTF8_COUNT ? 100 : 0));
+
+			// a row at a time. a rejected row writes nothing, and is written again with
+			// a null
+			sorbet_def ww = {0};
+			ww.filename = test_path("text_write_row");
+			ww.layout = layout;
+			ww.row_group_size = 100;
+			ww.utf8_policy = policy;
+			ww.schema.numCols = 2;
+			ww.schema.cols = text_cols;
+			sorbet_writer_open(&ww);
+			rejected = 0;
+			bool at_row_start = true;
+			for (int i = 0; i < n; i++) {
+				char text[32];
+				text_value(i, text);
+				col_val row[2];
+				row[0].intval = i;
+				row[1].strval.val = (uint8_t *)text;
+				row[1].strval.len = strlen(text);
+				if (!sorbet_write_row(&ww, row)) {
+					rejected++;
+					at_row_start = at_row_start && ww.cur_col == 0;
+					row[1].strval.val = NULL;
+					row[1].strval.len = 0;
+					CHECK(sorbet_write_row(&ww, row));
 				}
 			}
+			CHECK(sorbet_writer_close(&ww));
+			CHECK(rejected == (policy == SORBET_UTF8_REJECT ? 100 : 0) && at_row_start);
+			CHECK(count_texts("text_write_row", cbads, &nulls, &bads) == n);
+			CHECK(nulls == (policy == SORBET_UTF8_COUNT ? 0 : 100) && bads == (policy == SORBET_UTF8_COUNT ? 100 : 0));
+
+			// a batch at a time. every batch has a bad value, so REJECT writes nothing
+			sorbet_def in = {0};
+			in.filename = test_path("text");
+			sorbet_reader_open(&in);
+			sorbet_def wb = {0};
+			wb.filename = test_path("text_batches");
+			wb.layout = layout;
+			wb.row_group_size = 100;
+			wb.utf8_policy = policy;
+			wb.schema = in.schema;
+			sorbet_writer_open(&wb);
+			sorbet_batch batch;
+			sorbet_batch_init(&batch, &in.schema);
+			int written = 0;
+			while (sorbet_read_batch(&in, &batch, 50) > 0) {
+				if (sorbet_write_batch(&wb, &batch)) written++;
+			}
+			sorbet_batch_free(&batch);
+			sorbet_writer_close(&wb);
+			sorbet_reader_close(&in);
+			CHECK(written == (policy == SORBET_UTF8_REJECT ? 0 : 20));
+			CHECK(count_texts("text_batches", cbads, &nulls, &bads) == (policy == SORBET_UTF8_REJECT ? 0 : n));
+			CHECK(nulls == (policy == SORBET_UTF8_NULL ? 100 : 0) && bads == (policy == SORBET_UTF8_COUNT ? 100 : 0));
 		}
-/*
+	}
+}
+
+// reads the first batch of up to n rows of a file
+void read_first_batch(sorbet_def *sdef, const char *name, sorbet_batch *batch, int64_t n) {
+	sdef->filename = test_path(name);
+	sorbet_reader_open(sdef);
+	sorbet_batch_init(batch, &sdef->schema);
+	CHECK(sorbet_read_batch(sdef, batch, n) == n);
+}
+
+void test_filter() {
+	sorbet_def w = {0};
+	w.layout = SORBET_LAYOUT_COLUMNAR;
+	w.row_group_size = 1000;
+	write_types_file(&w, "filter", 3000);
+	int32_t sel[4000];
+	for (int codes = 0; codes < 2; codes++) {
+		sorbet_def sdef = {0};
+		sdef.dictionary_codes = codes;
+		sorbet_batch batch;
+		read_first_batch(&sdef, "filter", &batch, 1000);
+		CHECK((batch.cols[1].dictionary != NULL) == codes);
+		col_val v;
+		v.intval = 250;
+		CHECK(sorbet_filter(&batch, 0, SORBET_OP_GE, &v, sel, -1) == 750 && sel[0] == 250 && sel[749] == 999);
+		CHECK(sorbet_filter(&batch, 0, SORBET_OP_LT, &v, sel, -1) == 250 && sel[249] == 249);
+		v.doubleval = 100.0;
+		CHECK(sorbet_filter(&batch, 3, SORBET_OP_EQ, &v, sel, -1) == 1 && sel[0] == 200);
+		v.floatval = 2.5f;
+		CHECK(sorbet_filter(&batch, 8, SORBET_OP_NE, &v, sel, -1) == 999);
+		CHECK(sorbet_filter(&batch, 2, SORBET_OP_IS_NULL, NULL, sel, -1) == 200 && sel[1] == 5);
+		CHECK(sorbet_filter(&batch, 2, SORBET_OP_IS_NOT_NULL, NULL, sel, -1) == 800);
+
+		// nulls don't match comparisons
+		int want_ts = 0, want_l = 0, want_name = 0, want_chain = 0;
+		for (int i = 0; i < 1000; i++) {
+			want_ts += i > 900 && i % 5 != 0;
+			want_l += i > 500 && i % 13 != 0;
+			want_name += i % 50 == 7 && i % 7 != 0;
+			want_chain += i >= 250 && i % 5 != 0 && i % 50 != 7 && i % 7 != 0;
+		}
+		v.datetimeval = 1000000 + 900;
+		CHECK(sorbet_filter(&batch, 2, SORBET_OP_GT, &v, sel, -1) == want_ts);
+		v.longval = -500 * 1000000007LL;
+		CHECK(sorbet_filter(&batch, 9, SORBET_OP_LT, &v, sel, -1) == want_l);
+		v.strval.val = (uint8_t *)"name7";
+		v.strval.len = 5;
+		CHECK(sorbet_filter(&batch, 1, SORBET_OP_EQ, &v, sel, -1) == want_name && sel[0] == 57);
+
+		// each filter only tests the rows the one before it kept
+		col_val from;
+		from.intval = 250;
+		int64_t k = sorbet_filter(&batch, 0, SORBET_OP_GE, &from, sel, -1);
+		k = sorbet_filter(&batch, 2, SORBET_OP_IS_NOT_NULL, NULL, sel, k);
+		k = sorbet_filter(&batch, 1, SORBET_OP_NE, &v, sel, k);
+		CHECK(k == want_chain && sel[0] == 251);
+		bool increasing = true;
+		for (int64_t j = 1; j < k; j++) increasing = increasing && sel[j] > sel[j - 1];
+		CHECK(increasing);
+
+		// and the aggregates over them
+		int64_t want_count = 0;
+		int64_t want_sum = 0;
+		for (int64_t j = 0; j < k; j++) {
+			if (sel[j] % 13 != 0) {
+				want_count++;
+				want_sum += -sel[j] * 1000000007LL;
+			}
+		}
+		sorbet_agg_result res = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 9, SORBET_AGG_SUM, sel, k, &res));
+		CHECK(res.count == want_count && res.longval == want_sum);
+		sorbet_agg_result max = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 3, SORBET_AGG_MAX, sel, k, &max));
+		CHECK(max.count == k && max.doubleval == sel[k - 1] * 0.5);
+		sorbet_agg_result min = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 8, SORBET_AGG_MIN, NULL, -1, &min));
+		CHECK(min.count == 1000 && min.doubleval == 0.0);
+		sorbet_agg_result count = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 1, SORBET_AGG_COUNT, NULL, -1, &count));
+		CHECK(count.count == 1000 - 143);
+		// results add up across batches
+		CHECK(sorbet_read_batch(&sdef, &batch, 1000) == 1000);
+		CHECK(sorbet_aggregate_batch(&batch, 1, SORBET_AGG_COUNT, NULL, -1, &count));
+		CHECK(count.count == 2000 - 286);
+		CHECK(!sorbet_aggregate_batch(&batch, 1, SORBET_AGG_SUM, NULL, -1, &res));
+
+		CHECK(sorbet_filter(&batch, 10, SORBET_OP_IS_NULL, NULL, sel, -1) == -1);
+		CHECK(sorbet_filter(&batch, 0, SORBET_OP_EQ, NULL, sel, -1) == -1);
+		sorbet_batch_free(&batch);
+		sorbet_reader_close(&sdef);
+	}
+
+	// NaNs only match NE
+	sorbet_def wr = {0};
+	write_readings_file(&wr, "filter_readings", 1000, NULL);
+	sorbet_def sdef = {0};
+	sorbet_batch batch;
+	read_first_batch(&sdef, "filter_readings", &batch, 1000);
+	col_val v;
+	v.doubleval = NAN;
+	CHECK(sorbet_filter(&batch, 0, SORBET_OP_EQ, &v, sel, -1) == 0);
+	CHECK(sorbet_filter(&batch, 0, SORBET_OP_NE, &v, sel, -1) == 1000);
+	v.doubleval = 1e9;
+	CHECK(sorbet_filter(&batch, 0, SORBET_OP_LT, &v, sel, -1) == 998 && sel[77] == 78);
+	v.doubleval = 20.0;
+	CHECK(sorbet_filter(&batch, 0, SORBET_OP_NE, &v, sel, -1) == 940);
+	v.doubleval = 0.0;
+	// -0.0 == 0.0
+	CHECK(sorbet_filter(&batch, 0, SORBET_OP_EQ, &v, sel, -1) == 1 && sel[0] == 78);
+	sorbet_batch_free(&batch);
+	sorbet_reader_close(&sdef);
+
+	// runs are compared a run at a time
+	sorbet_def wrun = {0};
+	write_runs_file(&wrun, "filter_runs", 4000);
+	for (int runs = 0; runs < 2; runs++) {
+		sorbet_def rdef = {0};
+		rdef.rle_runs = runs;
+		read_first_batch(&rdef, "filter_runs", &batch, 4000);
+		CHECK((batch.cols[1].n_runs > 0) == runs);
+		v.intval = 5;
+		int want = 0;
+		for (int i = 0; i < 4000; i++) want += i / 300 == 5 && (i / 100) % 9 != 4;
+		CHECK(sorbet_filter(&batch, 1, SORBET_OP_EQ, &v, sel, -1) == want && sel[0] == 1500);
+		CHECK(sorbet_filter(&batch, 1, SORBET_OP_IS_NULL, NULL, sel, -1) == 400);
+		sorbet_agg_result sum = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 2, SORBET_AGG_SUM, NULL, -1, &sum));
+		float64_t want_sum = 0;
+		for (int i = 0; i < 4000; i++) want_sum += (i / 50) * 1.5;
+		CHECK(sum.count == 4000 && sum.doubleval == want_sum);
+		sorbet_batch_free(&batch);
+		sorbet_reader_close(&rdef);
+	}
+}
+
+void test_column_stats() {
+	int n = 20000;
+	bool sketches[] = {true, false, false, true, false, false, false, false, false, true};
+	uint64_t l_sum = 0;
+	int64_t l_count = 0;
+	for (int i = 0; i < n; i++) {
+		if (i % 13 == 0) continue;
+		l_count++;
+		l_sum += (uint64_t)(-i * 1000000007LL);
+	}
+	for (int layout = 0; layout < 2; layout++) {
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.row_group_size = 1000;
+		w.quantile_sketches = sketches;
+		write_types_file(&w, "stats", n);
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("stats");
+		sorbet_reader_open(&sdef);
+		const column_stats *st = sdef.cstats;
+		CHECK(st[0].count == n && st[0].sum.longval == (int64_t)n * (n - 1) / 2 && st[0].cwidth == 5);
+		CHECK(st[0].range.has_values && st[0].range.min.longval == 0 && st[0].range.max.longval == n - 1);
+		CHECK(st[1].count == n - (n + 6) / 7 && st[1].cnulls == (n + 6) / 7 && st[1].cwidth == 6);
+		CHECK(st[1].range.min_len == 5 && memcmp(st[1].range.min.bytes, "name0", 5) == 0);
+		CHECK(st[1].range.max_len == 5 && memcmp(st[1].range.max.bytes, "name9", 5) == 0);
+		CHECK(st[2].count == n - n / 5 && st[2].range.min.longval == 1000001 && st[2].range.max.longval == 1000000 + n - 1);
+		CHECK(st[3].count == n && st[3].sum.doubleval == 0.5 * n * (n - 1) / 2);
+		CHECK(st[3].range.min.doubleval == 0.0 && st[3].range.max.doubleval == (n - 1) * 0.5);
+		CHECK(st[7].count == n && st[7].cwidth == 10);
+		CHECK(st[9].count == l_count && st[9].sum.longval == (int64_t)l_sum);
+		CHECK(st[9].range.min.longval == -(n - 1) * 1000000007LL && st[9].range.max.longval == -1000000007LL);
+
+		// the sketches' estimates
+		int64_t ids = sorbet_distinct_count(&sdef, 0);
+		CHECK(ids > n * 0.95 && ids < n * 1.05);
+		int64_t names = sorbet_distinct_count(&sdef, 1);
+		CHECK(names >= 47 && names <= 53);
+		int64_t bins = sorbet_distinct_count(&sdef, 7);
+		CHECK(bins >= 10 && bins <= 12);
+		float64_t q;
+		CHECK(sorbet_quantile(&sdef, 0, 0.0, &q) && q == 0);
+		CHECK(sorbet_quantile(&sdef, 0, 1.0, &q) && q == n - 1);
+		CHECK(sorbet_quantile(&sdef, 0, 0.5, &q) && fabs(q - n / 2) < n * 0.02);
+		CHECK(sorbet_quantile(&sdef, 3, 0.9, &q) && fabs(q - n * 0.45) < n * 0.01);
+		CHECK(sorbet_quantile(&sdef, 9, 0.5, &q) && fabs(q + n / 2 * 1000000007.0) < n * 0.02 * 1000000007.0);
+		CHECK(!sorbet_quantile(&sdef, 2, 0.5, &q));
+		sorbet_reader_close(&sdef);
+
+		// the batch writer keeps the same statistics
+		sorbet_def wb = {0};
+		wb.layout = layout;
+		wb.row_group_size = 1000;
+		wb.quantile_sketches = sketches;
+		copy_test_file(&wb, "stats", "stats_batch", 777);
+		CHECK(same_files(test_path("stats"), test_path("stats_batch")));
+	}
+
+	// without a HyperLogLog sketch or the footer statistics
+	sorbet_def w = {0};
+	w.layout = SORBET_LAYOUT_COLUMNAR;
+	w.hll_precision = -1;
+	write_types_file(&w, "stats", 1000);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("stats");
+	sorbet_reader_open(&sdef);
+	CHECK(sorbet_distinct_count(&sdef, 0) == -1);
+	CHECK(sdef.cstats[0].count == 1000);
+	sorbet_reader_close(&sdef);
+	write_v3_file(test_path("v3"), 0, 1000);
+	sdef = (sorbet_def){0};
+	sdef.filename = test_path("v3");
+	sorbet_reader_open(&sdef);
+	float64_t q;
+	CHECK(sorbet_distinct_count(&sdef, 0) == -1 && !sorbet_quantile(&sdef, 0, 0.5, &q));
+	sorbet_reader_close(&sdef);
+}
+
+// an allocator that keeps track of what's out
+typedef struct s_counted {
+	int64_t allocs;
+	int64_t blocks;
+	int64_t bytes;
+	int64_t peak;
+} counted;
+
+void *counted_alloc(void *ctx, size_t len) {
+	counted *c = (counted *)ctx;
+	size_t *p = (size_t *)malloc(len + 16);
+	if (p == NULL) return NULL;
+	p[0] = len;
+	c->allocs++;
+	c->blocks++;
+	c->bytes += len;
+	if (c->bytes > c->peak) c->peak = c->bytes;
+	return (uint8_t *)p + 16;
+}
+
+void counted_release(void *ctx, void *p) {
+	counted *c = (counted *)ctx;
+	size_t *q = (size_t *)((uint8_t *)p - 16);
+	c->blocks--;
+	c->bytes -= q[0];
+	free(q);
+}
+
+void test_allocator() {
+	int n = 20000;
+	for (int layout = 0; layout < 2; layout++) {
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 1000;
+		write_types_file(&w, "allocator", n);
+		for (int mmap = 0; mmap < 2; mmap++) {
+			counted c = {0};
+			sorbet_allocator allocator = {counted_alloc, counted_release, &c};
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("allocator");
+			sdef.use_mmap = mmap;
+			sdef.allocator = &allocator;
+			sorbet_reader_open(&sdef);
+			CHECK(c.allocs > 0 && strcmp(sdef.schema.cols[1].name, "name") == 0);
+			check_types_rows(&sdef, 0, n);
+			// the row values' space is reused, so reading more rows doesn't take more
+			int64_t peak = c.peak;
+			CHECK(sorbet_seek_row(&sdef, 0));
+			check_types_rows(&sdef, 0, n);
+			CHECK(c.peak == peak);
+			int cols[] = {1, 7};
+			CHECK(sorbet_reader_set_projection(&sdef, cols, 2));
+			CHECK(sorbet_seek_row(&sdef, 5000));
+			col_val *row = sorbet_read_row(&sdef);
+			CHECK(row != NULL && row[1].strval.len == 5 && memcmp(row[1].strval.val, "name0", 5) == 0);
+			CHECK(sorbet_reader_set_projection(&sdef, NULL, 0));
+			sorbet_batch batch;
+			sorbet_batch_init(&batch, &sdef.schema);
+			CHECK(sorbet_read_batch(&sdef, &batch, 500) == 500 && is_types_batch(&batch, 5001));
+			sorbet_batch_free(&batch);
+			sorbet_reader_close(&sdef);
+			// everything comes back on close
+			CHECK(c.blocks == 0 && c.bytes == 0);
+		}
+	}
+}
+
+void test_mmap() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		for (int compression = 0; compression < 2; compression++) {
+			int n = 10000;
+			sorbet_def w = {0};
+			w.layout = layout;
+			w.compression = compression;
+			w.row_group_size = 333;
+			write_types_file(&w, "mmap", n);
+
+			sorbet_def sdef = {0};
+			sdef.filename = test_path("mmap");
+			sdef.use_mmap = true;
+			sorbet_reader_open(&sdef);
+			CHECK(sdef.map != NULL && sdef.map_size > 0);
+			check_types_rows(&sdef, 0, n);
+			CHECK(sorbet_seek_row(&sdef, 6000));
+			CHECK(is_types_row(sorbet_read_row(&sdef), 6000));
+			CHECK(sorbet_seek_row(&sdef, 332));
+			check_types_rows(&sdef, 332, n - 332);
+			sorbet_reader_close(&sdef);
+			CHECK(sdef.map == NULL);
+		}
+	}
+	// files without row groups are streamed as before
+	write_v3_file(test_path("mmap_v3"), 0, 1000);
+	sorbet_def sdef = {0};
+	sdef.filename = test_path("mmap_v3");
+	sdef.use_mmap = true;
+	sorbet_reader_open(&sdef);
+	CHECK(sdef.map == NULL);
+	int i = 0;
+	col_val *row;
+	while ((row = sorbet_read_row(&sdef)) != NULL && row[0].intval == i) {
+		i++;
+	}
+	CHECK(i == 1000);
+	sorbet_reader_close(&sdef);
+}
+
+void test_key_index() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 10000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.compression = SORBET_COMPRESSION_GZIP;
+		w.row_group_size = 333;
+		w.sorted = true;
+		w.sort_column = 0;
+		w.key_interval = 100;
+		write_test_file(&w, "key_index", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("key_index");
+		sorbet_reader_open(&sdef);
+		CHECK(sdef.sorted && sdef.sort_column == 0 && sdef.key_interval == 100);
+		CHECK(sdef.key_index != NULL);
+		col_val lo, hi;
+		lo.intval = 4321;
+		CHECK(sorbet_lookup(&sdef, &lo));
+		check_test_rows(&sdef, 4321, 1);
+		lo.intval = 1000;
+		hi.intval = 1999;
+		CHECK(sorbet_range(&sdef, &lo, &hi));
+		check_test_rows(&sdef, 1000, 1000);
+		hi.intval = 50;
+		CHECK(sorbet_range(&sdef, NULL, &hi));
+		check_test_rows(&sdef, 0, 51);
+		lo.intval = n - 10;
+		CHECK(sorbet_range(&sdef, &lo, NULL));
+		check_test_rows(&sdef, n - 10, 10);
+		lo.intval = -5;
+		CHECK(!sorbet_lookup(&sdef, &lo));
+		CHECK(sorbet_read_row(&sdef) == NULL);
+		// seeking ends the range
+		lo.intval = 20;
+		CHECK(sorbet_lookup(&sdef, &lo));
+		CHECK(sorbet_seek_row(&sdef, 0));
+		check_test_rows(&sdef, 0, n);
+		// skipping keeps it
+		lo.intval = 100;
+		hi.intval = 199;
+		CHECK(sorbet_range(&sdef, &lo, &hi));
+		CHECK(sorbet_skip_rows(&sdef, 50));
+		check_test_rows(&sdef, 150, 50);
+
+		// a reader opened on a split only finds the split's rows
+		sorbet_split splits[3];
+		CHECK(sorbet_reader_splits(&sdef, splits, 3) == 3);
+		sorbet_reader_close(&sdef);
+		sorbet_def part = {0};
+		CHECK(sorbet_reader_open_split(&part, &splits[1]));
+		int first = splits[1].first_row;
+		int last = first + splits[1].n_rows;
+		lo.intval = 0;
+		hi.intval = n;
+		CHECK(sorbet_range(&part, &lo, &hi));
+		check_test_rows(&part, first, last - first);
+		CHECK(sorbet_range(&part, NULL, NULL));
+		check_test_rows(&part, first, last - first);
+		lo.intval = first + 10;
+		CHECK(sorbet_range(&part, &lo, NULL));
+		check_test_rows(&part, first + 10, last - first - 10);
+		hi.intval = last - 5;
+		CHECK(sorbet_range(&part, NULL, &hi));
+		check_test_rows(&part, first, last - first - 4);
+		lo.intval = first - 1;
+		CHECK(!sorbet_lookup(&part, &lo));
+		lo.intval = last;
+		CHECK(!sorbet_lookup(&part, &lo));
+		lo.intval = last - 1;
+		CHECK(sorbet_lookup(&part, &lo));
+		check_test_rows(&part, last - 1, 1);
+		CHECK(sorbet_seek_row(&part, first));
+		check_test_rows(&part, first, last - first);
+		sorbet_reader_close(&part);
+	}
+}
+
+bool has_key_index(const char *name) {
+	sorbet_def sdef = {0};
+	sdef.filename = test_path(name);
+	sorbet_reader_open(&sdef);
+	bool ret = sdef.sorted && sdef.key_index != NULL;
+	sorbet_reader_close(&sdef);
+	return ret;
+}
+
+void test_unsorted_keys() {
+	// rows 776 and 777 swapped, between two samples and across two batches
+	sorbet_def w = {0};
+	w.row_group_size = 333;
+	w.sorted = true;
+	w.sort_column = 0;
+	w.key_interval = 100;
+	w.filename = test_path("unsorted");
+	w.schema.numCols = sizeof(test_cols) / sizeof(data_column);
+	w.schema.cols = test_cols;
+	sorbet_writer_open(&w);
+	for (int i = 0; i < 2000; i++) {
+		write_test_row(&w, (i == 776) ? 777 : (i == 777) ? 776 : i);
+	}
+	sorbet_writer_close(&w);
+	CHECK(!has_key_index("unsorted"));
+
+	sorbet_def b = {0};
+	b.sorted = true;
+	b.key_interval = 100;
+	copy_test_file(&b, "unsorted", "unsorted_batch", 777);
+	CHECK(!has_key_index("unsorted_batch"));
+	// a sorted file copied the same way keeps its index
+	sorbet_def s = {0};
+	write_test_file(&s, "sorted", 2000);
+	sorbet_def c = {0};
+	c.sorted = true;
+	c.key_interval = 100;
+	copy_test_file(&c, "sorted", "sorted_batch", 777);
+	CHECK(has_key_index("sorted_batch"));
+}
+
+// x is NaN every 3rd row and null every 5th, nan is null every 4th row and NaN
+// otherwise
+data_column agg_cols[] = {
+		{"v",   INTEGER, NULL_COL_TYPE, NULL_COL_TYPE},
+		{"x",   DOUBLE,  NULL_COL_TYPE, NULL_COL_TYPE},
+		{"nan", FLOAT,   NULL_COL_TYPE, NULL_COL_TYPE},
+};
+
+void test_aggregate() {
+	int n = 5000;
+	int64_t x_count = 0;
+	float64_t x_max = 0;
+	float64_t x_max_upper = 0;
+	for (int i = 0; i < n; i++) {
+		if (i % 3 == 0 || i % 5 == 0) continue;
+		x_count++;
+		x_max = i * 0.25;
+		if (i >= 2500) x_max_upper = i * 0.25;
+	}
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		sorbet_def w = {0};
+		w.filename = test_path("aggregate");
+		w.layout = layout;
+		w.row_group_size = 1000;
+		w.schema.numCols = 3;
+		w.schema.cols = agg_cols;
+		sorbet_writer_open(&w);
+		for (int i = 0; i < n; i++) {
+			float64_t x = (i % 3 == 0) ? NAN : i * 0.25;
+			float32_t f = NAN;
+			sorbet_write_int(&w, &i);
+			sorbet_write_double(&w, (i % 5 == 0) ? NULL : &x);
+			sorbet_write_float(&w, (i % 4 == 0) ? NULL : &f);
+		}
+		sorbet_writer_close(&w);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("aggregate");
+		sdef.rle_runs = true;
+		sorbet_reader_open(&sdef);
+		sorbet_agg_result res;
+		CHECK(sorbet_aggregate(&sdef, 0, SORBET_AGG_SUM, NULL, &res));
+		CHECK(res.count == n && res.longval == (int64_t)n * (n - 1) / 2);
+		CHECK(sorbet_seek_row(&sdef, 0));
+		CHECK(sorbet_aggregate(&sdef, 1, SORBET_AGG_COUNT, NULL, &res));
+		CHECK(res.count == n - n / 5);
+		// NaNs aren't counted by MIN and MAX
+		CHECK(sorbet_seek_row(&sdef, 0));
+		CHECK(sorbet_aggregate(&sdef, 1, SORBET_AGG_MIN, NULL, &res));
+		CHECK(res.count == x_count && res.doubleval == 0.25);
+		CHECK(sorbet_seek_row(&sdef, 0));
+		CHECK(sorbet_aggregate(&sdef, 1, SORBET_AGG_MAX, NULL, &res));
+		CHECK(res.count == x_count && res.doubleval == x_max);
+		sorbet_predicate pred = {0, SORBET_OP_GE};
+		pred.value.intval = 2500;
+		CHECK(sorbet_seek_row(&sdef, 0));
+		CHECK(sorbet_aggregate(&sdef, 1, SORBET_AGG_MAX, &pred, &res));
+		CHECK(res.doubleval == x_max_upper);
+		// a column of nulls and NaNs has no MIN or MAX
+		for (int agg = SORBET_AGG_MIN; agg <= SORBET_AGG_MAX; agg++) {
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(sorbet_aggregate(&sdef, 2, agg, NULL, &res));
+			CHECK(res.count == 0 && isnan(res.doubleval));
+		}
+		// and the same a batch at a time, with the selected rows
+		CHECK(sorbet_seek_row(&sdef, 0));
+		sorbet_batch batch;
+		sorbet_batch_init(&batch, &sdef.schema);
+		int64_t got = sorbet_read_batch(&sdef, &batch, 1000);
+		CHECK(got == 1000);
+		sorbet_agg_result min = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 2, SORBET_AGG_MIN, NULL, -1, &min));
+		CHECK(min.count == 0 && isnan(min.doubleval));
+		int32_t sel[1000];
+		int64_t k = sorbet_filter(&batch, 0, SORBET_OP_LT, &pred.value, sel, -1);
+		CHECK(k == 1000);
+		sorbet_agg_result max = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 2, SORBET_AGG_MAX, sel, k, &max));
+		CHECK(max.count == 0 && isnan(max.doubleval));
+		col_val ten;
+		ten.intval = 10;
+		k = sorbet_filter(&batch, 0, SORBET_OP_LT, &ten, sel, -1);
+		CHECK(k == 10);
+		sorbet_agg_result sum = {0};
+		CHECK(sorbet_aggregate_batch(&batch, 0, SORBET_AGG_SUM, sel, k, &sum));
+		CHECK(sum.count == 10 && sum.longval == 45);
+		sorbet_batch_free(&batch);
+		sorbet_reader_close(&sdef);
+	}
+}
+
+// true if bit i of an Arrow validity bitmap is set, or there's no bitmap
+bool arrow_valid(const void *validity, int64_t i) {
+	return validity == NULL || ((((const uint8_t *)validity)[i >> 3] >> (i & 7)) & 1);
+}
+
+// days from 1970-01-01, counted the long way
+int32_t test_days(int y, int m, int d) {
+	static const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	int32_t days = -25567;
+	for (int yy = 1900; yy < y; yy++) {
+		days += (yy % 4 == 0 && (yy % 100 != 0 || yy % 400 == 0)) ? 366 : 365;
+	}
+	for (int mm = 1; mm < m; mm++) {
+		days += month_days[mm - 1] + (mm == 2 && y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+	}
+	return days + d - 1;
+}
+
+void test_arrow() {
+	for (int layout = SORBET_LAYOUT_ROW; layout <= SORBET_LAYOUT_COLUMNAR; layout++) {
+		int n = 10000;
+		sorbet_def w = {0};
+		w.layout = layout;
+		w.row_group_size = 3000;
+		write_test_file(&w, "arrow", n);
+
+		sorbet_def sdef = {0};
+		sdef.filename = test_path("arrow");
+		sorbet_reader_open(&sdef);
+		int cols[] = {1, 2, 0};
+		CHECK(sorbet_reader_set_projection(&sdef, cols, 3));
+		int rows = 0;
+		int64_t got;
+		struct ArrowArray out;
+		struct ArrowSchema schema;
+		while ((got = sorbet_read_arrow_batch(&sdef, &out, &schema)) > 0) {
+			CHECK(strcmp(schema.format, "+s") == 0 && schema.n_children == 3);
+			CHECK(strcmp(schema.children[0]->name, "id") == 0 && strcmp(schema.children[0]->format, "i") == 0);
+			CHECK(strcmp(schema.children[1]->format, "u") == 0 && strcmp(schema.children[2]->format, "tss:") == 0);
+			CHECK(out.length == got && out.n_children == 3);
+			const int32_t *ids = out.children[0]->buffers[1];
+			const int32_t *offsets = out.children[1]->buffers[1];
+			const char *names = out.children[1]->buffers[2];
+			const int64_t *ts = out.children[2]->buffers[1];
+			bool ok = true;
+			for (int64_t j = 0; j < got; j++) {
+				int i = rows + j;
+				char name[32];
+				int len = sprintf(name, "name%d", i);
+				ok = ok && ids[j] == i;
+				ok = ok && arrow_valid(out.children[1]->buffers[0], j) == (i % 7 != 0);
+				if (i % 7 != 0) ok = ok && offsets[j + 1] - offsets[j] == len && memcmp(names + offsets[j], name, len) == 0;
+				ok = ok && arrow_valid(out.children[2]->buffers[0], j) == (i % 5 != 0);
+				if (i % 5 != 0) ok = ok && ts[j] == 1000000 + i;
+			}
+			CHECK(ok);
+			rows += got;
+			out.release(&out);
+			CHECK(out.release == NULL);
+			schema.release(&schema);
+			CHECK(schema.release == NULL);
+		}
+		CHECK(got == 0 && rows == n);
+		// nothing to release at the end, or on an error
+		CHECK(out.release == NULL && schema.release == NULL);
+		if (layout == SORBET_LAYOUT_ROW) {
+			int32_t id;
+			CHECK(sorbet_seek_row(&sdef, 0));
+			CHECK(sorbet_read_int(&sdef, &id));
+			CHECK(sorbet_read_arrow_batch(&sdef, &out, &schema) == -1);
+			CHECK(out.release == NULL && schema.release == NULL);
+		}
+		sorbet_reader_close(&sdef);
+
+		// the types Arrow stores differently: BOOLEAN as bits, DATE as days, TIME as
+		// seconds, and BINARY with offsets like STRING
+		sorbet_def t = {0};
+		t.layout = layout;
+		t.row_group_size = 3000;
+		write_types_file(&t, "arrow_types", n);
+		sdef.filename = test_path("arrow_types");
+		sorbet_reader_open(&sdef);
+		int type_cols[] = {4, 5, 6, 7};
+		CHECK(sorbet_reader_set_projection(&sdef, type_cols, 4));
+		rows = 0;
+		while ((got = sorbet_read_arrow_batch(&sdef, &out, &schema)) > 0) {
+			CHECK(schema.n_children == 4 && out.n_children == 4);
+			CHECK(strcmp(schema.children[0]->name, "b") == 0 && strcmp(schema.children[0]->format, "b") == 0);
+			CHECK(strcmp(schema.children[1]->format, "tdD") == 0 && strcmp(schema.children[2]->format, "tts") == 0);
+			CHECK(strcmp(schema.children[3]->name, "bin") == 0 && strcmp(schema.children[3]->format, "z") == 0);
+			CHECK(out.children[0]->n_buffers == 2 && out.children[3]->n_buffers == 3);
+			CHECK(out.children[1]->buffers[0] == NULL && out.children[2]->buffers[0] == NULL);
+			CHECK(out.children[3]->buffers[0] == NULL && out.children[3]->null_count == 0);
+			const uint8_t *bits = out.children[0]->buffers[1];
+			const int32_t *days = out.children[1]->buffers[1];
+			const int32_t *secs = out.children[2]->buffers[1];
+			const int32_t *offsets = out.children[3]->buffers[1];
+			const char *bin = out.children[3]->buffers[2];
+			int64_t nulls = 0;
+			bool ok = true;
+			for (int64_t j = 0; j < got; j++) {
+				int i = rows + j;
+				ok = ok && arrow_valid(out.children[0]->buffers[0], j) == (i % 3 != 0);
+				if (i % 3 == 0) nulls++;
+				else ok = ok && ((bits[j >> 3] >> (j & 7)) & 1) == (i & 1);
+				ok = ok && days[j] == test_days(1900 + i % 100, i % 12 + 1, i % 28 + 1);
+				ok = ok && secs[j] == (i % 24) * 3600 + (i % 60) * 60 + i % 59;
+				ok = ok && offsets[j + 1] - offsets[j] == i % 11 && memcmp(bin + offsets[j], "0123456789abcdef", i % 11) == 0;
+			}
+			CHECK(ok);
+			CHECK(out.children[0]->null_count == nulls);
+			rows += got;
+			out.release(&out);
+			schema.release(&schema);
+		}
+		CHECK(got == 0 && rows == n);
+		sorbet_reader_close(&sdef);
+	}
+}
+
+// x is NaN every 3rd row and null every 5th, nan is null every 4th row and NaN
+void dump_file(const char *filename) {
+	sorbet_def sdef = {0};
+	sdef.filename = filename;
+	sorbet_reader_open(&sdef);
+	for (int c=0; c<sdef.schema.numCols; c++) {
+		printf("%d - %s (%s)\n", c, sdef.schema.cols[c].name, column_type_label[sdef.schema.cols[c].type]);
+	}
+	col_val *row;
+	while ((row = sorbet_read_row(&sdef)) != NULL) {
 		for (int c=0; c<sdef.schema.numCols; c++) {
 			switch (sdef.schema.cols[c].type) {
 				case INTEGER: {
-					if (sorbet_read_int(&sdef, &intval)) {
-						printf(" %d", intval);
-					} else {
-						printf(" NULL");
-					}
+					printf(" %d", row[c].intval);
 					break;
 				}
 				case STRING: {
-					int strlen = 0;
-					if (sorbet_read_string(&sdef, strval, &strlen)) {
-						printf(" %s", strval);
-					} else {
-						printf(" NULL");
-					}
+					printf(" %.*s", row[c].strval.len, row[c].strval.val);
 					break;
 				}
 				default: {
 				}
 			}
 		}
-*/
 		printf("\n");
 	}
 	sorbet_reader_close(&sdef);
-/*
-	printf("sizeof col_val is %d\n", (int)sizeof(col_val));
-*/
-	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, const char **argv) {
+	if (argc > 1) {
+		dump_file(argv[1]);
+		return 0;
+	}
+	test_row_groups();
+	test_corrupt_footer();
+	test_projection();
+	test_columnar();
+	test_v3_files();
+	test_mmap();
+	test_read_batch();
+	test_write_batch();
+	test_threads();
+	test_splits();
+	test_codecs();
+	test_compress_failure();
+	test_read_ahead();
+	test_io_uring();
+	test_write_failure();
+	test_buffers();
+	test_dictionary();
+	test_integer_encodings();
+	test_bitmap_encoding();
+	test_rle();
+	test_xor_encoding();
+	test_predicates();
+	test_bloom_filters();
+	test_utf8();
+	test_filter();
+	test_column_stats();
+	test_allocator();
+	test_key_index();
+	test_unsorted_keys();
+	test_aggregate();
+	test_arrow();
+	printf("%d failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -18,6 +18,7 @@
  */
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "utf8_val.h"
 
 uint8_t *utf8_check(uint8_t *s) {
@@ -58,3 +59,227 @@ uint8_t *utf8_check(uint8_t *s) {
 	}
 	return NULL;
 }
+
+// utf8_valid() checks len bytes (no terminator needed) against RFC 3629: no
+// overlong forms, surrogates or code points above U+10FFFF. unlike utf8_check() it
+// accepts U+FFFE and U+FFFF, which are valid UTF-8. on x86 it checks 16 or 32 bytes
+// at a time with the lookup-table method of Keiser and Lemire ("Validating UTF-8 In
+// Less Than One Instruction Per Byte", 2021), picking AVX2 or SSE4.1 at run time.
+
+// the scalar version, for other CPUs and for short strings
+bool utf8_valid_scalar(const uint8_t *s, size_t len) {
+	size_t i = 0;
+	while (i < len) {
+		if (i + 8 <= len) {
+			// step over ASCII a word at a time
+			uint64_t w;
+			memcpy(&w, s + i, 8);
+			if ((w & 0x8080808080808080ull) == 0) {
+				i += 8;
+				continue;
+			}
+		}
+		uint8_t c = s[i];
+		if (c < 0x80) {
+			i++;
+			continue;
+		}
+		// the number of continuation bytes, and the range the first one has to be in
+		size_t n;
+		uint8_t lo = 0x80;
+		uint8_t hi = 0xbf;
+		if (c >= 0xc2 && c <= 0xdf) {
+			n = 1;
+		} else if (c == 0xe0) {
+			n = 2;
+			lo = 0xa0;
+		} else if (c == 0xed) {
+			n = 2;
+			hi = 0x9f;
+		} else if (c >= 0xe1 && c <= 0xef) {
+			n = 2;
+		} else if (c == 0xf0) {
+			n = 3;
+			lo = 0x90;
+		} else if (c == 0xf4) {
+			n = 3;
+			hi = 0x8f;
+		} else if (c >= 0xf1 && c <= 0xf3) {
+			n = 3;
+		} else {
+			return false;
+		}
+		if (len - i <= n) return false;
+		if (s[i + 1] < lo || s[i + 1] > hi) return false;
+		for (size_t k = 2; k <= n; k++) {
+			if ((s[i + k] & 0xc0) != 0x80) return false;
+		}
+		i += n + 1;
+	}
+	return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// the error classes. a pair of bytes is bad when the classes looked up from the high
+// nibble of the first, the low nibble of the first and the high nibble of the second
+// have one in common
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH \
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+	TOO_SHORT | OVERLONG_2, \
+	TOO_SHORT, \
+	TOO_SHORT | OVERLONG_3 | SURROGATE, \
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+#define BYTE_1_LOW \
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+	CARRY | OVERLONG_2, \
+	CARRY, \
+	CARRY, \
+	CARRY | TOO_LARGE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+#define BYTE_2_HIGH \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+__attribute__((target("sse4.1")))
+bool utf8_valid_sse(const uint8_t *s, size_t len) {
+	const __m128i byte_1_high = _mm_setr_epi8(BYTE_1_HIGH);
+	const __m128i byte_1_low = _mm_setr_epi8(BYTE_1_LOW);
+	const __m128i byte_2_high = _mm_setr_epi8(BYTE_2_HIGH);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	// a lead byte in the last three places needs bytes from the next block
+	const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0xef - 256, 0xdf - 256, 0xbf - 256);
+	__m128i prev = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+	__m128i error = _mm_setzero_si128();
+	uint8_t tail[16];
+	for (size_t i = 0; i < len; i += 16) {
+		__m128i in;
+		if (i + 16 <= len) {
+			in = _mm_loadu_si128((const __m128i *)(s + i));
+		} else {
+			// pad the last block with ASCII
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, s + i, len - i);
+			in = _mm_loadu_si128((const __m128i *)tail);
+		}
+		if (_mm_movemask_epi8(in) == 0) {
+			error = _mm_or_si128(error, incomplete);
+		} else {
+			__m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+			__m128i special = _mm_and_si128(
+				_mm_and_si128(
+					_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+					_mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+				_mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+			// the third and fourth bytes of a sequence have to be continuations, and
+			// only they can follow a continuation
+			__m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), _mm_set1_epi8(0xe0 - 0x80));
+			__m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), _mm_set1_epi8(0xf0 - 0x80));
+			__m128i must_be_cont = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(0x80 - 256));
+			error = _mm_or_si128(error, _mm_xor_si128(must_be_cont, special));
+			incomplete = _mm_subs_epu8(in, max);
+		}
+		prev = in;
+	}
+	error = _mm_or_si128(error, incomplete);
+	return _mm_testz_si128(error, error);
+}
+
+__attribute__((target("avx2")))
+bool utf8_valid_avx2(const uint8_t *s, size_t len) {
+	const __m256i byte_1_high = _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH);
+	const __m256i byte_1_low = _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW);
+	const __m256i byte_2_high = _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0xef - 256, 0xdf - 256, 0xbf - 256);
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	__m256i error = _mm256_setzero_si256();
+	uint8_t tail[32];
+	for (size_t i = 0; i < len; i += 32) {
+		__m256i in;
+		if (i + 32 <= len) {
+			in = _mm256_loadu_si256((const __m256i *)(s + i));
+		} else {
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, s + i, len - i);
+			in = _mm256_loadu_si256((const __m256i *)tail);
+		}
+		if (_mm256_movemask_epi8(in) == 0) {
+			error = _mm256_or_si256(error, incomplete);
+		} else {
+			// alignr works within 128-bit lanes, so shift in from the upper half of
+			// prev and the lower half of in
+			__m256i carried = _mm256_permute2x128_si256(prev, in, 0x21);
+			__m256i prev1 = _mm256_alignr_epi8(in, carried, 15);
+			__m256i special = _mm256_and_si256(
+				_mm256_and_si256(
+					_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+					_mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+				_mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+			__m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(in, carried, 14), _mm256_set1_epi8(0xe0 - 0x80));
+			__m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(in, carried, 13), _mm256_set1_epi8(0xf0 - 0x80));
+			__m256i must_be_cont = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(0x80 - 256));
+			error = _mm256_or_si256(error, _mm256_xor_si256(must_be_cont, special));
+			incomplete = _mm256_subs_epu8(in, max);
+		}
+		prev = in;
+	}
+	error = _mm256_or_si256(error, incomplete);
+	return _mm256_testz_si256(error, error);
+}
+#endif
+
+typedef bool (*utf8_valid_fn)(const uint8_t *s, size_t len);
+
+// the validator for this CPU, picked on the first call
+utf8_valid_fn utf8_valid_impl = NULL;
+
+utf8_valid_fn utf8_pick_validator(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return utf8_valid_avx2;
+	if (__builtin_cpu_supports("sse4.1")) return utf8_valid_sse;
+#endif
+	return utf8_valid_scalar;
+}
+
+bool utf8_valid(const uint8_t *s, size_t len) {
+	// strings shorter than a vector are quicker to check a word at a time
+	if (len < 16) return utf8_valid_scalar(s, len);
+	utf8_valid_fn fn = __atomic_load_n(&utf8_valid_impl, __ATOMIC_RELAXED);
+	if (fn == NULL) {
+		fn = utf8_pick_validator();
+		__atomic_store_n(&utf8_valid_impl, fn, __ATOMIC_RELAXED);
+	}
+	return fn(s, len);
+}
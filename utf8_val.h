@@ -1,6 +1,12 @@
 #ifndef SORBET_UTF8_VAL_H
 #define SORBET_UTF8_VAL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 uint8_t *utf8_check(uint8_t *s);
+// true if the len bytes at s are valid UTF-8
+bool utf8_valid(const uint8_t *s, size_t len);
 
 #endif //SORBET_UTF8_VAL_H